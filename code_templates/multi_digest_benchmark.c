@@ -0,0 +1,64 @@
+    {
+        mkdir("sdmc:/records", 0777);
+
+        const size_t blksize = USB_TRANSFER_BUFFER_SIZE, blkcount = 256; /* 2 GiB. */
+        const u32 bench_types[] = { MultiDigestType_Crc32, MultiDigestType_Md5, MultiDigestType_Sha1, MultiDigestType_Sha256, MultiDigestType_All };
+
+        FILE *bench_txt = NULL;
+        u8 *bench_buf = usbAllocatePageAlignedBuffer(blksize);
+
+        if (bench_buf)
+        {
+            for(size_t i = 0; i < blksize; i++) bench_buf[i] = (u8)rand();
+
+            bench_txt = fopen("sdmc:/records/multi_digest_benchmark.txt", "wb");
+        }
+
+        if (bench_txt)
+        {
+            fprintf(bench_txt, "Input: %lu MiB (%lu blocks, 0x%lX bytes each)\r\n\r\n", (blksize * blkcount) / 0x100000, blkcount, blksize);
+
+            for(u32 i = 0; i < MAX_ELEMENTS(bench_types); i++)
+            {
+                MultiDigestContext digest_ctx = {0};
+                MultiDigestResult digests = {0};
+
+                if (!multiDigestInitializeContext(&digest_ctx, bench_types[i]))
+                {
+                    multiDigestFreeContext(&digest_ctx);
+                    continue;
+                }
+
+                u64 start_tick = armGetSystemTick();
+
+                for(size_t j = 0; j < blkcount; j++) multiDigestUpdate(&digest_ctx, bench_buf, blksize);
+
+                multiDigestFinalize(&digest_ctx, &digests);
+
+                u64 elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+                /* Wall clock throughput is what the dump process gets to see. It's bound by the slowest digest. */
+                fprintf(bench_txt, "Digests: %s\r\n", bench_types[i] == MultiDigestType_All ? "All" : multiDigestGetTypeName(bench_types[i]));
+                fprintf(bench_txt, "    Wall clock: %lu MiB/s\r\n", (u64)(((double)(blksize * blkcount) * 1000000000.0) / (double)elapsed_ns) / 0x100000);
+
+                /* Per-digest throughput only accounts for the time spent by each worker thread hashing data. */
+                for(u32 j = 0; j < MULTI_DIGEST_TYPE_COUNT; j++)
+                {
+                    MultiDigestStats stats = {0};
+                    if (!(bench_types[i] & bench_types[j]) || !multiDigestGetStats(&digest_ctx, bench_types[j], &stats)) continue;
+                    fprintf(bench_txt, "    %s: %lu MiB/s\r\n", multiDigestGetTypeName(bench_types[j]), multiDigestGetStatsThroughput(&stats) / 0x100000);
+                }
+
+                fprintf(bench_txt, "\r\n");
+                fflush(bench_txt);
+
+                multiDigestFreeContext(&digest_ctx);
+            }
+
+            fclose(bench_txt);
+            bench_txt = NULL;
+            utilsCommitSdCardFileSystemChanges();
+        }
+
+        if (bench_buf) free(bench_buf);
+    }
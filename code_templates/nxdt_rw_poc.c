@@ -28,12 +28,24 @@
 #include <core/legal_info.h>
 #include <core/cert.h>
 #include <core/usb.h>
+#include <core/multi_digest.h>
+#include <core/checksum_db.h>
 #include <core/devoptab/nxdt_devoptab.h>
 
 #define BLOCK_SIZE      USB_TRANSFER_BUFFER_SIZE
 #define WAIT_TIME_LIMIT 30
+#define USB_BATCH_SIZE  512     /* Maximum number of extracted FS file entries announced through a single usbSendFileBatchProperties() call. */
 #define OUTDIR          APP_TITLE
 
+#define NSP_NCA_WORKER_COUNT        2   /* Number of NCAs processed at the same time while generating a NSP: the one being written and the next one. */
+#define NSP_NCA_WORKER_BLOCK_COUNT  2   /* Number of BLOCK_SIZE buffers owned by each NCA worker. */
+#define NSP_PREPARE_WORKER_COUNT    3   /* Number of threads used to run NSP preparation jobs. One per available CPU core. */
+
+#define NSP_CHECKPOINT_MAGIC        0x4E58434E  /* "NXCN". */
+#define NSP_CHECKPOINT_VERSION      1
+#define NSP_CHECKPOINT_EXTENSION    ".ckpt"
+#define NSP_CHECKPOINT_INTERVAL     0x10000000  /* NCA data size between checkpoints. Must be a multiple of BLOCK_SIZE. 256 MiB. */
+
 /* Type definitions. */
 
 typedef struct _Menu Menu;
@@ -116,6 +128,119 @@ typedef struct {
     bool transfer_cancelled;
 } NspThreadData;
 
+// Calculates both the clean and dirty sha-256 hashes for a nca
+// Both data streams are identical up to the first patched byte, so the sha-256 state from the multi-digest context is shared until that point, then copied into a separate context
+// Sha-256 states can't be merged back, so everything past the fork offset is still hashed twice. Since nca patches always modify the nca header, only unmodified ncas are fully hashed once
+typedef struct {
+    MultiDigestContext *digest_ctx;     // Calculates all digests for the dirty data stream
+    Sha256Context clean_sha256_ctx;     // Only used past the fork offset
+    u64 fork_offset;                    // Offset of the first byte that may differ between both data streams
+    u64 submitted_size;                 // Dirty data size from the current block that has already been submitted to the multi-digest context
+    bool forked;
+} NcaHashContext;
+
+// Per-nca state saved in nsp checkpoints, for all ncas that have already been fully written
+typedef struct {
+    MultiDigestResult dirty_digests;
+    u8 clean_hash[SHA256_HASH_SIZE];
+} NspCheckpointNcaState;
+
+// Resumable nsp dump state, saved next to the output file (sd card / ums devices only)
+// Followed by nca_count NspCheckpointNcaState entries in the checkpoint file
+typedef struct {
+    u32 magic;                          // NSP_CHECKPOINT_MAGIC
+    u32 version;                        // NSP_CHECKPOINT_VERSION
+    u8 source_hash[SHA256_HASH_SIZE];   // SHA-256 checksum calculated over the pfs0 header, the dump options and the nca patch state. Identifies the source title
+    u64 nsp_size;
+    u64 nsp_offset;                     // Output data size that was fully written when the checkpoint was generated
+    u32 nca_count;
+    u32 nca_idx;                        // Index of the nca being written at nsp_offset. All previous ncas have already been fully written
+    u64 nca_offset;                     // Offset within the current nca. If zero, no data from this nca has been written yet
+    u32 overlap_size;                   // Size of the output data block right before nsp_offset
+    u32 overlap_crc;                    // CRC32 calculated over that block, read back from the output file
+    MultiDigestState digest_state;      // Dirty hash state for the current nca. Only valid if nca_offset isn't zero
+    Sha256Context clean_sha256_ctx;     // Clean hash state for the current nca. Only valid if nca_offset isn't zero and clean_forked is true
+    bool clean_forked;
+    u8 reserved[0x3];
+    u32 state_crc;                      // CRC32 calculated over all nca states
+} NspCheckpoint;
+
+// Hash state snapshot taken by a nca worker right after hashing a block, if a checkpoint is due after it
+typedef struct {
+    bool valid;
+    bool clean_forked;
+    MultiDigestState digest_state;
+    Sha256Context clean_sha256_ctx;
+} NspNcaBlockCheckpoint;
+
+typedef struct _NspNcaPipeline NspNcaPipeline;
+
+// Reads, patches and hashes ncas in the background for the nsp writer
+// Each worker processes every NSP_NCA_WORKER_COUNT-th nca, so nca k + 1 is read and hashed by a different worker while nca k is being written
+typedef struct {
+    NspNcaPipeline *pipeline;
+    u32 idx;
+    Thread thread;
+    bool thread_created;
+    void *blocks[NSP_NCA_WORKER_BLOCK_COUNT];
+    u64 block_sizes[NSP_NCA_WORKER_BLOCK_COUNT];
+    NspNcaBlockCheckpoint block_ckpts[NSP_NCA_WORKER_BLOCK_COUNT];
+    u64 produced, consumed;             // Block counters. Blocks are passed to the writer in the same order they're read
+    MultiDigestContext digest_ctx;      // Calculates the dirty hash for the current nca
+    NcaHashContext hash_ctx;
+} NspNcaWorker;
+
+// Bounded reorder buffer between the nca workers and the nsp writer, which consumes nca blocks in pfs0 order
+struct _NspNcaPipeline {
+    NcaContext *nca_ctx;
+    u32 nca_count;
+    ContentMetaContext *cnmt_ctx;
+    bool patch_cnmt;                    // If true, the meta nca patch is generated once all other ncas have been written
+    MultiDigestResult *nca_digests;     // Dirty hashes, one per nca
+    u32 digest_mask;                    // Digests calculated by the nca workers. Always includes sha-256, which is needed for the content ids
+    u8 (*clean_hashes)[SHA256_HASH_SIZE];
+    bool *nca_hashed;
+    u32 done_count;                     // Number of ncas that have already been written and validated
+    const NspCheckpoint *resume_ckpt;   // If set, processing starts at the nca index and offset from this checkpoint
+    bool checkpoint;                    // If true, hash states are saved every NSP_CHECKPOINT_INTERVAL bytes
+    NspNcaWorker workers[NSP_NCA_WORKER_COUNT];
+    Mutex mutex;
+    CondVar cond;
+    bool error;
+    bool exit;
+};
+
+typedef enum {
+    NspPrepareJobType_Cnmt             = 0,     // cnmt ctx initialization
+    NspPrepareJobType_ContentType      = 1,     // content type ctx initialization, nca patch generation and nca header encryption for a single nca
+    NspPrepareJobType_AuthoringToolXml = 2,     // programinfo / nacp xml generation for a single nca
+    NspPrepareJobType_CnmtXml          = 3      // cnmt xml generation. Needs info from every nca
+} NspPrepareJobType;
+
+typedef struct {
+    u8 type;                            // NspPrepareJobType
+    NcaContext *nca_ctx;
+    void *content_type_ctx;             // Content type ctx to initialize (ProgramInfoContext, NacpContext or LegalInfoContext). May be NULL
+    u32 dep_count;                      // Number of unfinished jobs this one depends on
+    u32 *dependents;                    // Indexes of the jobs that depend on this one
+    u32 dependent_count;
+    bool started;
+} NspPrepareJob;
+
+// Runs all steps needed to prepare content type ctxs and authoring tool xmls as a dependency graph, using a pool of worker threads
+typedef struct {
+    TitleInfo *title_info;
+    NcaContext *nca_ctx;
+    ContentMetaContext *cnmt_ctx;
+    bool patch_sua, patch_screenshot, patch_video_capture, patch_hdcp;
+    NspPrepareJob *jobs;
+    u32 job_count;
+    u32 done_count;
+    Mutex mutex;
+    CondVar cond;
+    bool error;
+} NspPrepareContext;
+
 typedef struct {
     TitleInfo *title_info;
     u32 content_idx;
@@ -124,6 +249,7 @@ typedef struct {
 typedef struct {
     SharedThreadData shared_thread_data;
     NcaContext *nca_ctx;
+    MultiDigestContext digest_ctx;
 } NcaThreadData;
 
 typedef struct {
@@ -241,14 +367,20 @@ static void xciReadThreadFunc(void *arg);
 
 static void rawHfsReadThreadFunc(void *arg);
 static void extractedHfsReadThreadFunc(void *arg);
+static u32 sendExtractedHfsFileBatch(HashFileSystemContext *hfs_ctx, u32 entry_idx, const char *base_path, UsbFileBatchEntry *entries, char *paths);
 
 static void ncaReadThreadFunc(void *arg);
 
 static void rawPartitionFsReadThreadFunc(void *arg);
 static void extractedPartitionFsReadThreadFunc(void *arg);
+static u32 sendExtractedPartitionFsFileBatch(PartitionFileSystemContext *pfs_ctx, u32 entry_idx, const char *base_path, UsbFileBatchEntry *entries, char *paths);
 
 static void rawRomFsReadThreadFunc(void *arg);
 static void extractedRomFsReadThreadFunc(void *arg);
+static u32 sendExtractedRomFsFileBatch(RomFileSystemContext *romfs_ctx, u64 entry_offset, const char *base_path, u8 illegal_char_replace_type, UsbFileBatchEntry *entries, char *paths);
+
+static bool allocateUsbFileBatchBuffers(u32 dev_idx, UsbFileBatchEntry **out_entries, char **out_paths);
+static void freeUsbFileBatchBuffers(UsbFileBatchEntry **entries, char **paths);
 
 static void fsBrowserFileReadThreadFunc(void *arg);
 static void fsBrowserHighlightedEntriesReadThreadFunc(void *arg);
@@ -258,6 +390,35 @@ static void genericWriteThreadFunc(void *arg);
 
 static bool spanDumpThreads(ThreadFunc read_func, ThreadFunc write_func, void *arg);
 
+static bool nspWriteNcaPatches(NcaContext *nca_ctx, ContentMetaContext *cnmt_ctx, void *buf, u64 buf_size, u64 buf_offset);
+static bool nspPrecalculateNcaHashes(NcaContext *nca_ctx, u32 nca_ctx_count, ContentMetaContext *cnmt_ctx, PartitionFileSystemImageContext *pfs_img_ctx, void *buf, \
+                                     u8 (*out_hashes)[SHA256_HASH_SIZE], bool *out_hash_available);
+static void nspInitializeNcaHashContext(NcaHashContext *ctx, MultiDigestContext *digest_ctx, NcaContext *nca_ctx);
+static void nspSetNcaHashContextForkOffset(NcaHashContext *ctx, NcaContext *nca_ctx, const void *buf, u64 buf_size);
+static bool nspUpdateNcaHashContextClean(NcaHashContext *ctx, const void *buf, u64 buf_size, u64 buf_offset);
+static bool nspUpdateNcaHashContextDirty(NcaHashContext *ctx, const void *buf, u64 buf_size);
+static void nspGetNcaHashContextCleanHash(NcaHashContext *ctx, const MultiDigestResult *dirty_digests, u8 *out);
+static bool nspStartNcaPipeline(NspNcaPipeline *pipeline, NcaContext *nca_ctx, u32 nca_count, ContentMetaContext *cnmt_ctx, bool patch_cnmt, MultiDigestResult *nca_digests, \
+                                u32 digest_mask, const NspCheckpoint *resume_ckpt, bool checkpoint);
+static void nspFreeNcaPipeline(NspNcaPipeline *pipeline);
+static const void *nspAcquireNcaPipelineBlock(NspNcaPipeline *pipeline, u32 nca_idx, u64 *out_size, const NspNcaBlockCheckpoint **out_ckpt);
+static void nspReleaseNcaPipelineBlock(NspNcaPipeline *pipeline, u32 nca_idx);
+static bool nspWaitForNcaPipelineHash(NspNcaPipeline *pipeline, u32 nca_idx, u8 *out_clean_hash);
+static void nspSetNcaPipelineNcaDone(NspNcaPipeline *pipeline, u32 nca_idx);
+static bool nspNcaWorkerProcessNca(NspNcaWorker *worker, u32 nca_idx);
+static void nspNcaWorkerThreadFunc(void *arg);
+static bool nspAddPrepareJob(NspPrepareContext *ctx, u8 type, NcaContext *nca_ctx, void *content_type_ctx, u32 *out_idx);
+static bool nspAddPrepareJobDependency(NspPrepareContext *ctx, u32 job_idx, u32 dep_idx);
+static bool nspRunPrepareJob(NspPrepareContext *ctx, NspPrepareJob *job);
+static void nspPrepareWorkerThreadFunc(void *arg);
+static bool nspRunPrepareJobs(NspPrepareContext *ctx);
+static void nspFreePrepareContext(NspPrepareContext *ctx);
+static bool nspApplyNcaHash(NcaContext *nca_ctx, u32 nca_idx, ContentMetaContext *cnmt_ctx, PartitionFileSystemImageContext *pfs_img_ctx, const u8 *clean_hash, \
+                            const MultiDigestResult *dirty_digests, bool sequential_output, const u8 *precalc_hash);
+static bool nspLoadCheckpoint(const char *ckpt_path, u32 nca_count, NspCheckpoint *out, NspCheckpointNcaState *nca_states);
+static bool nspSaveCheckpoint(FILE *fp, const char *ckpt_path, NspCheckpoint *ckpt, const NspCheckpointNcaState *nca_states, void *buf);
+static void nspRemoveCheckpoint(const char *ckpt_path);
+static bool nspVerifyCheckpointOverlap(FILE *fp, const NspCheckpoint *ckpt, void *buf);
 static void nspThreadFunc(void *arg);
 
 static u32 getOutputStorageOption(void);
@@ -302,6 +463,15 @@ static void setNspDisableHdcpOption(u32 idx);
 static u32 getNspGenerateAuthoringToolDataOption(void);
 static void setNspGenerateAuthoringToolDataOption(u32 idx);
 
+static u32 getNspSequentialOutputOption(void);
+static void setNspSequentialOutputOption(u32 idx);
+
+static u32 getNspLookupChecksumOption(void);
+static void setNspLookupChecksumOption(u32 idx);
+
+static u32 getNspGenerateDigestReportOption(void);
+static void setNspGenerateDigestReportOption(u32 idx);
+
 static u32 getTicketRemoveConsoleDataOption(void);
 static void setTicketRemoveConsoleDataOption(u32 idx);
 
@@ -718,6 +888,45 @@ static MenuElement *g_nspMenuElements[] = {
         },
         .userdata = NULL
     },
+    &(MenuElement){
+        .str = "nsp: sequential output (header first, hashes modified ncas beforehand)",
+        .child_menu = NULL,
+        .task_func = NULL,
+        .element_options = &(MenuElementOption){
+            .selected = 0,
+            .retrieved = false,
+            .getter_func = &getNspSequentialOutputOption,
+            .setter_func = &setNspSequentialOutputOption,
+            .options = g_noYesStrings
+        },
+        .userdata = NULL
+    },
+    &(MenuElement){
+        .str = "nsp: lookup nca checksums in offline dat database",
+        .child_menu = NULL,
+        .task_func = NULL,
+        .element_options = &(MenuElementOption){
+            .selected = 1,
+            .retrieved = false,
+            .getter_func = &getNspLookupChecksumOption,
+            .setter_func = &setNspLookupChecksumOption,
+            .options = g_noYesStrings
+        },
+        .userdata = NULL
+    },
+    &(MenuElement){
+        .str = "nsp: generate nca digest report",
+        .child_menu = NULL,
+        .task_func = NULL,
+        .element_options = &(MenuElementOption){
+            .selected = 0,
+            .retrieved = false,
+            .getter_func = &getNspGenerateDigestReportOption,
+            .setter_func = &setNspGenerateDigestReportOption,
+            .options = g_noYesStrings
+        },
+        .userdata = NULL
+    },
     &g_storageMenuElement,
     NULL
 };
@@ -2340,6 +2549,44 @@ static bool saveFileData(const char *filepath, void *data, size_t data_size)
     return true;
 }
 
+static bool appendDigestReport(char **report, size_t *report_size, const MultiDigestResult *result, const char *file_name, u64 file_size)
+{
+    char *cur_report = multiDigestGenerateReport(result, MultiDigestType_All, file_name, file_size);
+    if (!cur_report)
+    {
+        consolePrint("failed to generate digest report for \"%s\"!\n", file_name);
+        return false;
+    }
+
+    bool success = utilsAppendFormattedStringToBuffer(report, report_size, "%s%s", *report ? "\r\n" : "", cur_report);
+    if (!success) consolePrint("failed to append digest report for \"%s\"!\n", file_name);
+
+    free(cur_report);
+
+    return success;
+}
+
+static bool saveDigestReport(const char *filepath, char *report)
+{
+    char *report_path = NULL;
+    size_t report_path_size = 0;
+    bool success = false;
+
+    if (!report || !*report || !utilsAppendFormattedStringToBuffer(&report_path, &report_path_size, "%s" MULTI_DIGEST_REPORT_EXTENSION, filepath))
+    {
+        consolePrint("failed to generate digest report path for \"%s\"!\n", filepath);
+        goto end;
+    }
+
+    success = saveFileData(report_path, report, strlen(report));
+    if (success) consolePrint("saved digest report as \"%s\"\n", report_path);
+
+end:
+    if (report_path) free(report_path);
+
+    return success;
+}
+
 static char *generateOutputGameCardFileName(const char *subdir, const char *extension, bool use_nacp_name)
 {
     char *filename = NULL, *prefix = NULL, *output = NULL;
@@ -2600,6 +2847,14 @@ static bool saveGameCardImage(void *userdata)
             consolePrint("xci crc: %08X", xci_thread_data.xci_crc);
             if (prepend_key_area) consolePrint(" | xci crc (with key area): %08X", xci_thread_data.full_xci_crc);
             consolePrint("\n");
+
+            char dat_name[0x200] = {0};
+            if (checksumDbLookup(xci_thread_data.xci_crc, shared_thread_data->total_size, NULL, dat_name, sizeof(dat_name)))
+            {
+                consolePrint("dat match: %s\n", dat_name);
+            } else {
+                consolePrint("no dat match\n");
+            }
         }
 
         consoleRefresh();
@@ -3433,6 +3688,12 @@ static bool saveNintendoContentArchive(void *userdata)
         ftruncate(fileno(shared_thread_data->fp), (off_t)shared_thread_data->total_size);
     }
 
+    if (!multiDigestInitializeContext(&(nca_thread_data.digest_ctx), MultiDigestType_All))
+    {
+        consolePrint("multi digest initialize ctx failed\n");
+        goto end;
+    }
+
     consoleRefresh();
 
     success = spanDumpThreads(ncaReadThreadFunc, genericWriteThreadFunc, &nca_thread_data);
@@ -3440,6 +3701,23 @@ static bool saveNintendoContentArchive(void *userdata)
     if (success)
     {
         consolePrint("successfully saved nca as \"%s\"\n", filename);
+
+        /* Close output file before saving the digest report. */
+        if (shared_thread_data->fp)
+        {
+            fclose(shared_thread_data->fp);
+            shared_thread_data->fp = NULL;
+        }
+
+        MultiDigestResult digests = {0};
+        char *report = NULL, *report_name = strrchr(filename, '/');
+        size_t report_size = 0;
+
+        if (multiDigestFinalize(&(nca_thread_data.digest_ctx), &digests) && \
+            appendDigestReport(&report, &report_size, &digests, report_name ? (report_name + 1) : filename, shared_thread_data->total_size)) saveDigestReport(filename, report);
+
+        if (report) free(report);
+
         consoleRefresh();
     }
 
@@ -3463,6 +3741,8 @@ end:
 
     if (filename) free(filename);
 
+    multiDigestFreeContext(&(nca_thread_data.digest_ctx));
+
     if (nca_thread_data.nca_ctx) free(nca_thread_data.nca_ctx);
 
     return success;
@@ -4571,7 +4851,7 @@ static void xciReadThreadFunc(void *arg)
         }
 
         /* Read current data chunk */
-        shared_thread_data->read_error = !gamecardReadStorage(buf1, blksize, offset);
+        shared_thread_data->read_error = !gamecardReadStorageWithPriority(buf1, blksize, offset, GameCardIoPriority_Low);
         if (shared_thread_data->read_error)
         {
             condvarWakeAll(&g_writeCondvar);
@@ -4703,6 +4983,10 @@ static void extractedHfsReadThreadFunc(void *arg)
     HashFileSystemEntry *hfs_entry = NULL;
     char *hfs_entry_name = NULL;
 
+    UsbFileBatchEntry *batch_entries = NULL;
+    char *batch_paths = NULL;
+    u32 batch_remaining = 0;
+
     u64 free_space = 0;
     u32 dev_idx = g_storageMenuElementOption.selected;
 
@@ -4746,6 +5030,9 @@ static void extractedHfsReadThreadFunc(void *arg)
         goto end;
     }
 
+    /* Announce file entries in batches if the USB host supports it. This avoids a status round trip per file. */
+    allocateUsbFileBatchBuffers(dev_idx, &batch_entries, &batch_paths);
+
     /* Loop through all file entries. */
     for(u32 i = 0; i < hfs_entry_count; i++)
     {
@@ -4795,8 +5082,17 @@ static void extractedHfsReadThreadFunc(void *arg)
 
             if (shared_thread_data->write_error) break;
 
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(hfs_entry->size, hfs_path);
+            if (batch_entries)
+            {
+                /* Send file properties for the next batch of file entries, if needed. */
+                if (!batch_remaining) batch_remaining = sendExtractedHfsFileBatch(hfs_ctx, i, filename, batch_entries, batch_paths);
+
+                shared_thread_data->read_error = !batch_remaining;
+                if (!shared_thread_data->read_error) batch_remaining--;
+            } else {
+                /* Send current file properties */
+                shared_thread_data->read_error = !usbSendFileProperties(hfs_entry->size, hfs_path);
+            }
         } else {
             /* Create directory tree. */
             utilsCreateDirectoryTree(hfs_path, false);
@@ -4913,12 +5209,39 @@ end:
 
     if (filename) free(filename);
 
+    freeUsbFileBatchBuffers(&batch_entries, &batch_paths);
+
     if (buf2) free(buf2);
     if (buf1) free(buf1);
 
     threadExit();
 }
 
+static u32 sendExtractedHfsFileBatch(HashFileSystemContext *hfs_ctx, u32 entry_idx, const char *base_path, UsbFileBatchEntry *entries, char *paths)
+{
+    u32 entry_count = hfsGetEntryCount(hfs_ctx), batch_count = 0;
+    size_t base_path_len = strlen(base_path);
+    HashFileSystemEntry *hfs_entry = NULL;
+    char *hfs_entry_name = NULL;
+
+    /* Generate paths for the next batch of file entries, starting at the provided index. */
+    for(; batch_count < USB_BATCH_SIZE && entry_idx < entry_count; entry_idx++)
+    {
+        char *path = (paths + (batch_count * FS_MAX_PATH));
+
+        if (!(hfs_entry = hfsGetEntryByIndex(hfs_ctx, entry_idx)) || !(hfs_entry_name = hfsGetEntryName(hfs_ctx, hfs_entry))) return 0;
+
+        snprintf(path, FS_MAX_PATH, "%s/%s", base_path, hfs_entry_name);
+        utilsReplaceIllegalCharacters(path + base_path_len + 1, false);
+
+        entries[batch_count].size = hfs_entry->size;
+        entries[batch_count++].path = path;
+    }
+
+    /* The USB host may not be able to take all of them at once. */
+    return (batch_count ? usbSendFileBatchProperties(entries, batch_count) : 0);
+}
+
 static void ncaReadThreadFunc(void *arg)
 {
     void *buf1 = NULL, *buf2 = NULL;
@@ -4957,11 +5280,16 @@ static void ncaReadThreadFunc(void *arg)
             break;
         }
 
+        /* Hash current data chunk while we wait for the write thread */
+        multiDigestUpdateAsync(&(nca_thread_data->digest_ctx), buf1, blksize);
+
         /* Wait until the previous data chunk has been written */
         mutexLock(&g_fileMutex);
 
         if (shared_thread_data->data_size && !shared_thread_data->write_error) condvarWait(&g_readCondvar, &g_fileMutex);
 
+        multiDigestWait(&(nca_thread_data->digest_ctx));
+
         if (shared_thread_data->write_error)
         {
             mutexUnlock(&g_fileMutex);
@@ -5072,6 +5400,10 @@ static void extractedPartitionFsReadThreadFunc(void *arg)
     PartitionFileSystemEntry *pfs_entry = NULL;
     char *pfs_entry_name = NULL;
 
+    UsbFileBatchEntry *batch_entries = NULL;
+    char *batch_paths = NULL;
+    u32 batch_remaining = 0;
+
     NcaFsSectionContext *nca_fs_ctx = pfs_ctx->nca_fs_ctx;
     NcaContext *nca_ctx = nca_fs_ctx->nca_ctx;
 
@@ -5134,6 +5466,9 @@ static void extractedPartitionFsReadThreadFunc(void *arg)
         goto end;
     }
 
+    /* Announce file entries in batches if the USB host supports it. This avoids a status round trip per file. */
+    allocateUsbFileBatchBuffers(dev_idx, &batch_entries, &batch_paths);
+
     /* Loop through all file entries. */
     for(u32 i = 0; i < pfs_entry_count; i++)
     {
@@ -5183,8 +5518,17 @@ static void extractedPartitionFsReadThreadFunc(void *arg)
 
             if (shared_thread_data->write_error) break;
 
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(pfs_entry->size, pfs_path);
+            if (batch_entries)
+            {
+                /* Send file properties for the next batch of file entries, if needed. */
+                if (!batch_remaining) batch_remaining = sendExtractedPartitionFsFileBatch(pfs_ctx, i, filename, batch_entries, batch_paths);
+
+                shared_thread_data->read_error = !batch_remaining;
+                if (!shared_thread_data->read_error) batch_remaining--;
+            } else {
+                /* Send current file properties */
+                shared_thread_data->read_error = !usbSendFileProperties(pfs_entry->size, pfs_path);
+            }
         } else {
             /* Create directory tree. */
             utilsCreateDirectoryTree(pfs_path, false);
@@ -5301,12 +5645,39 @@ end:
 
     if (filename) free(filename);
 
+    freeUsbFileBatchBuffers(&batch_entries, &batch_paths);
+
     if (buf2) free(buf2);
     if (buf1) free(buf1);
 
     threadExit();
 }
 
+static u32 sendExtractedPartitionFsFileBatch(PartitionFileSystemContext *pfs_ctx, u32 entry_idx, const char *base_path, UsbFileBatchEntry *entries, char *paths)
+{
+    u32 entry_count = pfsGetEntryCount(pfs_ctx), batch_count = 0;
+    size_t base_path_len = strlen(base_path);
+    PartitionFileSystemEntry *pfs_entry = NULL;
+    char *pfs_entry_name = NULL;
+
+    /* Generate paths for the next batch of file entries, starting at the provided index. */
+    for(; batch_count < USB_BATCH_SIZE && entry_idx < entry_count; entry_idx++)
+    {
+        char *path = (paths + (batch_count * FS_MAX_PATH));
+
+        if (!(pfs_entry = pfsGetEntryByIndex(pfs_ctx, entry_idx)) || !(pfs_entry_name = pfsGetEntryName(pfs_ctx, pfs_entry))) return 0;
+
+        snprintf(path, FS_MAX_PATH, "%s/%s", base_path, pfs_entry_name);
+        utilsReplaceIllegalCharacters(path + base_path_len + 1, false);
+
+        entries[batch_count].size = pfs_entry->size;
+        entries[batch_count++].path = path;
+    }
+
+    /* The USB host may not be able to take all of them at once. */
+    return (batch_count ? usbSendFileBatchProperties(entries, batch_count) : 0);
+}
+
 static void rawRomFsReadThreadFunc(void *arg)
 {
     void *buf1 = NULL, *buf2 = NULL;
@@ -5399,9 +5770,16 @@ static void extractedRomFsReadThreadFunc(void *arg)
     u32 dev_idx = g_storageMenuElementOption.selected;
     u8 romfs_illegal_char_replace_type = (dev_idx != 0 ? RomFileSystemPathIllegalCharReplaceType_IllegalFsChars : RomFileSystemPathIllegalCharReplaceType_KeepAsciiCharsOnly);
 
+    UsbFileBatchEntry *batch_entries = NULL;
+    char *batch_paths = NULL;
+    u32 batch_remaining = 0;
+
     buf1 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
     buf2 = usbAllocatePageAlignedBuffer(BLOCK_SIZE);
 
+    /* Announce file entries in batches if the USB host supports it. RomFS sections may hold tens of thousands of small files, and this avoids a status round trip per file. */
+    allocateUsbFileBatchBuffers(dev_idx, &batch_entries, &batch_paths);
+
     if (romfs_thread_data->use_layeredfs_dir)
     {
         /* Only use base title IDs if we're dealing with patches. */
@@ -5500,8 +5878,17 @@ static void extractedRomFsReadThreadFunc(void *arg)
 
             if (shared_thread_data->write_error) break;
 
-            /* Send current file properties */
-            shared_thread_data->read_error = !usbSendFileProperties(romfs_file_entry->size, romfs_path);
+            if (batch_entries)
+            {
+                /* Send file properties for the next batch of file entries, if needed. */
+                if (!batch_remaining) batch_remaining = sendExtractedRomFsFileBatch(romfs_ctx, cur_entry_offset, filename, romfs_illegal_char_replace_type, batch_entries, batch_paths);
+
+                shared_thread_data->read_error = !batch_remaining;
+                if (!shared_thread_data->read_error) batch_remaining--;
+            } else {
+                /* Send current file properties */
+                shared_thread_data->read_error = !usbSendFileProperties(romfs_file_entry->size, romfs_path);
+            }
         } else {
             /* Create directory tree. */
             utilsCreateDirectoryTree(romfs_path, false);
@@ -5621,12 +6008,74 @@ end:
 
     if (filename) free(filename);
 
+    freeUsbFileBatchBuffers(&batch_entries, &batch_paths);
+
     if (buf2) free(buf2);
     if (buf1) free(buf1);
 
     threadExit();
 }
 
+static u32 sendExtractedRomFsFileBatch(RomFileSystemContext *romfs_ctx, u64 entry_offset, const char *base_path, u8 illegal_char_replace_type, UsbFileBatchEntry *entries, char *paths)
+{
+    RomFileSystemFileEntry *romfs_file_entry = NULL;
+    size_t base_path_len = strlen(base_path);
+    u32 entry_count = 0;
+
+    /* Generate paths for the next batch of file entries, starting at the provided offset. */
+    while(entry_count < USB_BATCH_SIZE && entry_offset < romfs_ctx->file_table_size)
+    {
+        char *path = (paths + (entry_count * FS_MAX_PATH));
+
+        snprintf(path, FS_MAX_PATH, "%s", base_path);
+
+        if (!(romfs_file_entry = romfsGetFileEntryByOffset(romfs_ctx, entry_offset)) || \
+            !romfsGeneratePathFromFileEntry(romfs_ctx, romfs_file_entry, path + base_path_len, FS_MAX_PATH - base_path_len, illegal_char_replace_type)) return 0;
+
+        entries[entry_count].size = romfs_file_entry->size;
+        entries[entry_count++].path = path;
+
+        entry_offset += ALIGN_UP(sizeof(RomFileSystemFileEntry) + romfs_file_entry->name_length, ROMFS_TABLE_ENTRY_ALIGNMENT);
+    }
+
+    /* The USB host may not be able to take all of them at once. */
+    return (entry_count ? usbSendFileBatchProperties(entries, entry_count) : 0);
+}
+
+static bool allocateUsbFileBatchBuffers(u32 dev_idx, UsbFileBatchEntry **out_entries, char **out_paths)
+{
+    *out_entries = NULL;
+    *out_paths = NULL;
+
+    if (dev_idx != 1 || !usbIsFileBatchSupported()) return false;
+
+    /* We'll just fall back to sending file properties for each file entry if this fails. */
+    *out_entries = calloc(USB_BATCH_SIZE, sizeof(UsbFileBatchEntry));
+    *out_paths = calloc(USB_BATCH_SIZE, FS_MAX_PATH);
+    if (!*out_entries || !*out_paths)
+    {
+        freeUsbFileBatchBuffers(out_entries, out_paths);
+        return false;
+    }
+
+    return true;
+}
+
+static void freeUsbFileBatchBuffers(UsbFileBatchEntry **entries, char **paths)
+{
+    if (*paths)
+    {
+        free(*paths);
+        *paths = NULL;
+    }
+
+    if (*entries)
+    {
+        free(*entries);
+        *entries = NULL;
+    }
+}
+
 static void fsBrowserFileReadThreadFunc(void *arg)
 {
     void *buf1 = NULL, *buf2 = NULL;
@@ -6128,72 +6577,1063 @@ static bool spanDumpThreads(ThreadFunc read_func, ThreadFunc write_func, void *a
     return success;
 }
 
-static void nspThreadFunc(void *arg)
+static bool nspWriteNcaPatches(NcaContext *nca_ctx, ContentMetaContext *cnmt_ctx, void *buf, u64 buf_size, u64 buf_offset)
 {
-    NspThreadData *nsp_thread_data = (NspThreadData*)arg;
+    // write re-encrypted headers
+    if (!nca_ctx->header_written) ncaWriteEncryptedHeaderDataToMemoryBuffer(nca_ctx, buf, buf_size, buf_offset);
 
-    TitleInfo *title_info = NULL;
+    if (nca_ctx->content_type_ctx_patch)
+    {
+        // write content type context patch
+        switch(nca_ctx->content_type)
+        {
+            case NcmContentType_Meta:
+                cnmtWriteNcaPatch(cnmt_ctx, buf, buf_size, buf_offset);
+                break;
+            case NcmContentType_Control:
+                nacpWriteNcaPatch((NacpContext*)nca_ctx->content_type_ctx, buf, buf_size, buf_offset);
+                break;
+            default:
+                break;
+        }
+    }
 
-    bool set_download_type = (bool)getNspSetDownloadDistributionOption();
-    bool remove_console_data = (bool)getNspRemoveConsoleDataOption();
-    bool remove_titlekey_crypto = (bool)getNspRemoveTitlekeyCryptoOption();
-    bool patch_sua = (bool)getNspDisableLinkedAccountRequirementOption();
-    bool patch_screenshot = (bool)getNspEnableScreenshotsOption();
-    bool patch_video_capture = (bool)getNspEnableVideoCaptureOption();
-    bool patch_hdcp = (bool)getNspDisableHdcpOption();
-    bool generate_authoringtool_data = (bool)getNspGenerateAuthoringToolDataOption();
-    bool success = false, no_titlekey_confirmation = false;
+    // returns false once everything has been written
+    return (!nca_ctx->header_written || nca_ctx->content_type_ctx_patch);
+}
 
-    u64 free_space = 0;
-    u32 dev_idx = g_storageMenuElementOption.selected;
+static void nspInitializeNcaHashContext(NcaHashContext *ctx, MultiDigestContext *digest_ctx, NcaContext *nca_ctx)
+{
+    memset(ctx, 0, sizeof(NcaHashContext));
 
-    u8 *buf = NULL;
-    char *filename = NULL;
-    FILE *fp = NULL;
+    ctx->digest_ctx = digest_ctx;
 
-    NcaContext *nca_ctx = NULL;
+    // unmodified ncas never fork, so a single sha-256 calculation is enough for them
+    // the fork offset for modified ncas is refined by nspSetNcaHashContextForkOffset() once the first block has been read
+    // nca headers are re-encrypted on a per-sector basis, and the signature area from the first sector is never modified
+    // all content type context patches are located past the nca header
+    ctx->fork_offset = (!ncaIsHeaderDirty(nca_ctx) ? nca_ctx->content_size : NCA_SIGNATURE_AREA_SIZE);
 
-    NcaContext *meta_nca_ctx = NULL;
-    ContentMetaContext cnmt_ctx = {0};
+    // we can't share anything if the multi-digest context isn't calculating a sha-256 digest
+    if (!(digest_ctx->type_mask & MultiDigestType_Sha256)) ctx->fork_offset = 0;
 
-    ProgramInfoContext *program_info_ctx = NULL;
-    u32 program_idx = 0, program_count = 0;
+    if (!ctx->fork_offset)
+    {
+        sha256ContextCreate(&(ctx->clean_sha256_ctx));
+        ctx->forked = true;
+    }
+}
 
-    NacpContext *nacp_ctx = NULL;
-    u32 control_idx = 0, control_count = 0;
+static void nspSetNcaHashContextForkOffset(NcaHashContext *ctx, NcaContext *nca_ctx, const void *buf, u64 buf_size)
+{
+    // 'buf' must hold unpatched nca data starting at offset zero
+    // the fork offset is moved forward to the first byte from the re-encrypted headers that actually differs from the original data
+    // header regions that aren't fully available in the provided buffer are assumed to be modified right at their start
+    if (ctx->forked || ctx->fork_offset >= nca_ctx->content_size) return;
 
-    LegalInfoContext *legal_info_ctx = NULL;
-    u32 legal_info_idx = 0, legal_info_count = 0;
+    const u8 *data = (const u8*)buf;
+    u64 fork_offset = UINT64_MAX, region_end = 0;
 
-    Ticket tik = {0};
-    TikCommonBlock *tik_common_block = NULL;
+    for(int i = -1; i < NCA_FS_HEADER_COUNT; i++)
+    {
+        const u8 *patch = NULL;
+        u64 offset = 0, size = 0;
 
-    u8 *raw_cert_chain = NULL;
-    u64 raw_cert_chain_size = 0;
+        if (i < 0)
+        {
+            patch = (const u8*)&(nca_ctx->encrypted_header);
+            size = sizeof(NcaHeader);
+        } else {
+            NcaFsSectionContext *fs_ctx = &(nca_ctx->fs_ctx[i]);
+            if (!fs_ctx->enabled) continue;
 
-    PartitionFileSystemImageContext pfs_img_ctx = {0};
-    pfsInitializeImageContext(&pfs_img_ctx);
+            patch = (const u8*)&(fs_ctx->encrypted_header);
+            offset = (nca_ctx->format_version != NcaVersion_Nca0 ? (sizeof(NcaHeader) + ((u64)i * sizeof(NcaFsHeader))) : fs_ctx->section_offset);
+            size = sizeof(NcaFsHeader);
+        }
 
-    char entry_name[64] = {0};
-    u64 nsp_header_size = 0, nsp_size = 0, nsp_offset = 0;
-    char size_str[16] = {0};
-    char *tmp_name = NULL;
+        if ((offset + size) > buf_size)
+        {
+            fork_offset = MIN(fork_offset, offset);
+            continue;
+        }
 
-    Sha256Context clean_sha256_ctx = {0}, dirty_sha256_ctx = {0};
-    u8 clean_sha256_hash[SHA256_HASH_SIZE] = {0}, dirty_sha256_hash[SHA256_HASH_SIZE] = {0};
+        for(u64 j = 0; j < size && (offset + j) < fork_offset; j++)
+        {
+            if (data[offset + j] == patch[j]) continue;
+            fork_offset = (offset + j);
+            break;
+        }
 
-    if (!nsp_thread_data || !(title_info = (TitleInfo*)nsp_thread_data->data) || !title_info->content_count || !title_info->content_infos) goto end;
+        region_end = MAX(region_end, offset + size);
+    }
 
-    /* Allocate memory for the dump process. */
-    if (!(buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE)))
+    // if no differences were found, the streams are identical at least up to the end of the header regions. content type context patches are always located past them
+    if (fork_offset == UINT64_MAX) fork_offset = region_end;
+
+    ctx->fork_offset = MAX(ctx->fork_offset, fork_offset);
+}
+
+static bool nspUpdateNcaHashContextClean(NcaHashContext *ctx, const void *buf, u64 buf_size, u64 buf_offset)
+{
+    MultiDigestState state = {0};
+    u64 prefix_size = 0;
+
+    ctx->submitted_size = 0;
+
+    if (!ctx->forked)
     {
-        consolePrint("buf alloc failed\n");
-        goto end;
+        // nothing to do if this block is still part of the shared prefix
+        // it'll be hashed along with the dirty data
+        if ((buf_offset + buf_size) <= ctx->fork_offset) return true;
+
+        // submit the rest of the shared prefix, then fork the sha-256 state
+        prefix_size = (ctx->fork_offset - buf_offset);
+        if (prefix_size && !multiDigestUpdate(ctx->digest_ctx, buf, prefix_size)) return false;
+
+        if (!multiDigestExportState(ctx->digest_ctx, &state)) return false;
+        memcpy(&(ctx->clean_sha256_ctx), &(state.sha256), sizeof(Sha256Context));
+
+        ctx->submitted_size = prefix_size;
+        ctx->forked = true;
     }
 
-    /* Generate output path. */
-    filename = generateOutputTitleFileName(title_info, "NSP", ".nsp");
-    if (!filename) goto end;
+    // update clean hash calculation
+    sha256ContextUpdate(&(ctx->clean_sha256_ctx), (const u8*)buf + prefix_size, buf_size - prefix_size);
+
+    return true;
+}
+
+static bool nspUpdateNcaHashContextDirty(NcaHashContext *ctx, const void *buf, u64 buf_size)
+{
+    // runs on the digest worker threads. multiDigestWait() must be called before reusing the buffer
+    return multiDigestUpdateAsync(ctx->digest_ctx, (const u8*)buf + ctx->submitted_size, buf_size - ctx->submitted_size);
+}
+
+static void nspGetNcaHashContextCleanHash(NcaHashContext *ctx, const MultiDigestResult *dirty_digests, u8 *out)
+{
+    if (ctx->forked)
+    {
+        sha256ContextGetHash(&(ctx->clean_sha256_ctx), out);
+    } else {
+        // both data streams are identical
+        memcpy(out, dirty_digests->sha256, SHA256_HASH_SIZE);
+    }
+}
+
+static bool nspStartNcaPipeline(NspNcaPipeline *pipeline, NcaContext *nca_ctx, u32 nca_count, ContentMetaContext *cnmt_ctx, bool patch_cnmt, MultiDigestResult *nca_digests, \
+                                u32 digest_mask, const NspCheckpoint *resume_ckpt, bool checkpoint)
+{
+    pipeline->nca_ctx = nca_ctx;
+    pipeline->nca_count = nca_count;
+    pipeline->cnmt_ctx = cnmt_ctx;
+    pipeline->patch_cnmt = patch_cnmt;
+    pipeline->nca_digests = nca_digests;
+    pipeline->digest_mask = (digest_mask | MultiDigestType_Sha256);
+    pipeline->resume_ckpt = resume_ckpt;
+    pipeline->checkpoint = checkpoint;
+
+    // ncas written by a previous run have already been validated
+    if (resume_ckpt) pipeline->done_count = resume_ckpt->nca_idx;
+
+    mutexInit(&(pipeline->mutex));
+    condvarInit(&(pipeline->cond));
+
+    if (!(pipeline->clean_hashes = calloc(nca_count, SHA256_HASH_SIZE)) || !(pipeline->nca_hashed = calloc(nca_count, sizeof(bool))))
+    {
+        consolePrint("nca pipeline calloc failed\n");
+        return false;
+    }
+
+    for(u32 i = 0; i < NSP_NCA_WORKER_COUNT; i++)
+    {
+        NspNcaWorker *worker = &(pipeline->workers[i]);
+
+        worker->pipeline = pipeline;
+        worker->idx = i;
+
+        for(u32 j = 0; j < NSP_NCA_WORKER_BLOCK_COUNT; j++)
+        {
+            if (!(worker->blocks[j] = usbAllocatePageAlignedBuffer(BLOCK_SIZE)))
+            {
+                consolePrint("nca pipeline buf alloc failed\n");
+                return false;
+            }
+        }
+    }
+
+    // keep the nsp thread core free for the writer
+    for(u32 i = 0; i < NSP_NCA_WORKER_COUNT; i++)
+    {
+        NspNcaWorker *worker = &(pipeline->workers[i]);
+
+        if (!(worker->thread_created = utilsCreateThread(&(worker->thread), nspNcaWorkerThreadFunc, worker, (int)(i % 2))))
+        {
+            consolePrint("nca worker thread #%u creation failed\n", i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void nspFreeNcaPipeline(NspNcaPipeline *pipeline)
+{
+    if (!pipeline->nca_ctx) return;
+
+    mutexLock(&(pipeline->mutex));
+    pipeline->exit = true;
+    condvarWakeAll(&(pipeline->cond));
+    mutexUnlock(&(pipeline->mutex));
+
+    for(u32 i = 0; i < NSP_NCA_WORKER_COUNT; i++)
+    {
+        NspNcaWorker *worker = &(pipeline->workers[i]);
+
+        if (worker->thread_created) utilsJoinThread(&(worker->thread));
+
+        multiDigestFreeContext(&(worker->digest_ctx));
+
+        for(u32 j = 0; j < NSP_NCA_WORKER_BLOCK_COUNT; j++)
+        {
+            if (worker->blocks[j]) free(worker->blocks[j]);
+        }
+    }
+
+    if (pipeline->nca_hashed) free(pipeline->nca_hashed);
+
+    if (pipeline->clean_hashes) free(pipeline->clean_hashes);
+
+    memset(pipeline, 0, sizeof(NspNcaPipeline));
+}
+
+static const void *nspAcquireNcaPipelineBlock(NspNcaPipeline *pipeline, u32 nca_idx, u64 *out_size, const NspNcaBlockCheckpoint **out_ckpt)
+{
+    NspNcaWorker *worker = &(pipeline->workers[nca_idx % NSP_NCA_WORKER_COUNT]);
+    const void *block = NULL;
+
+    mutexLock(&(pipeline->mutex));
+
+    // wait until the worker for this nca has filled a block
+    while(!pipeline->error && !pipeline->exit && worker->consumed == worker->produced) condvarWait(&(pipeline->cond), &(pipeline->mutex));
+
+    if (!pipeline->error && !pipeline->exit)
+    {
+        u32 block_idx = (u32)(worker->consumed % NSP_NCA_WORKER_BLOCK_COUNT);
+        block = worker->blocks[block_idx];
+        *out_size = worker->block_sizes[block_idx];
+        *out_ckpt = (worker->block_ckpts[block_idx].valid ? &(worker->block_ckpts[block_idx]) : NULL);
+    }
+
+    mutexUnlock(&(pipeline->mutex));
+
+    return block;
+}
+
+static void nspReleaseNcaPipelineBlock(NspNcaPipeline *pipeline, u32 nca_idx)
+{
+    NspNcaWorker *worker = &(pipeline->workers[nca_idx % NSP_NCA_WORKER_COUNT]);
+
+    mutexLock(&(pipeline->mutex));
+    worker->consumed++;
+    condvarWakeAll(&(pipeline->cond));
+    mutexUnlock(&(pipeline->mutex));
+}
+
+static bool nspWaitForNcaPipelineHash(NspNcaPipeline *pipeline, u32 nca_idx, u8 *out_clean_hash)
+{
+    bool ret = false;
+
+    mutexLock(&(pipeline->mutex));
+
+    while(!pipeline->error && !pipeline->exit && !pipeline->nca_hashed[nca_idx]) condvarWait(&(pipeline->cond), &(pipeline->mutex));
+
+    if ((ret = pipeline->nca_hashed[nca_idx])) memcpy(out_clean_hash, pipeline->clean_hashes[nca_idx], SHA256_HASH_SIZE);
+
+    mutexUnlock(&(pipeline->mutex));
+
+    return ret;
+}
+
+static void nspSetNcaPipelineNcaDone(NspNcaPipeline *pipeline, u32 nca_idx)
+{
+    mutexLock(&(pipeline->mutex));
+    pipeline->done_count = (nca_idx + 1);
+    condvarWakeAll(&(pipeline->cond));
+    mutexUnlock(&(pipeline->mutex));
+}
+
+static bool nspNcaWorkerProcessNca(NspNcaWorker *worker, u32 nca_idx)
+{
+    NspNcaPipeline *pipeline = worker->pipeline;
+    NcaContext *nca_ctx = &(pipeline->nca_ctx[nca_idx]);
+    const NspCheckpoint *resume_ckpt = ((pipeline->resume_ckpt && pipeline->resume_ckpt->nca_idx == nca_idx) ? pipeline->resume_ckpt : NULL);
+    u64 blksize = BLOCK_SIZE, start_offset = (resume_ckpt ? resume_ckpt->nca_offset : 0);
+    bool stop = false;
+
+    if (nca_ctx->content_type == NcmContentType_Meta && pipeline->patch_cnmt)
+    {
+        // the cnmt patch needs the updated content ids from all other ncas, so we must wait until they have been written
+        mutexLock(&(pipeline->mutex));
+        while(!pipeline->error && !pipeline->exit && pipeline->done_count < nca_idx) condvarWait(&(pipeline->cond), &(pipeline->mutex));
+        stop = (pipeline->error || pipeline->exit);
+        mutexUnlock(&(pipeline->mutex));
+
+        if (stop) return false;
+
+        if (!cnmtGenerateNcaPatch(pipeline->cnmt_ctx) || !ncaEncryptHeader(nca_ctx))
+        {
+            consolePrint("cnmt generate patch failed\n");
+            return false;
+        }
+    }
+
+    multiDigestFreeContext(&(worker->digest_ctx));
+    if (!multiDigestInitializeContext(&(worker->digest_ctx), pipeline->digest_mask))
+    {
+        consolePrint("multi digest initialize ctx failed\n");
+        return false;
+    }
+
+    bool dirty_header = ncaIsHeaderDirty(nca_ctx);
+
+    nspInitializeNcaHashContext(&(worker->hash_ctx), &(worker->digest_ctx), nca_ctx);
+
+    if (start_offset)
+    {
+        // restore hash states from the checkpoint. patches located before the resume offset have already been written
+        if (!multiDigestImportState(&(worker->digest_ctx), &(resume_ckpt->digest_state)))
+        {
+            consolePrint("multi digest import state failed for \"%s\"\n", nca_ctx->content_id_str);
+            return false;
+        }
+
+        worker->hash_ctx.forked = resume_ckpt->clean_forked;
+        if (resume_ckpt->clean_forked) memcpy(&(worker->hash_ctx.clean_sha256_ctx), &(resume_ckpt->clean_sha256_ctx), sizeof(Sha256Context));
+    }
+
+    for(u64 offset = start_offset; offset < nca_ctx->content_size; offset += blksize)
+    {
+        // wait until the writer is done with the next block
+        mutexLock(&(pipeline->mutex));
+        while(!pipeline->error && !pipeline->exit && (worker->produced - worker->consumed) >= NSP_NCA_WORKER_BLOCK_COUNT) condvarWait(&(pipeline->cond), &(pipeline->mutex));
+        stop = (pipeline->error || pipeline->exit);
+        mutexUnlock(&(pipeline->mutex));
+
+        if (stop) return false;
+
+        u32 block_idx = (u32)(worker->produced % NSP_NCA_WORKER_BLOCK_COUNT);
+        void *buf = worker->blocks[block_idx];
+
+        if ((nca_ctx->content_size - offset) < blksize) blksize = (nca_ctx->content_size - offset);
+
+        // read nca chunk
+        if (!ncaReadContentFile(nca_ctx, buf, blksize, offset))
+        {
+            consolePrint("nca read failed at 0x%lX for \"%s\"\n", offset, nca_ctx->content_id_str);
+            return false;
+        }
+
+        // look for the first byte modified by our header patches before applying them
+        if (!offset && dirty_header) nspSetNcaHashContextForkOffset(&(worker->hash_ctx), nca_ctx, buf, blksize);
+
+        // update clean hash calculation (only if we're past the data shared by both hashes)
+        if (!nspUpdateNcaHashContextClean(&(worker->hash_ctx), buf, blksize, offset))
+        {
+            consolePrint("clean hash update failed at 0x%lX for \"%s\"\n", offset, nca_ctx->content_id_str);
+            return false;
+        }
+
+        // write re-encrypted headers and content type context patches
+        // update flag to avoid entering this code block if it's not needed anymore
+        if (dirty_header) dirty_header = nspWriteNcaPatches(nca_ctx, pipeline->cnmt_ctx, buf, blksize, offset);
+
+        // update dirty hash calculation
+        // the digest workers only read the block, so it can be handed over to the writer right away
+        // it won't be reused until the next block has been submitted, which waits for the digest workers
+        if (!nspUpdateNcaHashContextDirty(&(worker->hash_ctx), buf, blksize))
+        {
+            consolePrint("dirty hash update failed at 0x%lX for \"%s\"\n", offset, nca_ctx->content_id_str);
+            return false;
+        }
+
+        // take a snapshot of our hash states if a checkpoint is due right after this block. it'll be saved by the writer
+        NspNcaBlockCheckpoint *block_ckpt = &(worker->block_ckpts[block_idx]);
+        u64 block_end_offset = (offset + blksize);
+
+        block_ckpt->valid = (pipeline->checkpoint && !(block_end_offset % NSP_CHECKPOINT_INTERVAL) && block_end_offset < nca_ctx->content_size);
+        if (block_ckpt->valid)
+        {
+            if (!multiDigestExportState(&(worker->digest_ctx), &(block_ckpt->digest_state)))
+            {
+                consolePrint("multi digest export state failed at 0x%lX for \"%s\"\n", block_end_offset, nca_ctx->content_id_str);
+                return false;
+            }
+
+            block_ckpt->clean_forked = worker->hash_ctx.forked;
+            memcpy(&(block_ckpt->clean_sha256_ctx), &(worker->hash_ctx.clean_sha256_ctx), sizeof(Sha256Context));
+        }
+
+        mutexLock(&(pipeline->mutex));
+        worker->block_sizes[block_idx] = blksize;
+        worker->produced++;
+        condvarWakeAll(&(pipeline->cond));
+        mutexUnlock(&(pipeline->mutex));
+    }
+
+    // get dirty hash
+    if (!multiDigestFinalize(&(worker->digest_ctx), &(pipeline->nca_digests[nca_idx])))
+    {
+        consolePrint("dirty hash finalize failed for \"%s\"\n", nca_ctx->content_id_str);
+        return false;
+    }
+
+    mutexLock(&(pipeline->mutex));
+
+    // get clean hash
+    nspGetNcaHashContextCleanHash(&(worker->hash_ctx), &(pipeline->nca_digests[nca_idx]), pipeline->clean_hashes[nca_idx]);
+
+    pipeline->nca_hashed[nca_idx] = true;
+    condvarWakeAll(&(pipeline->cond));
+
+    mutexUnlock(&(pipeline->mutex));
+
+    return true;
+}
+
+static void nspNcaWorkerThreadFunc(void *arg)
+{
+    NspNcaWorker *worker = (NspNcaWorker*)arg;
+    NspNcaPipeline *pipeline = worker->pipeline;
+
+    for(u32 i = worker->idx; i < pipeline->nca_count; i += NSP_NCA_WORKER_COUNT)
+    {
+        // skip ncas written by a previous run
+        if ((pipeline->resume_ckpt && i < pipeline->resume_ckpt->nca_idx) || nspNcaWorkerProcessNca(worker, i)) continue;
+
+        // let the writer know something went wrong
+        mutexLock(&(pipeline->mutex));
+        pipeline->error = true;
+        condvarWakeAll(&(pipeline->cond));
+        mutexUnlock(&(pipeline->mutex));
+
+        break;
+    }
+
+    threadExit();
+}
+
+static bool nspAddPrepareJob(NspPrepareContext *ctx, u8 type, NcaContext *nca_ctx, void *content_type_ctx, u32 *out_idx)
+{
+    NspPrepareJob *tmp_jobs = realloc(ctx->jobs, (ctx->job_count + 1) * sizeof(NspPrepareJob));
+    if (!tmp_jobs)
+    {
+        consolePrint("prepare job realloc failed\n");
+        return false;
+    }
+
+    ctx->jobs = tmp_jobs;
+
+    NspPrepareJob *job = &(ctx->jobs[ctx->job_count]);
+    memset(job, 0, sizeof(NspPrepareJob));
+
+    job->type = type;
+    job->nca_ctx = nca_ctx;
+    job->content_type_ctx = content_type_ctx;
+
+    if (out_idx) *out_idx = ctx->job_count;
+
+    ctx->job_count++;
+
+    return true;
+}
+
+static bool nspAddPrepareJobDependency(NspPrepareContext *ctx, u32 job_idx, u32 dep_idx)
+{
+    NspPrepareJob *dep_job = &(ctx->jobs[dep_idx]);
+
+    u32 *tmp_dependents = realloc(dep_job->dependents, (dep_job->dependent_count + 1) * sizeof(u32));
+    if (!tmp_dependents)
+    {
+        consolePrint("prepare job dependency realloc failed\n");
+        return false;
+    }
+
+    dep_job->dependents = tmp_dependents;
+    dep_job->dependents[dep_job->dependent_count++] = job_idx;
+
+    ctx->jobs[job_idx].dep_count++;
+
+    return true;
+}
+
+static bool nspRunPrepareJob(NspPrepareContext *ctx, NspPrepareJob *job)
+{
+    NcaContext *nca_ctx = job->nca_ctx;
+
+    switch(job->type)
+    {
+        case NspPrepareJobType_Cnmt:
+        {
+            if (!cnmtInitializeContext(ctx->cnmt_ctx, nca_ctx))
+            {
+                consolePrint("cnmt initialize ctx failed\n");
+                return false;
+            }
+
+            consolePrint("cnmt initialize ctx succeeded (%s)\n", nca_ctx->content_id_str);
+
+            break;
+        }
+        case NspPrepareJobType_ContentType:
+        {
+            if (job->content_type_ctx)
+            {
+                switch(nca_ctx->content_type)
+                {
+                    case NcmContentType_Program:
+                    {
+                        if (!programInfoInitializeContext((ProgramInfoContext*)job->content_type_ctx, nca_ctx))
+                        {
+                            consolePrint("initialize program info ctx failed (%s)\n", nca_ctx->content_id_str);
+                            return false;
+                        }
+
+                        consolePrint("initialize program info ctx succeeded (%s)\n", nca_ctx->content_id_str);
+
+                        break;
+                    }
+                    case NcmContentType_Control:
+                    {
+                        NacpContext *nacp_ctx = (NacpContext*)job->content_type_ctx;
+
+                        if (!nacpInitializeContext(nacp_ctx, nca_ctx))
+                        {
+                            consolePrint("initialize nacp ctx failed (%s)\n", nca_ctx->content_id_str);
+                            return false;
+                        }
+
+                        if (!nacpGenerateNcaPatch(nacp_ctx, ctx->patch_sua, ctx->patch_screenshot, ctx->patch_video_capture, ctx->patch_hdcp))
+                        {
+                            consolePrint("nacp nca patch failed (%s)\n", nca_ctx->content_id_str);
+                            return false;
+                        }
+
+                        consolePrint("initialize nacp ctx succeeded (%s)\n", nca_ctx->content_id_str);
+
+                        break;
+                    }
+                    case NcmContentType_LegalInformation:
+                    {
+                        if (!legalInfoInitializeContext((LegalInfoContext*)job->content_type_ctx, nca_ctx))
+                        {
+                            consolePrint("initialize legal info ctx failed (%s)\n", nca_ctx->content_id_str);
+                            return false;
+                        }
+
+                        consolePrint("initialize legal info ctx succeeded (%s)\n", nca_ctx->content_id_str);
+
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+
+            // the nca header must be encrypted after generating nca patches
+            if (!ncaEncryptHeader(nca_ctx))
+            {
+                consolePrint("%s #%u encrypt nca header failed\n", titleGetNcmContentTypeName(nca_ctx->content_type), nca_ctx->id_offset);
+                return false;
+            }
+
+            break;
+        }
+        case NspPrepareJobType_AuthoringToolXml:
+        {
+            if (nca_ctx->content_type == NcmContentType_Program)
+            {
+                if (!programInfoGenerateAuthoringToolXml((ProgramInfoContext*)job->content_type_ctx))
+                {
+                    consolePrint("program info xml failed (%s)\n", nca_ctx->content_id_str);
+                    return false;
+                }
+            } else
+            if (nca_ctx->content_type == NcmContentType_Control)
+            {
+                if (!nacpGenerateAuthoringToolXml((NacpContext*)job->content_type_ctx, ctx->title_info->version.value, cnmtGetRequiredTitleVersion(ctx->cnmt_ctx)))
+                {
+                    consolePrint("nacp xml failed (%s)\n", nca_ctx->content_id_str);
+                    return false;
+                }
+            }
+
+            break;
+        }
+        case NspPrepareJobType_CnmtXml:
+        {
+            // generate cnmt xml right away even though we don't yet have all the data we need
+            // This is because we need its size to calculate the full nsp size
+            if (!cnmtGenerateAuthoringToolXml(ctx->cnmt_ctx, ctx->nca_ctx, ctx->title_info->content_count))
+            {
+                consolePrint("cnmt xml #1 failed\n");
+                return false;
+            }
+
+            break;
+        }
+        default:
+            break;
+    }
+
+    return true;
+}
+
+static void nspPrepareWorkerThreadFunc(void *arg)
+{
+    NspPrepareContext *ctx = (NspPrepareContext*)arg;
+
+    mutexLock(&(ctx->mutex));
+
+    while(!ctx->error && ctx->done_count < ctx->job_count)
+    {
+        NspPrepareJob *job = NULL;
+
+        // look for a job whose dependencies have all finished
+        for(u32 i = 0; i < ctx->job_count; i++)
+        {
+            if (ctx->jobs[i].started || ctx->jobs[i].dep_count) continue;
+            job = &(ctx->jobs[i]);
+            break;
+        }
+
+        if (!job)
+        {
+            // wait until another worker finishes a job
+            condvarWait(&(ctx->cond), &(ctx->mutex));
+            continue;
+        }
+
+        job->started = true;
+
+        mutexUnlock(&(ctx->mutex));
+        bool ret = nspRunPrepareJob(ctx, job);
+        mutexLock(&(ctx->mutex));
+
+        if (ret)
+        {
+            for(u32 i = 0; i < job->dependent_count; i++) ctx->jobs[job->dependents[i]].dep_count--;
+            ctx->done_count++;
+        } else {
+            ctx->error = true;
+        }
+
+        condvarWakeAll(&(ctx->cond));
+    }
+
+    mutexUnlock(&(ctx->mutex));
+
+    threadExit();
+}
+
+static bool nspRunPrepareJobs(NspPrepareContext *ctx)
+{
+    Thread threads[NSP_PREPARE_WORKER_COUNT] = {0};
+    u32 thread_count = 0;
+
+    mutexInit(&(ctx->mutex));
+    condvarInit(&(ctx->cond));
+
+    for(; thread_count < NSP_PREPARE_WORKER_COUNT; thread_count++)
+    {
+        if (!utilsCreateThread(&(threads[thread_count]), nspPrepareWorkerThreadFunc, ctx, (int)thread_count))
+        {
+            consolePrint("prepare worker thread #%u creation failed\n", thread_count);
+
+            // stop the workers we already started
+            mutexLock(&(ctx->mutex));
+            ctx->error = true;
+            condvarWakeAll(&(ctx->cond));
+            mutexUnlock(&(ctx->mutex));
+
+            break;
+        }
+    }
+
+    for(u32 i = 0; i < thread_count; i++) utilsJoinThread(&(threads[i]));
+
+    return (!ctx->error && ctx->done_count == ctx->job_count);
+}
+
+static void nspFreePrepareContext(NspPrepareContext *ctx)
+{
+    if (ctx->jobs)
+    {
+        for(u32 i = 0; i < ctx->job_count; i++)
+        {
+            if (ctx->jobs[i].dependents) free(ctx->jobs[i].dependents);
+        }
+
+        free(ctx->jobs);
+    }
+
+    memset(ctx, 0, sizeof(NspPrepareContext));
+}
+
+static bool nspPrecalculateNcaHashes(NcaContext *nca_ctx, u32 nca_ctx_count, ContentMetaContext *cnmt_ctx, PartitionFileSystemImageContext *pfs_img_ctx, void *buf, \
+                                     u8 (*out_hashes)[SHA256_HASH_SIZE], bool *out_hash_available)
+{
+    Sha256Context clean_sha256_ctx = {0}, dirty_sha256_ctx = {0};
+    u8 clean_sha256_hash[SHA256_HASH_SIZE] = {0};
+
+    for(u32 i = 0; i < nca_ctx_count; i++)
+    {
+        NcaContext *cur_nca_ctx = &(nca_ctx[i]);
+        u64 blksize = BLOCK_SIZE;
+
+        // the meta nca is always the last one, so all content records have already been updated at this point
+        if (cur_nca_ctx->content_type == NcmContentType_Meta && (!cnmtGenerateNcaPatch(cnmt_ctx) || !ncaEncryptHeader(cur_nca_ctx)))
+        {
+            consolePrint("cnmt generate patch failed\n");
+            return false;
+        }
+
+        // skip unmodified ncas
+        if (!ncaIsHeaderDirty(cur_nca_ctx)) continue;
+
+        bool content_type_ctx_patch = cur_nca_ctx->content_type_ctx_patch, dirty_header = true;
+
+        sha256ContextCreate(&clean_sha256_ctx);
+        sha256ContextCreate(&dirty_sha256_ctx);
+
+        for(u64 offset = 0; offset < cur_nca_ctx->content_size; offset += blksize)
+        {
+            if ((cur_nca_ctx->content_size - offset) < blksize) blksize = (cur_nca_ctx->content_size - offset);
+
+            // read nca chunk
+            if (!ncaReadContentFile(cur_nca_ctx, buf, blksize, offset))
+            {
+                consolePrint("nca read failed at 0x%lX for \"%s\"\n", offset, cur_nca_ctx->content_id_str);
+                return false;
+            }
+
+            // update clean hash calculation
+            sha256ContextUpdate(&clean_sha256_ctx, buf, blksize);
+
+            // write re-encrypted headers and content type context patches
+            if (dirty_header) dirty_header = nspWriteNcaPatches(cur_nca_ctx, cnmt_ctx, buf, blksize, offset);
+
+            // update dirty hash calculation
+            sha256ContextUpdate(&dirty_sha256_ctx, buf, blksize);
+        }
+
+        // validate clean hash
+        sha256ContextGetHash(&clean_sha256_ctx, clean_sha256_hash);
+        if (!cnmtVerifyContentHash(cnmt_ctx, cur_nca_ctx, clean_sha256_hash))
+        {
+            consolePrint("sha256 checksum mismatch for nca \"%s\"\nplease check for corrupted data using the data management menu\n", cur_nca_ctx->content_id_str);
+            return false;
+        }
+
+        // get dirty hash
+        sha256ContextGetHash(&dirty_sha256_ctx, out_hashes[i]);
+        out_hash_available[i] = true;
+
+        if (memcmp(clean_sha256_hash, out_hashes[i], SHA256_HASH_SIZE) != 0)
+        {
+            // update content id and hash
+            ncaUpdateContentIdAndHash(cur_nca_ctx, out_hashes[i]);
+
+            // update cnmt
+            if (!cnmtUpdateContentInfo(cnmt_ctx, cur_nca_ctx))
+            {
+                consolePrint("cnmt update content info failed\n");
+                return false;
+            }
+
+            // update pfs entry name
+            if (!pfsUpdateEntryNameFromImageContext(pfs_img_ctx, i, cur_nca_ctx->content_id_str))
+            {
+                consolePrint("pfs update entry name failed for nca \"%s\"\n", cur_nca_ctx->content_id_str);
+                return false;
+            }
+        }
+
+        // the headers and patches must be written once more while dumping the nca
+        // this also binds the patches to the updated content id
+        ncaResetHeaderWrittenStatus(cur_nca_ctx);
+
+        if (content_type_ctx_patch)
+        {
+            switch(cur_nca_ctx->content_type)
+            {
+                case NcmContentType_Meta:
+                    pfsResetEntryPatchWrittenStatus(&(cnmt_ctx->pfs_ctx), &(cnmt_ctx->nca_patch));
+                    break;
+                case NcmContentType_Control:
+                {
+                    NacpContext *nacp_ctx = (NacpContext*)cur_nca_ctx->content_type_ctx;
+                    romfsResetFileEntryPatchWrittenStatus(&(nacp_ctx->romfs_ctx), &(nacp_ctx->nca_patch));
+                    break;
+                }
+                default:
+                    break;
+            }
+
+            cur_nca_ctx->content_type_ctx_patch = true;
+        }
+    }
+
+    return true;
+}
+
+static bool nspApplyNcaHash(NcaContext *nca_ctx, u32 nca_idx, ContentMetaContext *cnmt_ctx, PartitionFileSystemImageContext *pfs_img_ctx, const u8 *clean_hash, \
+                            const MultiDigestResult *dirty_digests, bool sequential_output, const u8 *precalc_hash)
+{
+    // validate clean hash
+    if (!cnmtVerifyContentHash(cnmt_ctx, nca_ctx, clean_hash))
+    {
+        consolePrint("sha256 checksum mismatch for nca \"%s\"\nplease check for corrupted data using the data management menu\n", nca_ctx->content_id_str);
+        return false;
+    }
+
+    if (sequential_output)
+    {
+        // the pfs0 header has already been written, so the data we just wrote must match the hash we precalculated
+        if (precalc_hash && memcmp(precalc_hash, dirty_digests->sha256, SHA256_HASH_SIZE) != 0)
+        {
+            consolePrint("sha256 checksum mismatch for modified nca \"%s\" (data changed after hashing it)\n", nca_ctx->content_id_str);
+            return false;
+        }
+    } else
+    if (memcmp(clean_hash, dirty_digests->sha256, SHA256_HASH_SIZE) != 0)
+    {
+        // update content id and hash
+        ncaUpdateContentIdAndHash(nca_ctx, dirty_digests->sha256);
+
+        // update cnmt
+        if (!cnmtUpdateContentInfo(cnmt_ctx, nca_ctx))
+        {
+            consolePrint("cnmt update content info failed\n");
+            return false;
+        }
+
+        // update pfs entry name
+        if (!pfsUpdateEntryNameFromImageContext(pfs_img_ctx, nca_idx, nca_ctx->content_id_str))
+        {
+            consolePrint("pfs update entry name failed for nca \"%s\"\n", nca_ctx->content_id_str);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool nspLoadCheckpoint(const char *ckpt_path, u32 nca_count, NspCheckpoint *out, NspCheckpointNcaState *nca_states)
+{
+    char bak_path[FS_MAX_PATH] = {0};
+    FILE *ckpt_fp = fopen(ckpt_path, "rb");
+
+    if (!ckpt_fp)
+    {
+        // fall back to the backup checkpoint file if we were interrupted while nspSaveCheckpoint() was replacing the current one
+        snprintf(bak_path, sizeof(bak_path), "%s.bak", ckpt_path);
+        if (!(ckpt_fp = fopen(bak_path, "rb"))) return false;
+        ckpt_path = bak_path;
+    }
+
+    bool success = (fread(out, 1, sizeof(NspCheckpoint), ckpt_fp) == sizeof(NspCheckpoint) && out->magic == NSP_CHECKPOINT_MAGIC && out->version == NSP_CHECKPOINT_VERSION && \
+                    out->nca_count == nca_count && out->nca_idx <= nca_count && out->nsp_offset < out->nsp_size && out->overlap_size && out->overlap_size <= BLOCK_SIZE && \
+                    out->overlap_size <= out->nsp_offset && fread(nca_states, sizeof(NspCheckpointNcaState), nca_count, ckpt_fp) == nca_count && \
+                    crc32Calculate(nca_states, nca_count * sizeof(NspCheckpointNcaState)) == out->state_crc);
+
+    fclose(ckpt_fp);
+
+    if (!success) consolePrint("invalid nsp checkpoint \"%s\"\n", ckpt_path);
+
+    return success;
+}
+
+static bool nspSaveCheckpoint(FILE *fp, const char *ckpt_path, NspCheckpoint *ckpt, const NspCheckpointNcaState *nca_states, void *buf)
+{
+    char tmp_path[FS_MAX_PATH] = {0};
+    FILE *ckpt_fp = NULL;
+    bool success = false;
+
+    // make sure all written data has reached the storage device before saving the checkpoint
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        consolePrint("failed to flush nsp data before checkpoint\n");
+        return false;
+    }
+
+    // read back the last block before the checkpoint offset. it'll be verified before resuming
+    ckpt->overlap_size = (u32)MIN((u64)BLOCK_SIZE, ckpt->nsp_offset);
+
+    success = (fseeko(fp, (off_t)(ckpt->nsp_offset - ckpt->overlap_size), SEEK_SET) == 0 && fread(buf, 1, ckpt->overlap_size, fp) == ckpt->overlap_size);
+    if (success) ckpt->overlap_crc = crc32Calculate(buf, ckpt->overlap_size);
+
+    // restore file position
+    if (fseeko(fp, (off_t)ckpt->nsp_offset, SEEK_SET) != 0 || !success)
+    {
+        consolePrint("failed to read back nsp data before checkpoint\n");
+        return false;
+    }
+
+    ckpt->state_crc = crc32Calculate(nca_states, ckpt->nca_count * sizeof(NspCheckpointNcaState));
+
+    // write checkpoint data to a temporary file, then replace the current checkpoint file with it
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", ckpt_path);
+
+    success = false;
+
+    if ((ckpt_fp = fopen(tmp_path, "wb")))
+    {
+        success = (fwrite(ckpt, 1, sizeof(NspCheckpoint), ckpt_fp) == sizeof(NspCheckpoint) && \
+                   fwrite(nca_states, sizeof(NspCheckpointNcaState), ckpt->nca_count, ckpt_fp) == ckpt->nca_count);
+        fclose(ckpt_fp);
+    }
+
+    if (success && rename(tmp_path, ckpt_path) != 0)
+    {
+        // not every filesystem lets rename() overwrite an existing file (e.g. fat through the fs sysmodule)
+        // in that case, the current checkpoint file is moved out of the way and only removed once the new one is in place
+        // nspLoadCheckpoint() falls back to the backup file, so a valid checkpoint is still available if we're interrupted in between
+        char bak_path[FS_MAX_PATH] = {0};
+        struct stat st = {0};
+        bool has_ckpt = (stat(ckpt_path, &st) == 0);
+
+        snprintf(bak_path, sizeof(bak_path), "%s.bak", ckpt_path);
+        if (has_ckpt) remove(bak_path);
+
+        success = ((!has_ckpt || rename(ckpt_path, bak_path) == 0) && rename(tmp_path, ckpt_path) == 0);
+        if (success && has_ckpt) remove(bak_path);
+    }
+
+    if (!success)
+    {
+        consolePrint("failed to save nsp checkpoint at offset 0x%lX\n", ckpt->nsp_offset);
+        remove(tmp_path);
+    }
+
+    return success;
+}
+
+static void nspRemoveCheckpoint(const char *ckpt_path)
+{
+    char path[FS_MAX_PATH] = {0};
+
+    remove(ckpt_path);
+
+    snprintf(path, sizeof(path), "%s.bak", ckpt_path);
+    remove(path);
+
+    snprintf(path, sizeof(path), "%s.tmp", ckpt_path);
+    remove(path);
+}
+
+static bool nspVerifyCheckpointOverlap(FILE *fp, const NspCheckpoint *ckpt, void *buf)
+{
+    // the output file must have already been fully allocated by the previous run
+    bool match = (fseeko(fp, 0, SEEK_END) == 0 && (u64)ftello(fp) == ckpt->nsp_size && \
+                  fseeko(fp, (off_t)(ckpt->nsp_offset - ckpt->overlap_size), SEEK_SET) == 0 && fread(buf, 1, ckpt->overlap_size, fp) == ckpt->overlap_size && \
+                  crc32Calculate(buf, ckpt->overlap_size) == ckpt->overlap_crc && fseeko(fp, (off_t)ckpt->nsp_offset, SEEK_SET) == 0);
+
+    if (!match) consolePrint("nsp checkpoint overlap mismatch (offset 0x%lX, size 0x%X)\n", ckpt->nsp_offset - ckpt->overlap_size, ckpt->overlap_size);
+
+    return match;
+}
+
+static void nspThreadFunc(void *arg)
+{
+    NspThreadData *nsp_thread_data = (NspThreadData*)arg;
+
+    TitleInfo *title_info = NULL;
+
+    bool set_download_type = (bool)getNspSetDownloadDistributionOption();
+    bool remove_console_data = (bool)getNspRemoveConsoleDataOption();
+    bool remove_titlekey_crypto = (bool)getNspRemoveTitlekeyCryptoOption();
+    bool patch_sua = (bool)getNspDisableLinkedAccountRequirementOption();
+    bool patch_screenshot = (bool)getNspEnableScreenshotsOption();
+    bool patch_video_capture = (bool)getNspEnableVideoCaptureOption();
+    bool patch_hdcp = (bool)getNspDisableHdcpOption();
+    bool generate_authoringtool_data = (bool)getNspGenerateAuthoringToolDataOption();
+    bool sequential_output = (bool)getNspSequentialOutputOption();
+    bool lookup_checksum = (bool)getNspLookupChecksumOption();
+    bool generate_digest_report = (bool)getNspGenerateDigestReportOption();
+    bool success = false, no_titlekey_confirmation = false;
+
+    // only calculate the digests we actually need. sha-256 is always calculated, since it's used to update the content ids
+    // the digest report holds every digest, and dat lookups need both crc32 and sha-1
+    u32 digest_mask = (generate_digest_report ? MultiDigestType_All : (MultiDigestType_Sha256 | (lookup_checksum ? (MultiDigestType_Crc32 | MultiDigestType_Sha1) : 0)));
+
+    u64 free_space = 0;
+    u32 dev_idx = g_storageMenuElementOption.selected;
+
+    u8 *buf = NULL;
+    char *filename = NULL;
+    FILE *fp = NULL;
+
+    NcaContext *nca_ctx = NULL;
+
+    NcaContext *meta_nca_ctx = NULL;
+    ContentMetaContext cnmt_ctx = {0};
+
+    ProgramInfoContext *program_info_ctx = NULL;
+    u32 program_idx = 0, program_count = 0;
+
+    NacpContext *nacp_ctx = NULL;
+    u32 control_idx = 0, control_count = 0;
+
+    LegalInfoContext *legal_info_ctx = NULL;
+    u32 legal_info_idx = 0, legal_info_count = 0;
+
+    Ticket tik = {0};
+    TikCommonBlock *tik_common_block = NULL;
+
+    u8 *raw_cert_chain = NULL;
+    u64 raw_cert_chain_size = 0;
+
+    PartitionFileSystemImageContext pfs_img_ctx = {0};
+    pfsInitializeImageContext(&pfs_img_ctx);
+
+    char entry_name[64] = {0};
+    u64 nsp_header_size = 0, nsp_size = 0, nsp_offset = 0;
+    char size_str[16] = {0};
+    char *tmp_name = NULL;
+
+    u8 clean_sha256_hash[SHA256_HASH_SIZE] = {0};
+
+    /* NCAs are read, patched and hashed by the pipeline workers. The SHA-256 digest calculated by their multi-digest contexts is the dirty NCA hash. */
+    NspNcaPipeline nca_pipeline = {0};
+    MultiDigestResult *nca_digests = NULL;
+
+    NspPrepareContext prepare_ctx = {0};
+    u32 cnmt_job_idx = 0, job_idx = 0;
+    u8 (*nca_hashes)[SHA256_HASH_SIZE] = NULL;
+    bool *nca_hash_available = NULL;
+    char *digest_report = NULL;
+    size_t digest_report_size = 0;
+
+    // interrupted dumps to the sd card / ums devices are resumed using a checkpoint file saved next to them
+    char *ckpt_path = NULL;
+    size_t ckpt_path_size = 0;
+    NspCheckpoint ckpt = {0}, resume_ckpt = {0};
+    NspCheckpointNcaState *ckpt_nca_states = NULL;
+    bool checkpoint = false, resumed = false, keep_partial_dump = false;
+
+    if (!nsp_thread_data || !(title_info = (TitleInfo*)nsp_thread_data->data) || !title_info->content_count || !title_info->content_infos) goto end;
+
+    /* Allocate memory for the dump process. */
+    if (!(buf = usbAllocatePageAlignedBuffer(BLOCK_SIZE)))
+    {
+        consolePrint("buf alloc failed\n");
+        goto end;
+    }
+
+    /* Generate output path. */
+    filename = generateOutputTitleFileName(title_info, "NSP", ".nsp");
+    if (!filename) goto end;
 
     /* Get free space on output storage. */
     if (dev_idx != 1 && !utilsGetFileSystemStatsByPath(filename, NULL, &free_space))
@@ -6208,6 +7648,27 @@ static void nspThreadFunc(void *arg)
         goto end;
     }
 
+    if (!(nca_digests = calloc(title_info->content_count, sizeof(MultiDigestResult))))
+    {
+        consolePrint("nca digests calloc failed\n");
+        goto end;
+    }
+
+    if (sequential_output && (!(nca_hashes = calloc(title_info->content_count, SHA256_HASH_SIZE)) || !(nca_hash_available = calloc(title_info->content_count, sizeof(bool)))))
+    {
+        consolePrint("nca hashes calloc failed\n");
+        goto end;
+    }
+
+    checkpoint = (dev_idx != 1);
+
+    if (checkpoint && (!utilsAppendFormattedStringToBuffer(&ckpt_path, &ckpt_path_size, "%s" NSP_CHECKPOINT_EXTENSION, filename) || \
+        !(ckpt_nca_states = calloc(title_info->content_count, sizeof(NspCheckpointNcaState)))))
+    {
+        consolePrint("nsp checkpoint alloc failed\n");
+        goto end;
+    }
+
     // determine if we should initialize programinfo ctx
     if (generate_authoringtool_data)
     {
@@ -6253,18 +7714,20 @@ static void nspThreadFunc(void *arg)
 
     consolePrint("meta nca initialize ctx succeeded\n");
 
-    if (!cnmtInitializeContext(&cnmt_ctx, meta_nca_ctx))
-    {
-        consolePrint("cnmt initialize ctx failed\n");
-        goto end;
-    }
+    // content type ctxs and authoring tool xmls are prepared by a pool of worker threads once all nca ctxs have been initialized
+    // nca ctxs themselves are initialized right here, since they share the ticket and may need user confirmation
+    prepare_ctx.title_info = title_info;
+    prepare_ctx.nca_ctx = nca_ctx;
+    prepare_ctx.cnmt_ctx = &cnmt_ctx;
+    prepare_ctx.patch_sua = patch_sua;
+    prepare_ctx.patch_screenshot = patch_screenshot;
+    prepare_ctx.patch_video_capture = patch_video_capture;
+    prepare_ctx.patch_hdcp = patch_hdcp;
 
-    consolePrint("cnmt initialize ctx succeeded (%s)\n", meta_nca_ctx->content_id_str);
+    if (!nspAddPrepareJob(&prepare_ctx, NspPrepareJobType_Cnmt, meta_nca_ctx, NULL, &cnmt_job_idx)) goto end;
 
     // initialize nca context
-    // initialize content type context
-    // generate nca patches (if needed)
-    // generate content type xml
+    // queue content type context initialization, nca patch generation and content type xml generation
     for(u32 i = 0, j = 0; i < title_info->content_count; i++)
     {
         // skip meta nca since we already initialized it
@@ -6309,127 +7772,84 @@ static void nspThreadFunc(void *arg)
             {
                 j++;
                 no_titlekey_confirmation = true;
-                continue;
-            }
-
-            goto end;
-        }
-
-        // set download distribution type
-        // has no effect if this nca uses NcaDistributionType_Download
-        if (set_download_type) ncaSetDownloadDistributionType(cur_nca_ctx);
-
-        // remove titlekey crypto
-        // has no effect if this nca doesn't use titlekey crypto
-        if (remove_titlekey_crypto && !ncaRemoveTitleKeyCrypto(cur_nca_ctx))
-        {
-            consolePrint("nca remove titlekey crypto failed\n");
-            goto end;
-        }
-
-        if (!cur_nca_ctx->fs_ctx[0].has_sparse_layer)
-        {
-            switch(content_info->content_type)
-            {
-                case NcmContentType_Program:
-                {
-                    // don't proceed if we didn't allocate programinfo ctx
-                    if (!program_count || !program_info_ctx) break;
-
-                    ProgramInfoContext *cur_program_info_ctx = &(program_info_ctx[program_idx]);
-
-                    if (!programInfoInitializeContext(cur_program_info_ctx, cur_nca_ctx))
-                    {
-                        consolePrint("initialize program info ctx failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
-
-                    if (!programInfoGenerateAuthoringToolXml(cur_program_info_ctx))
-                    {
-                        consolePrint("program info xml failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
-
-                    program_idx++;
-
-                    consolePrint("initialize program info ctx succeeded (%s)\n", cur_nca_ctx->content_id_str);
-
-                    break;
-                }
-                case NcmContentType_Control:
-                {
-                    // don't proceed if we didn't allocate nacp ctx
-                    if (!control_count || !nacp_ctx) break;
-
-                    NacpContext *cur_nacp_ctx = &(nacp_ctx[control_idx]);
-
-                    if (!nacpInitializeContext(cur_nacp_ctx, cur_nca_ctx))
-                    {
-                        consolePrint("initialize nacp ctx failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
-
-                    if (!nacpGenerateNcaPatch(cur_nacp_ctx, patch_sua, patch_screenshot, patch_video_capture, patch_hdcp))
-                    {
-                        consolePrint("nacp nca patch failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
-
-                    if (generate_authoringtool_data && !nacpGenerateAuthoringToolXml(cur_nacp_ctx, title_info->version.value, cnmtGetRequiredTitleVersion(&cnmt_ctx)))
-                    {
-                        consolePrint("nacp xml failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
-
-                    control_idx++;
-
-                    consolePrint("initialize nacp ctx succeeded (%s)\n", cur_nca_ctx->content_id_str);
-
-                    break;
-                }
-                case NcmContentType_LegalInformation:
-                {
-                    // don't proceed if we didn't allocate legalinfo ctx
-                    if (!legal_info_count || !legal_info_ctx) break;
+                continue;
+            }
 
-                    LegalInfoContext *cur_legal_info_ctx = &(legal_info_ctx[legal_info_idx]);
+            goto end;
+        }
 
-                    if (!legalInfoInitializeContext(cur_legal_info_ctx, cur_nca_ctx))
-                    {
-                        consolePrint("initialize legal info ctx failed (%s)\n", cur_nca_ctx->content_id_str);
-                        goto end;
-                    }
+        // set download distribution type
+        // has no effect if this nca uses NcaDistributionType_Download
+        if (set_download_type) ncaSetDownloadDistributionType(cur_nca_ctx);
 
-                    legal_info_idx++;
+        // remove titlekey crypto
+        // has no effect if this nca doesn't use titlekey crypto
+        if (remove_titlekey_crypto && !ncaRemoveTitleKeyCrypto(cur_nca_ctx))
+        {
+            consolePrint("nca remove titlekey crypto failed\n");
+            goto end;
+        }
 
-                    consolePrint("initialize legal info ctx succeeded (%s)\n", cur_nca_ctx->content_id_str);
+        void *content_type_ctx = NULL;
 
+        if (!cur_nca_ctx->fs_ctx[0].has_sparse_layer)
+        {
+            switch(content_info->content_type)
+            {
+                case NcmContentType_Program:
+                    // skip programinfo ctx if we didn't allocate it
+                    if (program_count && program_info_ctx) content_type_ctx = &(program_info_ctx[program_idx++]);
+                    break;
+                case NcmContentType_Control:
+                    // skip nacp ctx if we didn't allocate it
+                    if (control_count && nacp_ctx) content_type_ctx = &(nacp_ctx[control_idx++]);
+                    break;
+                case NcmContentType_LegalInformation:
+                    // skip legalinfo ctx if we didn't allocate it
+                    if (legal_info_count && legal_info_ctx) content_type_ctx = &(legal_info_ctx[legal_info_idx++]);
                     break;
-                }
                 default:
                     break;
             }
         }
 
-        if (!ncaEncryptHeader(cur_nca_ctx))
+        if (!nspAddPrepareJob(&prepare_ctx, NspPrepareJobType_ContentType, cur_nca_ctx, content_type_ctx, &job_idx)) goto end;
+
+        // programinfo and nacp xmls can only be generated once their ctxs are ready
+        // the nacp xml also needs the required title version from the cnmt
+        if (generate_authoringtool_data && content_type_ctx && (content_info->content_type == NcmContentType_Program || content_info->content_type == NcmContentType_Control))
         {
-            consolePrint("%s #%u encrypt nca header failed\n", titleGetNcmContentTypeName(content_info->content_type), content_info->id_offset);
-            goto end;
+            u32 xml_job_idx = 0;
+
+            if (!nspAddPrepareJob(&prepare_ctx, NspPrepareJobType_AuthoringToolXml, cur_nca_ctx, content_type_ctx, &xml_job_idx) || \
+                !nspAddPrepareJobDependency(&prepare_ctx, xml_job_idx, job_idx) || \
+                (content_info->content_type == NcmContentType_Control && !nspAddPrepareJobDependency(&prepare_ctx, xml_job_idx, cnmt_job_idx))) goto end;
         }
 
         j++;
     }
 
-    consoleRefresh();
+    // the cnmt xml needs info from every nca, so it depends on all other jobs
+    if (generate_authoringtool_data)
+    {
+        u32 dep_count = prepare_ctx.job_count;
+
+        if (!nspAddPrepareJob(&prepare_ctx, NspPrepareJobType_CnmtXml, meta_nca_ctx, NULL, &job_idx)) goto end;
+
+        for(u32 i = 0; i < dep_count; i++)
+        {
+            if (!nspAddPrepareJobDependency(&prepare_ctx, job_idx, i)) goto end;
+        }
+    }
 
-    // generate cnmt xml right away even though we don't yet have all the data we need
-    // This is because we need its size to calculate the full nsp size
-    if (generate_authoringtool_data && !cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
+    if (!nspRunPrepareJobs(&prepare_ctx))
     {
-        consolePrint("cnmt xml #1 failed\n");
+        consolePrint("nsp preparation failed\n");
         goto end;
     }
 
+    consoleRefresh();
+
     bool retrieve_tik_cert = (!remove_titlekey_crypto && tikIsValidTicket(&tik));
     if (retrieve_tik_cert)
     {
@@ -6570,78 +7990,227 @@ static void nspThreadFunc(void *arg)
 
     consoleRefresh();
 
+    if (sequential_output)
+    {
+        // the pfs0 header is written first, so we need to know the final content ids for all modified ncas beforehand
+        // unmodified ncas keep the hashes from the cnmt, which are verified while they're being written
+        consolePrint("hashing modified ncas, please wait.\n");
+        consoleRefresh();
+
+        if (!nspPrecalculateNcaHashes(nca_ctx, title_info->content_count, &cnmt_ctx, &pfs_img_ctx, buf, nca_hashes, nca_hash_available))
+        {
+            consolePrint("nca hash precalculation failed\n");
+            goto end;
+        }
+
+        if (generate_authoringtool_data)
+        {
+            // regenerate cnmt xml
+            // its size doesn't change, since content ids always have the same length
+            if (!cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
+            {
+                consolePrint("cnmt xml #2 failed\n");
+                goto end;
+            }
+
+            // update cnmt xml pfs entry name
+            if (!pfsUpdateEntryNameFromImageContext(&pfs_img_ctx, meta_nca_ctx->content_type_ctx_data_idx, meta_nca_ctx->content_id_str))
+            {
+                consolePrint("pfs update entry name cnmt xml failed\n");
+                goto end;
+            }
+        }
+
+        // update content type ctx data pfs entry names
+        for(u32 i = 0; i < limit; i++)
+        {
+            NcaContext *cur_nca_ctx = &(nca_ctx[i]);
+            if (!cur_nca_ctx->content_type_ctx) continue;
+
+            u32 data_idx = cur_nca_ctx->content_type_ctx_data_idx;
+            u32 data_count = (cur_nca_ctx->content_type == NcmContentType_Control ? ((u32)((NacpContext*)cur_nca_ctx->content_type_ctx)->icon_count + 1) : 1);
+
+            for(u32 j = 0; j < data_count; j++)
+            {
+                if (!pfsUpdateEntryNameFromImageContext(&pfs_img_ctx, data_idx + j, cur_nca_ctx->content_id_str))
+                {
+                    consolePrint("pfs update entry name failed for \"%s\" (%u)\n", cur_nca_ctx->content_id_str, j);
+                    goto end;
+                }
+            }
+        }
+
+        // write final pfs0 header to memory buffer
+        if (!pfsWriteImageContextHeaderToMemoryBuffer(&pfs_img_ctx, buf, BLOCK_SIZE, &nsp_header_size))
+        {
+            consolePrint("pfs write header to mem #2 failed\n");
+            goto end;
+        }
+    }
+
+    if (checkpoint)
+    {
+        // identify the source title, the dump options and the nca patch state. checkpoints are only used if all of them match
+        u32 options = ((u32)set_download_type | ((u32)remove_console_data << 1) | ((u32)remove_titlekey_crypto << 2) | ((u32)patch_sua << 3) | ((u32)patch_screenshot << 4) | \
+                       ((u32)patch_video_capture << 5) | ((u32)patch_hdcp << 6) | ((u32)generate_authoringtool_data << 7) | ((u32)sequential_output << 8) | (digest_mask << 9));
+        Sha256Context sha256_ctx = {0};
+
+        sha256ContextCreate(&sha256_ctx);
+        sha256ContextUpdate(&sha256_ctx, buf, nsp_header_size);
+        sha256ContextUpdate(&sha256_ctx, &options, sizeof(options));
+
+        for(u32 i = 0; i < title_info->content_count; i++)
+        {
+            NcaContext *cur_nca_ctx = &(nca_ctx[i]);
+            bool patch_state[2] = { ncaIsHeaderDirty(cur_nca_ctx), cur_nca_ctx->content_type_ctx_patch };
+
+            sha256ContextUpdate(&sha256_ctx, patch_state, sizeof(patch_state));
+            if (patch_state[0]) sha256ContextUpdate(&sha256_ctx, &(cur_nca_ctx->encrypted_header), sizeof(NcaHeader));
+        }
+
+        sha256ContextGetHash(&sha256_ctx, ckpt.source_hash);
+
+        ckpt.magic = NSP_CHECKPOINT_MAGIC;
+        ckpt.version = NSP_CHECKPOINT_VERSION;
+        ckpt.nsp_size = nsp_size;
+        ckpt.nca_count = title_info->content_count;
+    }
+
     if (dev_idx == 1)
     {
+        if (sequential_output)
+        {
+            // send the whole nsp as a regular file, starting with the pfs0 header
+            if (!usbSendFileProperties(nsp_size, filename) || !usbSendFileData(buf, nsp_header_size))
+            {
+                consolePrint("usb send nsp header failed\n");
+                goto end;
+            }
+        } else
         if (!usbSendNspProperties(nsp_size, filename, (u32)nsp_header_size))
         {
             consolePrint("usb send nsp properties failed\n");
             goto end;
         }
     } else {
-        if (nsp_size >= free_space)
+        // try to resume a previous dump using its checkpoint
+        if (nspLoadCheckpoint(ckpt_path, title_info->content_count, &resume_ckpt, ckpt_nca_states) && \
+            !memcmp(resume_ckpt.source_hash, ckpt.source_hash, SHA256_HASH_SIZE) && resume_ckpt.nsp_size == nsp_size && \
+            (resume_ckpt.nca_idx < title_info->content_count ? (resume_ckpt.nca_offset < nca_ctx[resume_ckpt.nca_idx].content_size) : !resume_ckpt.nca_offset) && \
+            (fp = fopen(filename, "rb+")))
         {
-            consolePrint("nsp size exceeds free space\n");
-            goto end;
-        }
+            setvbuf(fp, NULL, _IONBF, 0);
 
-        utilsCreateDirectoryTree(filename, false);
+            resumed = nspVerifyCheckpointOverlap(fp, &resume_ckpt, buf);
+            if (!resumed)
+            {
+                fclose(fp);
+                fp = NULL;
+            }
+        }
 
-        if (dev_idx == 0)
+        if (!resumed)
         {
-            if (nsp_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
+            // start over
+            nspRemoveCheckpoint(ckpt_path);
+            memset(ckpt_nca_states, 0, title_info->content_count * sizeof(NspCheckpointNcaState));
+
+            if (nsp_size >= free_space)
             {
-                consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
+                consolePrint("nsp size exceeds free space\n");
                 goto end;
             }
-        } else {
-            if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && nsp_size > FAT32_FILESIZE_LIMIT)
+
+            utilsCreateDirectoryTree(filename, false);
+
+            if (dev_idx == 0)
             {
-                consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                if (nsp_size > FAT32_FILESIZE_LIMIT && !utilsCreateConcatenationFile(filename))
+                {
+                    consolePrint("failed to create concatenation file for \"%s\"!\n", filename);
+                    goto end;
+                }
+            } else {
+                if (g_umsDevices[dev_idx - 2].fs_type < UsbHsFsDeviceFileSystemType_exFAT && nsp_size > FAT32_FILESIZE_LIMIT)
+                {
+                    consolePrint("split dumps not supported for FAT12/16/32 volumes in UMS devices (yet)\n");
+                    goto end;
+                }
+            }
+
+            if (!(fp = fopen(filename, "wb+")))
+            {
+                consolePrint("fopen failed\n");
                 goto end;
             }
-        }
 
-        if (!(fp = fopen(filename, "wb")))
-        {
-            consolePrint("fopen failed\n");
-            goto end;
-        }
+            // set file size
+            setvbuf(fp, NULL, _IONBF, 0);
+            ftruncate(fileno(fp), (off_t)nsp_size);
 
-        // set file size
-        setvbuf(fp, NULL, _IONBF, 0);
-        ftruncate(fileno(fp), (off_t)nsp_size);
+            // write placeholder header, or the final one if we're generating a sequential nsp
+            if (!sequential_output) memset(buf, 0, nsp_header_size);
 
-        // write placeholder header
-        memset(buf, 0, nsp_header_size);
-        fwrite(buf, 1, nsp_header_size, fp);
+            if (fwrite(buf, 1, nsp_header_size, fp) != nsp_header_size)
+            {
+                consolePrint("failed to write nsp header\n");
+                goto end;
+            }
+        }
     }
 
     consolePrint("dump process started, please wait. hold b to cancel.\n");
     consoleRefresh();
 
-    nsp_offset += nsp_header_size;
+    if (resumed)
+    {
+        consolePrint("resuming nsp dump at offset 0x%lX (nca #%u)\n", resume_ckpt.nsp_offset, resume_ckpt.nca_idx);
+        consoleRefresh();
+
+        // restore hashes, content ids and cnmt / pfs0 entries for all ncas written by the previous run
+        // the meta nca patch relies on them, so this must be done before starting the nca pipeline
+        for(u32 i = 0; i < resume_ckpt.nca_idx; i++)
+        {
+            memcpy(&(nca_digests[i]), &(ckpt_nca_states[i].dirty_digests), sizeof(MultiDigestResult));
+
+            if (!nspApplyNcaHash(&(nca_ctx[i]), i, &cnmt_ctx, &pfs_img_ctx, ckpt_nca_states[i].clean_hash, &(nca_digests[i]), sequential_output, \
+                                 (sequential_output && nca_hash_available[i]) ? nca_hashes[i] : NULL)) goto end;
+        }
+
+        // the partial dump is only kept from this point on
+        keep_partial_dump = true;
+
+        nsp_offset = resume_ckpt.nsp_offset;
+
+        // the pfs0 header is only accounted for once it has been written if we're not generating a sequential nsp
+        nsp_thread_data->data_written = (sequential_output ? nsp_offset : (nsp_offset - nsp_header_size));
+    } else {
+        nsp_offset += nsp_header_size;
+
+        if (sequential_output) nsp_thread_data->data_written += nsp_header_size;
+    }
 
     // set nsp size
     nsp_thread_data->total_size = nsp_size;
 
+    // start reading and hashing ncas in the background
+    // the meta nca patch has already been generated while precalculating hashes if we're generating a sequential nsp
+    if (!nspStartNcaPipeline(&nca_pipeline, nca_ctx, title_info->content_count, &cnmt_ctx, !sequential_output, nca_digests, digest_mask, resumed ? &resume_ckpt : NULL, checkpoint)) goto end;
+
     // write ncas
     for(u32 i = 0; i < title_info->content_count; i++)
     {
         NcaContext *cur_nca_ctx = &(nca_ctx[i]);
-        u64 blksize = BLOCK_SIZE;
-
-        sha256ContextCreate(&clean_sha256_ctx);
-        sha256ContextCreate(&dirty_sha256_ctx);
+        u64 blksize = 0, start_offset = 0;
 
-        if (cur_nca_ctx->content_type == NcmContentType_Meta && (!cnmtGenerateNcaPatch(&cnmt_ctx) || !ncaEncryptHeader(cur_nca_ctx)))
+        if (resumed)
         {
-            consolePrint("cnmt generate patch failed\n");
-            goto end;
+            // skip ncas written by the previous run
+            if (i < resume_ckpt.nca_idx) continue;
+            if (i == resume_ckpt.nca_idx) start_offset = resume_ckpt.nca_offset;
         }
 
-        bool dirty_header = ncaIsHeaderDirty(cur_nca_ctx);
-
-        if (dev_idx == 1)
+        if (dev_idx == 1 && !sequential_output)
         {
             tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, i);
             if (!usbSendFileProperties(cur_nca_ctx->content_size, tmp_name))
@@ -6651,7 +8220,7 @@ static void nspThreadFunc(void *arg)
             }
         }
 
-        for(u64 offset = 0; offset < cur_nca_ctx->content_size; offset += blksize, nsp_offset += blksize, nsp_thread_data->data_written += blksize)
+        for(u64 offset = start_offset; offset < cur_nca_ctx->content_size; offset += blksize, nsp_offset += blksize, nsp_thread_data->data_written += blksize)
         {
             mutexLock(&g_fileMutex);
             bool cancelled = nsp_thread_data->transfer_cancelled;
@@ -6659,100 +8228,81 @@ static void nspThreadFunc(void *arg)
 
             if (cancelled) goto end;
 
-            if ((cur_nca_ctx->content_size - offset) < blksize) blksize = (cur_nca_ctx->content_size - offset);
-
-            // read nca chunk
-            if (!ncaReadContentFile(cur_nca_ctx, buf, blksize, offset))
+            // get the next nca chunk, already patched and hashed
+            const NspNcaBlockCheckpoint *block_ckpt = NULL;
+            const void *block = nspAcquireNcaPipelineBlock(&nca_pipeline, i, &blksize, &block_ckpt);
+            if (!block)
             {
-                consolePrint("nca read failed at 0x%lX for \"%s\"\n", offset, cur_nca_ctx->content_id_str);
+                consolePrint("nca processing failed at 0x%lX for \"%s\"\n", offset, cur_nca_ctx->content_id_str);
                 goto end;
             }
 
-            // update clean hash calculation
-            sha256ContextUpdate(&clean_sha256_ctx, buf, blksize);
-
-            if ((offset + blksize) >= cur_nca_ctx->content_size)
+            // write nca chunk
+            if (dev_idx == 1)
             {
-                // get clean hash
-                sha256ContextGetHash(&clean_sha256_ctx, clean_sha256_hash);
-
-                // validate clean hash
-                if (!cnmtVerifyContentHash(&cnmt_ctx, cur_nca_ctx, clean_sha256_hash))
+                if (!usbSendFileData(block, blksize))
                 {
-                    consolePrint("sha256 checksum mismatch for nca \"%s\"\nplease check for corrupted data using the data management menu\n", cur_nca_ctx->content_id_str);
+                    consolePrint("send file data failed\n");
                     goto end;
                 }
+            } else {
+                fwrite(block, 1, blksize, fp);
             }
 
-            if (dirty_header)
+            // save a checkpoint if one is due right after this block. failing to do so isn't considered a fatal error
+            if (block_ckpt)
             {
-                // write re-encrypted headers
-                if (!cur_nca_ctx->header_written) ncaWriteEncryptedHeaderDataToMemoryBuffer(cur_nca_ctx, buf, blksize, offset);
-
-                if (cur_nca_ctx->content_type_ctx_patch)
-                {
-                    // write content type context patch
-                    switch(cur_nca_ctx->content_type)
-                    {
-                        case NcmContentType_Meta:
-                            cnmtWriteNcaPatch(&cnmt_ctx, buf, blksize, offset);
-                            break;
-                        case NcmContentType_Control:
-                            nacpWriteNcaPatch((NacpContext*)cur_nca_ctx->content_type_ctx, buf, blksize, offset);
-                            break;
-                        default:
-                            break;
-                    }
-                }
-
-                // update flag to avoid entering this code block if it's not needed anymore
-                dirty_header = (!cur_nca_ctx->header_written || cur_nca_ctx->content_type_ctx_patch);
+                ckpt.nsp_offset = (nsp_offset + blksize);
+                ckpt.nca_idx = i;
+                ckpt.nca_offset = (offset + blksize);
+                memcpy(&(ckpt.digest_state), &(block_ckpt->digest_state), sizeof(MultiDigestState));
+                memcpy(&(ckpt.clean_sha256_ctx), &(block_ckpt->clean_sha256_ctx), sizeof(Sha256Context));
+                ckpt.clean_forked = block_ckpt->clean_forked;
+
+                if (nspSaveCheckpoint(fp, ckpt_path, &ckpt, ckpt_nca_states, buf)) keep_partial_dump = true;
             }
 
-            // update dirty hash calculation
-            sha256ContextUpdate(&dirty_sha256_ctx, buf, blksize);
+            nspReleaseNcaPipelineBlock(&nca_pipeline, i);
+        }
 
-            // write nca chunk
-            if (dev_idx == 1)
-            {
-                if (!usbSendFileData(buf, blksize))
-                {
-                    consolePrint("send file data failed\n");
-                    goto end;
-                }
-            } else {
-                fwrite(buf, 1, blksize, fp);
-            }
+        // get clean hash (the dirty hash is saved to nca_digests by the worker)
+        if (!nspWaitForNcaPipelineHash(&nca_pipeline, i, clean_sha256_hash))
+        {
+            consolePrint("nca hash calculation failed for \"%s\"\n", cur_nca_ctx->content_id_str);
+            goto end;
         }
 
-        // get dirty hash
-        sha256ContextGetHash(&dirty_sha256_ctx, dirty_sha256_hash);
+        // validate clean hash, then update content id, cnmt and pfs0 entry if needed
+        if (!nspApplyNcaHash(cur_nca_ctx, i, &cnmt_ctx, &pfs_img_ctx, clean_sha256_hash, &(nca_digests[i]), sequential_output, \
+                             (sequential_output && nca_hash_available[i]) ? nca_hashes[i] : NULL)) goto end;
 
-        if (memcmp(clean_sha256_hash, dirty_sha256_hash, SHA256_HASH_SIZE) != 0)
-        {
-            // update content id and hash
-            ncaUpdateContentIdAndHash(cur_nca_ctx, dirty_sha256_hash);
+        // the worker for the meta nca may now proceed if this was the last nca before it
+        nspSetNcaPipelineNcaDone(&nca_pipeline, i);
 
-            // update cnmt
-            if (!cnmtUpdateContentInfo(&cnmt_ctx, cur_nca_ctx))
-            {
-                consolePrint("cnmt update content info failed\n");
-                goto end;
-            }
+        if (checkpoint)
+        {
+            // save a checkpoint right after each nca. failing to do so isn't considered a fatal error
+            memcpy(&(ckpt_nca_states[i].dirty_digests), &(nca_digests[i]), sizeof(MultiDigestResult));
+            memcpy(ckpt_nca_states[i].clean_hash, clean_sha256_hash, SHA256_HASH_SIZE);
 
-            // update pfs entry name
-            if (!pfsUpdateEntryNameFromImageContext(&pfs_img_ctx, i, cur_nca_ctx->content_id_str))
+            if (nsp_offset < nsp_size)
             {
-                consolePrint("pfs update entry name failed for nca \"%s\"\n", cur_nca_ctx->content_id_str);
-                goto end;
+                ckpt.nsp_offset = nsp_offset;
+                ckpt.nca_idx = (i + 1);
+                ckpt.nca_offset = 0;
+                memset(&(ckpt.digest_state), 0, sizeof(MultiDigestState));
+                memset(&(ckpt.clean_sha256_ctx), 0, sizeof(Sha256Context));
+                ckpt.clean_forked = false;
+
+                if (nspSaveCheckpoint(fp, ckpt_path, &ckpt, ckpt_nca_states, buf)) keep_partial_dump = true;
             }
         }
     }
 
     if (generate_authoringtool_data)
     {
-        // regenerate cnmt xml
-        if (!cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
+        // regenerate cnmt xml (already done if we're generating a sequential nsp)
+        if (!sequential_output && !cnmtGenerateAuthoringToolXml(&cnmt_ctx, nca_ctx, title_info->content_count))
         {
             consolePrint("cnmt xml #2 failed\n");
             goto end;
@@ -6762,7 +8312,7 @@ static void nspThreadFunc(void *arg)
         if (dev_idx == 1)
         {
             tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, meta_nca_ctx->content_type_ctx_data_idx);
-            if (!usbSendFileProperties(cnmt_ctx.authoring_tool_xml_size, tmp_name) || !usbSendFileData(cnmt_ctx.authoring_tool_xml, cnmt_ctx.authoring_tool_xml_size))
+            if ((!sequential_output && !usbSendFileProperties(cnmt_ctx.authoring_tool_xml_size, tmp_name)) || !usbSendFileData(cnmt_ctx.authoring_tool_xml, cnmt_ctx.authoring_tool_xml_size))
             {
                 consolePrint("send \"%s\" failed\n", tmp_name);
                 goto end;
@@ -6816,7 +8366,7 @@ static void nspThreadFunc(void *arg)
                     if (dev_idx == 1)
                     {
                         tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, data_idx);
-                        if (!usbSendFileProperties(icon_ctx->icon_size, tmp_name) || !usbSendFileData(icon_ctx->icon_data, icon_ctx->icon_size))
+                        if ((!sequential_output && !usbSendFileProperties(icon_ctx->icon_size, tmp_name)) || !usbSendFileData(icon_ctx->icon_data, icon_ctx->icon_size))
                         {
                             consolePrint("send \"%s\" failed\n", tmp_name);
                             goto end;
@@ -6853,7 +8403,7 @@ static void nspThreadFunc(void *arg)
         if (dev_idx == 1)
         {
             tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, data_idx);
-            if (!usbSendFileProperties(authoring_tool_xml_size, tmp_name) || !usbSendFileData(authoring_tool_xml, authoring_tool_xml_size))
+            if ((!sequential_output && !usbSendFileProperties(authoring_tool_xml_size, tmp_name)) || !usbSendFileData(authoring_tool_xml, authoring_tool_xml_size))
             {
                 consolePrint("send \"%s\" failed\n", tmp_name);
                 goto end;
@@ -6879,7 +8429,7 @@ static void nspThreadFunc(void *arg)
         if (dev_idx == 1)
         {
             tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, pfs_img_ctx.header.entry_count - 2);
-            if (!usbSendFileProperties(tik.size, tmp_name) || !usbSendFileData(tik.data, tik.size))
+            if ((!sequential_output && !usbSendFileProperties(tik.size, tmp_name)) || !usbSendFileData(tik.data, tik.size))
             {
                 consolePrint("send \"%s\" failed\n", tmp_name);
                 goto end;
@@ -6895,7 +8445,7 @@ static void nspThreadFunc(void *arg)
         if (dev_idx == 1)
         {
             tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, pfs_img_ctx.header.entry_count - 1);
-            if (!usbSendFileProperties(raw_cert_chain_size, tmp_name) || !usbSendFileData(raw_cert_chain, raw_cert_chain_size))
+            if ((!sequential_output && !usbSendFileProperties(raw_cert_chain_size, tmp_name)) || !usbSendFileData(raw_cert_chain, raw_cert_chain_size))
             {
                 consolePrint("send \"%s\" failed\n", tmp_name);
                 goto end;
@@ -6908,32 +8458,74 @@ static void nspThreadFunc(void *arg)
         nsp_thread_data->data_written += raw_cert_chain_size;
     }
 
-    // write new pfs0 header
-    if (!pfsWriteImageContextHeaderToMemoryBuffer(&pfs_img_ctx, buf, BLOCK_SIZE, &nsp_header_size))
-    {
-        consolePrint("pfs write header to mem #2 failed\n");
-        goto end;
-    }
-
-    if (dev_idx == 1)
+    if (!sequential_output)
     {
-        if (!usbSendNspHeader(buf, (u32)nsp_header_size))
+        // write new pfs0 header
+        if (!pfsWriteImageContextHeaderToMemoryBuffer(&pfs_img_ctx, buf, BLOCK_SIZE, &nsp_header_size))
         {
-            consolePrint("send nsp header failed\n");
+            consolePrint("pfs write header to mem #3 failed\n");
             goto end;
         }
-    } else {
-        rewind(fp);
-        fwrite(buf, 1, nsp_header_size, fp);
-    }
 
-    nsp_thread_data->data_written += nsp_header_size;
+        if (dev_idx == 1)
+        {
+            if (!usbSendNspHeader(buf, (u32)nsp_header_size))
+            {
+                consolePrint("send nsp header failed\n");
+                goto end;
+            }
+        } else {
+            rewind(fp);
+            fwrite(buf, 1, nsp_header_size, fp);
+        }
+
+        nsp_thread_data->data_written += nsp_header_size;
+    }
 
     success = true;
 
+    // save nca digest report, if requested
+    if (fp)
+    {
+        fclose(fp);
+        fp = NULL;
+    }
+
+    for(u32 i = 0; generate_digest_report && i < title_info->content_count; i++)
+    {
+        tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, i);
+        if (!appendDigestReport(&digest_report, &digest_report_size, &(nca_digests[i]), tmp_name, nca_ctx[i].content_size)) break;
+        if ((i + 1) == title_info->content_count) saveDigestReport(filename, digest_report);
+    }
+
+    // look up nca checksums in the offline checksum database
+    // dat files for digital titles list individual ncas, so the dirty digests (the ones from the data we actually wrote) are used
+    // modified ncas won't ever match, since their data no longer matches the original content
+    if (lookup_checksum)
+    {
+        char dat_name[0x200] = {0};
+
+        for(u32 i = 0; i < title_info->content_count; i++)
+        {
+            tmp_name = pfsGetEntryNameByIndexFromImageContext(&pfs_img_ctx, i);
+
+            if (checksumDbLookup(nca_digests[i].crc32, nca_ctx[i].content_size, nca_digests[i].sha1, dat_name, sizeof(dat_name)))
+            {
+                consolePrint("dat match for \"%s\": %s\n", tmp_name, dat_name);
+            } else {
+                consolePrint("no dat match for \"%s\"\n", tmp_name);
+            }
+        }
+    }
+
 end:
     consoleRefresh();
 
+    // stop nca workers before freeing any of the data they use
+    nspFreeNcaPipeline(&nca_pipeline);
+
+    nspFreePrepareContext(&prepare_ctx);
+
     mutexLock(&g_fileMutex);
     if (!success && !nsp_thread_data->transfer_cancelled) nsp_thread_data->error = true;
     mutexUnlock(&g_fileMutex);
@@ -6942,6 +8534,10 @@ end:
     {
         fclose(fp);
 
+        if (!success && keep_partial_dump)
+        {
+            consolePrint("partial dump kept. it will be resumed the next time this title is dumped using the same options\n");
+        } else
         if (!success)
         {
             if (dev_idx == 0)
@@ -6956,6 +8552,14 @@ end:
 
     if (!success && dev_idx == 1) usbCancelFileTransfer();
 
+    if (ckpt_path)
+    {
+        if (success || !keep_partial_dump) nspRemoveCheckpoint(ckpt_path);
+        free(ckpt_path);
+    }
+
+    if (ckpt_nca_states) free(ckpt_nca_states);
+
     pfsFreeImageContext(&pfs_img_ctx);
 
     if (raw_cert_chain) free(raw_cert_chain);
@@ -6980,6 +8584,14 @@ end:
 
     cnmtFreeContext(&cnmt_ctx);
 
+    if (digest_report) free(digest_report);
+
+    if (nca_hash_available) free(nca_hash_available);
+
+    if (nca_hashes) free(nca_hashes);
+
+    if (nca_digests) free(nca_digests);
+
     if (nca_ctx) free(nca_ctx);
 
     if (filename) free(filename);
@@ -7129,6 +8741,36 @@ static void setNspGenerateAuthoringToolDataOption(u32 idx)
     configSetBoolean("nsp/generate_authoringtool_data", (bool)idx);
 }
 
+static u32 getNspSequentialOutputOption(void)
+{
+    return (u32)configGetBoolean("nsp/sequential_output");
+}
+
+static void setNspSequentialOutputOption(u32 idx)
+{
+    configSetBoolean("nsp/sequential_output", (bool)idx);
+}
+
+static u32 getNspLookupChecksumOption(void)
+{
+    return (u32)configGetBoolean("nsp/lookup_checksum");
+}
+
+static void setNspLookupChecksumOption(u32 idx)
+{
+    configSetBoolean("nsp/lookup_checksum", (bool)idx);
+}
+
+static u32 getNspGenerateDigestReportOption(void)
+{
+    return (u32)configGetBoolean("nsp/generate_digest_report");
+}
+
+static void setNspGenerateDigestReportOption(u32 idx)
+{
+    configSetBoolean("nsp/generate_digest_report", (bool)idx);
+}
+
 static u32 getTicketRemoveConsoleDataOption(void)
 {
     return (u32)configGetBoolean("ticket/remove_console_data");
@@ -0,0 +1,68 @@
+    /* Start the host script with '--no-compression'. LZ4 frames are never split, so transfer chunk sizes don't apply to them. */
+    u8 usb_speed = usbIsReady();
+    if (usb_speed != UsbHostSpeed_None)
+    {
+        mkdir("sdmc:/records", 0777);
+
+        /* Full Speed transfers are way too slow to push 512 MiB through them multiple times. */
+        const size_t blksize = USB_TRANSFER_BUFFER_SIZE, blkcount = (usb_speed == UsbHostSpeed_FullSpeed ? 4 : 64); /* 32 MiB / 512 MiB. */
+        const u32 chunk_sizes[] = { 0x10000, 0x40000, 0x100000, 0x200000, 0x400000, 0x800000, 0 }; /* Zero: adaptive. */
+        const char *usb_speed_strs[] = { "None", "Full Speed (USB 1.x)", "High Speed (USB 2.0)", "SuperSpeed (USB 3.0)" };
+
+        FILE *bench_txt = NULL;
+        u8 *bench_buf = usbAllocatePageAlignedBuffer(blksize);
+
+        if (bench_buf)
+        {
+            for(size_t i = 0; i < blksize; i++) bench_buf[i] = (u8)rand();
+
+            bench_txt = fopen("sdmc:/records/usb_chunk_benchmark.txt", "wb");
+        }
+
+        if (bench_txt)
+        {
+            fprintf(bench_txt, "Link speed: %s\r\n", usb_speed_strs[usb_speed]);
+            fprintf(bench_txt, "Input: %lu MiB (%lu blocks, 0x%lX bytes each)\r\n\r\n", (blksize * blkcount) / 0x100000, blkcount, blksize);
+            fprintf(bench_txt, "| Chunk size | Throughput |\r\n");
+            fprintf(bench_txt, "|------------|------------|\r\n");
+
+            for(u32 i = 0; i < MAX_ELEMENTS(chunk_sizes); i++)
+            {
+                size_t j = 0;
+
+                if (!usbSetTransferChunkSizeBounds(chunk_sizes[i], chunk_sizes[i]) || !usbSendFileProperties(blksize * blkcount, "/usb_chunk_benchmark.bin")) break;
+
+                u64 start_tick = armGetSystemTick();
+
+                for(j = 0; j < blkcount; j++)
+                {
+                    if (!usbSendFileData(bench_buf, blksize)) break;
+                }
+
+                u64 elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+                /* usbSendFileData() resets the transfer state on its own if an error occurs. */
+                if (j < blkcount) break;
+
+                u64 throughput = (u64)(((double)(blksize * blkcount) * 1000000000.0) / (double)elapsed_ns) / 0x100000;
+
+                if (chunk_sizes[i])
+                {
+                    fprintf(bench_txt, "| 0x%08X | %lu MiB/s |\r\n", chunk_sizes[i], throughput);
+                } else {
+                    fprintf(bench_txt, "| Adaptive (0x%08X at the end) | %lu MiB/s |\r\n", usbGetTransferChunkSize(), throughput);
+                }
+
+                fflush(bench_txt);
+            }
+
+            /* Restore default bounds. */
+            usbSetTransferChunkSizeBounds(0, 0);
+
+            fclose(bench_txt);
+            bench_txt = NULL;
+            utilsCommitSdCardFileSystemChanges();
+        }
+
+        if (bench_buf) free(bench_buf);
+    }
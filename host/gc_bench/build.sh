@@ -0,0 +1,19 @@
+#!/bin/sh
+
+# Builds the gamecard image benchmark harness for the current (Linux) host, using the real gamecard.c and hfs.c from the application.
+# Requires OpenSSL's libcrypto, which stands in for the libnx crypto functions.
+
+cd "$(dirname "$0")" || exit 1
+
+ROOT_DIR="../.."
+
+VERSION_MAJOR="$(sed -n 's/^VERSION_MAJOR[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+VERSION_MINOR="$(sed -n 's/^VERSION_MINOR[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+VERSION_MICRO="$(sed -n 's/^VERSION_MICRO[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+GIT_COMMIT="$(git rev-parse --short HEAD 2>/dev/null || echo unknown)"
+
+${CC:-cc} -std=gnu11 -O2 -march=native -pthread -Wall -Wextra -Wno-unused-parameter -Wno-sign-compare -Wno-missing-field-initializers \
+    -DAPP_TITLE=\"nxdumptool\" -DVERSION_MAJOR="${VERSION_MAJOR:-2}" -DVERSION_MINOR="${VERSION_MINOR:-0}" -DVERSION_MICRO="${VERSION_MICRO:-0}" \
+    -DGIT_COMMIT=\"$GIT_COMMIT\" -Icompat -I../usb_bench/compat -I"$ROOT_DIR/include" \
+    "$ROOT_DIR/source/core/gamecard.c" "$ROOT_DIR/source/core/hfs.c" ../usb_bench/compat/compat.c compat/gc_compat.c gc_bench.c \
+    -lcrypto -o gc_bench "$@"
@@ -0,0 +1,150 @@
+/*
+ * nxdt_utils.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// Linux stand-in for the real nxdt_utils.h, used to build gamecard.c and hfs.c outside of the Switch.
+/// Extends the usb_bench stand-in with the FS service, crypto and system definitions needed by the gamecard interface.
+/// FS services behave as if no gamecard is inserted, so gamecard images mounted through gamecardMountImageFile() are the only data source.
+
+#pragma once
+
+#ifndef __GC_BENCH_NXDT_UTILS_H__
+#define __GC_BENCH_NXDT_UTILS_H__
+
+#include_next <core/nxdt_utils.h>
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BITL(n)             (1UL << (n))
+
+#define SHA256_HASH_SIZE    0x20
+#define AES_128_KEY_SIZE    0x10
+
+#include <core/hos_version_structs.h>
+
+/// Used to determine which CFW is the application running under.
+typedef enum {
+    UtilsCustomFirmwareType_Unknown    = 0,
+    UtilsCustomFirmwareType_Atmosphere = 1,
+    UtilsCustomFirmwareType_SXOS       = 2,
+    UtilsCustomFirmwareType_ReiNX      = 3,
+    UtilsCustomFirmwareType_Count      = 4  ///< Total values supported by this enum.
+} UtilsCustomFirmwareType;
+
+/* libnx services. None of them are ever active. */
+
+typedef struct {
+    bool active;
+} Service;
+
+typedef struct {
+    Service s;
+} FsStorage;
+
+typedef struct {
+    Service s;
+} FsEventNotifier;
+
+typedef struct {
+    Service s;
+} FsDeviceOperator;
+
+typedef struct {
+    u32 value;
+} FsGameCardHandle;
+
+NX_INLINE bool serviceIsActive(Service *s)
+{
+    return s->active;
+}
+
+/// Always returns true, but never reports an inserted gamecard.
+Result fsOpenDeviceOperator(FsDeviceOperator *out);
+Result fsDeviceOperatorIsGameCardInserted(FsDeviceOperator *d, bool *out);
+Result fsDeviceOperatorGetGameCardHandle(FsDeviceOperator *d, FsGameCardHandle *out);
+Result fsDeviceOperatorGetGameCardIdSet(FsDeviceOperator *d, void *dst, size_t dst_size, s64 size);
+Result fsDeviceOperatorGetGameCardDeviceCertificate(FsDeviceOperator *d, const FsGameCardHandle *handle, void *dst, size_t dst_size, s64 size);
+Result fsDeviceOperatorUpdatePartitionInfo(FsDeviceOperator *d, const FsGameCardHandle *handle, u32 *out_title_version, u64 *out_title_id);
+void fsDeviceOperatorClose(FsDeviceOperator *d);
+
+Result fsOpenGameCardDetectionEventNotifier(FsEventNotifier *out);
+Result fsEventNotifierGetEventHandle(FsEventNotifier *e, Event *out, bool autoclear);
+void fsEventNotifierClose(FsEventNotifier *e);
+
+Result fsOpenGameCardStorage(FsStorage *out, const FsGameCardHandle *handle, u32 partition);
+Result fsStorageRead(FsStorage *s, s64 off, void *buf, u64 read_size);
+Result fsStorageGetSize(FsStorage *s, s64 *out);
+void fsStorageClose(FsStorage *s);
+
+NX_INLINE void eventClose(Event *t)
+{
+    eventClear(t);
+}
+
+NX_INLINE void svcSleepThread(s64 nano)
+{
+    struct timespec ts = { (time_t)(nano / 1000000000), (long)(nano % 1000000000) };
+    nanosleep(&ts, NULL);
+}
+
+/* System information. The host is treated as a retail unit running Atmosphère. */
+
+NX_INLINE bool utilsIsDevelopmentUnit(void)
+{
+    return false;
+}
+
+NX_INLINE u8 utilsGetCustomFirmwareType(void)
+{
+    return UtilsCustomFirmwareType_Atmosphere;
+}
+
+NX_INLINE void utilsAppletLoopDelay(void)
+{
+    svcSleepThread(THIRTY_FPS_DELAY);
+}
+
+/* Crypto. Backed by OpenSSL's libcrypto. */
+
+typedef struct {
+    u8 key[AES_128_KEY_SIZE];
+    u8 iv[AES_128_KEY_SIZE];
+    bool is_encryptor;
+} Aes128CbcContext;
+
+void aes128CbcContextCreate(Aes128CbcContext *out, const void *key, const void *iv, bool is_encryptor);
+void aes128CbcDecrypt(Aes128CbcContext *ctx, void *dst, const void *src, size_t size);
+
+void sha256CalculateHash(void *dst, const void *src, size_t size);
+
+/// Sets the AES-128-CBC CardInfo area key returned by keysGetGameCardInfoKey(). A zeroed key is used by default.
+void compatSetGameCardInfoKey(const u8 *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GC_BENCH_NXDT_UTILS_H__ */
@@ -0,0 +1,218 @@
+/*
+ * gc_compat.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <core/nxdt_utils.h>
+#include <core/mem.h>
+#include <core/keys.h>
+#include <core/rsa.h>
+#include <core/gamecard.h>
+
+#include <openssl/evp.h>
+
+#define LAFW_MAGIC  0x4C414657  /* "LAFW". */
+
+/* Global variables. */
+
+static u8 g_compatGameCardInfoKey[AES_128_KEY_SIZE] = {0};
+
+/* FS device operator. No gamecard is ever reported as inserted. */
+
+Result fsOpenDeviceOperator(FsDeviceOperator *out)
+{
+    out->s.active = true;
+    return 0;
+}
+
+Result fsDeviceOperatorIsGameCardInserted(FsDeviceOperator *d, bool *out)
+{
+    NX_IGNORE_ARG(d);
+    *out = false;
+    return 0;
+}
+
+Result fsDeviceOperatorGetGameCardHandle(FsDeviceOperator *d, FsGameCardHandle *out)
+{
+    NX_IGNORE_ARG(d);
+    NX_IGNORE_ARG(out);
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+Result fsDeviceOperatorGetGameCardIdSet(FsDeviceOperator *d, void *dst, size_t dst_size, s64 size)
+{
+    NX_IGNORE_ARG(d);
+    NX_IGNORE_ARG(dst);
+    NX_IGNORE_ARG(dst_size);
+    NX_IGNORE_ARG(size);
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+Result fsDeviceOperatorGetGameCardDeviceCertificate(FsDeviceOperator *d, const FsGameCardHandle *handle, void *dst, size_t dst_size, s64 size)
+{
+    NX_IGNORE_ARG(d);
+    NX_IGNORE_ARG(handle);
+    NX_IGNORE_ARG(dst);
+    NX_IGNORE_ARG(dst_size);
+    NX_IGNORE_ARG(size);
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+Result fsDeviceOperatorUpdatePartitionInfo(FsDeviceOperator *d, const FsGameCardHandle *handle, u32 *out_title_version, u64 *out_title_id)
+{
+    NX_IGNORE_ARG(d);
+    NX_IGNORE_ARG(handle);
+    NX_IGNORE_ARG(out_title_version);
+    NX_IGNORE_ARG(out_title_id);
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+void fsDeviceOperatorClose(FsDeviceOperator *d)
+{
+    d->s.active = false;
+}
+
+/* FS gamecard detection event notifier. The returned event is never signaled. */
+
+Result fsOpenGameCardDetectionEventNotifier(FsEventNotifier *out)
+{
+    out->s.active = true;
+    return 0;
+}
+
+Result fsEventNotifierGetEventHandle(FsEventNotifier *e, Event *out, bool autoclear)
+{
+    NX_IGNORE_ARG(e);
+    eventCreate(out, autoclear);
+    return 0;
+}
+
+void fsEventNotifierClose(FsEventNotifier *e)
+{
+    e->s.active = false;
+}
+
+/* FS gamecard storage. Never available. */
+
+Result fsOpenGameCardStorage(FsStorage *out, const FsGameCardHandle *handle, u32 partition)
+{
+    NX_IGNORE_ARG(out);
+    NX_IGNORE_ARG(handle);
+    NX_IGNORE_ARG(partition);
+    return MAKERESULT(Module_Libnx, LibnxError_NotFound);
+}
+
+Result fsStorageRead(FsStorage *s, s64 off, void *buf, u64 read_size)
+{
+    NX_IGNORE_ARG(s);
+    NX_IGNORE_ARG(off);
+    NX_IGNORE_ARG(buf);
+    NX_IGNORE_ARG(read_size);
+    return MAKERESULT(Module_Libnx, LibnxError_IoError);
+}
+
+Result fsStorageGetSize(FsStorage *s, s64 *out)
+{
+    NX_IGNORE_ARG(s);
+    NX_IGNORE_ARG(out);
+    return MAKERESULT(Module_Libnx, LibnxError_IoError);
+}
+
+void fsStorageClose(FsStorage *s)
+{
+    s->s.active = false;
+}
+
+/* FS program memory. The .data segment holds a single LAFW ReadFw blob, which is all gamecardInitialize() needs. */
+
+bool memRetrieveProgramMemorySegment(MemoryLocation *location)
+{
+    if (!location || location->program_id != FS_SYSMODULE_TID || !(location->mask & MemoryProgramSegmentType_Data)) return false;
+
+    LotusAsicFirmwareBlob *lafw_blob = calloc(1, sizeof(LotusAsicFirmwareBlob));
+    if (!lafw_blob) return false;
+
+    lafw_blob->magic = __builtin_bswap32(LAFW_MAGIC);
+    lafw_blob->fw_type = LotusAsicFirmwareType_ReadFw;
+    lafw_blob->device_type = LotusAsicDeviceType_Prod;
+
+    location->data = (u8*)lafw_blob;
+    location->data_size = sizeof(LotusAsicFirmwareBlob);
+
+    return true;
+}
+
+bool memRetrieveFullProgramMemory(MemoryLocation *location)
+{
+    NX_IGNORE_ARG(location);
+    LOG_MSG_ERROR("FS program memory isn't available on this host!");
+    return false;
+}
+
+/* Keys. */
+
+void compatSetGameCardInfoKey(const u8 *key)
+{
+    memcpy(g_compatGameCardInfoKey, key, AES_128_KEY_SIZE);
+}
+
+const u8 *keysGetGameCardInfoKey(void)
+{
+    return g_compatGameCardInfoKey;
+}
+
+/* Crypto. */
+
+void aes128CbcContextCreate(Aes128CbcContext *out, const void *key, const void *iv, bool is_encryptor)
+{
+    memcpy(out->key, key, AES_128_KEY_SIZE);
+    memcpy(out->iv, iv, AES_128_KEY_SIZE);
+    out->is_encryptor = is_encryptor;
+}
+
+void aes128CbcDecrypt(Aes128CbcContext *ctx, void *dst, const void *src, size_t size)
+{
+    EVP_CIPHER_CTX *cipher_ctx = EVP_CIPHER_CTX_new();
+    int out_size = 0;
+
+    if (!cipher_ctx || !EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL, ctx->key, ctx->iv) || !EVP_CIPHER_CTX_set_padding(cipher_ctx, 0) || \
+        !EVP_DecryptUpdate(cipher_ctx, dst, &out_size, src, (int)size)) LOG_MSG_ERROR("AES-128-CBC decryption failed!");
+
+    /* Keep the IV chained for subsequent calls, just like libnx does. */
+    if (size >= AES_128_KEY_SIZE) memcpy(ctx->iv, (const u8*)src + size - AES_128_KEY_SIZE, AES_128_KEY_SIZE);
+
+    if (cipher_ctx) EVP_CIPHER_CTX_free(cipher_ctx);
+}
+
+void sha256CalculateHash(void *dst, const void *src, size_t size)
+{
+    if (!EVP_Digest(src, size, dst, NULL, EVP_sha256(), NULL)) LOG_MSG_ERROR("SHA-256 calculation failed!");
+}
+
+bool rsa2048VerifySha256BasedPkcs1v15Signature(const void *data, size_t data_size, const void *signature, const void *modulus, const void *public_exponent, size_t public_exponent_size)
+{
+    NX_IGNORE_ARG(data);
+    NX_IGNORE_ARG(data_size);
+    NX_IGNORE_ARG(signature);
+    NX_IGNORE_ARG(modulus);
+    NX_IGNORE_ARG(public_exponent);
+    NX_IGNORE_ARG(public_exponent_size);
+    LOG_MSG_ERROR("RSA signature verification isn't available on this host!");
+    return false;
+}
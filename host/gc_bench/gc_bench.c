@@ -0,0 +1,490 @@
+/*
+ * gc_bench.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Runs the gamecard interface from gamecard.c and hfs.c on Linux, on top of the gamecard image file backend, and measures it. */
+/* An XCI image is mounted with gamecardMountImageFile(), its Hash FS partitions are listed, an entry can be extracted and a full image dump is timed. */
+
+#include <core/nxdt_utils.h>
+#include <core/gamecard.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+
+#define BENCH_DEFAULT_CHUNK_SIZE    0x800000    /* 8 MiB. */
+#define BENCH_STATUS_TIMEOUT        5000000000  /* Nanoseconds. */
+
+/* Type definitions. */
+
+typedef struct {
+    const char *image_path;
+    u8 card_info_key[AES_128_KEY_SIZE];
+    u8 extract_partition;       ///< HashFileSystemPartitionType.
+    const char *extract_name;
+    const char *extract_path;   ///< NULL: use the entry name.
+    const char *dump_path;      ///< NULL: discard dump data.
+    u64 chunk_size;
+    bool trimmed;
+    u8 log_level;
+} BenchOptions;
+
+/* Global variables. */
+
+static BenchOptions g_benchOptions = {
+    .image_path = NULL,
+    .card_info_key = {0},
+    .extract_partition = HashFileSystemPartitionType_Secure,
+    .extract_name = NULL,
+    .extract_path = NULL,
+    .dump_path = NULL,
+    .chunk_size = BENCH_DEFAULT_CHUNK_SIZE,
+    .trimmed = false,
+    .log_level = LOG_LEVEL_WARNING
+};
+
+static u8 *g_benchBuffer = NULL;
+
+/* Function prototypes. */
+
+static void benchPrintUsage(const char *argv0);
+static bool benchParseOptions(int argc, char **argv);
+static bool benchParseKey(const char *str, u8 *out);
+static bool benchLoadKeyFromFile(const char *path, u8 *out);
+static u8 benchGetPartitionTypeByName(const char *name);
+
+static bool benchWaitForStatusChange(void);
+
+static void benchPrintImageInfo(void);
+static void benchListPartitions(void);
+static bool benchExtractEntry(void);
+static bool benchDumpImage(void);
+
+static void benchPrintThroughput(const char *label, u64 size, u64 elapsed_ns);
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    bool gc_init = false, mounted = false;
+    u64 start_tick = 0, mount_ns = 0;
+
+    if (!benchParseOptions(argc, argv)) goto end;
+
+    compatSetLogLevel(g_benchOptions.log_level);
+    compatSetGameCardInfoKey(g_benchOptions.card_info_key);
+
+    /* Allocate data buffer. */
+    g_benchBuffer = malloc(g_benchOptions.chunk_size);
+    if (!g_benchBuffer)
+    {
+        fprintf(stderr, "Failed to allocate data buffer!\n");
+        goto end;
+    }
+
+    /* Initialize gamecard interface and wait for the detection thread to report the initial (empty) slot status. */
+    gc_init = gamecardInitialize();
+    if (!gc_init)
+    {
+        fprintf(stderr, "Failed to initialize gamecard interface!\n");
+        goto end;
+    }
+
+    if (!benchWaitForStatusChange()) goto end;
+
+    /* Mount gamecard image file. */
+    start_tick = armGetSystemTick();
+
+    mounted = gamecardMountImageFile(g_benchOptions.image_path);
+    if (!mounted || !gamecardIsImageFileMounted())
+    {
+        fprintf(stderr, "Failed to mount \"%s\"! (status %u).\n", g_benchOptions.image_path, gamecardGetStatus());
+        goto end;
+    }
+
+    mount_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+    if (!benchWaitForStatusChange()) goto end;
+
+    printf("# Gamecard image benchmark\n\n");
+    printf("* Image: \"%s\".\n", g_benchOptions.image_path);
+    printf("* Mount: %lu us.\n", mount_ns / 1000);
+
+    benchPrintImageInfo();
+    benchListPartitions();
+
+    if (g_benchOptions.extract_name && !benchExtractEntry()) goto end;
+
+    if (!benchDumpImage()) goto end;
+
+    ret = EXIT_SUCCESS;
+
+end:
+    if (mounted)
+    {
+        gamecardUnmountImageFile();
+
+        if (gamecardIsImageFileMounted() || gamecardGetStatus() != GameCardStatus_NotInserted)
+        {
+            fprintf(stderr, "Gamecard image file still mounted after unmounting it!\n");
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (gc_init) gamecardExit();
+
+    if (g_benchBuffer) free(g_benchBuffer);
+
+    return ret;
+}
+
+static void benchPrintUsage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [options] IMAGE\n\n", argv0);
+    fprintf(stderr, "  -k KEY         CardInfo area key, as 32 hex characters or a keys file holding xci_header_key. Needed to verify the root Hash FS\n");
+    fprintf(stderr, "                 header from most images, since the CardInfo area holds the compatibility type used as its hash salt.\n");
+    fprintf(stderr, "  -p PARTITION   Hash FS partition used by -x: root, update, logo, normal or secure (default: secure).\n");
+    fprintf(stderr, "  -x NAME        Extract Hash FS entry NAME from the selected partition.\n");
+    fprintf(stderr, "  -O FILE        Write the extracted entry to FILE instead of ./NAME.\n");
+    fprintf(stderr, "  -w FILE        Write the timed image dump to FILE instead of discarding it.\n");
+    fprintf(stderr, "  -c KIB         Read size per gamecardReadStorage() call (default: 8192).\n");
+    fprintf(stderr, "  -t             Dump the trimmed image instead of the full one.\n");
+    fprintf(stderr, "  -v             Verbose logging. May be used twice.\n");
+}
+
+static bool benchParseOptions(int argc, char **argv)
+{
+    int opt = 0;
+
+    while((opt = getopt(argc, argv, "k:p:x:O:w:c:tvh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'k':
+                if (!benchParseKey(optarg, g_benchOptions.card_info_key) && !benchLoadKeyFromFile(optarg, g_benchOptions.card_info_key))
+                {
+                    fprintf(stderr, "Invalid CardInfo area key \"%s\"!\n", optarg);
+                    return false;
+                }
+                break;
+            case 'p':
+                g_benchOptions.extract_partition = benchGetPartitionTypeByName(optarg);
+                if (g_benchOptions.extract_partition == HashFileSystemPartitionType_None)
+                {
+                    fprintf(stderr, "Invalid Hash FS partition \"%s\"!\n", optarg);
+                    return false;
+                }
+                break;
+            case 'x':
+                g_benchOptions.extract_name = optarg;
+                break;
+            case 'O':
+                g_benchOptions.extract_path = optarg;
+                break;
+            case 'w':
+                g_benchOptions.dump_path = optarg;
+                break;
+            case 'c':
+                g_benchOptions.chunk_size = (strtoull(optarg, NULL, 0) * 0x400);
+                break;
+            case 't':
+                g_benchOptions.trimmed = true;
+                break;
+            case 'v':
+                if (g_benchOptions.log_level > LOG_LEVEL_DEBUG) g_benchOptions.log_level--;
+                break;
+            default:
+                benchPrintUsage(argv[0]);
+                return false;
+        }
+    }
+
+    if (optind != (argc - 1) || !g_benchOptions.chunk_size)
+    {
+        benchPrintUsage(argv[0]);
+        return false;
+    }
+
+    g_benchOptions.image_path = argv[optind];
+
+    return true;
+}
+
+static bool benchParseKey(const char *str, u8 *out)
+{
+    if (strlen(str) != (AES_128_KEY_SIZE * 2)) return false;
+
+    for(u32 i = 0; i < AES_128_KEY_SIZE; i++)
+    {
+        char byte_str[3] = { str[i * 2], str[(i * 2) + 1], '\0' };
+        if (!isxdigit((unsigned char)byte_str[0]) || !isxdigit((unsigned char)byte_str[1])) return false;
+        out[i] = (u8)strtoul(byte_str, NULL, 16);
+    }
+
+    return true;
+}
+
+static bool benchLoadKeyFromFile(const char *path, u8 *out)
+{
+    FILE *fd = fopen(path, "r");
+    char line[0x100] = {0}, name[0x40] = {0}, value[0x80] = {0};
+    bool success = false;
+
+    if (!fd) return false;
+
+    while(!success && fgets(line, sizeof(line), fd))
+    {
+        if (sscanf(line, " %63[^= \t] = %127s", name, value) != 2 || strcasecmp(name, "xci_header_key") != 0) continue;
+        success = benchParseKey(value, out);
+    }
+
+    fclose(fd);
+
+    return success;
+}
+
+static u8 benchGetPartitionTypeByName(const char *name)
+{
+    if (!name) return HashFileSystemPartitionType_None;
+
+    for(u8 i = HashFileSystemPartitionType_Root; i < HashFileSystemPartitionType_Count; i++)
+    {
+        if (!strcasecmp(name, hfsGetPartitionNameString(i))) return i;
+    }
+
+    return HashFileSystemPartitionType_None;
+}
+
+static bool benchWaitForStatusChange(void)
+{
+    UEvent *status_change_event = gamecardGetStatusChangeUserEvent();
+
+    Result rc = eventWait(status_change_event, BENCH_STATUS_TIMEOUT);
+    if (R_FAILED(rc))
+    {
+        fprintf(stderr, "Timed out waiting for a gamecard status change! (0x%X).\n", rc);
+        return false;
+    }
+
+    return true;
+}
+
+static void benchPrintImageInfo(void)
+{
+    GameCardHeader header = {0};
+    FsGameCardCertificate cert = {0};
+    u64 total_size = 0, trimmed_size = 0, capacity = 0;
+
+    if (!gamecardGetHeader(&header) || !gamecardGetTotalSize(&total_size) || !gamecardGetTrimmedSize(&trimmed_size) || !gamecardGetRomCapacity(&capacity)) return;
+
+    printf("* Package ID: ");
+    for(u32 i = 0; i < sizeof(header.package_id); i++) printf("%02X", header.package_id[i]);
+    printf(".\n");
+
+    printf("* ROM capacity: %lu MiB. Total size: %lu bytes. Trimmed size: %lu bytes.\n", capacity / 0x100000, total_size, trimmed_size);
+    printf("* Flags: 0x%02X. Root Hash FS: 0x%lX bytes at 0x%lX.\n", header.flags, header.partition_fs_header_size, header.partition_fs_header_address);
+    printf("* Certificate: %s.\n", gamecardGetCertificate(&cert) ? "present" : "not available");
+}
+
+static void benchListPartitions(void)
+{
+    HashFileSystemContext root_hfs_ctx = {0}, hfs_ctx = {0};
+    u32 meta_count = 0;
+
+    if (!gamecardGetHashFileSystemContext(HashFileSystemPartitionType_Root, &root_hfs_ctx)) return;
+
+    printf("\n## Hash FS partitions\n\n");
+    printf("| Partition | Offset | Size | Entries |\n");
+    printf("|-----------|--------|------|---------|\n");
+    printf("| %s | 0x%lX | 0x%lX | %u |\n", root_hfs_ctx.name, root_hfs_ctx.offset, root_hfs_ctx.size, hfsGetEntryCount(&root_hfs_ctx));
+
+    /* Not every gamecard holds every partition, so only the ones listed in the root partition are looked up. */
+    for(u32 i = 0; i < hfsGetEntryCount(&root_hfs_ctx); i++)
+    {
+        u8 hfs_partition_type = benchGetPartitionTypeByName(hfsGetEntryNameByIndex(&root_hfs_ctx, i));
+        if (hfs_partition_type == HashFileSystemPartitionType_None || !gamecardGetHashFileSystemContext(hfs_partition_type, &hfs_ctx)) continue;
+
+        printf("| %s | 0x%lX | 0x%lX | %u |\n", hfs_ctx.name, hfs_ctx.offset, hfs_ctx.size, hfsGetEntryCount(&hfs_ctx));
+        hfsFreeContext(&hfs_ctx);
+    }
+
+    hfsFreeContext(&root_hfs_ctx);
+
+    if (!gamecardGetHashFileSystemContext(HashFileSystemPartitionType_Secure, &hfs_ctx)) return;
+
+    /* There's one Meta NCA per title, so this doubles as the title list. Title IDs can't be retrieved without NCA keys. */
+    printf("\n## Secure partition contents\n\n");
+    printf("| Entry | Size | Type |\n");
+    printf("|-------|------|------|\n");
+
+    for(u32 i = 0; i < hfsGetEntryCount(&hfs_ctx); i++)
+    {
+        HashFileSystemEntry *hfs_entry = hfsGetEntryByIndex(&hfs_ctx, i);
+        const char *hfs_entry_name = hfsGetEntryName(&hfs_ctx, hfs_entry);
+        if (!hfs_entry || !hfs_entry_name) continue;
+
+        size_t name_len = strlen(hfs_entry_name);
+        bool is_meta = (name_len > 9 && !strcasecmp(hfs_entry_name + name_len - 9, ".cnmt.nca"));
+        if (is_meta) meta_count++;
+
+        printf("| %s | 0x%lX | %s |\n", hfs_entry_name, hfs_entry->size, is_meta ? "Meta" : "Content");
+    }
+
+    printf("\n%u title(s) found.\n", meta_count);
+
+    hfsFreeContext(&hfs_ctx);
+}
+
+static bool benchExtractEntry(void)
+{
+    HashFileSystemContext hfs_ctx = {0};
+    HashFileSystemEntry *hfs_entry = NULL;
+    const char *path = (g_benchOptions.extract_path ? g_benchOptions.extract_path : g_benchOptions.extract_name);
+    FILE *fd = NULL;
+    u64 start_tick = 0;
+    bool success = false;
+
+    if (!gamecardGetHashFileSystemContext(g_benchOptions.extract_partition, &hfs_ctx))
+    {
+        fprintf(stderr, "Failed to retrieve %s Hash FS partition!\n", hfsGetPartitionNameString(g_benchOptions.extract_partition));
+        goto end;
+    }
+
+    hfs_entry = hfsGetEntryByName(&hfs_ctx, g_benchOptions.extract_name);
+    if (!hfs_entry)
+    {
+        fprintf(stderr, "Hash FS entry \"%s\" not found in %s partition!\n", g_benchOptions.extract_name, hfs_ctx.name);
+        goto end;
+    }
+
+    fd = fopen(path, "wb");
+    if (!fd)
+    {
+        fprintf(stderr, "Failed to open \"%s\"! (%d).\n", path, errno);
+        goto end;
+    }
+
+    start_tick = armGetSystemTick();
+
+    for(u64 offset = 0, blksize = g_benchOptions.chunk_size; offset < hfs_entry->size; offset += blksize)
+    {
+        if (blksize > (hfs_entry->size - offset)) blksize = (hfs_entry->size - offset);
+
+        if (!hfsReadEntryData(&hfs_ctx, hfs_entry, g_benchBuffer, blksize, offset))
+        {
+            fprintf(stderr, "Failed to read 0x%lX bytes from offset 0x%lX in \"%s\"!\n", blksize, offset, g_benchOptions.extract_name);
+            goto end;
+        }
+
+        if (fwrite(g_benchBuffer, 1, blksize, fd) != blksize)
+        {
+            fprintf(stderr, "Failed to write 0x%lX bytes to \"%s\"! (%d).\n", blksize, path, errno);
+            goto end;
+        }
+    }
+
+    printf("\n## Extraction\n\n");
+    printf("* \"%s\" (%s) -> \"%s\".\n", g_benchOptions.extract_name, hfs_ctx.name, path);
+    benchPrintThroughput("Extraction", hfs_entry->size, armTicksToNs(armGetSystemTick() - start_tick));
+
+    success = true;
+
+end:
+    if (fd)
+    {
+        fclose(fd);
+        if (!success) remove(path);
+    }
+
+    hfsFreeContext(&hfs_ctx);
+
+    return success;
+}
+
+static bool benchDumpImage(void)
+{
+    GameCardIoStats start_stats = {0}, end_stats = {0};
+    u64 dump_size = 0, start_tick = 0, elapsed_ns = 0;
+    FILE *fd = NULL;
+    bool success = false;
+
+    if (!(g_benchOptions.trimmed ? gamecardGetTrimmedSize(&dump_size) : gamecardGetTotalSize(&dump_size)) || !dump_size)
+    {
+        fprintf(stderr, "Failed to retrieve gamecard image size!\n");
+        goto end;
+    }
+
+    if (g_benchOptions.dump_path)
+    {
+        fd = fopen(g_benchOptions.dump_path, "wb");
+        if (!fd)
+        {
+            fprintf(stderr, "Failed to open \"%s\"! (%d).\n", g_benchOptions.dump_path, errno);
+            goto end;
+        }
+    }
+
+    gamecardGetIoStats(&start_stats);
+
+    start_tick = armGetSystemTick();
+
+    for(u64 offset = 0, blksize = g_benchOptions.chunk_size; offset < dump_size; offset += blksize)
+    {
+        if (blksize > (dump_size - offset)) blksize = (dump_size - offset);
+
+        if (!gamecardReadStorage(g_benchBuffer, blksize, offset))
+        {
+            fprintf(stderr, "Failed to read 0x%lX bytes from gamecard image offset 0x%lX!\n", blksize, offset);
+            goto end;
+        }
+
+        if (fd && fwrite(g_benchBuffer, 1, blksize, fd) != blksize)
+        {
+            fprintf(stderr, "Failed to write 0x%lX bytes to \"%s\"! (%d).\n", blksize, g_benchOptions.dump_path, errno);
+            goto end;
+        }
+    }
+
+    elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+    gamecardGetIoStats(&end_stats);
+
+    printf("\n## %s image dump (%lu KiB per read)\n\n", g_benchOptions.trimmed ? "Trimmed" : "Full", g_benchOptions.chunk_size / 0x400);
+    benchPrintThroughput("Dump", dump_size, elapsed_ns);
+    printf("* I/O scheduler: %lu request(s), %lu merged, %lu storage read(s), %lu area switch(es).\n", end_stats.request_count - start_stats.request_count, \
+           end_stats.merged_request_count - start_stats.merged_request_count, end_stats.storage_read_count - start_stats.storage_read_count, \
+           end_stats.storage_switch_count - start_stats.storage_switch_count);
+
+    success = true;
+
+end:
+    if (fd)
+    {
+        fclose(fd);
+        if (!success) remove(g_benchOptions.dump_path);
+    }
+
+    return success;
+}
+
+static void benchPrintThroughput(const char *label, u64 size, u64 elapsed_ns)
+{
+    double mib = ((double)size / (double)0x100000), secs = ((double)elapsed_ns / 1000000000.0);
+    printf("* %s: %lu bytes in %.3f s (%.2f MiB/s).\n", label, size, secs, secs > 0.0 ? (mib / secs) : 0.0);
+}
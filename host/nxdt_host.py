@@ -44,10 +44,12 @@ import queue
 import shutil
 import time
 import struct
+import zlib
 import usb.core
 import usb.util
 import warnings
 import base64
+import socket
 
 import tkinter as tk
 import tkinter.ttk as ttk
@@ -60,6 +62,20 @@ from argparse import ArgumentParser
 from io import BufferedWriter
 from typing import Generator, Any, Callable
 
+# LZ4 support is optional. File data compression is simply not negotiated if the module isn't available.
+try:
+    import lz4.block
+    LZ4_AVAILABLE = True
+except ImportError:
+    LZ4_AVAILABLE = False
+
+# CRC32C support is optional as well. Per-chunk checksums are only negotiated if a (hardware-accelerated) implementation is available.
+try:
+    import crc32c
+    CRC32C_AVAILABLE = True
+except ImportError:
+    CRC32C_AVAILABLE = False
+
 # Scaling factors.
 WINDOWS_SCALING_FACTOR = 96.0
 SCALE = 1.0
@@ -101,6 +117,25 @@ USB_ABI_VERSION_MINOR = 2
 # USB command header size.
 USB_CMD_HEADER_SIZE = 0x10
 
+# Optional USB session features (StartSession).
+USB_SESSION_FEATURE_LZ4_COMPRESSION = (1 << 0)
+USB_SESSION_FEATURE_FILE_BATCH      = (1 << 1)
+USB_SESSION_FEATURE_STREAMS         = (1 << 2)
+USB_SESSION_FEATURE_RESUME          = (1 << 3)
+USB_SESSION_FEATURE_CHUNK_CHECKSUM  = (1 << 4)
+
+# Supported USB session features.
+USB_SUPPORTED_SESSION_FEATURES = (USB_SESSION_FEATURE_FILE_BATCH | USB_SESSION_FEATURE_STREAMS | USB_SESSION_FEATURE_RESUME | (USB_SESSION_FEATURE_LZ4_COMPRESSION if LZ4_AVAILABLE else 0) | \
+                                  (USB_SESSION_FEATURE_CHUNK_CHECKSUM if CRC32C_AVAILABLE else 0))
+
+# File data frame header magic word and size. Only used if LZ4 compression has been negotiated.
+USB_FRAME_MAGIC_WORD = b'NXLZ'
+USB_FRAME_HEADER_SIZE = 0x10
+
+# File data chunk trailer/acknowledgement magic word and size. Only used if per-chunk checksums have been negotiated.
+USB_CHUNK_MAGIC_WORD = b'NXCK'
+USB_CHUNK_TRAILER_SIZE = 0x10
+
 # USB command IDs.
 USB_CMD_START_SESSION           = 0
 USB_CMD_SEND_FILE_PROPERTIES    = 1
@@ -109,15 +144,36 @@ USB_CMD_SEND_NSP_HEADER         = 3
 USB_CMD_END_SESSION             = 4
 USB_CMD_START_EXTRACTED_FS_DUMP = 5
 USB_CMD_END_EXTRACTED_FS_DUMP   = 6
+USB_CMD_SEND_FILE_BATCH         = 7
+USB_CMD_OPEN_STREAM             = 8
+USB_CMD_SEND_STREAM_DATA        = 9
+USB_CMD_CLOSE_STREAM            = 10
+USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES = 11
 
 # USB command block sizes.
 USB_CMD_BLOCK_SIZE_START_SESSION           = 0x10
 USB_CMD_BLOCK_SIZE_SEND_FILE_PROPERTIES    = 0x320
 USB_CMD_BLOCK_SIZE_START_EXTRACTED_FS_DUMP = 0x310
+USB_CMD_BLOCK_SIZE_OPEN_STREAM             = 0x318
+USB_CMD_BLOCK_SIZE_CLOSE_STREAM            = 0x10
+
+# Resume offsets are aligned to this value. The data right before the resume offset is used to calculate the resume window checksum.
+USB_RESUME_WINDOW_SIZE = 0x100000
+
+# SendStreamData command block header size.
+USB_STREAM_DATA_HEADER_SIZE = 0x10
+
+# Max packet size reported by loopback endpoints (USB 2.0 bulk).
+LOOPBACK_MAX_PACKET_SIZE = 0x200
 
 # Max filename length (file properties).
 USB_FILE_PROPERTIES_MAX_NAME_LENGTH = 0x300
 
+# SendFileBatch command block header size, manifest entry header size and manifest entry alignment.
+USB_FILE_BATCH_HEADER_SIZE = 0x10
+USB_FILE_BATCH_ENTRY_HEADER_SIZE = 0x10
+USB_FILE_BATCH_ENTRY_ALIGNMENT = 8
+
 # USB status codes.
 USB_STATUS_SUCCESS                 = 0
 USB_STATUS_INVALID_MAGIC_WORD      = 4
@@ -339,6 +395,11 @@ g_nxdtAbiVersionMajor: int = 0
 g_nxdtAbiVersionMinor: int = 0
 g_nxdtGitCommit: str = ''
 
+g_usbSessionFeatures: int = 0
+
+g_loopbackAddress: tuple[str, int] | None = None
+g_noCompression: bool = False
+
 g_nspTransferMode: bool = False
 g_nspSize: int = 0
 g_nspHeaderSize: int = 0
@@ -347,6 +408,62 @@ g_nspFile: BufferedWriter | None = None
 g_nspFilePath: str = ''
 
 # Reference: https://beenje.github.io/blog/posts/logging-to-a-tkinter-scrolledtext-widget.
+class UsbStream:
+    def __init__(self, file: BufferedWriter, fullpath: str, size: int) -> None:
+        self.file: BufferedWriter | None = file
+        self.fullpath = fullpath
+        self.size = size
+        self.received = 0
+        self.failed = False
+
+    def close(self, delete: bool = False) -> None:
+        if self.file is not None:
+            self.file.close()
+            self.file = None
+
+        if delete and os.path.isfile(self.fullpath):
+            os.remove(self.fullpath)
+
+g_usbStreams: dict[int, UsbStream] = {}
+
+class LoopbackEndpoint:
+    # Mimics the subset of the PyUSB endpoint interface used by this script, on top of a TCP connection.
+    # Each USB transfer is sent as a single message prefixed by its 32-bit little endian length, which preserves transfer boundaries.
+    def __init__(self, conn: socket.socket) -> None:
+        self.conn = conn
+        self.wMaxPacketSize = LOOPBACK_MAX_PACKET_SIZE
+
+    def _recv_exact(self, size: int) -> bytes:
+        buf = bytearray()
+        while len(buf) < size:
+            data = self.conn.recv(size - len(buf))
+            if not data:
+                raise usb.core.USBError('Loopback connection closed')
+            buf += data
+        return bytes(buf)
+
+    def read(self, size: int, timeout: int = -1) -> bytes:
+        try:
+            self.conn.settimeout((timeout / 1000) if (timeout is not None and timeout > 0) else None)
+            (msg_size,) = struct.unpack('<I', self._recv_exact(4))
+            data = self._recv_exact(msg_size)
+        except (OSError, struct.error) as e:
+            raise usb.core.USBError(str(e))
+
+        if msg_size > size:
+            raise usb.core.USBError(f'Loopback transfer overflow (0x{msg_size:X} > 0x{size:X})')
+
+        return data
+
+    def write(self, data: bytes, timeout: int = -1) -> int:
+        try:
+            self.conn.settimeout((timeout / 1000) if (timeout is not None and timeout > 0) else None)
+            self.conn.sendall(struct.pack('<I', len(data)) + bytes(data))
+        except OSError as e:
+            raise usb.core.USBError(str(e))
+
+        return len(data)
+
 class LogQueueHandler(logging.Handler):
     def __init__(self, log_queue: queue.Queue) -> None:
         super().__init__()
@@ -619,6 +736,15 @@ def utilsResetNspInfo(delete: bool = False) -> None:
     g_nspFile = None
     g_nspFilePath = ''
 
+def utilsResetStreams(delete: bool = False) -> None:
+    global g_usbStreams
+
+    # Unfinished streams are always discarded.
+    for stream in g_usbStreams.values():
+        stream.close(delete or (stream.received != stream.size))
+
+    g_usbStreams = {}
+
 def utilsGetSizeUnitAndDivisor(size: int) -> tuple[str, int]:
     size_suffixes = [ 'B', 'KiB', 'MiB', 'GiB' ]
     size_suffixes_count = len(size_suffixes)
@@ -633,11 +759,40 @@ def utilsGetSizeUnitAndDivisor(size: int) -> tuple[str, int]:
 
     return ret
 
+def usbGetLoopbackEndpoints() -> bool:
+    global g_usbEpIn, g_usbEpOut, g_usbEpMaxPacketSize
+
+    assert g_logger is not None
+    assert g_loopbackAddress is not None
+
+    g_logger.info(f'Waiting for a loopback connection on {g_loopbackAddress[0]}:{g_loopbackAddress[1]}.')
+
+    try:
+        with socket.create_server(g_loopbackAddress) as server:
+            (conn, peer) = server.accept()
+    except OSError:
+        g_logger.error(f'Failed to accept loopback connection on {g_loopbackAddress[0]}:{g_loopbackAddress[1]}.')
+        return False
+
+    conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+    g_usbEpIn = g_usbEpOut = LoopbackEndpoint(conn)
+    g_usbEpMaxPacketSize = LOOPBACK_MAX_PACKET_SIZE
+
+    g_logger.debug(f'Accepted loopback connection from {peer[0]}:{peer[1]}.')
+    g_logger.debug(f'Max packet size: 0x{g_usbEpMaxPacketSize:X} (loopback).\n')
+
+    return True
+
 def usbGetDeviceEndpoints() -> bool:
     global g_usbEpIn, g_usbEpOut, g_usbEpMaxPacketSize
 
     assert g_logger is not None
 
+    # Use a loopback TCP connection instead of a real USB device, if requested.
+    if g_loopbackAddress is not None:
+        return usbGetLoopbackEndpoints()
+
     cur_dev: Generator[usb.core.Device, Any, None] | None = None
     prev_dev: usb.core.Device | None = None
     usb_ep_in_lambda = lambda ep: usb.util.endpoint_direction(ep.bEndpointAddress) == usb.util.ENDPOINT_IN
@@ -748,11 +903,11 @@ def usbWrite(data: bytes, timeout: int = -1) -> int:
     return wr
 
 def usbSendStatus(code: int) -> bool:
-    status = struct.pack('<4sIH6x', USB_MAGIC_WORD, code, g_usbEpMaxPacketSize)
+    status = struct.pack('<4sIHB5x', USB_MAGIC_WORD, code, g_usbEpMaxPacketSize, g_usbSessionFeatures)
     return bool(usbWrite(status, USB_TRANSFER_TIMEOUT) == len(status))
 
 def usbHandleStartSession(cmd_block: bytes) -> int:
-    global g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, g_nxdtAbiVersionMajor, g_nxdtAbiVersionMinor, g_nxdtGitCommit
+    global g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, g_nxdtAbiVersionMajor, g_nxdtAbiVersionMinor, g_nxdtGitCommit, g_usbSessionFeatures
 
     assert g_logger is not None
 
@@ -762,7 +917,7 @@ def usbHandleStartSession(cmd_block: bytes) -> int:
     g_logger.debug(f'Received StartSession ({USB_CMD_START_SESSION:02X}) command.')
 
     # Parse command block.
-    (g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, abi_version, git_commit) = struct.unpack_from('<BBBB8s', cmd_block, 0)
+    (g_nxdtVersionMajor, g_nxdtVersionMinor, g_nxdtVersionMicro, abi_version, git_commit, features) = struct.unpack_from('<BBBB8sB', cmd_block, 0)
     g_nxdtGitCommit = git_commit.decode('utf-8').strip('\x00')
 
     # Unpack ABI version.
@@ -777,10 +932,19 @@ def usbHandleStartSession(cmd_block: bytes) -> int:
         g_logger.error('Unsupported ABI version!')
         return USB_STATUS_UNSUPPORTED_ABI_VERSION
 
+    # Accept the optional features we support. They're sent back to the console through the status response.
+    g_usbSessionFeatures = (features & USB_SUPPORTED_SESSION_FEATURES)
+    if g_noCompression:
+        g_usbSessionFeatures &= ~USB_SESSION_FEATURE_LZ4_COMPRESSION
+    if g_usbSessionFeatures & USB_SESSION_FEATURE_LZ4_COMPRESSION:
+        g_logger.debug('LZ4 file data compression enabled.\n')
+    if g_usbSessionFeatures & USB_SESSION_FEATURE_CHUNK_CHECKSUM:
+        g_logger.debug('CRC32C file data checksums enabled.\n')
+
     # Return status code.
     return USB_STATUS_SUCCESS
 
-def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
+def usbHandleSendFileProperties(cmd_block: bytes, resume: bool = False) -> int | None:
     global g_nspTransferMode, g_nspSize, g_nspHeaderSize, g_nspRemainingSize, g_nspFile, g_nspFilePath, g_outputDir, g_tkRoot, g_progressBarWindow
 
     assert g_logger is not None
@@ -789,7 +953,10 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
     if g_cliMode and not g_nspTransferMode:
         print()
 
-    g_logger.debug(f'Received SendFileProperties ({USB_CMD_SEND_FILE_PROPERTIES:02X}) command.')
+    if resume:
+        g_logger.debug(f'Received SendResumableFileProperties ({USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES:02X}) command.')
+    else:
+        g_logger.debug(f'Received SendFileProperties ({USB_CMD_SEND_FILE_PROPERTIES:02X}) command.')
 
     # Parse command block.
     (file_size, filename_length, nsp_header_size, raw_filename) = struct.unpack_from(f'<QII{USB_FILE_PROPERTIES_MAX_NAME_LENGTH}s', cmd_block, 0)
@@ -815,6 +982,10 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         g_logger.error('Received non-zero NSP header size during NSP transfer mode!\n')
         return USB_STATUS_MALFORMED_CMD
 
+    if resume and (g_nspTransferMode or nsp_header_size):
+        g_logger.error('NSP transfers can\'t be resumed!\n')
+        return USB_STATUS_MALFORMED_CMD
+
     if (not filename_length) or (filename_length > USB_FILE_PROPERTIES_MAX_NAME_LENGTH):
         g_logger.error('Invalid filename length!\n')
         return USB_STATUS_MALFORMED_CMD
@@ -829,6 +1000,8 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         g_nspFilePath = ''
         g_logger.debug('NSP transfer mode enabled!\n')
 
+    resume_offset = window_crc = 0
+
     # Perform additional sanity checks and get a file object to work with.
     if (not g_nspTransferMode) or (g_nspFile is None):
         # Generate full, absolute path to the destination file.
@@ -847,15 +1020,33 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
             g_logger.error(f'Output filepath points to an existing directory! ("{printable_fullpath}").\n')
             return USB_STATUS_HOST_IO_ERROR
 
+        # Check how much data we already hold from a previous transfer, if needed.
+        # Partial data is truncated to an aligned offset. Anything past it will be sent again.
+        if resume and os.path.isfile(fullpath) and (os.path.getsize(fullpath) <= file_size):
+            resume_offset = os.path.getsize(fullpath)
+            if resume_offset < file_size:
+                resume_offset &= ~(USB_RESUME_WINDOW_SIZE - 1)
+
         # Make sure we have enough free space.
         (_, _, free_space) = shutil.disk_usage(dirpath)
-        if free_space <= file_size:
+        if free_space <= (file_size - resume_offset):
             utilsResetNspInfo()
             g_logger.error('Not enough free space available in output volume!\n')
             return USB_STATUS_HOST_IO_ERROR
 
         # Get file object.
-        file = open(fullpath, "wb")
+        if resume_offset:
+            file = open(fullpath, "r+b")
+            file.truncate(resume_offset)
+
+            # Calculate a checksum over the data right before the resume offset. The console uses it to make sure the data we hold matches its own.
+            window_size = min(resume_offset, USB_RESUME_WINDOW_SIZE)
+            file.seek(resume_offset - window_size)
+            window_crc = zlib.crc32(file.read(window_size))
+
+            g_logger.info(f'Resuming transfer at offset 0x{resume_offset:X}.')
+        else:
+            file = open(fullpath, "wb")
 
         if g_nspTransferMode:
             # Update NSP file object.
@@ -873,22 +1064,32 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         dirpath = os.path.dirname(fullpath)
         printable_fullpath = (fullpath[4:] if g_isWindows else fullpath)
 
-    # Check if we're dealing with an empty file or with the first SendFileProperties command from a NSP.
-    if (not file_size) or (g_nspTransferMode and file_size == g_nspSize):
+    if resume:
+        # Send status response and resume info block. A status response always follows the data transfer stage, even if there's no data left to transfer.
+        usbSendStatus(USB_STATUS_SUCCESS)
+        usbWrite(struct.pack('<4sIQ', USB_MAGIC_WORD, window_crc, resume_offset), USB_TRANSFER_TIMEOUT)
+
+        if resume_offset == file_size:
+            file.close()
+
+            # Let the command handler take care of sending the status response for us.
+            return USB_STATUS_SUCCESS
+    elif (not file_size) or (g_nspTransferMode and file_size == g_nspSize):
+        # We're dealing with an empty file or with the first SendFileProperties command from a NSP.
         # Close file (if needed).
         if not g_nspTransferMode:
             file.close()
 
         # Let the command handler take care of sending the status response for us.
         return USB_STATUS_SUCCESS
-
-    # Send status response before entering the data transfer stage.
-    usbSendStatus(USB_STATUS_SUCCESS)
+    else:
+        # Send status response before entering the data transfer stage.
+        usbSendStatus(USB_STATUS_SUCCESS)
 
     # Start data transfer stage.
     g_logger.debug(f'Data transfer started. {"Saving" if file_type_str == "file" else "Writing"} {file_type_str} to: "{printable_fullpath}".')
 
-    offset = 0
+    offset = resume_offset
     blksize = USB_TRANSFER_BLOCK_SIZE
 
     # Check if we should use the progress bar window.
@@ -903,8 +1104,8 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
 
         if (not g_nspTransferMode) or g_nspRemainingSize == (g_nspSize - g_nspHeaderSize):
             if not g_nspTransferMode:
-                # Set current progress to zero and the maximum value to the provided file size.
-                pbar_n = 0
+                # Set current progress to the resume offset and the maximum value to the provided file size.
+                pbar_n = resume_offset
                 pbar_file_size = file_size
             else:
                 # Set current progress to the NSP header size and the maximum value to the provided NSP size.
@@ -917,13 +1118,18 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
             # Set current prefix (holds the filename for the current NSP file entry).
             g_progressBarWindow.set_prefix(prefix)
 
-    def cancelTransfer():
+    def cancelTransfer(keep_data: bool = False):
         # Cancel file transfer.
         if g_nspTransferMode:
             utilsResetNspInfo(True)
         else:
             file.close()
-            os.remove(fullpath)
+
+            # Resumable transfers keep the data received so far if the connection is lost. It's sent back to the console on the next attempt.
+            if keep_data and resume:
+                g_logger.info(f'Keeping 0x{offset:X} bytes from "{printable_fullpath}" for a later resume.')
+            else:
+                os.remove(fullpath)
 
         if use_pbar and (g_progressBarWindow is not None):
             g_progressBarWindow.end()
@@ -931,15 +1137,23 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
     # Start transfer process.
     start_time = time.time()
 
+    # Check if file data is being sent as LZ4 frames and/or checksummed chunks.
+    use_frames = bool(g_usbSessionFeatures & USB_SESSION_FEATURE_LZ4_COMPRESSION)
+    use_checksums = bool(g_usbSessionFeatures & USB_SESSION_FEATURE_CHUNK_CHECKSUM)
+
     while offset < file_size:
         # Update block size (if needed).
         diff = (file_size - offset)
         if blksize > diff: blksize = diff
 
         # Set block size and handle Zero-Length Termination packet (if needed).
-        rd_size = blksize
-        if ((offset + blksize) >= file_size) and utilsIsValueAlignedToEndpointPacketSize(blksize):
-            rd_size += 1
+        if use_frames or use_checksums:
+            # Frames and checksummed chunks are never bigger than a full block plus their header and trailer. The console always terminates them with a short packet or a ZLT packet.
+            rd_size = (USB_TRANSFER_BLOCK_SIZE + USB_CHUNK_TRAILER_SIZE + g_usbEpMaxPacketSize)
+        else:
+            rd_size = blksize
+            if ((offset + blksize) >= file_size) and utilsIsValueAlignedToEndpointPacketSize(blksize):
+                rd_size += 1
 
         # Read current chunk.
         chunk = usbRead(rd_size, USB_TRANSFER_TIMEOUT)
@@ -947,7 +1161,7 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
             g_logger.error(f'Failed to read 0x{rd_size:X}-byte long data chunk!')
 
             # Cancel file transfer.
-            cancelTransfer()
+            cancelTransfer(True)
 
             # Returning None will make the command handler exit right away.
             return None
@@ -967,6 +1181,34 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
                 # Let the command handler take care of sending the status response for us.
                 return USB_STATUS_SUCCESS
 
+        # Verify current chunk (if needed).
+        if use_checksums:
+            (success, chunk) = usbVerifyFileDataChunk(chunk, offset - resume_offset)
+            if not success:
+                # Cancel file transfer.
+                cancelTransfer(True)
+
+                # Returning None will make the command handler exit right away.
+                return None
+
+            # The console sends rejected chunks again.
+            if chunk is None:
+                continue
+
+            chunk_size = len(chunk)
+
+        # Decode current frame (if needed).
+        if use_frames:
+            chunk = usbDecodeFileDataFrame(chunk, file_size - offset)
+            if chunk is None:
+                # Cancel file transfer.
+                cancelTransfer()
+
+                # Returning None will make the command handler exit right away.
+                return None
+
+            chunk_size = len(chunk)
+
         # Write current chunk.
         file.write(chunk)
         file.flush()
@@ -982,8 +1224,9 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
         if use_pbar:
             g_progressBarWindow.update(chunk_size)
 
-    elapsed_time = round(time.time() - start_time)
-    g_logger.debug(f'File transfer successfully completed in {tqdm.format_interval(elapsed_time)}!\n')
+    elapsed_time = (time.time() - start_time)
+    throughput = (((file_size - resume_offset) / elapsed_time) / 0x100000 if elapsed_time > 0 else 0)
+    g_logger.debug(f'File transfer successfully completed in {tqdm.format_interval(round(elapsed_time))} ({throughput:.2f} MiB/s)!\n')
 
     # Close file handle (if needed).
     if not g_nspTransferMode:
@@ -995,6 +1238,75 @@ def usbHandleSendFileProperties(cmd_block: bytes) -> int | None:
 
     return USB_STATUS_SUCCESS
 
+def usbHandleSendResumableFileProperties(cmd_block: bytes) -> int | None:
+    return usbHandleSendFileProperties(cmd_block, True)
+
+def usbVerifyFileDataChunk(chunk: bytes, offset: int) -> tuple[bool, bytes | None]:
+    assert g_logger is not None
+
+    chunk_size = len(chunk)
+    if chunk_size <= USB_CHUNK_TRAILER_SIZE:
+        g_logger.error(f'Received truncated file data chunk! (0x{chunk_size:X} byte[s]).')
+        return (False, None)
+
+    # Parse chunk trailer.
+    payload = chunk[:-USB_CHUNK_TRAILER_SIZE]
+    (magic, crc, chunk_offset) = struct.unpack_from('<4sIQ', chunk, chunk_size - USB_CHUNK_TRAILER_SIZE)
+
+    if magic != USB_CHUNK_MAGIC_WORD:
+        g_logger.error(f'Received malformed file data chunk! (size 0x{chunk_size:X}).')
+        return (False, None)
+
+    # Chunks past the expected offset are leftovers sent by the console before it found out about a previously rejected chunk. They're rejected as well.
+    # This makes the console send them all again, in order.
+    accepted = (chunk_offset == offset)
+    if not accepted:
+        g_logger.debug(f'Discarding file data chunk at offset 0x{chunk_offset:X} (expected 0x{offset:X}).')
+    elif crc32c.crc32c(payload) != crc:
+        g_logger.warning(f'CRC32C checksum mismatch for file data chunk at offset 0x{chunk_offset:X}! Requesting it again.')
+        accepted = False
+
+    # Acknowledge chunk.
+    ack = struct.pack('<4sIQ', USB_CHUNK_MAGIC_WORD, int(not accepted), chunk_offset)
+    if usbWrite(ack, USB_TRANSFER_TIMEOUT) != len(ack):
+        g_logger.error(f'Failed to acknowledge file data chunk at offset 0x{chunk_offset:X}!')
+        return (False, None)
+
+    return (True, (payload if accepted else None))
+
+def usbDecodeFileDataFrame(frame: bytes, max_size: int) -> bytes | None:
+    assert g_logger is not None
+
+    frame_size = len(frame)
+    if frame_size < USB_FRAME_HEADER_SIZE:
+        g_logger.error(f'Received truncated file data frame! (0x{frame_size:X} byte[s]).')
+        return None
+
+    # Parse frame header.
+    (magic, raw_size, stored_size, compressed) = struct.unpack_from('<4sIIB', frame, 0)
+
+    if (magic != USB_FRAME_MAGIC_WORD) or (stored_size != (frame_size - USB_FRAME_HEADER_SIZE)) or (not raw_size) or (raw_size > max_size) or \
+       ((not compressed) and (stored_size != raw_size)):
+        g_logger.error(f'Received malformed file data frame! (raw size 0x{raw_size:X}, stored size 0x{stored_size:X}, frame size 0x{frame_size:X}).')
+        return None
+
+    payload = frame[USB_FRAME_HEADER_SIZE:]
+    if not compressed:
+        return payload
+
+    # Decompress LZ4 block.
+    try:
+        data = lz4.block.decompress(payload, uncompressed_size=raw_size)
+    except Exception:
+        g_logger.error('Failed to decompress LZ4 file data frame!')
+        return None
+
+    if len(data) != raw_size:
+        g_logger.error(f'LZ4 file data frame size mismatch! (0x{len(data):X} != 0x{raw_size:X}).')
+        return None
+
+    return data
+
 def usbHandleCancelFileTransfer(cmd_block: bytes) -> int:
     assert g_logger is not None
 
@@ -1075,7 +1387,326 @@ def usbHandleEndExtractedFsDump(cmd_block: bytes) -> int:
     g_logger.info(f'Finished extracted FS dump.')
     return USB_STATUS_SUCCESS
 
+def usbHandleSendFileBatch(cmd_block: bytes) -> int | None:
+    assert g_logger is not None
+    assert g_progressBarWindow is not None
+
+    g_logger.debug(f'Received SendFileBatch ({USB_CMD_SEND_FILE_BATCH:02X}) command.')
+
+    if g_nspTransferMode:
+        g_logger.error('SendFileBatch received mid NSP transfer.\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    # Parse command block header.
+    (total_size, file_count) = struct.unpack_from('<QI', cmd_block, 0)
+
+    # Parse manifest.
+    entries: list[tuple[str, int]] = []
+    manifest_offset = USB_FILE_BATCH_HEADER_SIZE
+    manifest_size = 0
+
+    for _ in range(file_count):
+        if (manifest_offset + USB_FILE_BATCH_ENTRY_HEADER_SIZE) > len(cmd_block):
+            g_logger.error('Truncated SendFileBatch manifest!\n')
+            return USB_STATUS_MALFORMED_CMD
+
+        (file_size, path_length) = struct.unpack_from('<QI', cmd_block, manifest_offset)
+
+        path_offset = (manifest_offset + USB_FILE_BATCH_ENTRY_HEADER_SIZE)
+        if (not path_length) or (path_length > USB_FILE_PROPERTIES_MAX_NAME_LENGTH) or ((path_offset + path_length) > len(cmd_block)):
+            g_logger.error('Invalid path length in SendFileBatch manifest!\n')
+            return USB_STATUS_MALFORMED_CMD
+
+        filename = cmd_block[path_offset:path_offset + path_length].decode('utf-8')
+        entries.append((os.path.abspath(g_outputDir + os.path.sep + filename), file_size))
+
+        manifest_size += file_size
+        manifest_offset = (path_offset + path_length + USB_FILE_BATCH_ENTRY_ALIGNMENT - 1) & ~(USB_FILE_BATCH_ENTRY_ALIGNMENT - 1)
+
+    if (not entries) or (manifest_size != total_size):
+        g_logger.error('Invalid SendFileBatch manifest!\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    g_logger.debug(f'File count: {file_count} | Total size: 0x{total_size:X}.')
+
+    # Create all directory trees and make sure no output path points to an existing directory.
+    for (fullpath, _) in entries:
+        os.makedirs(os.path.dirname(fullpath), exist_ok=True)
+
+        if os.path.exists(fullpath) and (not os.path.isfile(fullpath)):
+            printable_fullpath = (fullpath[4:] if g_isWindows else fullpath)
+            g_logger.error(f'Output filepath points to an existing directory! ("{printable_fullpath}").\n')
+            return USB_STATUS_HOST_IO_ERROR
+
+    # Make sure we have enough free space.
+    (_, _, free_space) = shutil.disk_usage(os.path.dirname(entries[0][0]))
+    if free_space <= total_size:
+        g_logger.error('Not enough free space available in output volume!\n')
+        return USB_STATUS_HOST_IO_ERROR
+
+    # File data is split across all manifest entries, in order.
+    entry_idx = 0
+    file: BufferedWriter | None = None
+    file_remaining = 0
+
+    def openNextFile() -> None:
+        nonlocal entry_idx, file, file_remaining
+
+        # Empty files are created right away.
+        while (file is None) and (entry_idx < len(entries)):
+            (fullpath, file_size) = entries[entry_idx]
+            file = open(fullpath, 'wb')
+            file_remaining = file_size
+
+            g_logger.debug(f'Receiving file: "{fullpath[4:] if g_isWindows else fullpath}".')
+
+            if not file_remaining:
+                file.close()
+                file = None
+                entry_idx += 1
+
+    def writeChunk(chunk: bytes) -> None:
+        nonlocal entry_idx, file, file_remaining
+
+        view = memoryview(chunk)
+
+        while len(view):
+            openNextFile()
+            assert file is not None
+
+            wr_size = min(len(view), file_remaining)
+            file.write(view[:wr_size])
+            view = view[wr_size:]
+            file_remaining -= wr_size
+
+            if not file_remaining:
+                file.close()
+                file = None
+                entry_idx += 1
+
+    def cancelTransfer() -> None:
+        # Only the file we were writing to is removed. Files that were fully received are kept.
+        if file is not None:
+            file.close()
+            os.remove(entries[entry_idx][0])
+
+        if use_pbar and (g_progressBarWindow is not None):
+            g_progressBarWindow.end()
+
+    use_pbar = False
+
+    # Check if this batch only holds empty files.
+    if not total_size:
+        openNextFile()
+
+        # Let the command handler take care of sending the status response for us.
+        return USB_STATUS_SUCCESS
+
+    # Send status response before entering the data transfer stage.
+    usbSendStatus(USB_STATUS_SUCCESS)
+
+    g_logger.debug(f'Data transfer started. Saving {file_count} file(s) to: "{os.path.dirname(entries[0][0])}".')
+
+    # Check if we should use the progress bar window.
+    use_pbar = (total_size > USB_TRANSFER_THRESHOLD)
+    if use_pbar:
+        prefix = ('' if g_cliMode else f'Current batch: {file_count} file(s).\nUse your console to cancel the file transfer if you wish to do so.')
+        g_progressBarWindow.start(total_size, 0, prefix)
+
+    # Check if file data is being sent as LZ4 frames and/or checksummed chunks.
+    use_frames = bool(g_usbSessionFeatures & USB_SESSION_FEATURE_LZ4_COMPRESSION)
+    use_checksums = bool(g_usbSessionFeatures & USB_SESSION_FEATURE_CHUNK_CHECKSUM)
+
+    offset = 0
+    start_time = time.time()
+
+    while offset < total_size:
+        # Set block size and handle Zero-Length Termination packet (if needed).
+        if use_frames or use_checksums:
+            rd_size = (USB_TRANSFER_BLOCK_SIZE + USB_CHUNK_TRAILER_SIZE + g_usbEpMaxPacketSize)
+        else:
+            rd_size = min(USB_TRANSFER_BLOCK_SIZE, total_size - offset)
+            if ((offset + rd_size) >= total_size) and utilsIsValueAlignedToEndpointPacketSize(rd_size):
+                rd_size += 1
+
+        # Read current chunk.
+        chunk = usbRead(rd_size, USB_TRANSFER_TIMEOUT)
+        if not chunk:
+            g_logger.error(f'Failed to read 0x{rd_size:X}-byte long data chunk!')
+            cancelTransfer()
+            return None
+
+        # Check if we're dealing with a CancelFileTransfer command.
+        if len(chunk) == USB_CMD_HEADER_SIZE:
+            (magic, cmd_id, _) = struct.unpack_from('<4sII', chunk, 0)
+            if (magic == USB_MAGIC_WORD) and (cmd_id == USB_CMD_CANCEL_FILE_TRANSFER):
+                cancelTransfer()
+
+                g_logger.debug(f'Received CancelFileTransfer ({USB_CMD_CANCEL_FILE_TRANSFER:02X}) command.')
+                g_logger.warning('Transfer cancelled.')
+
+                # Let the command handler take care of sending the status response for us.
+                return USB_STATUS_SUCCESS
+
+        # Verify current chunk (if needed).
+        if use_checksums:
+            (success, verified) = usbVerifyFileDataChunk(chunk, offset)
+            if not success:
+                cancelTransfer()
+                return None
+
+            # The console sends rejected chunks again.
+            if verified is None:
+                continue
+
+            chunk = verified
+
+        # Decode current frame (if needed).
+        if use_frames:
+            decoded = usbDecodeFileDataFrame(chunk, total_size - offset)
+            if decoded is None:
+                cancelTransfer()
+                return None
+
+            chunk = decoded
+
+        # Write current chunk, splitting it across files as needed.
+        writeChunk(chunk)
+
+        offset += len(chunk)
+
+        # Update progress bar window (if needed).
+        if use_pbar:
+            g_progressBarWindow.update(len(chunk))
+
+    # Create trailing empty files (if needed).
+    openNextFile()
+
+    elapsed_time = round(time.time() - start_time)
+    g_logger.debug(f'File batch transfer successfully completed in {tqdm.format_interval(elapsed_time)}!\n')
+
+    # Hide progress bar window (if needed).
+    if use_pbar:
+        g_progressBarWindow.end()
+
+    return USB_STATUS_SUCCESS
+
+def usbHandleOpenStream(cmd_block: bytes) -> int:
+    assert g_logger is not None
+
+    g_logger.debug(f'Received OpenStream ({USB_CMD_OPEN_STREAM:02X}) command.')
+
+    if not (g_usbSessionFeatures & USB_SESSION_FEATURE_STREAMS):
+        g_logger.error('OpenStream received without negotiating stream support.\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    if g_nspTransferMode:
+        g_logger.error('OpenStream received mid NSP transfer.\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    # Parse command block.
+    (stream_id, file_size, raw_filename) = struct.unpack_from(f'<I4xQ{USB_FILE_PROPERTIES_MAX_NAME_LENGTH}s', cmd_block, 0)
+    filename = raw_filename.decode('utf-8').strip('\x00')
+
+    g_logger.debug(f'Stream ID: {stream_id} | File size: 0x{file_size:X}.')
+
+    if (not stream_id) or (stream_id in g_usbStreams) or (not filename):
+        g_logger.error('Invalid OpenStream parameters!\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    g_logger.info(f'Receiving stream #{stream_id}: "{filename}".')
+
+    # Generate full, absolute path to the destination file and create its directory tree.
+    fullpath = os.path.abspath(g_outputDir + os.path.sep + filename)
+    printable_fullpath = (fullpath[4:] if g_isWindows else fullpath)
+    dirpath = os.path.dirname(fullpath)
+
+    os.makedirs(dirpath, exist_ok=True)
+
+    # Make sure the output filepath doesn't point to an existing directory.
+    if os.path.exists(fullpath) and (not os.path.isfile(fullpath)):
+        g_logger.error(f'Output filepath points to an existing directory! ("{printable_fullpath}").\n')
+        return USB_STATUS_HOST_IO_ERROR
+
+    # Make sure we have enough free space. Take into account the data still expected by other open streams.
+    pending_size = sum((stream.size - stream.received) for stream in g_usbStreams.values())
+    (_, _, free_space) = shutil.disk_usage(dirpath)
+    if free_space <= (pending_size + file_size):
+        g_logger.error('Not enough free space available in output volume!\n')
+        return USB_STATUS_HOST_IO_ERROR
+
+    g_usbStreams[stream_id] = UsbStream(open(fullpath, 'wb'), fullpath, file_size)
+
+    return USB_STATUS_SUCCESS
+
+def usbHandleSendStreamData(cmd_block: bytes) -> int:
+    assert g_logger is not None
+
+    # Parse command block header.
+    (stream_id, data_size, offset) = struct.unpack_from('<IIQ', cmd_block, 0)
+
+    stream = g_usbStreams.get(stream_id, None)
+    if (stream is None) or (data_size != (len(cmd_block) - USB_STREAM_DATA_HEADER_SIZE)) or ((offset + data_size) > stream.size):
+        g_logger.error(f'Invalid SendStreamData parameters! (stream #{stream_id}, offset 0x{offset:X}, size 0x{data_size:X}).\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    # Errors only affect the stream they occurred in. The console is expected to close it.
+    if stream.failed:
+        return USB_STATUS_HOST_IO_ERROR
+
+    assert stream.file is not None
+
+    try:
+        if stream.file.tell() != offset:
+            stream.file.seek(offset)
+
+        stream.file.write(memoryview(cmd_block)[USB_STREAM_DATA_HEADER_SIZE:])
+    except OSError:
+        g_logger.error(f'Failed to write 0x{data_size:X} bytes to stream #{stream_id} at offset 0x{offset:X}!\n')
+        stream.failed = True
+        stream.close(True)
+        return USB_STATUS_HOST_IO_ERROR
+
+    stream.received += data_size
+
+    return USB_STATUS_SUCCESS
+
+def usbHandleCloseStream(cmd_block: bytes) -> int:
+    assert g_logger is not None
+
+    g_logger.debug(f'Received CloseStream ({USB_CMD_CLOSE_STREAM:02X}) command.')
+
+    # Parse command block.
+    (stream_id, cancel) = struct.unpack_from('<IB', cmd_block, 0)
+
+    stream = g_usbStreams.pop(stream_id, None)
+    if stream is None:
+        g_logger.error(f'Invalid stream ID! ({stream_id}).\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    if cancel:
+        stream.close(True)
+        g_logger.warning(f'Stream #{stream_id} cancelled.')
+        return USB_STATUS_SUCCESS
+
+    if stream.failed:
+        return USB_STATUS_HOST_IO_ERROR
+
+    if stream.received != stream.size:
+        stream.close(True)
+        g_logger.error(f'Stream #{stream_id} closed before receiving all of its data! (0x{stream.received:X} / 0x{stream.size:X}).\n')
+        return USB_STATUS_MALFORMED_CMD
+
+    stream.close()
+
+    printable_fullpath = (stream.fullpath[4:] if g_isWindows else stream.fullpath)
+    g_logger.info(f'Stream #{stream_id} finished: "{printable_fullpath}".')
+
+    return USB_STATUS_SUCCESS
+
 def usbCommandHandler() -> None:
+    global g_usbSessionFeatures
+
     assert g_logger is not None
 
     cmd_dict = {
@@ -1085,7 +1716,12 @@ def usbCommandHandler() -> None:
         USB_CMD_SEND_NSP_HEADER:         usbHandleSendNspHeader,
         USB_CMD_END_SESSION:             usbHandleEndSession,
         USB_CMD_START_EXTRACTED_FS_DUMP: usbHandleStartExtractedFsDump,
-        USB_CMD_END_EXTRACTED_FS_DUMP:   usbHandleEndExtractedFsDump
+        USB_CMD_END_EXTRACTED_FS_DUMP:   usbHandleEndExtractedFsDump,
+        USB_CMD_SEND_FILE_BATCH:         usbHandleSendFileBatch,
+        USB_CMD_OPEN_STREAM:             usbHandleOpenStream,
+        USB_CMD_SEND_STREAM_DATA:        usbHandleSendStreamData,
+        USB_CMD_CLOSE_STREAM:            usbHandleCloseStream,
+        USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES: usbHandleSendResumableFileProperties
     }
 
     # Get device endpoints.
@@ -1105,6 +1741,10 @@ def usbCommandHandler() -> None:
     # Reset NSP info.
     utilsResetNspInfo()
 
+    # Reset negotiated session features and streams.
+    g_usbSessionFeatures = 0
+    utilsResetStreams()
+
     while True:
         # Read command header.
         cmd_header = usbRead(USB_CMD_HEADER_SIZE)
@@ -1145,9 +1785,13 @@ def usbCommandHandler() -> None:
 
         # Verify command block size.
         if (cmd_id == USB_CMD_START_SESSION and cmd_block_size != USB_CMD_BLOCK_SIZE_START_SESSION) or \
-           (cmd_id == USB_CMD_SEND_FILE_PROPERTIES and cmd_block_size != USB_CMD_BLOCK_SIZE_SEND_FILE_PROPERTIES) or \
+           (cmd_id in (USB_CMD_SEND_FILE_PROPERTIES, USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES) and cmd_block_size != USB_CMD_BLOCK_SIZE_SEND_FILE_PROPERTIES) or \
            (cmd_id == USB_CMD_SEND_NSP_HEADER and not cmd_block_size) or \
-           (cmd_id == USB_CMD_START_EXTRACTED_FS_DUMP and cmd_block_size != USB_CMD_BLOCK_SIZE_START_EXTRACTED_FS_DUMP):
+           (cmd_id == USB_CMD_START_EXTRACTED_FS_DUMP and cmd_block_size != USB_CMD_BLOCK_SIZE_START_EXTRACTED_FS_DUMP) or \
+           (cmd_id == USB_CMD_SEND_FILE_BATCH and cmd_block_size < USB_FILE_BATCH_HEADER_SIZE) or \
+           (cmd_id == USB_CMD_OPEN_STREAM and cmd_block_size != USB_CMD_BLOCK_SIZE_OPEN_STREAM) or \
+           (cmd_id == USB_CMD_SEND_STREAM_DATA and cmd_block_size <= USB_STREAM_DATA_HEADER_SIZE) or \
+           (cmd_id == USB_CMD_CLOSE_STREAM and cmd_block_size != USB_CMD_BLOCK_SIZE_CLOSE_STREAM):
             g_logger.error(f'Invalid command block size for command ID {cmd_id:02X}! (0x{cmd_block_size:X}).\n')
             usbSendStatus(USB_STATUS_MALFORMED_CMD)
             continue
@@ -1158,6 +1802,9 @@ def usbCommandHandler() -> None:
         if (status is None) or (not usbSendStatus(status)) or (cmd_id == USB_CMD_END_SESSION) or (status == USB_STATUS_UNSUPPORTED_ABI_VERSION):
             break
 
+    # Discard unfinished streams.
+    utilsResetStreams()
+
     g_logger.info('\nStopping server.')
 
     if not g_cliMode:
@@ -1410,7 +2057,7 @@ def cliInitialize() -> None:
     usbCommandHandler()
 
 def main() -> int:
-    global g_cliMode, g_outputDir, g_osType, g_osVersion, g_isWindows, g_isWindowsVista, g_isWindows7, g_logger
+    global g_cliMode, g_outputDir, g_osType, g_osVersion, g_isWindows, g_isWindowsVista, g_isWindows7, g_logger, g_loopbackAddress, g_noCompression
 
     # Disable warnings.
     warnings.filterwarnings("ignore")
@@ -1420,10 +2067,17 @@ def main() -> int:
     parser.add_argument('-c', '--cli', required=False, action='store_true', default=False, help='Start the script in CLI mode.')
     parser.add_argument('-o', '--outdir', required=False, type=str, metavar='DIR', help=f'Path to output directory. Defaults to "{DEFAULT_DIR}".')
     parser.add_argument('-v', '--verbose', required=False, action='store_true', default=False, help='Enable verbose output.')
+    parser.add_argument('-l', '--loopback', required=False, type=str, metavar='HOST:PORT', help='Listen for a loopback TCP connection instead of a USB device (testing only). Implies CLI mode.')
+    parser.add_argument('-n', '--no-compression', required=False, action='store_true', default=False, help='Don\'t accept LZ4 compression for file data, even if the lz4 module is available.')
     args = parser.parse_args()
 
     # Update global flags.
-    g_cliMode = args.cli
+    g_cliMode = (args.cli or (args.loopback is not None))
+    g_noCompression = args.no_compression
+
+    if args.loopback is not None:
+        (loopback_host, _, loopback_port) = args.loopback.rpartition(':')
+        g_loopbackAddress = (loopback_host or '127.0.0.1', int(loopback_port))
     g_outputDir = utilsGetPath(args.outdir, DEFAULT_DIR, False, True)
 
     # Get OS information.
@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+
+"""
+ * nxdt_loopback.py
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""
+
+# Console-side emulator for the nxdumptool USB ABI, meant to exercise nxdt_host.py without a Switch.
+# Start the host script with `nxdt_host.py --loopback 127.0.0.1:PORT`, then run this script against the same address.
+# Only depends on the Python standard library.
+
+from __future__ import annotations
+
+import os
+import sys
+import socket
+import struct
+import zlib
+
+from argparse import ArgumentParser
+
+# Use a hardware-accelerated CRC32C implementation if available. The fallback is slow, but good enough for small test files.
+try:
+    from crc32c import crc32c as crc32cCalculate
+except ImportError:
+    CRC32C_TABLE = [0] * 256
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = ((crc >> 1) ^ 0x82F63B78) if (crc & 1) else (crc >> 1)
+        CRC32C_TABLE[i] = crc
+
+    def crc32cCalculate(data: bytes) -> int:
+        crc = 0xFFFFFFFF
+        for byte in data:
+            crc = (CRC32C_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8))
+        return (crc ^ 0xFFFFFFFF)
+
+# USB ABI values. Must match the ones from nxdt_host.py.
+USB_MAGIC_WORD = b'NXDT'
+USB_ABI_VERSION = ((1 << 4) | 2)
+
+USB_SESSION_FEATURE_STREAMS = (1 << 2)
+USB_SESSION_FEATURE_RESUME  = (1 << 3)
+USB_SESSION_FEATURE_CHUNK_CHECKSUM = (1 << 4)
+
+USB_CMD_START_SESSION                  = 0
+USB_CMD_END_SESSION                    = 4
+USB_CMD_OPEN_STREAM                    = 8
+USB_CMD_SEND_STREAM_DATA               = 9
+USB_CMD_CLOSE_STREAM                   = 10
+USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES = 11
+
+USB_STATUS_SUCCESS = 0
+
+USB_FILE_PROPERTIES_MAX_NAME_LENGTH = 0x300
+
+# Default SendStreamData slice size. Matches USB_STREAM_SLICE_SIZE from usb.c.
+DEFAULT_SLICE_SIZE = 0x400000
+
+# File data chunk size. Matches USB_TRANSFER_BUFFER_SIZE from usb.h.
+FILE_DATA_CHUNK_SIZE = 0x800000
+
+# Matches USB_RESUME_WINDOW_SIZE from usb.h.
+USB_RESUME_WINDOW_SIZE = 0x100000
+
+USB_CHUNK_MAGIC_WORD = b'NXCK'
+
+class LoopbackConsole:
+    def __init__(self, address: tuple[str, int]) -> None:
+        self.conn = socket.create_connection(address)
+        self.conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.features = self.last_features = 0
+
+    def close(self) -> None:
+        self.conn.close()
+
+    def _recv_exact(self, size: int) -> bytes:
+        buf = bytearray()
+        while len(buf) < size:
+            data = self.conn.recv(size - len(buf))
+            if not data:
+                raise ConnectionError('Loopback connection closed by host.')
+            buf += data
+        return bytes(buf)
+
+    def write(self, data: bytes) -> None:
+        # Each message represents a single USB transfer.
+        self.conn.sendall(struct.pack('<I', len(data)) + data)
+
+    def read(self) -> bytes:
+        (size,) = struct.unpack('<I', self._recv_exact(4))
+        return self._recv_exact(size)
+
+    def readStatus(self) -> int:
+        (magic, status, _, features) = struct.unpack_from('<4sIHB', self.read(), 0)
+        if magic != USB_MAGIC_WORD:
+            raise ValueError('Received status response with invalid magic word.')
+
+        self.last_features = features
+
+        return status
+
+    def sendCommand(self, cmd_id: int, cmd_block: bytes = b'') -> int:
+        self.write(struct.pack('<4sII4x', USB_MAGIC_WORD, cmd_id, len(cmd_block)))
+        if cmd_block:
+            self.write(cmd_block)
+
+        status = self.readStatus()
+
+        if cmd_id == USB_CMD_START_SESSION:
+            self.features = self.last_features
+
+        return status
+
+    def startSession(self, features: int) -> int:
+        return self.sendCommand(USB_CMD_START_SESSION, struct.pack('<BBBB8sB3x', 1, 0, 0, USB_ABI_VERSION, b'loopback', features))
+
+    def endSession(self) -> int:
+        return self.sendCommand(USB_CMD_END_SESSION)
+
+    def openStream(self, stream_id: int, file_size: int, filename: str) -> int:
+        return self.sendCommand(USB_CMD_OPEN_STREAM, struct.pack(f'<I4xQ{USB_FILE_PROPERTIES_MAX_NAME_LENGTH}s8x', stream_id, file_size, filename.encode('utf-8')))
+
+    def sendStreamData(self, stream_id: int, offset: int, data: bytes) -> int:
+        return self.sendCommand(USB_CMD_SEND_STREAM_DATA, struct.pack('<IIQ', stream_id, len(data), offset) + data)
+
+    def closeStream(self, stream_id: int, cancel: bool = False) -> int:
+        return self.sendCommand(USB_CMD_CLOSE_STREAM, struct.pack('<IB11x', stream_id, int(cancel)))
+
+    def sendResumableFileProperties(self, file_size: int, filename: str) -> tuple[int, int, int]:
+        raw_filename = filename.encode('utf-8')
+        status = self.sendCommand(USB_CMD_SEND_RESUMABLE_FILE_PROPERTIES, struct.pack(f'<QII{USB_FILE_PROPERTIES_MAX_NAME_LENGTH}s16x', file_size, len(raw_filename), 0, raw_filename))
+        if status != USB_STATUS_SUCCESS:
+            return (status, 0, 0)
+
+        (magic, window_crc, offset) = struct.unpack('<4sIQ', self.read())
+        if magic != USB_MAGIC_WORD:
+            raise ValueError('Received resume info block with invalid magic word.')
+
+        # The final status response is sent right away if the host already holds the whole file.
+        if offset == file_size:
+            status = self.readStatus()
+
+        return (status, offset, window_crc)
+
+    def sendChunk(self, data: bytes, offset: int, corrupt: bool = False) -> bool:
+        trailer = struct.pack('<4sIQ', USB_CHUNK_MAGIC_WORD, crc32cCalculate(data), offset)
+
+        # Flip a single bit after calculating the checksum, if requested.
+        if corrupt:
+            data = (bytes([data[0] ^ 1]) + data[1:])
+
+        self.write(data + trailer)
+
+        (magic, resend, ack_offset) = struct.unpack('<4sIQ', self.read())
+        if (magic != USB_CHUNK_MAGIC_WORD) or (ack_offset != offset):
+            raise ValueError('Received invalid chunk acknowledgement.')
+
+        return (not resend)
+
+def sendResumableFile(console: LoopbackConsole, path: str, filename: str, interrupt: int, chunk_size: int, corrupt: int) -> int:
+    size = os.path.getsize(path)
+
+    with open(path, 'rb') as file:
+        (status, offset, window_crc) = console.sendResumableFileProperties(size, filename)
+        print(f'SendResumableFileProperties ("{path}", 0x{size:X} bytes): status {status}, offset 0x{offset:X}.')
+        if status != USB_STATUS_SUCCESS:
+            return status
+
+        # Verify the data held by the host.
+        if offset:
+            window_size = min(offset, USB_RESUME_WINDOW_SIZE)
+            file.seek(offset - window_size)
+            if zlib.crc32(file.read(window_size)) != window_crc:
+                raise ValueError('Resume window checksum mismatch.')
+
+        if offset == size:
+            return status
+
+        # Send the remaining data. Simulate a disconnection if requested.
+        file.seek(offset)
+        sent = 0
+
+        while (offset + sent) < size:
+            chunk = file.read(chunk_size)
+
+            if (interrupt >= 0) and ((sent + len(chunk)) > interrupt):
+                console.write(chunk[:max(interrupt - sent, 1)])
+                console.close()
+                print(f'Connection closed after sending 0x{sent:X} bytes.')
+                sys.exit(2)
+
+            # Send checksummed chunks again until the host accepts them. Corrupt the requested chunk on the first attempt.
+            if console.features & USB_SESSION_FEATURE_CHUNK_CHECKSUM:
+                corrupted = ((corrupt >= 0) and (sent <= corrupt < (sent + len(chunk))))
+                while not console.sendChunk(chunk, sent, corrupted):
+                    print(f'Chunk at offset 0x{sent:X} rejected by host. Sending it again.')
+                    corrupted = False
+            else:
+                console.write(chunk)
+
+            sent += len(chunk)
+
+        return console.readStatus()
+
+def main() -> int:
+    parser = ArgumentParser(description='nxdumptool USB ABI loopback emulator.')
+    parser.add_argument('-l', '--loopback', required=False, type=str, metavar='HOST:PORT', default='127.0.0.1:9999', help='Address the host script is listening on.')
+    parser.add_argument('-s', '--slice-size', required=False, type=lambda x: int(x, 0), metavar='SIZE', default=DEFAULT_SLICE_SIZE, help='SendStreamData slice size.')
+    parser.add_argument('-p', '--prefix', required=False, type=str, metavar='DIR', default='loopback', help='Relative output directory on the host side.')
+    parser.add_argument('-x', '--cancel', required=False, type=int, metavar='INDEX', default=-1, help='Cancel the stream at this index halfway through.')
+    parser.add_argument('-r', '--resume', required=False, action='store_true', default=False, help='Send files one by one using resumable transfers instead of streams.')
+    parser.add_argument('-i', '--interrupt', required=False, type=lambda x: int(x, 0), metavar='SIZE', default=-1, help='Drop the connection after sending this much data from a resumable transfer.')
+    parser.add_argument('-k', '--checksum', required=False, action='store_true', default=False, help='Request per-chunk CRC32C checksums for resumable transfers.')
+    parser.add_argument('-c', '--chunk-size', required=False, type=lambda x: int(x, 0), metavar='SIZE', default=FILE_DATA_CHUNK_SIZE, help='File data chunk size for resumable transfers.')
+    parser.add_argument('-e', '--corrupt', required=False, type=lambda x: int(x, 0), metavar='OFFSET', default=-1, help='Corrupt the checksummed chunk holding this offset once.')
+    parser.add_argument('files', nargs='+', help='Input files. All of them are sent concurrently, using interleaved streams.')
+    args = parser.parse_args()
+
+    (host, _, port) = args.loopback.rpartition(':')
+    console = LoopbackConsole((host or '127.0.0.1', int(port)))
+
+    try:
+        if args.resume:
+            features = (USB_SESSION_FEATURE_RESUME | (USB_SESSION_FEATURE_CHUNK_CHECKSUM if args.checksum else 0))
+            if (console.startSession(features) != USB_STATUS_SUCCESS) or (not (console.features & USB_SESSION_FEATURE_RESUME)):
+                print('Host doesn\'t support resumable transfers.', file=sys.stderr)
+                return 1
+
+            if args.checksum and (not (console.features & USB_SESSION_FEATURE_CHUNK_CHECKSUM)):
+                print('Host doesn\'t support per-chunk checksums.', file=sys.stderr)
+                return 1
+
+            ret = 0
+            for path in args.files:
+                status = sendResumableFile(console, path, f'/{args.prefix}/{os.path.basename(path)}', args.interrupt, args.chunk_size, args.corrupt)
+                print(f'Transfer finished: status {status}.')
+                if status != USB_STATUS_SUCCESS:
+                    ret = 1
+
+            console.endSession()
+            return ret
+
+        if (console.startSession(USB_SESSION_FEATURE_STREAMS) != USB_STATUS_SUCCESS) or (not (console.features & USB_SESSION_FEATURE_STREAMS)):
+            print('Host doesn\'t support streams.', file=sys.stderr)
+            return 1
+
+        # Open all streams.
+        streams: list[tuple[int, str, int, int]] = []
+        for (idx, path) in enumerate(args.files):
+            stream_id = (idx + 1)
+            size = os.path.getsize(path)
+            status = console.openStream(stream_id, size, f'/{args.prefix}/{os.path.basename(path)}')
+            print(f'OpenStream #{stream_id} ("{path}", 0x{size:X} bytes): status {status}.')
+            if status == USB_STATUS_SUCCESS:
+                streams.append((stream_id, path, size, idx))
+
+        # Send a slice from each stream in turn.
+        files = { stream_id: open(path, 'rb') for (stream_id, path, _, _) in streams }
+        offsets = { stream_id: 0 for (stream_id, _, _, _) in streams }
+        active = list(streams)
+        ret = 0
+
+        while active:
+            for entry in list(active):
+                (stream_id, _, size, idx) = entry
+
+                # Cancel stream, if requested.
+                if (idx == args.cancel) and (offsets[stream_id] >= (size // 2)):
+                    status = console.closeStream(stream_id, True)
+                    print(f'CloseStream #{stream_id} (cancel): status {status}.')
+                    active.remove(entry)
+                    continue
+
+                data = files[stream_id].read(min(args.slice_size, size - offsets[stream_id]))
+                status = (console.sendStreamData(stream_id, offsets[stream_id], data) if data else USB_STATUS_SUCCESS)
+                offsets[stream_id] += len(data)
+
+                # Errors only affect the current stream.
+                if status != USB_STATUS_SUCCESS:
+                    print(f'SendStreamData #{stream_id} failed at offset 0x{offsets[stream_id] - len(data):X}: status {status}.')
+                    console.closeStream(stream_id, True)
+                    active.remove(entry)
+                    ret = 1
+                    continue
+
+                if offsets[stream_id] >= size:
+                    status = console.closeStream(stream_id)
+                    print(f'CloseStream #{stream_id}: status {status}.')
+                    active.remove(entry)
+                    if status != USB_STATUS_SUCCESS:
+                        ret = 1
+
+        for file in files.values():
+            file.close()
+
+        console.endSession()
+    finally:
+        console.close()
+
+    return ret
+
+if __name__ == '__main__':
+    sys.exit(main())
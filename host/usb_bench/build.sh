@@ -0,0 +1,18 @@
+#!/bin/sh
+
+# Builds the USB loopback benchmark harness for the current (Linux) host, using the real usb.c from the application.
+
+cd "$(dirname "$0")" || exit 1
+
+ROOT_DIR="../.."
+
+VERSION_MAJOR="$(sed -n 's/^VERSION_MAJOR[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+VERSION_MINOR="$(sed -n 's/^VERSION_MINOR[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+VERSION_MICRO="$(sed -n 's/^VERSION_MICRO[[:space:]]*:=[[:space:]]*//p' "$ROOT_DIR/Makefile")"
+GIT_COMMIT="$(git rev-parse --short HEAD 2>/dev/null || echo unknown)"
+
+${CC:-cc} -std=gnu11 -O2 -march=native -pthread -Wall -Wextra -Wno-unused-parameter -Wno-sign-compare -Wno-missing-field-initializers \
+    -DAPP_TITLE=\"nxdumptool\" -DVERSION_MAJOR="${VERSION_MAJOR:-2}" -DVERSION_MINOR="${VERSION_MINOR:-0}" -DVERSION_MICRO="${VERSION_MICRO:-0}" \
+    -DGIT_COMMIT=\"$GIT_COMMIT\" -Icompat -I"$ROOT_DIR/include" \
+    "$ROOT_DIR/source/core/usb.c" "$ROOT_DIR/source/core/lz4.c" compat/compat.c usb_loopback.c usb_stub_host.c usb_bench.c \
+    -o usb_bench "$@"
@@ -0,0 +1,410 @@
+/*
+ * compat.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <core/nxdt_utils.h>
+
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#define MUTEX_WAIT_MASK     BIT(31)
+
+/* Type definitions. */
+
+typedef struct {
+    ThreadFunc func;
+    void *arg;
+} CompatThreadArgs;
+
+/* Global variables. */
+
+static __thread u32 g_compatThreadId = 0;
+
+static pthread_mutex_t g_compatEventMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_compatEventCondVar;
+static pthread_once_t g_compatEventOnce = PTHREAD_ONCE_INIT;
+
+static u8 g_compatLogLevel = LOG_LEVEL_WARNING;
+static pthread_mutex_t g_compatLogMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#if !defined(__SSE4_2__)
+static u32 g_compatCrc32cTable[0x100] = {0};
+static pthread_once_t g_compatCrc32cOnce = PTHREAD_ONCE_INIT;
+#endif
+
+/* Function prototypes. */
+
+NX_INLINE u32 compatGetThreadId(void);
+NX_INLINE void compatFutexWait(u32 *addr, u32 value, const struct timespec *timeout);
+NX_INLINE void compatFutexWake(u32 *addr, int count);
+
+static void compatInitializeEventCondVar(void);
+static void compatGetAbsoluteTime(struct timespec *ts, u64 timeout);
+NX_INLINE bool compatConsumeEvent(Event *t);
+
+static void *compatThreadTrampoline(void *arg);
+
+#if !defined(__SSE4_2__)
+static void compatInitializeCrc32cTable(void);
+#endif
+
+void mutexLock(Mutex *mtx)
+{
+    u32 tid = compatGetThreadId(), cur = 0;
+
+    if (__atomic_compare_exchange_n(mtx, &cur, tid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+
+    while(true)
+    {
+        cur = __atomic_load_n(mtx, __ATOMIC_RELAXED);
+
+        /* Always take ownership with the wait bit set, since other threads may still be waiting. */
+        if (!cur)
+        {
+            if (__atomic_compare_exchange_n(mtx, &cur, tid | MUTEX_WAIT_MASK, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+            continue;
+        }
+
+        if (!(cur & MUTEX_WAIT_MASK) && !__atomic_compare_exchange_n(mtx, &cur, cur | MUTEX_WAIT_MASK, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) continue;
+
+        compatFutexWait(mtx, cur | MUTEX_WAIT_MASK, NULL);
+    }
+}
+
+bool mutexTryLock(Mutex *mtx)
+{
+    u32 cur = 0;
+    return __atomic_compare_exchange_n(mtx, &cur, compatGetThreadId(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutexUnlock(Mutex *mtx)
+{
+    if (__atomic_exchange_n(mtx, 0, __ATOMIC_RELEASE) & MUTEX_WAIT_MASK) compatFutexWake(mtx, 1);
+}
+
+bool mutexIsLockedByCurrentThread(const Mutex *mtx)
+{
+    return ((__atomic_load_n(mtx, __ATOMIC_RELAXED) & ~MUTEX_WAIT_MASK) == compatGetThreadId());
+}
+
+Result condvarWaitTimeout(CondVar *c, Mutex *m, u64 timeout)
+{
+    u32 seq = __atomic_load_n(c, __ATOMIC_ACQUIRE);
+    struct timespec ts = {0}, *ts_ptr = NULL;
+
+    if (timeout != UINT64_MAX)
+    {
+        ts.tv_sec = (time_t)(timeout / 1000000000);
+        ts.tv_nsec = (long)(timeout % 1000000000);
+        ts_ptr = &ts;
+    }
+
+    mutexUnlock(m);
+    compatFutexWait(c, seq, ts_ptr);
+    mutexLock(m);
+
+    return ((ts_ptr && __atomic_load_n(c, __ATOMIC_ACQUIRE) == seq) ? MAKERESULT(Module_Kernel, KernelError_TimedOut) : 0);
+}
+
+void condvarWakeAll(CondVar *c)
+{
+    __atomic_fetch_add(c, 1, __ATOMIC_RELEASE);
+    compatFutexWake(c, INT_MAX);
+}
+
+void condvarWakeOne(CondVar *c)
+{
+    __atomic_fetch_add(c, 1, __ATOMIC_RELEASE);
+    compatFutexWake(c, 1);
+}
+
+void eventCreate(Event *t, bool autoclear)
+{
+    pthread_once(&g_compatEventOnce, compatInitializeEventCondVar);
+
+    pthread_mutex_lock(&g_compatEventMutex);
+    t->signaled = false;
+    t->autoclear = autoclear;
+    pthread_mutex_unlock(&g_compatEventMutex);
+}
+
+void eventFire(Event *t)
+{
+    pthread_mutex_lock(&g_compatEventMutex);
+    t->signaled = true;
+    pthread_cond_broadcast(&g_compatEventCondVar);
+    pthread_mutex_unlock(&g_compatEventMutex);
+}
+
+Result eventWait(Event *t, u64 timeout)
+{
+    return waitObjects(NULL, &(Waiter){ WaiterType_Event, t }, 1, timeout);
+}
+
+void eventClear(Event *t)
+{
+    pthread_mutex_lock(&g_compatEventMutex);
+    t->signaled = false;
+    pthread_mutex_unlock(&g_compatEventMutex);
+}
+
+Result waitObjects(int *idx_out, const Waiter *objects, s32 num_objects, u64 timeout)
+{
+    struct timespec deadline = {0};
+    Result rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
+
+    if (timeout != UINT64_MAX) compatGetAbsoluteTime(&deadline, timeout);
+
+    pthread_mutex_lock(&g_compatEventMutex);
+
+    while(true)
+    {
+        s32 i = 0;
+
+        for(i = 0; i < num_objects; i++)
+        {
+            if (compatConsumeEvent(objects[i].event)) break;
+        }
+
+        if (i < num_objects)
+        {
+            if (idx_out) *idx_out = i;
+            rc = 0;
+            break;
+        }
+
+        if (timeout == UINT64_MAX)
+        {
+            pthread_cond_wait(&g_compatEventCondVar, &g_compatEventMutex);
+        } else
+        if (!timeout || pthread_cond_timedwait(&g_compatEventCondVar, &g_compatEventMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_compatEventMutex);
+
+    return rc;
+}
+
+bool utilsCreateThread(Thread *out_thread, ThreadFunc func, void *arg, int cpu_id)
+{
+    NX_IGNORE_ARG(cpu_id);
+
+    CompatThreadArgs *args = NULL;
+
+    if (!out_thread || !func || !(args = malloc(sizeof(CompatThreadArgs))))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    args->func = func;
+    args->arg = arg;
+
+    if (pthread_create(&(out_thread->handle), NULL, compatThreadTrampoline, args) != 0)
+    {
+        LOG_MSG_ERROR("pthread_create failed!");
+        free(args);
+        return false;
+    }
+
+    return true;
+}
+
+void utilsJoinThread(Thread *thread)
+{
+    if (!thread) return;
+    pthread_join(thread->handle, NULL);
+    memset(thread, 0, sizeof(Thread));
+}
+
+void threadExit(void)
+{
+    pthread_exit(NULL);
+}
+
+u64 armGetSystemTick(void)
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return armNsToTicks(((u64)ts.tv_sec * 1000000000) + (u64)ts.tv_nsec);
+}
+
+u32 crc32cCalculateWithSeed(u32 crc, const void *src, size_t size)
+{
+    const u8 *data = (const u8*)src;
+    crc = ~crc;
+
+#if defined(__SSE4_2__)
+    u64 crc64 = crc;
+
+    for(; size >= sizeof(u64); data += sizeof(u64), size -= sizeof(u64))
+    {
+        u64 value = 0;
+        memcpy(&value, data, sizeof(u64));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+
+    crc = (u32)crc64;
+
+    for(; size; data++, size--) crc = _mm_crc32_u8(crc, *data);
+#else
+    pthread_once(&g_compatCrc32cOnce, compatInitializeCrc32cTable);
+
+    for(; size; data++, size--) crc = (g_compatCrc32cTable[(crc ^ *data) & 0xFF] ^ (crc >> 8));
+#endif
+
+    return ~crc;
+}
+
+void compatSetLogLevel(u8 level)
+{
+    g_compatLogLevel = level;
+}
+
+void logWriteFormattedStringToLogFile(u8 level, const char *file_name, int line, const char *func_name, const char *fmt, ...)
+{
+    NX_IGNORE_ARG(file_name);
+    NX_IGNORE_ARG(line);
+
+    static const char *level_strs[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+    va_list args;
+
+    if (level < g_compatLogLevel || level >= MAX_ELEMENTS(level_strs)) return;
+
+    pthread_mutex_lock(&g_compatLogMutex);
+
+    fprintf(stderr, "[%s] %s: ", level_strs[level], func_name);
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+
+    pthread_mutex_unlock(&g_compatLogMutex);
+}
+
+void logWriteBinaryDataToLogFile(const void *data, size_t data_size, u8 level, const char *file_name, int line, const char *func_name, const char *fmt, ...)
+{
+    NX_IGNORE_ARG(file_name);
+    NX_IGNORE_ARG(line);
+
+    const u8 *bytes = (const u8*)data;
+    va_list args;
+
+    if (level < g_compatLogLevel) return;
+
+    pthread_mutex_lock(&g_compatLogMutex);
+
+    fprintf(stderr, "%s: ", func_name);
+
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+
+    for(size_t i = 0; i < data_size; i++) fprintf(stderr, "%s%02X", (i % 0x20) ? "" : "\n    ", bytes[i]);
+
+    fputc('\n', stderr);
+
+    pthread_mutex_unlock(&g_compatLogMutex);
+}
+
+NX_INLINE u32 compatGetThreadId(void)
+{
+    if (!g_compatThreadId) g_compatThreadId = (u32)syscall(SYS_gettid);
+    return g_compatThreadId;
+}
+
+NX_INLINE void compatFutexWait(u32 *addr, u32 value, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0);
+}
+
+NX_INLINE void compatFutexWake(u32 *addr, int count)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static void compatInitializeEventCondVar(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_compatEventCondVar, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void compatGetAbsoluteTime(struct timespec *ts, u64 timeout)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+
+    ts->tv_sec += (time_t)(timeout / 1000000000);
+    ts->tv_nsec += (long)(timeout % 1000000000);
+
+    if (ts->tv_nsec >= 1000000000)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+NX_INLINE bool compatConsumeEvent(Event *t)
+{
+    if (!t->signaled) return false;
+    if (t->autoclear) t->signaled = false;
+    return true;
+}
+
+static void *compatThreadTrampoline(void *arg)
+{
+    CompatThreadArgs args = *((CompatThreadArgs*)arg);
+    free(arg);
+
+    args.func(args.arg);
+
+    return NULL;
+}
+
+#if !defined(__SSE4_2__)
+static void compatInitializeCrc32cTable(void)
+{
+    for(u32 i = 0; i < 0x100; i++)
+    {
+        u32 crc = i;
+        for(u32 j = 0; j < 8; j++) crc = ((crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0));
+        g_compatCrc32cTable[i] = crc;
+    }
+}
+#endif
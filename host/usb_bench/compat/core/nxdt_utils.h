@@ -0,0 +1,240 @@
+/*
+ * nxdt_utils.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// Linux stand-in for the real nxdt_utils.h, used to build usb.c outside of the Switch.
+/// It only provides the subset of libnx and nxdumptool definitions needed by usb.c. Synchronization primitives keep libnx semantics (e.g. zero-initialized mutexes).
+
+#pragma once
+
+#ifndef __NXDT_UTILS_H__
+#define __NXDT_UTILS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <malloc.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef u32 Result;
+
+#define BIT(n)                      (1U << (n))
+#define NX_INLINE                   __attribute__((always_inline)) static inline
+#define NX_PACKED                   __attribute__((packed))
+#define NX_IGNORE_ARG(x)            (void)(x)
+
+#ifndef MIN
+#define MIN(a, b)                   (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b)                   (((a) > (b)) ? (a) : (b))
+#endif
+
+#define FS_MAX_PATH                 0x301
+
+#define R_SUCCEEDED(res)            ((res) == 0)
+#define R_FAILED(res)               ((res) != 0)
+#define MAKERESULT(module, desc)    ((((module) & 0x1FF)) | ((desc) & 0x1FFF) << 9)
+
+enum {
+    Module_Kernel = 1,
+    Module_Libnx  = 345
+};
+
+enum {
+    KernelError_TimedOut  = 117,
+    KernelError_Cancelled = 118
+};
+
+enum {
+    LibnxError_BadInput = 3,
+    LibnxError_IoError  = 7,
+    LibnxError_NotFound = 11
+};
+
+#include <defines.h>
+#include <core/nxdt_log.h>
+#include <core/lz4.h>
+
+/* libnx synchronization primitives. */
+
+/// Holds the owner thread ID. Bit 31 is set if other threads are waiting for the mutex.
+typedef u32 Mutex;
+
+/// Sequence counter.
+typedef u32 CondVar;
+
+void mutexLock(Mutex *mtx);
+bool mutexTryLock(Mutex *mtx);
+void mutexUnlock(Mutex *mtx);
+bool mutexIsLockedByCurrentThread(const Mutex *mtx);
+
+Result condvarWaitTimeout(CondVar *c, Mutex *m, u64 timeout);
+void condvarWakeAll(CondVar *c);
+void condvarWakeOne(CondVar *c);
+
+NX_INLINE Result condvarWait(CondVar *c, Mutex *m)
+{
+    return condvarWaitTimeout(c, m, UINT64_MAX);
+}
+
+/* libnx events. All of them share a single process-wide lock. */
+
+typedef struct {
+    bool signaled;
+    bool autoclear;
+} Event;
+
+typedef Event UEvent;
+
+typedef enum {
+    WaiterType_Event  = 0,
+    WaiterType_UEvent = 1
+} WaiterType;
+
+typedef struct {
+    WaiterType type;
+    Event *event;
+} Waiter;
+
+/// Initializes an event. Kernel events from usb:ds are loaded with 'autoclear' set to false.
+void eventCreate(Event *t, bool autoclear);
+
+/// Signals an event. Meant to be used by transport backends, in place of the kernel.
+void eventFire(Event *t);
+
+Result eventWait(Event *t, u64 timeout);
+void eventClear(Event *t);
+
+NX_INLINE void ueventCreate(UEvent *t, bool autoclear)
+{
+    eventCreate(t, autoclear);
+}
+
+NX_INLINE void ueventSignal(UEvent *t)
+{
+    eventFire(t);
+}
+
+NX_INLINE Waiter waiterForEvent(Event *t)
+{
+    return (Waiter){ WaiterType_Event, t };
+}
+
+NX_INLINE Waiter waiterForUEvent(UEvent *t)
+{
+    return (Waiter){ WaiterType_UEvent, t };
+}
+
+Result waitObjects(int *idx_out, const Waiter *objects, s32 num_objects, u64 timeout);
+
+#define waitMulti(idx_out, timeout, ...) \
+    waitObjects((idx_out), (Waiter[]) { __VA_ARGS__ }, sizeof((Waiter[]) { __VA_ARGS__ }) / sizeof(Waiter), (timeout))
+
+/* Threads. */
+
+typedef void (*ThreadFunc)(void *);
+
+typedef struct {
+    pthread_t handle;
+} Thread;
+
+/// CPU IDs are ignored.
+bool utilsCreateThread(Thread *out_thread, ThreadFunc func, void *arg, int cpu_id);
+void utilsJoinThread(Thread *thread);
+
+__attribute__((noreturn)) void threadExit(void);
+
+/* System ticks. Emulates the 19.2 MHz system counter from the Switch. */
+
+u64 armGetSystemTick(void);
+
+NX_INLINE u64 armTicksToNs(u64 tick)
+{
+    return ((tick * 625) / 12);
+}
+
+NX_INLINE u64 armNsToTicks(u64 ns)
+{
+    return ((ns * 12) / 625);
+}
+
+/* Checksums. */
+
+u32 crc32cCalculateWithSeed(u32 crc, const void *src, size_t size);
+
+NX_INLINE u32 crc32cCalculate(const void *src, size_t size)
+{
+    return crc32cCalculateWithSeed(0, src, size);
+}
+
+/* Logging. */
+
+/// Log messages with a level lower than this one are discarded. Defaults to LOG_LEVEL_WARNING.
+void compatSetLogLevel(u8 level);
+
+/* Scoped lock macro. */
+#define SCOPED_LOCK(mtx)        for(UtilsScopedLock ANONYMOUS_VARIABLE(scoped_lock) CLEANUP(utilsUnlockScope) = utilsLockScope(mtx); ANONYMOUS_VARIABLE(scoped_lock).cond; ANONYMOUS_VARIABLE(scoped_lock).cond = 0)
+
+/// Used by scoped locks.
+typedef struct {
+    Mutex *mtx;
+    bool lock;
+    int cond;
+} UtilsScopedLock;
+
+NX_INLINE UtilsScopedLock utilsLockScope(Mutex *mtx)
+{
+    UtilsScopedLock scoped_lock = { mtx, !mutexIsLockedByCurrentThread(mtx), 1 };
+    if (scoped_lock.lock) mutexLock(scoped_lock.mtx);
+    return scoped_lock;
+}
+
+NX_INLINE void utilsUnlockScope(UtilsScopedLock *scoped_lock)
+{
+    if (scoped_lock->lock) mutexUnlock(scoped_lock->mtx);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NXDT_UTILS_H__ */
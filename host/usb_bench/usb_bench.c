@@ -0,0 +1,787 @@
+/*
+ * usb_bench.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Runs the USB protocol implementation from usb.c on Linux, on top of the loopback transport, and measures it. */
+/* By default, an in-process stub host device is used. '-t HOST:PORT' connects to 'nxdt_host.py --loopback HOST:PORT' instead. */
+
+#include <core/nxdt_utils.h>
+#include <core/usb.h>
+#include <core/usb_transport.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "usb_loopback.h"
+#include "usb_stub_host.h"
+
+#define BENCH_SMALL_FILE_SIZE       0x1000      /* 4 KiB. */
+#define BENCH_BATCH_FILE_COUNT      16
+#define BENCH_NSP_HEADER_SIZE       0x200
+#define BENCH_HISTOGRAM_BUCKETS     24          /* Power-of-two microsecond buckets, from [0, 1) to [2^22, inf). */
+#define BENCH_SESSION_TIMEOUT       10000       /* Milliseconds. */
+#define BENCH_STREAM_COUNT          2
+#define BENCH_STREAM_FILE_SIZE      (2 * USB_TRANSFER_BUFFER_SIZE)  /* Several slices per stream, so they get interleaved. */
+
+/* Type definitions. */
+
+typedef bool (*BenchOpFunc)(void);
+
+typedef struct {
+    const char *name;
+    BenchOpFunc func;
+    bool (*supported)(void);
+} BenchOp;
+
+typedef struct {
+    const char *host_address;   ///< NULL: use the stub host.
+    u8 features;
+    u64 data_size;
+    u32 iterations;
+    u32 latency_us;
+    u64 bandwidth;
+    u32 reject_interval;
+    bool compressible;
+    u8 log_level;
+} BenchOptions;
+
+typedef struct {
+    u32 stream_id;
+    bool success;
+} BenchStreamContext;
+
+/* Global variables. */
+
+static BenchOptions g_benchOptions = {
+    .host_address = NULL,
+    .features = 0x1E,          /* Everything but LZ4 compression, which makes fixed transfer sizes meaningless. */
+    .data_size = 0x10000000,    /* 256 MiB. */
+    .iterations = 1000,
+    .latency_us = 0,
+    .bandwidth = 0,
+    .reject_interval = 0,
+    .compressible = false,
+    .log_level = LOG_LEVEL_WARNING
+};
+
+static FILE *g_benchOutput = NULL;
+static u8 *g_benchBuffer = NULL;
+static u32 g_benchFileCounter = 0;
+
+static int g_benchRawSocket = -1;
+
+/* Function prototypes. */
+
+static void benchPrintUsage(const char *argv0);
+static bool benchParseOptions(int argc, char **argv);
+
+static int benchConnectToHost(const char *address);
+static bool benchWaitForSession(u64 *out_elapsed_ns);
+static void benchFillBuffer(u8 *buf, size_t size, bool compressible);
+
+static bool benchOpEmptyFile(void);
+static bool benchOpSmallFile(void);
+static bool benchOpResumableFile(void);
+static bool benchOpExtractedFsDump(void);
+static bool benchOpFileBatch(void);
+static bool benchOpNsp(void);
+static bool benchOpStream(void);
+static bool benchAlwaysSupported(void);
+
+static bool benchRunLatency(const BenchOp *op);
+static int benchCompareU64(const void *a, const void *b);
+
+static bool benchRunConcurrentStreams(bool stub_host);
+static void benchStreamSenderThreadFunc(void *arg);
+
+static bool benchRunThroughput(u32 chunk_size, u64 raw_ns_per_mib);
+static u64 benchRunRawBaseline(void);
+static void benchRawReaderThreadFunc(void *arg);
+
+static const BenchOp g_benchOps[] = {
+    { "SendFileProperties (empty)",      benchOpEmptyFile,       benchAlwaysSupported   },
+    { "SendFileProperties + 4 KiB",      benchOpSmallFile,       benchAlwaysSupported   },
+    { "SendResumableFileProperties + 4 KiB", benchOpResumableFile, usbIsResumeSupported },
+    { "Start/EndExtractedFsDump",        benchOpExtractedFsDump, benchAlwaysSupported   },
+    { "SendFileBatch (16 x 4 KiB)",      benchOpFileBatch,       usbIsFileBatchSupported },
+    { "NSP (properties + 4 KiB + header)", benchOpNsp,           benchAlwaysSupported   },
+    { "Open/SendData/CloseStream (4 KiB)", benchOpStream,        usbIsStreamSupported   }
+};
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE, fds[2] = { -1, -1 };
+    UsbStubHostConfig stub_config = {0};
+    UsbStubHostStats stub_stats = {0};
+    bool stub_started = false, usb_init = false;
+    u64 session_ns = 0, raw_ns_per_mib = 0;
+    u8 session_features = 0;
+
+    const u32 chunk_sizes[] = { 0x10000, 0x40000, 0x100000, 0x200000, 0x400000, 0x800000, 0 }; /* Zero: adaptive. */
+
+    g_benchOutput = stdout;
+
+    if (!benchParseOptions(argc, argv)) goto end;
+
+    compatSetLogLevel(g_benchOptions.log_level);
+
+    /* Allocate data buffer. */
+    g_benchBuffer = usbAllocatePageAlignedBuffer(USB_TRANSFER_BUFFER_SIZE);
+    if (!g_benchBuffer)
+    {
+        fprintf(stderr, "Failed to allocate data buffer!\n");
+        goto end;
+    }
+
+    benchFillBuffer(g_benchBuffer, USB_TRANSFER_BUFFER_SIZE, g_benchOptions.compressible);
+
+    /* Set up the connection to the host device. */
+    if (g_benchOptions.host_address)
+    {
+        fds[0] = benchConnectToHost(g_benchOptions.host_address);
+        if (fds[0] < 0) goto end;
+    } else {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            fprintf(stderr, "socketpair() failed! (%d).\n", errno);
+            goto end;
+        }
+
+        stub_config.features = g_benchOptions.features;
+        stub_config.max_packet_size = USB_HS_EP_MAX_PACKET_SIZE;
+        stub_config.reject_interval = g_benchOptions.reject_interval;
+
+        stub_started = usbStubHostStart(fds[1], &stub_config);
+        if (!stub_started)
+        {
+            fprintf(stderr, "Failed to start stub host!\n");
+            goto end;
+        }
+    }
+
+    usbLoopbackSetSocket(fds[0]);
+    usbLoopbackSetLinkProfile(g_benchOptions.latency_us, g_benchOptions.bandwidth);
+
+    /* Measure raw socket throughput first, using a separate socketpair. This is our baseline. */
+    /* The emulated bandwidth limit applies to both. */
+    raw_ns_per_mib = benchRunRawBaseline();
+    if (g_benchOptions.bandwidth) raw_ns_per_mib += (u64)((1000000000.0 * (double)0x100000) / (double)g_benchOptions.bandwidth);
+
+    /* Initialize USB interface and wait for the session to be established. */
+    usb_init = usbInitialize();
+    if (!usb_init)
+    {
+        fprintf(stderr, "Failed to initialize USB interface!\n");
+        goto end;
+    }
+
+    if (!benchWaitForSession(&session_ns))
+    {
+        fprintf(stderr, "Failed to establish USB session!\n");
+        goto end;
+    }
+
+    session_features = usbGetSessionFeatures();
+
+    fprintf(g_benchOutput, "# USB loopback benchmark\n\n");
+    fprintf(g_benchOutput, "* Host device: %s.\n", g_benchOptions.host_address ? g_benchOptions.host_address : "stub");
+    fprintf(g_benchOutput, "* Session features: LZ4 %s, FileBatch %s, Streams %s, Resume %s, ChunkChecksum %s. Stub host mask: 0x%02X.\n", \
+            (session_features & UsbSessionFeature_Lz4Compression) ? "on" : "off", (session_features & UsbSessionFeature_FileBatch) ? "on" : "off", \
+            (session_features & UsbSessionFeature_Streams) ? "on" : "off", (session_features & UsbSessionFeature_Resume) ? "on" : "off", \
+            (session_features & UsbSessionFeature_ChunkChecksum) ? "on" : "off", g_benchOptions.features);
+    fprintf(g_benchOutput, "* Link profile: %u us latency, %s.\n", g_benchOptions.latency_us, g_benchOptions.bandwidth ? "bandwidth limited" : "unlimited bandwidth");
+    if (g_benchOptions.bandwidth) fprintf(g_benchOutput, "* Bandwidth: %lu MiB/s.\n", g_benchOptions.bandwidth / 0x100000);
+    if (g_benchOptions.reject_interval) fprintf(g_benchOutput, "* Every %u checksummed chunk(s) rejected by the stub host.\n", g_benchOptions.reject_interval);
+    fprintf(g_benchOutput, "* Data: %s.\n", g_benchOptions.compressible ? "compressible" : "random");
+    fprintf(g_benchOutput, "* Session start: %lu us.\n\n", session_ns / 1000);
+
+    /* Per-command latency. */
+    fprintf(g_benchOutput, "## Command latency (%u iterations)\n\n", g_benchOptions.iterations);
+    fprintf(g_benchOutput, "| Operation | Min (us) | p50 (us) | p90 (us) | p99 (us) | Max (us) | Mean (us) | URBs/op (in/out) | Bytes/op (in/out) |\n");
+    fprintf(g_benchOutput, "|-----------|----------|----------|----------|----------|----------|-----------|------------------|-------------------|\n");
+
+    for(u32 i = 0; i < MAX_ELEMENTS(g_benchOps); i++)
+    {
+        if (!g_benchOps[i].supported()) continue;
+        if (!benchRunLatency(&(g_benchOps[i]))) goto end;
+    }
+
+    /* Concurrent streams. */
+    if (usbIsStreamSupported() && !benchRunConcurrentStreams(stub_started)) goto end;
+
+    /* Throughput per chunk size. */
+    fprintf(g_benchOutput, "\n## File data throughput (%lu MiB per run)\n\n", g_benchOptions.data_size / 0x100000);
+    fprintf(g_benchOutput, "Raw framed socket baseline (including the emulated bandwidth limit): %lu ns/MiB.\n\n", raw_ns_per_mib);
+
+    if (session_features & UsbSessionFeature_Lz4Compression)
+    {
+        /* LZ4 frames are always sent as whole transfers, so every transfer size would yield the same results. */
+        fprintf(g_benchOutput, "Skipped: LZ4 compression has been negotiated, so file data is never split into fixed-size transfers. Clear bit 0 from the feature mask (-f) to run this test.\n");
+    } else {
+        fprintf(g_benchOutput, "| Chunk size | Throughput (MiB/s) | ns/MiB | Overhead (ns/MiB) | URBs (in/out) |\n");
+        fprintf(g_benchOutput, "|------------|--------------------|--------|-------------------|---------------|\n");
+
+        for(u32 i = 0; i < MAX_ELEMENTS(chunk_sizes); i++)
+        {
+            if (!benchRunThroughput(chunk_sizes[i], raw_ns_per_mib)) goto end;
+        }
+    }
+
+    /* Restore default bounds. */
+    usbSetTransferChunkSizeBounds(0, 0);
+
+    ret = EXIT_SUCCESS;
+
+end:
+    /* This sends an EndSession command. The stub host exits right after it. */
+    if (usb_init) usbExit();
+
+    if (fds[0] >= 0) shutdown(fds[0], SHUT_RDWR);
+
+    if (stub_started)
+    {
+        usbStubHostWait();
+        usbStubHostGetStats(&stub_stats);
+
+        fprintf(g_benchOutput, "\n## Stub host\n\n");
+        fprintf(g_benchOutput, "* Commands: %lu (%u failed).\n", stub_stats.cmd_count, stub_stats.error_count);
+        fprintf(g_benchOutput, "* File data: %lu bytes in %lu transfers (%lu rejected).\n", stub_stats.data_size, stub_stats.chunk_count, stub_stats.rejected_count);
+
+        if (ret == EXIT_SUCCESS && stub_stats.error_count)
+        {
+            fprintf(stderr, "Stub host reported %u failed command(s)!\n", stub_stats.error_count);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    for(u32 i = 0; i < MAX_ELEMENTS(fds); i++)
+    {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+
+    if (g_benchOutput && g_benchOutput != stdout) fclose(g_benchOutput);
+
+    if (g_benchBuffer) free(g_benchBuffer);
+
+    return ret;
+}
+
+static void benchPrintUsage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [options]\n\n", argv0);
+    fprintf(stderr, "  -t HOST:PORT   Connect to 'nxdt_host.py --loopback HOST:PORT' instead of using the stub host.\n");
+    fprintf(stderr, "  -f MASK        Session features accepted by the stub host (default: 0x1E, LZ4 disabled).\n");
+    fprintf(stderr, "  -s MIB         File data size per throughput run (default: 256).\n");
+    fprintf(stderr, "  -n COUNT       Iterations per latency run (default: 1000).\n");
+    fprintf(stderr, "  -l USEC        Emulated per-transfer latency (default: 0).\n");
+    fprintf(stderr, "  -b MIBPS       Emulated link bandwidth, in MiB/s (default: unlimited).\n");
+    fprintf(stderr, "  -r N           Make the stub host reject every Nth checksummed chunk (default: 0).\n");
+    fprintf(stderr, "  -z             Use compressible data instead of random data.\n");
+    fprintf(stderr, "  -o FILE        Write results to FILE instead of stdout.\n");
+    fprintf(stderr, "  -v             Verbose logging. May be used twice.\n");
+}
+
+static bool benchParseOptions(int argc, char **argv)
+{
+    int opt = 0;
+
+    while((opt = getopt(argc, argv, "t:f:s:n:l:b:r:zo:vh")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                g_benchOptions.host_address = optarg;
+                break;
+            case 'f':
+                g_benchOptions.features = (u8)strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                g_benchOptions.data_size = (strtoull(optarg, NULL, 0) * 0x100000);
+                break;
+            case 'n':
+                g_benchOptions.iterations = (u32)strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                g_benchOptions.latency_us = (u32)strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                g_benchOptions.bandwidth = (strtoull(optarg, NULL, 0) * 0x100000);
+                break;
+            case 'r':
+                g_benchOptions.reject_interval = (u32)strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                g_benchOptions.compressible = true;
+                break;
+            case 'o':
+                g_benchOutput = fopen(optarg, "w");
+                if (!g_benchOutput)
+                {
+                    fprintf(stderr, "Failed to open \"%s\"!\n", optarg);
+                    g_benchOutput = stdout;
+                    return false;
+                }
+                break;
+            case 'v':
+                if (g_benchOptions.log_level > LOG_LEVEL_DEBUG) g_benchOptions.log_level--;
+                break;
+            default:
+                benchPrintUsage(argv[0]);
+                return false;
+        }
+    }
+
+    if (!g_benchOptions.data_size || !g_benchOptions.iterations)
+    {
+        benchPrintUsage(argv[0]);
+        return false;
+    }
+
+    return true;
+}
+
+static int benchConnectToHost(const char *address)
+{
+    char host[0x100] = {0};
+    const char *port = strrchr(address, ':');
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res = NULL, *cur = NULL;
+    int fd = -1;
+
+    if (!port || (size_t)(port - address) >= sizeof(host))
+    {
+        fprintf(stderr, "Invalid host address \"%s\"!\n", address);
+        return -1;
+    }
+
+    memcpy(host, address, (size_t)(port++ - address));
+
+    if (getaddrinfo(*host ? host : "127.0.0.1", port, &hints, &res) != 0)
+    {
+        fprintf(stderr, "Failed to resolve \"%s\"!\n", address);
+        return -1;
+    }
+
+    for(cur = res; cur; cur = cur->ai_next)
+    {
+        fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
+        if (fd < 0) continue;
+
+        if (connect(fd, cur->ai_addr, cur->ai_addrlen) == 0)
+        {
+            /* Command headers and blocks are sent as separate small messages. Don't let Nagle's algorithm hold them back. */
+            int nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            break;
+        }
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+
+    if (fd < 0) fprintf(stderr, "Failed to connect to \"%s\"!\n", address);
+
+    return fd;
+}
+
+static bool benchWaitForSession(u64 *out_elapsed_ns)
+{
+    u64 start_tick = armGetSystemTick();
+
+    for(u32 i = 0; i < BENCH_SESSION_TIMEOUT; i++)
+    {
+        if (usbIsReady() != UsbHostSpeed_None)
+        {
+            *out_elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+            return true;
+        }
+
+        usleep(1000);
+    }
+
+    return false;
+}
+
+static void benchFillBuffer(u8 *buf, size_t size, bool compressible)
+{
+    u64 state = 0x9E3779B97F4A7C15ULL;
+
+    for(size_t i = 0; i < size; i++)
+    {
+        /* xorshift64. Compressible data only changes every 64 bytes, and only uses 16 different values. */
+        if (!compressible || !(i % 64))
+        {
+            state ^= (state << 13);
+            state ^= (state >> 7);
+            state ^= (state << 17);
+        }
+
+        buf[i] = (compressible ? (u8)(state & 0xF) : (u8)(state >> 24));
+    }
+}
+
+static bool benchOpEmptyFile(void)
+{
+    return usbSendFileProperties(0, "/usb_bench/empty.bin");
+}
+
+static bool benchOpSmallFile(void)
+{
+    return (usbSendFileProperties(BENCH_SMALL_FILE_SIZE, "/usb_bench/small.bin") && usbSendFileData(g_benchBuffer, BENCH_SMALL_FILE_SIZE));
+}
+
+static bool benchOpResumableFile(void)
+{
+    char path[0x40] = {0};
+    u64 offset = 0;
+    u32 window_crc = 0;
+
+    /* Use a different file each time, so nxdt_host.py doesn't find a complete copy and skip the data stage. */
+    snprintf(path, sizeof(path), "/usb_bench/resumable_%u.bin", g_benchFileCounter++);
+
+    if (!usbSendResumableFileProperties(BENCH_SMALL_FILE_SIZE, path, &offset, &window_crc)) return false;
+
+    return (offset == BENCH_SMALL_FILE_SIZE || usbSendFileData(g_benchBuffer + offset, BENCH_SMALL_FILE_SIZE - offset));
+}
+
+static bool benchOpExtractedFsDump(void)
+{
+    if (!usbStartExtractedFsDump(BENCH_SMALL_FILE_SIZE, "/usb_bench/fs")) return false;
+    usbEndExtractedFsDump();
+    return true;
+}
+
+static bool benchOpFileBatch(void)
+{
+    char paths[BENCH_BATCH_FILE_COUNT][0x40] = {0};
+    UsbFileBatchEntry entries[BENCH_BATCH_FILE_COUNT] = {0};
+    u64 total_size = (BENCH_BATCH_FILE_COUNT * BENCH_SMALL_FILE_SIZE);
+    bool ret = false;
+
+    for(u32 i = 0; i < BENCH_BATCH_FILE_COUNT; i++)
+    {
+        snprintf(paths[i], sizeof(paths[i]), "/usb_bench/fs/%02u.bin", i);
+        entries[i].size = BENCH_SMALL_FILE_SIZE;
+        entries[i].path = paths[i];
+    }
+
+    if (!usbStartExtractedFsDump(total_size, "/usb_bench/fs")) return false;
+
+    ret = (usbSendFileBatchProperties(entries, BENCH_BATCH_FILE_COUNT) == BENCH_BATCH_FILE_COUNT && usbSendFileData(g_benchBuffer, total_size));
+
+    if (ret) usbEndExtractedFsDump();
+
+    return ret;
+}
+
+static bool benchOpNsp(void)
+{
+    u64 nsp_size = (BENCH_NSP_HEADER_SIZE + BENCH_SMALL_FILE_SIZE);
+
+    if (!usbSendNspProperties(nsp_size, "/usb_bench/bench.nsp", BENCH_NSP_HEADER_SIZE) || !usbSendFileProperties(BENCH_SMALL_FILE_SIZE, "entry.nca") || \
+        !usbSendFileData(g_benchBuffer, BENCH_SMALL_FILE_SIZE))
+    {
+        usbCancelFileTransfer();
+        return false;
+    }
+
+    return usbSendNspHeader(g_benchBuffer, BENCH_NSP_HEADER_SIZE);
+}
+
+static bool benchOpStream(void)
+{
+    u32 stream_id = 0;
+
+    if (!usbOpenStream(BENCH_SMALL_FILE_SIZE, "/usb_bench/stream.bin", &stream_id)) return false;
+
+    bool ret = usbSendStreamData(stream_id, g_benchBuffer, BENCH_SMALL_FILE_SIZE);
+
+    return (usbCloseStream(stream_id, !ret) && ret);
+}
+
+static bool benchAlwaysSupported(void)
+{
+    return true;
+}
+
+static bool benchRunLatency(const BenchOp *op)
+{
+    u64 *samples = calloc(g_benchOptions.iterations, sizeof(u64)), total_ns = 0;
+    u32 histogram[BENCH_HISTOGRAM_BUCKETS] = {0}, count = g_benchOptions.iterations;
+    UsbLoopbackStats stats = {0};
+    bool ret = false;
+
+    if (!samples)
+    {
+        fprintf(stderr, "Failed to allocate memory for latency samples!\n");
+        return false;
+    }
+
+    usbLoopbackResetStats();
+
+    for(u32 i = 0; i < count; i++)
+    {
+        u64 start_tick = armGetSystemTick();
+
+        if (!op->func())
+        {
+            fprintf(stderr, "%s failed! (iteration %u).\n", op->name, i);
+            goto end;
+        }
+
+        samples[i] = armTicksToNs(armGetSystemTick() - start_tick);
+        total_ns += samples[i];
+
+        /* Bucket index: number of significant bits in the microsecond value. */
+        u64 us = (samples[i] / 1000);
+        u32 bucket = (us ? (64 - (u32)__builtin_clzll(us)) : 0);
+        histogram[MIN(bucket, BENCH_HISTOGRAM_BUCKETS - 1)]++;
+    }
+
+    usbLoopbackGetStats(&stats);
+
+    qsort(samples, count, sizeof(u64), benchCompareU64);
+
+    fprintf(g_benchOutput, "| %s | %.1f | %.1f | %.1f | %.1f | %.1f | %.1f | %.1f / %.1f | %.0f / %.0f |\n", op->name, \
+            (double)samples[0] / 1000.0, (double)samples[count / 2] / 1000.0, (double)samples[(count * 9) / 10] / 1000.0, \
+            (double)samples[(count * 99) / 100] / 1000.0, (double)samples[count - 1] / 1000.0, (double)total_ns / (double)count / 1000.0, \
+            (double)stats.urb_count[UsbTransportEndpoint_In] / (double)count, (double)stats.urb_count[UsbTransportEndpoint_Out] / (double)count, \
+            (double)stats.byte_count[UsbTransportEndpoint_In] / (double)count, (double)stats.byte_count[UsbTransportEndpoint_Out] / (double)count);
+
+    /* Print histogram to the log, if requested. */
+    for(u32 i = 0; i < BENCH_HISTOGRAM_BUCKETS; i++)
+    {
+        if (!histogram[i]) continue;
+        LOG_MSG_INFO("%s: [%u, %u) us -> %u.", op->name, i ? BIT(i - 1) : 0, BIT(i), histogram[i]);
+    }
+
+    ret = true;
+
+end:
+    free(samples);
+
+    return ret;
+}
+
+static int benchCompareU64(const void *a, const void *b)
+{
+    u64 va = *(const u64*)a, vb = *(const u64*)b;
+    return ((va > vb) - (va < vb));
+}
+
+static bool benchRunConcurrentStreams(bool stub_host)
+{
+    BenchStreamContext ctx[BENCH_STREAM_COUNT] = {0};
+    Thread threads[BENCH_STREAM_COUNT] = {0};
+    bool threads_created[BENCH_STREAM_COUNT] = {0};
+    UsbStubHostStats start_stats = {0}, end_stats = {0};
+    char path[0x40] = {0};
+    u64 start_tick = 0, elapsed_ns = 0;
+    bool success = true;
+
+    fprintf(g_benchOutput, "\n## Concurrent streams\n\n");
+
+    usbStubHostGetStats(&start_stats);
+
+    /* Open all streams first, then send data for each one from its own thread. */
+    for(u32 i = 0; i < BENCH_STREAM_COUNT; i++)
+    {
+        snprintf(path, sizeof(path), "/usb_bench/stream_%u.bin", i);
+        if (!usbOpenStream(BENCH_STREAM_FILE_SIZE, path, &(ctx[i].stream_id)))
+        {
+            success = false;
+            goto end;
+        }
+    }
+
+    start_tick = armGetSystemTick();
+
+    for(u32 i = 0; i < BENCH_STREAM_COUNT; i++)
+    {
+        threads_created[i] = utilsCreateThread(&(threads[i]), benchStreamSenderThreadFunc, &(ctx[i]), 0);
+        if (!threads_created[i]) success = false;
+    }
+
+    for(u32 i = 0; i < BENCH_STREAM_COUNT; i++)
+    {
+        if (!threads_created[i]) continue;
+        utilsJoinThread(&(threads[i]));
+        if (!ctx[i].success) success = false;
+    }
+
+    elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+end:
+    /* The host device discards incomplete streams. */
+    for(u32 i = 0; i < BENCH_STREAM_COUNT; i++)
+    {
+        if (ctx[i].stream_id && !usbCloseStream(ctx[i].stream_id, !success)) success = false;
+    }
+
+    if (!success)
+    {
+        fprintf(stderr, "Concurrent stream run failed!\n");
+        return false;
+    }
+
+    fprintf(g_benchOutput, "* %u streams x %lu MiB: %lu ms (%.1f MiB/s aggregate).\n", BENCH_STREAM_COUNT, (u64)BENCH_STREAM_FILE_SIZE / 0x100000, elapsed_ns / 1000000, \
+            ((double)(BENCH_STREAM_COUNT * (u64)BENCH_STREAM_FILE_SIZE) * 1000000000.0) / ((double)elapsed_ns * (double)0x100000));
+
+    if (stub_host)
+    {
+        /* Each CloseStream command is acknowledged by the stub host, so its statistics are up to date at this point. */
+        usbStubHostGetStats(&end_stats);
+        fprintf(g_benchOutput, "* Stream switches seen by the stub host: %lu.\n", end_stats.stream_switch_count - start_stats.stream_switch_count);
+    }
+
+    fflush(g_benchOutput);
+
+    return true;
+}
+
+static void benchStreamSenderThreadFunc(void *arg)
+{
+    BenchStreamContext *ctx = (BenchStreamContext*)arg;
+
+    ctx->success = true;
+
+    for(u64 offset = 0; offset < BENCH_STREAM_FILE_SIZE && ctx->success; offset += USB_TRANSFER_BUFFER_SIZE)
+    {
+        ctx->success = usbSendStreamData(ctx->stream_id, g_benchBuffer, MIN((u64)USB_TRANSFER_BUFFER_SIZE, BENCH_STREAM_FILE_SIZE - offset));
+    }
+
+    threadExit();
+}
+
+static bool benchRunThroughput(u32 chunk_size, u64 raw_ns_per_mib)
+{
+    u64 blkcount = (g_benchOptions.data_size / USB_TRANSFER_BUFFER_SIZE), remaining = (g_benchOptions.data_size % USB_TRANSFER_BUFFER_SIZE);
+    UsbLoopbackStats stats = {0};
+    u64 start_tick = 0, elapsed_ns = 0, ns_per_mib = 0;
+
+    if (!usbSetTransferChunkSizeBounds(chunk_size, chunk_size) || !usbSendFileProperties(g_benchOptions.data_size, "/usb_bench/throughput.bin"))
+    {
+        fprintf(stderr, "Failed to start throughput run! (chunk size 0x%X).\n", chunk_size);
+        return false;
+    }
+
+    usbLoopbackResetStats();
+    start_tick = armGetSystemTick();
+
+    for(u64 i = 0; i < blkcount; i++)
+    {
+        if (!usbSendFileData(g_benchBuffer, USB_TRANSFER_BUFFER_SIZE)) goto fail;
+    }
+
+    if (remaining && !usbSendFileData(g_benchBuffer, remaining)) goto fail;
+
+    elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+    usbLoopbackGetStats(&stats);
+
+    ns_per_mib = (u64)(((double)elapsed_ns * (double)0x100000) / (double)g_benchOptions.data_size);
+
+    if (chunk_size)
+    {
+        fprintf(g_benchOutput, "| 0x%08X ", chunk_size);
+    } else {
+        fprintf(g_benchOutput, "| Adaptive (0x%08X at the end) ", usbGetTransferChunkSize());
+    }
+
+    fprintf(g_benchOutput, "| %.1f | %lu | %ld | %lu / %lu |\n", ((double)g_benchOptions.data_size * 1000000000.0) / ((double)elapsed_ns * (double)0x100000), \
+            ns_per_mib, (s64)ns_per_mib - (s64)raw_ns_per_mib, stats.urb_count[UsbTransportEndpoint_In], stats.urb_count[UsbTransportEndpoint_Out]);
+
+    fflush(g_benchOutput);
+
+    return true;
+
+fail:
+    /* usbSendFileData() resets the transfer state on its own if an error occurs. */
+    fprintf(stderr, "Throughput run failed! (chunk size 0x%X).\n", chunk_size);
+    return false;
+}
+
+static u64 benchRunRawBaseline(void)
+{
+    int fds[2] = { -1, -1 };
+    Thread thread = {0};
+    u64 sent = 0, elapsed_ns = 0, start_tick = 0;
+    u32 msg_size = USB_TRANSFER_BUFFER_SIZE;
+    bool thread_created = false;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return 0;
+
+    g_benchRawSocket = fds[1];
+
+    thread_created = utilsCreateThread(&thread, benchRawReaderThreadFunc, NULL, 0);
+    if (!thread_created) goto end;
+
+    start_tick = armGetSystemTick();
+
+    /* Same framing used by the loopback transport: 32-bit length, then the payload. */
+    for(sent = 0; sent < g_benchOptions.data_size; sent += msg_size)
+    {
+        msg_size = (u32)MIN(g_benchOptions.data_size - sent, USB_TRANSFER_BUFFER_SIZE);
+        if (send(fds[0], &msg_size, sizeof(u32), MSG_NOSIGNAL) != sizeof(u32)) break;
+
+        for(u32 offset = 0; offset < msg_size;)
+        {
+            ssize_t ret = send(fds[0], g_benchBuffer + offset, msg_size - offset, MSG_NOSIGNAL);
+            if (ret <= 0) goto end;
+            offset += (u32)ret;
+        }
+    }
+
+    shutdown(fds[0], SHUT_WR);
+    utilsJoinThread(&thread);
+    thread_created = false;
+
+    elapsed_ns = armTicksToNs(armGetSystemTick() - start_tick);
+
+end:
+    if (thread_created)
+    {
+        shutdown(fds[0], SHUT_RDWR);
+        utilsJoinThread(&thread);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return (sent >= g_benchOptions.data_size ? (u64)(((double)elapsed_ns * (double)0x100000) / (double)g_benchOptions.data_size) : 0);
+}
+
+static void benchRawReaderThreadFunc(void *arg)
+{
+    NX_IGNORE_ARG(arg);
+
+    u8 *buf = malloc(0x100000);
+
+    while(buf && recv(g_benchRawSocket, buf, 0x100000, 0) > 0);
+
+    free(buf);
+
+    threadExit();
+}
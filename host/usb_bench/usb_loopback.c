@@ -0,0 +1,457 @@
+/*
+ * usb_loopback.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <core/nxdt_utils.h>
+#include <core/usb_transport.h>
+
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "usb_loopback.h"
+
+#define LOOPBACK_URB_QUEUE_SIZE     8                           /* Maximum number of in-flight URBs per endpoint. */
+#define LOOPBACK_REPORT_COUNT       8                           /* Completed URBs kept around per endpoint, just like usb:ds report data. */
+
+/* Type definitions. */
+
+typedef enum {
+    LoopbackUrbStatus_Pending   = 0,
+    LoopbackUrbStatus_Completed = 3,
+    LoopbackUrbStatus_Failed    = 4
+} LoopbackUrbStatus;
+
+typedef struct {
+    u32 id;
+    u8 *buf;
+    u32 size;
+    u32 transferred;
+    u8 status;      ///< LoopbackUrbStatus.
+} LoopbackUrb;
+
+typedef struct {
+    u8 index;                                   ///< UsbTransportEndpoint.
+    Thread thread;
+    bool thread_created;
+    Mutex mutex;
+    CondVar cond;
+    LoopbackUrb queue[LOOPBACK_URB_QUEUE_SIZE]; ///< Pending URBs. The one at the head is being processed by the endpoint thread.
+    u32 queue_head, queue_count;
+    LoopbackUrb reports[LOOPBACK_REPORT_COUNT]; ///< Ring of completed URBs.
+    u32 report_idx;
+    u32 urb_id;
+    bool busy;                                  ///< Set while the endpoint thread is transferring data for the URB at the head of the queue.
+    bool exit;
+    Event completion_event;
+} LoopbackEndpoint;
+
+/* Global variables. */
+
+static int g_loopbackSocket = -1;
+static u32 g_loopbackLatency = 0;
+static u64 g_loopbackBandwidth = 0;
+
+static LoopbackEndpoint g_loopbackEndpoints[UsbTransportEndpoint_Count] = {0};
+static Event g_loopbackStateChangeEvent = {0};
+static atomic_bool g_loopbackHostAvailable = false;
+
+static u64 g_loopbackUrbCount[UsbTransportEndpoint_Count] = {0}, g_loopbackByteCount[UsbTransportEndpoint_Count] = {0};
+
+/* Function prototypes. */
+
+static void usbLoopbackEndpointThreadFunc(void *arg);
+
+static bool usbLoopbackSend(const void *buf, size_t size);
+static bool usbLoopbackReceive(void *buf, size_t size);
+static bool usbLoopbackTransfer(u8 endpoint, u8 *buf, u32 size, u32 *out_transferred);
+static void usbLoopbackThrottle(u64 start_ns, u32 size);
+
+static void usbLoopbackDisconnect(void);
+
+NX_INLINE u64 usbLoopbackGetTimeNs(void);
+NX_INLINE LoopbackEndpoint *usbLoopbackGetEndpoint(u8 endpoint);
+NX_INLINE void usbLoopbackCompleteUrb(LoopbackEndpoint *ep, const LoopbackUrb *urb);
+
+void usbLoopbackSetSocket(int fd)
+{
+    g_loopbackSocket = fd;
+}
+
+void usbLoopbackSetLinkProfile(u32 latency_us, u64 bandwidth)
+{
+    g_loopbackLatency = latency_us;
+    g_loopbackBandwidth = bandwidth;
+}
+
+void usbLoopbackGetStats(UsbLoopbackStats *out_stats)
+{
+    if (!out_stats) return;
+
+    for(u8 i = 0; i < UsbTransportEndpoint_Count; i++)
+    {
+        out_stats->urb_count[i] = __atomic_load_n(&(g_loopbackUrbCount[i]), __ATOMIC_RELAXED);
+        out_stats->byte_count[i] = __atomic_load_n(&(g_loopbackByteCount[i]), __ATOMIC_RELAXED);
+    }
+}
+
+void usbLoopbackResetStats(void)
+{
+    for(u8 i = 0; i < UsbTransportEndpoint_Count; i++)
+    {
+        __atomic_store_n(&(g_loopbackUrbCount[i]), 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&(g_loopbackByteCount[i]), 0, __ATOMIC_RELAXED);
+    }
+}
+
+bool usbTransportInitialize(void)
+{
+    if (g_loopbackSocket < 0)
+    {
+        LOG_MSG_ERROR("Loopback socket not set!");
+        return false;
+    }
+
+    eventCreate(&g_loopbackStateChangeEvent, true);
+
+    for(u8 i = 0; i < UsbTransportEndpoint_Count; i++)
+    {
+        LoopbackEndpoint *ep = &(g_loopbackEndpoints[i]);
+
+        memset(ep, 0, sizeof(LoopbackEndpoint));
+        ep->index = i;
+
+        /* usb:ds completion events aren't cleared automatically. */
+        eventCreate(&(ep->completion_event), false);
+
+        ep->thread_created = utilsCreateThread(&(ep->thread), usbLoopbackEndpointThreadFunc, ep, 0);
+        if (!ep->thread_created)
+        {
+            LOG_MSG_ERROR("Failed to create thread for loopback endpoint #%u!", i);
+            usbTransportExit();
+            return false;
+        }
+    }
+
+    /* The host device is already connected by the time we get here. */
+    atomic_store(&g_loopbackHostAvailable, true);
+    eventFire(&g_loopbackStateChangeEvent);
+
+    return true;
+}
+
+void usbTransportExit(void)
+{
+    /* Unblock endpoint threads that may be waiting for data. */
+    usbLoopbackDisconnect();
+
+    for(u8 i = 0; i < UsbTransportEndpoint_Count; i++)
+    {
+        LoopbackEndpoint *ep = &(g_loopbackEndpoints[i]);
+        if (!ep->thread_created) continue;
+
+        SCOPED_LOCK(&(ep->mutex))
+        {
+            ep->exit = true;
+            condvarWakeAll(&(ep->cond));
+        }
+
+        utilsJoinThread(&(ep->thread));
+        ep->thread_created = false;
+    }
+}
+
+Event *usbTransportGetStateChangeEvent(void)
+{
+    return &g_loopbackStateChangeEvent;
+}
+
+bool usbTransportIsHostAvailable(void)
+{
+    return atomic_load(&g_loopbackHostAvailable);
+}
+
+void usbTransportSetZlt(bool enable)
+{
+    /* Transfer boundaries are preserved by the message framing, so ZLT packets aren't needed. */
+    NX_IGNORE_ARG(enable);
+}
+
+Result usbTransportPostBuffer(u8 endpoint, void *buf, u32 size, u32 *out_urb_id)
+{
+    LoopbackEndpoint *ep = usbLoopbackGetEndpoint(endpoint);
+    Result rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (!ep || !buf || !size || !out_urb_id) return rc;
+
+    SCOPED_LOCK(&(ep->mutex))
+    {
+        if (ep->queue_count >= LOOPBACK_URB_QUEUE_SIZE)
+        {
+            LOG_MSG_ERROR("Too many in-flight URBs for loopback endpoint #%u!", endpoint);
+            break;
+        }
+
+        LoopbackUrb *urb = &(ep->queue[(ep->queue_head + ep->queue_count) % LOOPBACK_URB_QUEUE_SIZE]);
+
+        urb->id = *out_urb_id = ++(ep->urb_id);
+        urb->buf = (u8*)buf;
+        urb->size = size;
+        urb->transferred = 0;
+        urb->status = LoopbackUrbStatus_Pending;
+
+        ep->queue_count++;
+        condvarWakeAll(&(ep->cond));
+
+        rc = 0;
+    }
+
+    return rc;
+}
+
+Event *usbTransportGetCompletionEvent(u8 endpoint)
+{
+    LoopbackEndpoint *ep = usbLoopbackGetEndpoint(endpoint);
+    return (ep ? &(ep->completion_event) : NULL);
+}
+
+Result usbTransportGetUrbStatus(u8 endpoint, u32 urb_id, bool *out_completed, u32 *out_transferred_size)
+{
+    LoopbackEndpoint *ep = usbLoopbackGetEndpoint(endpoint);
+    Result rc = MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (!ep || !out_completed || !out_transferred_size) return rc;
+
+    SCOPED_LOCK(&(ep->mutex))
+    {
+        rc = MAKERESULT(Module_Libnx, LibnxError_NotFound);
+
+        for(u32 i = 0; i < ep->queue_count; i++)
+        {
+            if (ep->queue[(ep->queue_head + i) % LOOPBACK_URB_QUEUE_SIZE].id != urb_id) continue;
+            *out_completed = false;
+            rc = 0;
+            break;
+        }
+
+        if (R_SUCCEEDED(rc)) break;
+
+        for(u32 i = 0; i < LOOPBACK_REPORT_COUNT; i++)
+        {
+            LoopbackUrb *urb = &(ep->reports[i]);
+            if (!urb->id || urb->id != urb_id) continue;
+
+            *out_completed = true;
+            *out_transferred_size = urb->transferred;
+            rc = (urb->status == LoopbackUrbStatus_Completed ? 0 : MAKERESULT(Module_Libnx, LibnxError_IoError));
+            break;
+        }
+    }
+
+    if (R_FAILED(rc)) LOG_MSG_ERROR("Failed to retrieve status for URB %u from loopback endpoint #%u! (0x%X).", urb_id, endpoint, rc);
+
+    return rc;
+}
+
+void usbTransportCancel(u8 endpoint)
+{
+    LoopbackEndpoint *ep = usbLoopbackGetEndpoint(endpoint);
+    bool busy = false;
+
+    if (!ep) return;
+
+    SCOPED_LOCK(&(ep->mutex))
+    {
+        /* Fail all URBs that haven't been picked by the endpoint thread yet. */
+        u32 first = (ep->busy ? 1 : 0);
+
+        for(u32 i = first; i < ep->queue_count; i++)
+        {
+            LoopbackUrb *urb = &(ep->queue[(ep->queue_head + i) % LOOPBACK_URB_QUEUE_SIZE]);
+            urb->status = LoopbackUrbStatus_Failed;
+            usbLoopbackCompleteUrb(ep, urb);
+        }
+
+        ep->queue_count = first;
+        busy = ep->busy;
+    }
+
+    if (busy)
+    {
+        /* Data for the current URB may have already been partially transferred, which would break the message framing for good. */
+        /* Just like a USB reset, we drop the connection. The endpoint thread signals the completion event on its own once the transfer fails. */
+        usbLoopbackDisconnect();
+    } else {
+        eventFire(&(ep->completion_event));
+    }
+}
+
+static void usbLoopbackEndpointThreadFunc(void *arg)
+{
+    LoopbackEndpoint *ep = (LoopbackEndpoint*)arg;
+    LoopbackUrb urb = {0};
+    bool success = false;
+
+    while(true)
+    {
+        SCOPED_LOCK(&(ep->mutex))
+        {
+            while(!ep->exit && !ep->queue_count) condvarWait(&(ep->cond), &(ep->mutex));
+            if (ep->exit) break;
+
+            urb = ep->queue[ep->queue_head];
+            ep->busy = true;
+        }
+
+        if (ep->exit) break;
+
+        /* Transfer data without holding the lock. New URBs may be posted in the meantime. */
+        success = usbLoopbackTransfer(ep->index, urb.buf, urb.size, &(urb.transferred));
+        urb.status = (success ? LoopbackUrbStatus_Completed : LoopbackUrbStatus_Failed);
+
+        SCOPED_LOCK(&(ep->mutex))
+        {
+            usbLoopbackCompleteUrb(ep, &urb);
+            ep->queue_head = ((ep->queue_head + 1) % LOOPBACK_URB_QUEUE_SIZE);
+            ep->queue_count--;
+            ep->busy = false;
+        }
+
+        if (success)
+        {
+            __atomic_fetch_add(&(g_loopbackUrbCount[ep->index]), 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&(g_loopbackByteCount[ep->index]), urb.transferred, __ATOMIC_RELAXED);
+        } else {
+            usbLoopbackDisconnect();
+        }
+
+        eventFire(&(ep->completion_event));
+    }
+
+    threadExit();
+}
+
+static bool usbLoopbackSend(const void *buf, size_t size)
+{
+    const u8 *data = (const u8*)buf;
+
+    while(size)
+    {
+        ssize_t ret = send(g_loopbackSocket, data, size, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+
+        data += ret;
+        size -= (size_t)ret;
+    }
+
+    return true;
+}
+
+static bool usbLoopbackReceive(void *buf, size_t size)
+{
+    u8 *data = (u8*)buf;
+
+    while(size)
+    {
+        ssize_t ret = recv(g_loopbackSocket, data, size, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) return false;
+
+        data += ret;
+        size -= (size_t)ret;
+    }
+
+    return true;
+}
+
+static bool usbLoopbackTransfer(u8 endpoint, u8 *buf, u32 size, u32 *out_transferred)
+{
+    u64 start_ns = usbLoopbackGetTimeNs();
+    u32 msg_size = size;
+    bool ret = false;
+
+    if (!atomic_load(&g_loopbackHostAvailable)) return false;
+
+    if (endpoint == UsbTransportEndpoint_In)
+    {
+        /* Each message holds a single transfer. */
+        ret = (usbLoopbackSend(&msg_size, sizeof(u32)) && usbLoopbackSend(buf, size));
+    } else {
+        /* Just like with bulk transfers, the host device may send less data than requested, but never more. */
+        ret = usbLoopbackReceive(&msg_size, sizeof(u32));
+        if (ret && msg_size > size)
+        {
+            LOG_MSG_ERROR("Loopback transfer overflow! (0x%X > 0x%X).", msg_size, size);
+            ret = false;
+        }
+
+        if (ret) ret = usbLoopbackReceive(buf, msg_size);
+    }
+
+    if (!ret) return false;
+
+    usbLoopbackThrottle(start_ns, msg_size);
+
+    *out_transferred = msg_size;
+
+    return true;
+}
+
+static void usbLoopbackThrottle(u64 start_ns, u32 size)
+{
+    u64 target_ns = (start_ns + ((u64)g_loopbackLatency * 1000));
+    if (g_loopbackBandwidth) target_ns += (((u64)size * 1000000000) / g_loopbackBandwidth);
+
+    u64 cur_ns = usbLoopbackGetTimeNs();
+    if (cur_ns >= target_ns) return;
+
+    u64 diff = (target_ns - cur_ns);
+    struct timespec ts = { .tv_sec = (time_t)(diff / 1000000000), .tv_nsec = (long)(diff % 1000000000) };
+
+    while(nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+static void usbLoopbackDisconnect(void)
+{
+    if (!atomic_exchange(&g_loopbackHostAvailable, false)) return;
+
+    /* Makes pending send() / recv() calls fail right away. */
+    shutdown(g_loopbackSocket, SHUT_RDWR);
+
+    eventFire(&g_loopbackStateChangeEvent);
+}
+
+NX_INLINE u64 usbLoopbackGetTimeNs(void)
+{
+    return armTicksToNs(armGetSystemTick());
+}
+
+NX_INLINE LoopbackEndpoint *usbLoopbackGetEndpoint(u8 endpoint)
+{
+    return (endpoint < UsbTransportEndpoint_Count ? &(g_loopbackEndpoints[endpoint]) : NULL);
+}
+
+NX_INLINE void usbLoopbackCompleteUrb(LoopbackEndpoint *ep, const LoopbackUrb *urb)
+{
+    memcpy(&(ep->reports[ep->report_idx]), urb, sizeof(LoopbackUrb));
+    ep->report_idx = ((ep->report_idx + 1) % LOOPBACK_REPORT_COUNT);
+}
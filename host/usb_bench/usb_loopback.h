@@ -0,0 +1,55 @@
+/*
+ * usb_loopback.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __USB_LOOPBACK_H__
+#define __USB_LOOPBACK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Loopback USB transport. Implements the interface from usb_transport.h on top of a connected stream socket.
+/// Each transfer is sent as a single message prefixed by its 32-bit little endian length, just like 'nxdt_host.py --loopback' expects.
+
+/// Transfer statistics, indexed by UsbTransportEndpoint values.
+typedef struct {
+    u64 urb_count[UsbTransportEndpoint_Count];
+    u64 byte_count[UsbTransportEndpoint_Count];
+} UsbLoopbackStats;
+
+/// Sets the socket used by the transport. Must be called before usbInitialize(). The socket is owned by the caller.
+void usbLoopbackSetSocket(int fd);
+
+/// Emulates a slower link. Each transfer takes at least 'latency_us' microseconds, plus the time needed to move its data at 'bandwidth' bytes per second.
+/// Zero disables each one of them. Must be called before usbInitialize().
+void usbLoopbackSetLinkProfile(u32 latency_us, u64 bandwidth);
+
+/// Retrieves the statistics gathered since the last usbLoopbackResetStats() call.
+void usbLoopbackGetStats(UsbLoopbackStats *out_stats);
+void usbLoopbackResetStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_LOOPBACK_H__ */
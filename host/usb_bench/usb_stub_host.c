@@ -0,0 +1,617 @@
+/*
+ * usb_stub_host.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <core/nxdt_utils.h>
+#include <core/usb.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "usb_stub_host.h"
+
+#define STUB_ABI_VERSION            0x12                        /* 1.2. */
+
+#define STUB_CMD_MAGIC              "NXDT"
+#define STUB_FRAME_MAGIC            "NXLZ"
+#define STUB_CHUNK_MAGIC            "NXCK"
+
+#define STUB_MESSAGE_MAX_SIZE       (USB_TRANSFER_BUFFER_SIZE + 0x2000) /* Full transfer buffer + frame header + chunk trailer, rounded up. */
+#define STUB_STREAM_MAX_COUNT       8
+
+#define STUB_FEATURE_LZ4            BIT(0)
+#define STUB_FEATURE_CHECKSUM       BIT(4)
+
+/* Type definitions. */
+
+typedef enum {
+    StubCommand_StartSession                = 0,
+    StubCommand_SendFileProperties          = 1,
+    StubCommand_CancelFileTransfer          = 2,
+    StubCommand_SendNspHeader               = 3,
+    StubCommand_EndSession                  = 4,
+    StubCommand_StartExtractedFsDump        = 5,
+    StubCommand_EndExtractedFsDump          = 6,
+    StubCommand_SendFileBatch               = 7,
+    StubCommand_OpenStream                  = 8,
+    StubCommand_SendStreamData              = 9,
+    StubCommand_CloseStream                 = 10,
+    StubCommand_SendResumableFileProperties = 11
+} StubCommand;
+
+typedef enum {
+    StubStatus_Success               = 0,
+    StubStatus_InvalidMagicWord      = 4,
+    StubStatus_UnsupportedCommand    = 5,
+    StubStatus_UnsupportedAbiVersion = 6,
+    StubStatus_MalformedCommand      = 7,
+    StubStatus_Abort                 = 0xFF     ///< Internal usage. The connection must be dropped.
+} StubStatus;
+
+typedef struct {
+    char magic[4];
+    u32 cmd;
+    u32 cmd_block_size;
+    u8 reserved[0x4];
+} StubCommandHeader;
+
+NXDT_ASSERT(StubCommandHeader, 0x10);
+
+typedef struct {
+    char magic[4];
+    u32 status;
+    u16 max_packet_size;
+    u8 features;
+    u8 reserved[0x5];
+} StubStatusResponse;
+
+NXDT_ASSERT(StubStatusResponse, 0x10);
+
+/// Shared by chunk trailers and chunk acknowledgements.
+typedef struct {
+    char magic[4];
+    u32 value;              ///< CRC32C for trailers, resend flag for acknowledgements.
+    u64 offset;
+} StubChunkTrailer;
+
+NXDT_ASSERT(StubChunkTrailer, 0x10);
+
+typedef struct {
+    char magic[4];
+    u32 raw_size;
+    u32 stored_size;
+    u8 compressed;
+    u8 reserved[0x3];
+} StubFrameHeader;
+
+NXDT_ASSERT(StubFrameHeader, 0x10);
+
+typedef struct {
+    char magic[4];
+    u32 window_crc;
+    u64 offset;
+} StubResumeInfo;
+
+NXDT_ASSERT(StubResumeInfo, 0x10);
+
+typedef struct {
+    u32 id;
+    u64 size;
+    u64 received;
+} StubStream;
+
+/* Global variables. */
+
+static int g_stubSocket = -1;
+static UsbStubHostConfig g_stubConfig = {0};
+static Thread g_stubThread = {0};
+static bool g_stubThreadCreated = false;
+
+static u8 *g_stubBuffer = NULL, *g_stubDecodeBuffer = NULL;
+static u8 g_stubFeatures = 0;
+
+static bool g_stubNspMode = false;
+static u64 g_stubNspSize = 0, g_stubNspRemainingSize = 0;
+static u32 g_stubNspHeaderSize = 0;
+
+static StubStream g_stubStreams[STUB_STREAM_MAX_COUNT] = {0};
+static u32 g_stubLastStreamId = 0;
+
+static UsbStubHostStats g_stubStats = {0};
+
+/* Function prototypes. */
+
+static void usbStubHostThreadFunc(void *arg);
+
+static bool usbStubHostReadMessage(u8 *buf, u32 max_size, u32 *out_size);
+static bool usbStubHostWriteMessage(const void *buf, u32 size);
+static bool usbStubHostSendStatus(u32 status);
+
+static u32 usbStubHostHandleCommand(u32 cmd, const u8 *cmd_block, u32 cmd_block_size, bool *out_end_session);
+static u32 usbStubHostHandleStartSession(const u8 *cmd_block, u32 cmd_block_size);
+static u32 usbStubHostHandleSendFileProperties(const u8 *cmd_block, u32 cmd_block_size, bool resume);
+static u32 usbStubHostHandleSendNspHeader(u32 cmd_block_size);
+static u32 usbStubHostHandleSendFileBatch(const u8 *cmd_block, u32 cmd_block_size);
+static u32 usbStubHostHandleOpenStream(const u8 *cmd_block, u32 cmd_block_size);
+static u32 usbStubHostHandleSendStreamData(const u8 *cmd_block, u32 cmd_block_size);
+static u32 usbStubHostHandleCloseStream(const u8 *cmd_block, u32 cmd_block_size);
+
+static u32 usbStubHostReceiveFileData(u64 size);
+
+NX_INLINE StubStream *usbStubHostGetStream(u32 id);
+
+bool usbStubHostStart(int fd, const UsbStubHostConfig *config)
+{
+    if (fd < 0 || !config || g_stubThreadCreated)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    if (!g_stubBuffer) g_stubBuffer = malloc(STUB_MESSAGE_MAX_SIZE);
+    if (!g_stubDecodeBuffer) g_stubDecodeBuffer = malloc(USB_TRANSFER_BUFFER_SIZE);
+
+    if (!g_stubBuffer || !g_stubDecodeBuffer)
+    {
+        LOG_MSG_ERROR("Failed to allocate memory for the stub host buffers!");
+        return false;
+    }
+
+    g_stubSocket = fd;
+    memcpy(&g_stubConfig, config, sizeof(UsbStubHostConfig));
+    memset(&g_stubStats, 0, sizeof(UsbStubHostStats));
+
+    g_stubThreadCreated = utilsCreateThread(&g_stubThread, usbStubHostThreadFunc, NULL, 0);
+    if (!g_stubThreadCreated) LOG_MSG_ERROR("Failed to create stub host thread!");
+
+    return g_stubThreadCreated;
+}
+
+void usbStubHostWait(void)
+{
+    if (!g_stubThreadCreated) return;
+
+    utilsJoinThread(&g_stubThread);
+    g_stubThreadCreated = false;
+
+    free(g_stubBuffer);
+    free(g_stubDecodeBuffer);
+    g_stubBuffer = g_stubDecodeBuffer = NULL;
+}
+
+void usbStubHostGetStats(UsbStubHostStats *out_stats)
+{
+    if (out_stats) memcpy(out_stats, &g_stubStats, sizeof(UsbStubHostStats));
+}
+
+static void usbStubHostThreadFunc(void *arg)
+{
+    NX_IGNORE_ARG(arg);
+
+    StubCommandHeader cmd_header = {0};
+    u32 size = 0, status = 0;
+    bool end_session = false;
+
+    g_stubFeatures = 0;
+    g_stubNspMode = false;
+    memset(g_stubStreams, 0, sizeof(g_stubStreams));
+    g_stubLastStreamId = 0;
+
+    while(!end_session)
+    {
+        /* Read command header. */
+        if (!usbStubHostReadMessage(g_stubBuffer, STUB_MESSAGE_MAX_SIZE, &size)) break;
+
+        if (size != sizeof(StubCommandHeader))
+        {
+            LOG_MSG_ERROR("Invalid command header size! (0x%X).", size);
+            break;
+        }
+
+        memcpy(&cmd_header, g_stubBuffer, sizeof(StubCommandHeader));
+
+        /* The command block is always sent right after the header. */
+        if (cmd_header.cmd_block_size)
+        {
+            if (!usbStubHostReadMessage(g_stubBuffer, STUB_MESSAGE_MAX_SIZE, &size)) break;
+
+            if (size != cmd_header.cmd_block_size)
+            {
+                LOG_MSG_ERROR("Command block size mismatch! (0x%X != 0x%X).", size, cmd_header.cmd_block_size);
+                break;
+            }
+        }
+
+        if (memcmp(cmd_header.magic, STUB_CMD_MAGIC, sizeof(cmd_header.magic)) != 0)
+        {
+            status = StubStatus_InvalidMagicWord;
+        } else {
+            status = usbStubHostHandleCommand(cmd_header.cmd, g_stubBuffer, cmd_header.cmd_block_size, &end_session);
+        }
+
+        if (status == StubStatus_Abort) break;
+
+        g_stubStats.cmd_count++;
+        if (status != StubStatus_Success) g_stubStats.error_count++;
+
+        if (!usbStubHostSendStatus(status)) break;
+    }
+
+    /* Let the console know we're gone. */
+    shutdown(g_stubSocket, SHUT_RDWR);
+
+    threadExit();
+}
+
+static bool usbStubHostReadMessage(u8 *buf, u32 max_size, u32 *out_size)
+{
+    u32 msg_size = 0, offset = 0;
+    ssize_t ret = 0;
+
+    for(offset = 0; offset < sizeof(u32); offset += (u32)ret)
+    {
+        ret = recv(g_stubSocket, (u8*)&msg_size + offset, sizeof(u32) - offset, 0);
+        if (ret < 0 && errno == EINTR) { ret = 0; continue; }
+        if (ret <= 0) return false;
+    }
+
+    if (msg_size > max_size)
+    {
+        LOG_MSG_ERROR("Message too big! (0x%X > 0x%X).", msg_size, max_size);
+        return false;
+    }
+
+    for(offset = 0; offset < msg_size; offset += (u32)ret)
+    {
+        ret = recv(g_stubSocket, buf + offset, msg_size - offset, 0);
+        if (ret < 0 && errno == EINTR) { ret = 0; continue; }
+        if (ret <= 0) return false;
+    }
+
+    *out_size = msg_size;
+
+    return true;
+}
+
+static bool usbStubHostWriteMessage(const void *buf, u32 size)
+{
+    u8 msg[sizeof(u32) + 0x20] = {0};
+    size_t msg_size = (sizeof(u32) + size), offset = 0;
+    ssize_t ret = 0;
+
+    /* Only small messages are ever sent by the host device. */
+    if (size > (sizeof(msg) - sizeof(u32))) return false;
+
+    memcpy(msg, &size, sizeof(u32));
+    memcpy(msg + sizeof(u32), buf, size);
+
+    for(offset = 0; offset < msg_size; offset += (size_t)ret)
+    {
+        ret = send(g_stubSocket, msg + offset, msg_size - offset, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR) { ret = 0; continue; }
+        if (ret <= 0) return false;
+    }
+
+    return true;
+}
+
+static bool usbStubHostSendStatus(u32 status)
+{
+    StubStatusResponse resp = { .status = status, .max_packet_size = g_stubConfig.max_packet_size, .features = g_stubFeatures };
+    memcpy(resp.magic, STUB_CMD_MAGIC, sizeof(resp.magic));
+    return usbStubHostWriteMessage(&resp, sizeof(StubStatusResponse));
+}
+
+static u32 usbStubHostHandleCommand(u32 cmd, const u8 *cmd_block, u32 cmd_block_size, bool *out_end_session)
+{
+    switch(cmd)
+    {
+        case StubCommand_StartSession:
+            return usbStubHostHandleStartSession(cmd_block, cmd_block_size);
+        case StubCommand_SendFileProperties:
+        case StubCommand_SendResumableFileProperties:
+            return usbStubHostHandleSendFileProperties(cmd_block, cmd_block_size, cmd == StubCommand_SendResumableFileProperties);
+        case StubCommand_CancelFileTransfer:
+            g_stubNspMode = false;
+            return StubStatus_Success;
+        case StubCommand_SendNspHeader:
+            return usbStubHostHandleSendNspHeader(cmd_block_size);
+        case StubCommand_EndSession:
+            *out_end_session = true;
+            return StubStatus_Success;
+        case StubCommand_StartExtractedFsDump:
+            return ((cmd_block_size == 0x310 && !g_stubNspMode) ? StubStatus_Success : StubStatus_MalformedCommand);
+        case StubCommand_EndExtractedFsDump:
+            return StubStatus_Success;
+        case StubCommand_SendFileBatch:
+            return usbStubHostHandleSendFileBatch(cmd_block, cmd_block_size);
+        case StubCommand_OpenStream:
+            return usbStubHostHandleOpenStream(cmd_block, cmd_block_size);
+        case StubCommand_SendStreamData:
+            return usbStubHostHandleSendStreamData(cmd_block, cmd_block_size);
+        case StubCommand_CloseStream:
+            return usbStubHostHandleCloseStream(cmd_block, cmd_block_size);
+        default:
+            break;
+    }
+
+    return StubStatus_UnsupportedCommand;
+}
+
+static u32 usbStubHostHandleStartSession(const u8 *cmd_block, u32 cmd_block_size)
+{
+    if (cmd_block_size != 0x10) return StubStatus_MalformedCommand;
+    if (cmd_block[3] != STUB_ABI_VERSION) return StubStatus_UnsupportedAbiVersion;
+
+    /* Accept the requested features we've been told to support. */
+    g_stubFeatures = (cmd_block[12] & g_stubConfig.features);
+
+    return StubStatus_Success;
+}
+
+static u32 usbStubHostHandleSendFileProperties(const u8 *cmd_block, u32 cmd_block_size, bool resume)
+{
+    u64 file_size = 0;
+    u32 filename_length = 0, nsp_header_size = 0;
+
+    if (cmd_block_size != 0x320) return StubStatus_MalformedCommand;
+
+    memcpy(&file_size, cmd_block, sizeof(u64));
+    memcpy(&filename_length, cmd_block + 0x8, sizeof(u32));
+    memcpy(&nsp_header_size, cmd_block + 0xC, sizeof(u32));
+
+    if ((!g_stubNspMode && file_size && nsp_header_size >= file_size) || (g_stubNspMode && nsp_header_size) || (resume && (g_stubNspMode || nsp_header_size)) || \
+        !filename_length || filename_length >= FS_MAX_PATH) return StubStatus_MalformedCommand;
+
+    /* Enable NSP transfer mode, if needed. No data is sent for the first SendFileProperties command from a NSP. */
+    if (!g_stubNspMode && file_size && nsp_header_size)
+    {
+        g_stubNspMode = true;
+        g_stubNspSize = file_size;
+        g_stubNspHeaderSize = nsp_header_size;
+        g_stubNspRemainingSize = (file_size - nsp_header_size);
+        return StubStatus_Success;
+    }
+
+    if (resume)
+    {
+        /* We never hold any data from previous transfers. */
+        StubResumeInfo resume_info = {0};
+        memcpy(resume_info.magic, STUB_CMD_MAGIC, sizeof(resume_info.magic));
+
+        if (!usbStubHostSendStatus(StubStatus_Success) || !usbStubHostWriteMessage(&resume_info, sizeof(StubResumeInfo))) return StubStatus_Abort;
+        if (!file_size) return StubStatus_Success;
+    } else {
+        if (!file_size) return StubStatus_Success;
+        if (!usbStubHostSendStatus(StubStatus_Success)) return StubStatus_Abort;
+    }
+
+    if (g_stubNspMode)
+    {
+        if (file_size > g_stubNspRemainingSize) return StubStatus_Abort;
+        g_stubNspRemainingSize -= file_size;
+    }
+
+    return usbStubHostReceiveFileData(file_size);
+}
+
+static u32 usbStubHostHandleSendNspHeader(u32 cmd_block_size)
+{
+    if (!g_stubNspMode || g_stubNspRemainingSize || cmd_block_size != g_stubNspHeaderSize) return StubStatus_MalformedCommand;
+    g_stubNspMode = false;
+    return StubStatus_Success;
+}
+
+static u32 usbStubHostHandleSendFileBatch(const u8 *cmd_block, u32 cmd_block_size)
+{
+    u64 total_size = 0, manifest_size = 0, file_size = 0;
+    u32 file_count = 0, path_length = 0, offset = 0x10;
+
+    if (cmd_block_size < 0x10 || g_stubNspMode) return StubStatus_MalformedCommand;
+
+    memcpy(&total_size, cmd_block, sizeof(u64));
+    memcpy(&file_count, cmd_block + 0x8, sizeof(u32));
+
+    for(u32 i = 0; i < file_count; i++)
+    {
+        if ((offset + 0x10) > cmd_block_size) return StubStatus_MalformedCommand;
+
+        memcpy(&file_size, cmd_block + offset, sizeof(u64));
+        memcpy(&path_length, cmd_block + offset + 0x8, sizeof(u32));
+
+        if (!path_length || path_length >= FS_MAX_PATH || (offset + 0x10 + path_length) > cmd_block_size) return StubStatus_MalformedCommand;
+
+        manifest_size += file_size;
+        offset += (u32)ALIGN_UP(0x10 + path_length, 8);
+    }
+
+    if (!file_count || manifest_size != total_size) return StubStatus_MalformedCommand;
+    if (!total_size) return StubStatus_Success;
+
+    if (!usbStubHostSendStatus(StubStatus_Success)) return StubStatus_Abort;
+
+    return usbStubHostReceiveFileData(total_size);
+}
+
+static u32 usbStubHostHandleOpenStream(const u8 *cmd_block, u32 cmd_block_size)
+{
+    StubStream *stream = NULL;
+    u32 id = 0;
+    u64 size = 0;
+
+    if (cmd_block_size != 0x318) return StubStatus_MalformedCommand;
+
+    memcpy(&id, cmd_block, sizeof(u32));
+    memcpy(&size, cmd_block + 0x8, sizeof(u64));
+
+    if (!id || usbStubHostGetStream(id) || !(stream = usbStubHostGetStream(0))) return StubStatus_MalformedCommand;
+
+    stream->id = id;
+    stream->size = size;
+    stream->received = 0;
+
+    return StubStatus_Success;
+}
+
+static u32 usbStubHostHandleSendStreamData(const u8 *cmd_block, u32 cmd_block_size)
+{
+    StubStream *stream = NULL;
+    u32 id = 0, data_size = 0;
+    u64 offset = 0;
+
+    if (cmd_block_size <= 0x10) return StubStatus_MalformedCommand;
+
+    memcpy(&id, cmd_block, sizeof(u32));
+    memcpy(&data_size, cmd_block + 0x4, sizeof(u32));
+    memcpy(&offset, cmd_block + 0x8, sizeof(u64));
+
+    if (!id || !(stream = usbStubHostGetStream(id)) || data_size != (cmd_block_size - 0x10) || (offset + data_size) > stream->size) return StubStatus_MalformedCommand;
+
+    if (g_stubLastStreamId && g_stubLastStreamId != id) g_stubStats.stream_switch_count++;
+    g_stubLastStreamId = id;
+
+    stream->received += data_size;
+    g_stubStats.data_size += data_size;
+    g_stubStats.chunk_count++;
+
+    return StubStatus_Success;
+}
+
+static u32 usbStubHostHandleCloseStream(const u8 *cmd_block, u32 cmd_block_size)
+{
+    StubStream *stream = NULL;
+    u32 id = 0;
+    bool complete = false;
+
+    if (cmd_block_size != 0x10) return StubStatus_MalformedCommand;
+
+    memcpy(&id, cmd_block, sizeof(u32));
+
+    if (!id || !(stream = usbStubHostGetStream(id))) return StubStatus_MalformedCommand;
+
+    complete = (cmd_block[4] || stream->received == stream->size);
+    memset(stream, 0, sizeof(StubStream));
+
+    return (complete ? StubStatus_Success : StubStatus_MalformedCommand);
+}
+
+static u32 usbStubHostReceiveFileData(u64 size)
+{
+    bool use_frames = (g_stubFeatures & STUB_FEATURE_LZ4), use_checksums = (g_stubFeatures & STUB_FEATURE_CHECKSUM);
+    u64 offset = 0, chunk_count = 0;
+    u32 chunk_size = 0;
+
+    while(offset < size)
+    {
+        if (!usbStubHostReadMessage(g_stubBuffer, STUB_MESSAGE_MAX_SIZE, &chunk_size)) return StubStatus_Abort;
+
+        g_stubStats.chunk_count++;
+
+        /* Check if we're dealing with a CancelFileTransfer command. */
+        if (chunk_size == sizeof(StubCommandHeader))
+        {
+            StubCommandHeader *cmd_header = (StubCommandHeader*)g_stubBuffer;
+            if (!memcmp(cmd_header->magic, STUB_CMD_MAGIC, sizeof(cmd_header->magic)) && cmd_header->cmd == StubCommand_CancelFileTransfer)
+            {
+                g_stubNspMode = false;
+                return StubStatus_Success;
+            }
+        }
+
+        if (use_checksums)
+        {
+            StubChunkTrailer trailer = {0}, ack = {0};
+            bool accepted = false;
+
+            if (chunk_size <= sizeof(StubChunkTrailer)) return StubStatus_Abort;
+
+            chunk_size -= (u32)sizeof(StubChunkTrailer);
+            memcpy(&trailer, g_stubBuffer + chunk_size, sizeof(StubChunkTrailer));
+
+            if (memcmp(trailer.magic, STUB_CHUNK_MAGIC, sizeof(trailer.magic)) != 0)
+            {
+                LOG_MSG_ERROR("Malformed file data chunk! (size 0x%X).", chunk_size);
+                return StubStatus_Abort;
+            }
+
+            /* Chunks past the expected offset are leftovers sent before the console found out about a previously rejected chunk. */
+            accepted = (trailer.offset == offset && crc32cCalculate(g_stubBuffer, chunk_size) == trailer.value);
+            if (accepted && g_stubConfig.reject_interval && (++chunk_count % g_stubConfig.reject_interval) == 0) accepted = false;
+
+            memcpy(ack.magic, STUB_CHUNK_MAGIC, sizeof(ack.magic));
+            ack.value = !accepted;
+            ack.offset = trailer.offset;
+
+            if (!usbStubHostWriteMessage(&ack, sizeof(StubChunkTrailer))) return StubStatus_Abort;
+
+            if (!accepted)
+            {
+                g_stubStats.rejected_count++;
+                continue;
+            }
+        }
+
+        if (use_frames)
+        {
+            StubFrameHeader frame = {0};
+
+            if (chunk_size < sizeof(StubFrameHeader)) return StubStatus_Abort;
+            memcpy(&frame, g_stubBuffer, sizeof(StubFrameHeader));
+
+            if (memcmp(frame.magic, STUB_FRAME_MAGIC, sizeof(frame.magic)) != 0 || frame.stored_size != (chunk_size - sizeof(StubFrameHeader)) || !frame.raw_size || \
+                frame.raw_size > (size - offset) || frame.raw_size > USB_TRANSFER_BUFFER_SIZE || (!frame.compressed && frame.stored_size != frame.raw_size))
+            {
+                LOG_MSG_ERROR("Malformed file data frame! (raw size 0x%X, stored size 0x%X, frame size 0x%X).", frame.raw_size, frame.stored_size, chunk_size);
+                return StubStatus_Abort;
+            }
+
+            if (frame.compressed && LZ4_decompress_safe((const char*)g_stubBuffer + sizeof(StubFrameHeader), (char*)g_stubDecodeBuffer, (int)frame.stored_size, \
+                                                        (int)frame.raw_size) != (int)frame.raw_size)
+            {
+                LOG_MSG_ERROR("Failed to decompress LZ4 file data frame!");
+                return StubStatus_Abort;
+            }
+
+            chunk_size = frame.raw_size;
+        }
+
+        if (chunk_size > (size - offset))
+        {
+            LOG_MSG_ERROR("Received more file data than expected! (0x%X > 0x%lX).", chunk_size, size - offset);
+            return StubStatus_Abort;
+        }
+
+        offset += chunk_size;
+        g_stubStats.data_size += chunk_size;
+    }
+
+    return StubStatus_Success;
+}
+
+NX_INLINE StubStream *usbStubHostGetStream(u32 id)
+{
+    for(u32 i = 0; i < STUB_STREAM_MAX_COUNT; i++)
+    {
+        if (g_stubStreams[i].id == id) return &(g_stubStreams[i]);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ * usb_stub_host.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __USB_STUB_HOST_H__
+#define __USB_STUB_HOST_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// In-process USB host device. Speaks the same protocol as nxdt_host.py over the loopback message framing, but discards all file data.
+/// File data is still fully validated: chunk checksums are verified and LZ4 frames are decoded.
+
+typedef struct {
+    u8 features;            ///< Session features accepted by the stub host, if requested by the console.
+    u16 max_packet_size;    ///< Endpoint max packet size reported to the console. Picks the USB speed seen by usb.c.
+    u32 reject_interval;    ///< If non-zero, every Nth checksummed chunk is rejected as if it were corrupted.
+} UsbStubHostConfig;
+
+typedef struct {
+    u64 cmd_count;              ///< Processed commands.
+    u64 data_size;              ///< Decoded file data bytes.
+    u64 chunk_count;            ///< File data transfers, including rejected ones.
+    u64 rejected_count;         ///< Rejected checksummed chunks.
+    u64 stream_switch_count;    ///< SendStreamData commands for a different stream than the previous one.
+    u32 error_count;            ///< Commands that didn't succeed.
+} UsbStubHostStats;
+
+/// Starts the stub host on the provided socket, using a background thread. The socket is owned by the caller.
+/// The thread exits after an EndSession command, or when the connection is closed.
+bool usbStubHostStart(int fd, const UsbStubHostConfig *config);
+
+/// Waits for the stub host thread to exit.
+void usbStubHostWait(void);
+
+/// Retrieves the stub host statistics.
+void usbStubHostGetStats(UsbStubHostStats *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_STUB_HOST_H__ */
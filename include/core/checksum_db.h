@@ -0,0 +1,84 @@
+/*
+ * checksum_db.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __CHECKSUM_DB_H__
+#define __CHECKSUM_DB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Logiqx XML DAT files (e.g. No-Intro) placed in this directory are used to build the offline checksum database.
+#define CHECKSUM_DB_DAT_PATH    DEVOPTAB_SDMC_DEVICE APP_BASE_PATH "dat/"
+
+/// Index file generated out of all available DAT files. It's automatically rebuilt whenever the DAT files are modified.
+#define CHECKSUM_DB_INDEX_PATH  CHECKSUM_DB_DAT_PATH "checksum_db.idx"
+
+#define CHECKSUM_DB_INDEX_MAGIC     0x4E584349  /* "NXCI". */
+#define CHECKSUM_DB_INDEX_VERSION   1
+
+/// Index file header. The sorted entry table is stored right after it, followed by the string table.
+/// All fields are stored using native endianness, which means the index file can be directly loaded or memory-mapped.
+typedef struct {
+    u32 magic;                  ///< "NXCI".
+    u32 version;                ///< CHECKSUM_DB_INDEX_VERSION.
+    u32 entry_count;
+    u32 string_table_size;
+    u32 dat_count;              ///< Number of DAT files used to generate this index.
+    u8 reserved[0x4];
+    u64 dat_size;               ///< Combined size from all DAT files used to generate this index.
+    u64 dat_mtime;              ///< Most recent modification timestamp from all DAT files used to generate this index.
+} ChecksumDbIndexHeader;
+
+NXDT_ASSERT(ChecksumDbIndexHeader, 0x28);
+
+/// Index entry. Entries are sorted by CRC32 and size.
+typedef struct {
+    u32 crc32;
+    u32 name_offset;            ///< Relative to the start of the string table. Points to the NULL-terminated title record name.
+    u64 size;
+    u8 sha1[SHA1_HASH_SIZE];    ///< Zeroed out if the DAT entry doesn't provide a SHA-1 checksum.
+    u8 reserved[0x4];
+} ChecksumDbIndexEntry;
+
+NXDT_ASSERT(ChecksumDbIndexEntry, 0x28);
+
+/// Initializes the offline checksum database interface. Builds the index file if it doesn't exist or if it's outdated.
+/// Only the entry table is kept in memory. Title record names are read from the index file on demand.
+/// Returns false if no DAT files are available or if an error occurs.
+/// Failed attempts are cached: further calls return false right away until the contents from the DAT directory change.
+bool checksumDbInitialize(void);
+
+/// Closes the offline checksum database interface.
+void checksumDbExit(void);
+
+/// Looks up a title record using the provided CRC32 checksum and size. Lazily initializes the interface if needed.
+/// If 'sha1' is provided, it's also compared against index entries that hold a SHA-1 checksum.
+/// If a match is found, the title record name is saved to 'out_name' and true is returned.
+bool checksumDbLookup(u32 crc32, u64 size, const u8 *sha1, char *out_name, size_t out_name_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CHECKSUM_DB_H__ */
@@ -305,6 +305,24 @@ typedef enum {
     GameCardStatus_Count                           = 6  ///< Total values supported by this enum.
 } GameCardStatus;
 
+/// Used by the gamecard I/O scheduler to sort pending read requests.
+typedef enum {
+    GameCardIoPriority_Low    = 0,  ///< Background processes (e.g. full gamecard image dumps).
+    GameCardIoPriority_Normal = 1,  ///< Default priority used by gamecardReadStorage().
+    GameCardIoPriority_High   = 2,  ///< Interactive reads (e.g. UI-driven filesystem browsing).
+    GameCardIoPriority_Count  = 3   ///< Total values supported by this enum.
+} GameCardIoPriority;
+
+/// Gamecard I/O scheduler statistics. Values are accumulated throughout the lifetime of the application.
+typedef struct {
+    u64 request_count;          ///< Total number of read requests submitted to the scheduler.
+    u64 merged_request_count;   ///< Number of read requests that were merged with adjacent requests and serviced by a single storage read.
+    u64 storage_read_count;     ///< Total number of storage reads issued by the scheduler.
+    u64 storage_switch_count;   ///< Number of times the open storage area had to be switched (normal <-> secure).
+    u32 queue_depth;            ///< Current number of pending read requests.
+    u32 max_queue_depth;        ///< Highest number of pending read requests observed at once.
+} GameCardIoStats;
+
 typedef enum {
     LotusAsicFirmwareType_ReadFw    = 0xFF,
     LotusAsicFirmwareType_ReadDevFw = 0xFFFF,
@@ -355,6 +373,18 @@ UEvent *gamecardGetStatusChangeUserEvent(void);
 /// Returns the current GameCardStatus value.
 u8 gamecardGetStatus(void);
 
+/// Mounts a gamecard image file (XCI), which is used in place of the inserted gamecard until gamecardUnmountImageFile() is called.
+/// Both normal and secure storage areas are served from the image file, using the same area switching, alignment and read buffer logic as the inserted gamecard.
+/// Image files with a prepended key area are supported, as well as trimmed image files. The gamecard status change user event is signaled either way.
+/// Data that can only be retrieved from the Lotus ASIC (e.g. GameCardSecurityInformation, FsGameCardIdSet and the bundled firmware update version) isn't available.
+bool gamecardMountImageFile(const char *path);
+
+/// Unmounts the currently mounted gamecard image file and reloads data from the inserted gamecard, if available.
+void gamecardUnmountImageFile(void);
+
+/// Returns true if a gamecard image file is currently mounted.
+bool gamecardIsImageFileMounted(void);
+
 /// Fills the provided GameCardSecurityInformation pointer.
 /// This area can't be read using gamecardReadStorage().
 bool gamecardGetSecurityInformation(GameCardSecurityInformation *out);
@@ -370,7 +400,30 @@ bool gamecardGetLotusAsicFirmwareBlob(LotusAsicFirmwareBlob *out_lafw_blob, u64
 /// Used to read raw data from the inserted gamecard. Supports unaligned reads.
 /// All required handles, changes between normal <-> secure storage areas and proper offset calculations are managed internally.
 /// 'offset' + 'read_size' must not exceed the value returned by gamecardGetTotalSize().
-bool gamecardReadStorage(void *out, u64 read_size, u64 offset);
+/// Requests from multiple threads are queued and serviced by the gamecard I/O scheduler, which sorts them by priority, storage area and offset.
+/// Small adjacent requests are merged into a single storage read. Blocks until the request has been serviced.
+bool gamecardReadStorageWithPriority(void *out, u64 read_size, u64 offset, u8 priority);
+
+/// Sets the GameCardIoPriority used by all gamecardReadStorage() calls issued by the current thread, which is GameCardIoPriority_Normal by default.
+/// Useful for threads that read gamecard data through other interfaces (e.g. NCA contexts). Explicit gamecardReadStorageWithPriority() calls aren't affected.
+/// Returns the previous value.
+u8 gamecardSetThreadIoPriority(u8 priority);
+
+/// Returns the GameCardIoPriority used by all gamecardReadStorage() calls issued by the current thread.
+u8 gamecardGetThreadIoPriority(void);
+
+/// Same as gamecardReadStorageWithPriority(), but using the priority set for the current thread through gamecardSetThreadIoPriority().
+NX_INLINE bool gamecardReadStorage(void *out, u64 read_size, u64 offset)
+{
+    return gamecardReadStorageWithPriority(out, read_size, offset, gamecardGetThreadIoPriority());
+}
+
+/// Fills the provided GameCardIoStats pointer with the current gamecard I/O scheduler statistics.
+bool gamecardGetIoStats(GameCardIoStats *out);
+
+/// Resets the highest queue depth from the gamecard I/O scheduler statistics to the current queue depth.
+/// Unlike the rest of the statistics, it can't be calculated for a specific time span using two snapshots, so this must be called at the start of that time span.
+void gamecardResetIoMaxQueueDepth(void);
 
 /// Fills the provided GameCardHeader pointer.
 /// This area can also be read using gamecardReadStorage(), starting at offset 0.
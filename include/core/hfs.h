@@ -60,6 +60,12 @@ typedef enum {
     HashFileSystemPartitionType_Count  = 6  ///< Total values supported by this enum.
 } HashFileSystemPartitionType;
 
+/// Generated on demand by hfsGetEntryIndexByName() to speed up Hash FS entry lookups by name.
+typedef struct {
+    u32 name_hash;  ///< FNV-1a hash calculated over the entry name.
+    u32 index;      ///< Hash FS entry index.
+} HashFileSystemNameIndexEntry;
+
 /// Internally used by gamecard functions.
 /// Use gamecardGetHashFileSystemContext() to retrieve a Hash FS context.
 typedef struct {
@@ -69,14 +75,21 @@ typedef struct {
     u64 size;           ///< Partition size.
     u64 header_size;    ///< Full header size.
     u8 *header;         ///< HashFileSystemHeader + (HashFileSystemEntry * entry_count) + Name Table.
+    HashFileSystemNameIndexEntry *name_index;   ///< Lazily generated by hfsGetEntryIndexByName(). Holds entry_count elements sorted by name hash.
 } HashFileSystemContext;
 
-/// Reads raw partition data using a Hash FS context.
+/// Reads raw partition data using a Hash FS context and the provided GameCardIoPriority value.
 /// Input offset must be relative to the start of the Hash FS.
-bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset);
+bool hfsReadPartitionDataWithPriority(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset, u8 priority);
 
-/// Reads data from a previously retrieved HashFileSystemEntry using a Hash FS context.
+/// Reads data from a previously retrieved HashFileSystemEntry using a Hash FS context and the provided GameCardIoPriority value.
 /// Input offset must be relative to the start of the Hash FS entry.
+bool hfsReadEntryDataWithPriority(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset, u8 priority);
+
+/// Same as hfsReadPartitionDataWithPriority(), but using the gamecard I/O priority set for the current thread.
+bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset);
+
+/// Same as hfsReadEntryDataWithPriority(), but using the gamecard I/O priority set for the current thread.
 bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset);
 
 /// Calculates the extracted Hash FS size.
@@ -84,6 +97,7 @@ bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry,
 bool hfsGetTotalDataSize(HashFileSystemContext *ctx, u64 *out_size);
 
 /// Retrieves a Hash FS entry index by its name.
+/// A sorted name hash index is generated the first time this function is called on a context, so subsequent lookups are O(log n).
 bool hfsGetEntryIndexByName(HashFileSystemContext *ctx, const char *name, u32 *out_idx);
 
 /// Takes a HashFileSystemPartitionType value. Returns a pointer to a string that represents the partition name that matches the provided Hash FS partition type.
@@ -97,6 +111,7 @@ NX_INLINE void hfsFreeContext(HashFileSystemContext *ctx)
     if (!ctx) return;
     if (ctx->name) free(ctx->name);
     if (ctx->header) free(ctx->header);
+    if (ctx->name_index) free(ctx->name_index);
     memset(ctx, 0, sizeof(HashFileSystemContext));
 }
 
@@ -0,0 +1,167 @@
+/*
+ * multi_digest.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __MULTI_DIGEST_H__
+#define __MULTI_DIGEST_H__
+
+#include <mbedtls/md5.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD5_HASH_SIZE                   0x10
+
+#define MULTI_DIGEST_REPORT_EXTENSION   ".digests.txt"
+
+typedef enum {
+    MultiDigestType_None   = 0,
+    MultiDigestType_Crc32  = BIT(0),
+    MultiDigestType_Md5    = BIT(1),
+    MultiDigestType_Sha1   = BIT(2),
+    MultiDigestType_Sha256 = BIT(3),
+    MultiDigestType_All    = (MultiDigestType_Crc32 | MultiDigestType_Md5 | MultiDigestType_Sha1 | MultiDigestType_Sha256)
+} MultiDigestType;
+
+/// Number of digest algorithms supported by the multi-digest engine.
+#define MULTI_DIGEST_TYPE_COUNT 4
+
+/// Holds the output digests from a multi-digest context.
+/// Only the fields that match the type mask used to initialize the context are populated.
+typedef struct {
+    u32 crc32;
+    u8 md5[MD5_HASH_SIZE];
+    u8 sha1[SHA1_HASH_SIZE];
+    u8 sha256[SHA256_HASH_SIZE];
+} MultiDigestResult;
+
+/// Per-digest statistics.
+typedef struct {
+    u64 processed_size;     ///< Total data size processed by the digest worker.
+    u64 busy_time;          ///< Time spent by the digest worker hashing data, in nanoseconds.
+} MultiDigestStats;
+
+struct _MultiDigestContext;
+
+/// Holds the state for a single digest worker thread.
+typedef struct {
+    struct _MultiDigestContext *parent;
+    u32 type;                               ///< Single MultiDigestType value.
+    Thread thread;
+    bool thread_created;
+    u64 generation;                         ///< Last block generation processed by this worker.
+    union {
+        u32 crc32;
+        mbedtls_md5_context md5;
+        Sha1Context sha1;
+        Sha256Context sha256;
+    } state;
+    MultiDigestStats stats;
+} MultiDigestWorker;
+
+/// Streaming multi-digest context. Each enabled digest is calculated on its own worker thread, so all digests are updated in parallel using a single pass over the input data.
+/// Must not be moved or copied after initialization, since worker threads keep a pointer to it.
+typedef struct _MultiDigestContext {
+    u32 type_mask;                                      ///< Bitmask of MultiDigestType values.
+    u32 worker_count;
+    MultiDigestWorker workers[MULTI_DIGEST_TYPE_COUNT];
+    Mutex mutex;
+    CondVar work_cond;                                  ///< Signaled by the producer whenever a new block is submitted or the workers must exit.
+    CondVar done_cond;                                  ///< Signaled by the workers whenever they're done processing the current block.
+    const void *data;                                   ///< Current block. Must remain valid until multiDigestWait() returns.
+    size_t data_size;
+    u64 generation;                                     ///< Incremented each time a new block is submitted.
+    u32 pending_count;                                  ///< Number of workers that haven't finished processing the current block.
+    bool exit;
+    bool finalized;
+    u64 total_size;                                     ///< Total data size submitted to this context.
+    u64 wait_time;                                      ///< Time spent by the producer waiting on the workers, in nanoseconds.
+} MultiDigestContext;
+
+/// Snapshot of all digest states from a multi-digest context. Used to checkpoint and resume interrupted dumps.
+/// Digest states are stored using their native in-memory representation, so snapshots are only meant to be restored by the same application build.
+typedef struct {
+    u32 type_mask;                  ///< Bitmask of MultiDigestType values.
+    u8 reserved[0x4];
+    u64 total_size;                 ///< Total data size processed by the context.
+    u32 crc32;
+    mbedtls_md5_context md5;
+    Sha1Context sha1;
+    Sha256Context sha256;
+} MultiDigestState;
+
+/// Initializes a multi-digest context using the provided MultiDigestType bitmask and starts one worker thread per enabled digest.
+/// Returns false if an error occurs. multiDigestFreeContext() must be called on the context either way.
+bool multiDigestInitializeContext(MultiDigestContext *ctx, u32 type_mask);
+
+/// Submits a block to all digest workers and returns right away, which lets the caller do other work while the block is being hashed.
+/// The block must remain valid and unmodified until multiDigestWait() is called. Any previously submitted block is waited on before submitting the new one.
+bool multiDigestUpdateAsync(MultiDigestContext *ctx, const void *data, size_t data_size);
+
+/// Waits until all digest workers are done processing the last submitted block.
+void multiDigestWait(MultiDigestContext *ctx);
+
+/// Submits a block to all digest workers and waits until it has been processed.
+NX_INLINE bool multiDigestUpdate(MultiDigestContext *ctx, const void *data, size_t data_size)
+{
+    bool ret = multiDigestUpdateAsync(ctx, data, data_size);
+    if (ret) multiDigestWait(ctx);
+    return ret;
+}
+
+/// Waits until all digest workers are idle and saves a snapshot of their digest states to the provided MultiDigestState element.
+bool multiDigestExportState(MultiDigestContext *ctx, MultiDigestState *out);
+
+/// Restores digest states from a snapshot generated by multiDigestExportState(). The type mask from the snapshot must match the one from the context.
+/// Must be called before submitting any blocks to the context.
+bool multiDigestImportState(MultiDigestContext *ctx, const MultiDigestState *state);
+
+/// Stops all digest workers and stores the output digests in the provided MultiDigestResult element.
+/// No further blocks can be submitted after calling this function.
+bool multiDigestFinalize(MultiDigestContext *ctx, MultiDigestResult *out);
+
+/// Retrieves the statistics for a single digest from the provided multi-digest context.
+bool multiDigestGetStats(MultiDigestContext *ctx, u32 type, MultiDigestStats *out);
+
+/// Stops all digest workers (if needed) and frees the provided multi-digest context.
+void multiDigestFreeContext(MultiDigestContext *ctx);
+
+/// Returns a pointer to a string that holds the name for the provided MultiDigestType value, or NULL if it's invalid.
+const char *multiDigestGetTypeName(u32 type);
+
+/// Returns a pointer to a dynamically allocated string that holds a plain text report for the provided digests, using one line per digest in the provided bitmask.
+/// The returned pointer must be freed by the caller.
+char *multiDigestGenerateReport(const MultiDigestResult *result, u32 type_mask, const char *file_name, u64 file_size);
+
+/// Helper inline functions.
+
+NX_INLINE u64 multiDigestGetStatsThroughput(const MultiDigestStats *stats)
+{
+    return ((stats && stats->busy_time) ? (u64)(((double)stats->processed_size * 1000000000.0) / (double)stats->busy_time) : 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MULTI_DIGEST_H__ */
@@ -621,6 +621,51 @@ NX_INLINE void ncaFreeHierarchicalIntegrityPatch(NcaHierarchicalIntegrityPatch *
     memset(patch, 0, sizeof(NcaHierarchicalIntegrityPatch));
 }
 
+/// Resets the written status from the NCA header and the NCA FS section headers, so they can be written once more.
+NX_INLINE void ncaResetHeaderWrittenStatus(NcaContext *ctx)
+{
+    if (!ctx) return;
+
+    ctx->header_written = false;
+
+    for(u8 i = 0; i < NCA_FS_HEADER_COUNT; i++) ctx->fs_ctx[i].header_written = false;
+}
+
+/// Resets the written status from a previously generated hierarchical SHA-256 patch, so it can be written once more.
+/// The patch is also bound to the current content ID from the provided NCA context, in case it was updated after generating the patch (e.g. via ncaUpdateContentIdAndHash()).
+NX_INLINE void ncaResetHierarchicalSha256PatchWrittenStatus(NcaContext *ctx, NcaHierarchicalSha256Patch *patch)
+{
+    if (!ctx || !patch || !patch->hash_region_count || patch->hash_region_count > NCA_HIERARCHICAL_SHA256_MAX_REGION_COUNT) return;
+
+    patch->written = false;
+
+    for(u32 i = 0; i < patch->hash_region_count; i++) patch->hash_region_patch[i].written = false;
+
+    memcpy(&(patch->content_id), &(ctx->content_id), sizeof(NcmContentId));
+}
+
+/// Resets the written status from a previously generated hierarchical integrity patch, so it can be written once more.
+/// The patch is also bound to the current content ID from the provided NCA context, in case it was updated after generating the patch (e.g. via ncaUpdateContentIdAndHash()).
+NX_INLINE void ncaResetHierarchicalIntegrityPatchWrittenStatus(NcaContext *ctx, NcaHierarchicalIntegrityPatch *patch)
+{
+    bool generated = false;
+
+    if (!ctx || !patch) return;
+
+    for(u32 i = 0; i < NCA_IVFC_LEVEL_COUNT; i++)
+    {
+        if (patch->hash_level_patch[i].data) generated = true;
+    }
+
+    if (!generated) return;
+
+    patch->written = false;
+
+    for(u32 i = 0; i < NCA_IVFC_LEVEL_COUNT; i++) patch->hash_level_patch[i].written = false;
+
+    memcpy(&(patch->content_id), &(ctx->content_id), sizeof(NcmContentId));
+}
+
 #ifdef __cplusplus
 }
 #endif
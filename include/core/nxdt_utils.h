@@ -164,6 +164,10 @@ void utilsGenerateFormattedSizeString(double size, char *dst, size_t dst_size);
 /// Returns false if there's an error.
 bool utilsGetFileSystemStatsByPath(const char *path, u64 *out_total, u64 *out_free);
 
+/// Saves the cluster size from the filesystem pointed to by the input path (e.g. "ums0:/") to 'out_cluster_size'.
+/// Returns false if there's an error, or if the filesystem doesn't report a usable cluster size.
+bool utilsGetFileSystemClusterSizeByPath(const char *path, u32 *out_cluster_size);
+
 /// Returns true if a file exists.
 bool utilsCheckIfFileExists(const char *path);
 
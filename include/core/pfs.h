@@ -50,6 +50,12 @@ typedef struct {
 
 NXDT_ASSERT(PartitionFileSystemEntry, 0x18);
 
+/// Generated on demand by pfsGetEntryIndexByName() to speed up Partition FS entry lookups by name.
+typedef struct {
+    u32 name_hash;  ///< FNV-1a hash calculated over the entry name.
+    u32 index;      ///< Partition FS entry index.
+} PartitionFileSystemNameIndexEntry;
+
 /// Used with Partition FS sections from NCAs.
 typedef struct {
     NcaStorageContext storage_ctx;      ///< Used to read NCA FS section data.
@@ -59,6 +65,7 @@ typedef struct {
     bool is_exefs;                      ///< ExeFS flag.
     u64 header_size;                    ///< Full header size.
     u8 *header;                         ///< PartitionFileSystemHeader + (PartitionFileSystemEntry * entry_count) + Name Table.
+    PartitionFileSystemNameIndexEntry *name_index;  ///< Lazily generated by pfsGetEntryIndexByName(). Holds entry_count elements sorted by name hash.
 } PartitionFileSystemContext;
 
 /// Used to generate Partition FS images (e.g. NSPs).
@@ -81,6 +88,7 @@ bool pfsReadPartitionData(PartitionFileSystemContext *ctx, void *out, u64 read_s
 bool pfsReadEntryData(PartitionFileSystemContext *ctx, PartitionFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset);
 
 /// Retrieves a Partition FS entry index by its name.
+/// A sorted name hash index is generated the first time this function is called on a context, so subsequent lookups are O(log n).
 bool pfsGetEntryIndexByName(PartitionFileSystemContext *ctx, const char *name, u32 *out_idx);
 
 /// Calculates the extracted Partition FS size.
@@ -111,6 +119,7 @@ NX_INLINE void pfsFreeContext(PartitionFileSystemContext *ctx)
     if (!ctx) return;
     ncaStorageFreeContext(&(ctx->storage_ctx));
     if (ctx->header) free(ctx->header);
+    if (ctx->name_index) free(ctx->name_index);
     memset(ctx, 0, sizeof(PartitionFileSystemContext));
 }
 
@@ -163,6 +172,12 @@ NX_INLINE void pfsWriteEntryPatchToMemoryBuffer(PartitionFileSystemContext *ctx,
     ncaWriteHierarchicalSha256PatchToMemoryBuffer(ctx->nca_fs_ctx->nca_ctx, patch, buf, buf_size, buf_offset);
 }
 
+NX_INLINE void pfsResetEntryPatchWrittenStatus(PartitionFileSystemContext *ctx, NcaHierarchicalSha256Patch *patch)
+{
+    if (!pfsIsValidContext(ctx)) return;
+    ncaResetHierarchicalSha256PatchWrittenStatus(ctx->nca_fs_ctx->nca_ctx, patch);
+}
+
 NX_INLINE void pfsFreeEntryPatch(NcaHierarchicalSha256Patch *patch)
 {
     ncaFreeHierarchicalSha256Patch(patch);
@@ -243,6 +243,22 @@ NX_INLINE void romfsWriteFileEntryPatchToMemoryBuffer(RomFileSystemContext *ctx,
     }
 }
 
+NX_INLINE void romfsResetFileEntryPatchWrittenStatus(RomFileSystemContext *ctx, RomFileSystemFileEntryPatch *patch)
+{
+    if (!romfsIsValidContext(ctx) || !patch) return;
+
+    NcaContext *nca_ctx = ctx->default_storage_ctx->nca_fs_ctx->nca_ctx;
+
+    if (patch->use_old_format_patch)
+    {
+        ncaResetHierarchicalSha256PatchWrittenStatus(nca_ctx, &(patch->old_format_patch));
+        patch->written = patch->old_format_patch.written;
+    } else {
+        ncaResetHierarchicalIntegrityPatchWrittenStatus(nca_ctx, &(patch->cur_format_patch));
+        patch->written = patch->cur_format_patch.written;
+    }
+}
+
 NX_INLINE void romfsFreeFileEntryPatch(RomFileSystemFileEntryPatch *patch)
 {
     if (!patch) return;
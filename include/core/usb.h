@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 #define USB_TRANSFER_BUFFER_SIZE    0x800000    /* 8 MiB. */
+#define USB_RESUME_WINDOW_SIZE      0x100000    /* 1 MiB. Resume offsets are aligned to this value, unless the host device already holds the whole file. */
 
 /// Used to indicate the USB speed selected by the host device.
 typedef enum {
@@ -42,6 +43,23 @@ typedef enum {
     UsbHostSpeed_Count      = 4     ///< Total values supported by this enum.
 } UsbHostSpeed;
 
+/// Optional ABI features. Requested by nxdumptool through StartSession command blocks, and accepted by the host through the StartSession status response.
+/// Hosts that don't know about a feature leave its bit cleared, so new features never break compatibility with older hosts using the same ABI version.
+typedef enum {
+    UsbSessionFeature_None           = 0,
+    UsbSessionFeature_Lz4Compression = BIT(0),  ///< File data is sent as a sequence of UsbFileDataFrameHeader-prefixed frames.
+    UsbSessionFeature_FileBatch      = BIT(1),  ///< SendFileBatch commands may be issued during extracted FS dumps.
+    UsbSessionFeature_Streams        = BIT(2),  ///< OpenStream, SendStreamData and CloseStream commands may be issued.
+    UsbSessionFeature_Resume         = BIT(3),  ///< SendResumableFileProperties commands may be issued.
+    UsbSessionFeature_ChunkChecksum  = BIT(4)   ///< Each file data chunk is followed by a UsbFileDataChunkTrailer, and the host acknowledges it with a UsbFileDataChunkAck.
+} UsbSessionFeature;
+
+/// File entry used by usbSendFileBatchProperties().
+typedef struct {
+    u64 size;
+    const char *path;   ///< Same conventions as the 'filename' argument from usbSendFileProperties().
+} UsbFileBatchEntry;
+
 /// Initializes the USB interface, input and output endpoints and allocates an internal transfer buffer.
 bool usbInitialize(void);
 
@@ -61,6 +79,16 @@ u8 usbIsReady(void);
 /// Under NSP transfer mode, this function must be called right before transferring data from each NSP file entry to the host device, which should in turn write it all to the same output file.
 bool usbSendFileProperties(u64 file_size, const char *filename);
 
+/// Returns true if the host device supports usbSendResumableFileProperties() calls.
+bool usbIsResumeSupported(void);
+
+/// Same as usbSendFileProperties(), but the host device may keep data from a previous, interrupted transfer of the same file.
+/// The amount of data already held by the host device is saved to 'out_offset', and only the remaining 'file_size - out_offset' bytes must be sent through usbSendFileData().
+/// 'out_window_crc' receives a CRC32 checksum calculated by the host device over the last MIN(out_offset, USB_RESUME_WINDOW_SIZE) bytes before 'out_offset'.
+/// Callers should check it against their own source data. If it doesn't match, usbCancelFileTransfer() must be called and the transfer must be restarted with usbSendFileProperties().
+/// If the host device doesn't support resuming transfers, this behaves just like usbSendFileProperties() and 'out_offset' is set to zero. Not available under NSP transfer mode.
+bool usbSendResumableFileProperties(u64 file_size, const char *filename, u64 *out_offset, u32 *out_window_crc);
+
 /// Sends NSP properties to the host device and enables NSP transfer mode. If needed, it must be called before usbSendFileData().
 /// Both 'nsp_size' and 'nsp_header_size' must be greater than zero. 'nsp_size' must also be greater than 'nsp_header_size'.
 /// Calling this function after NSP transfer mode has already been enabled will result in an error.
@@ -71,6 +99,8 @@ bool usbSendNspProperties(u64 nsp_size, const char *filename, u32 nsp_header_siz
 /// Data chunk size must not exceed USB_TRANSFER_BUFFER_SIZE.
 /// If the last file data chunk is aligned to the endpoint max packet size, the host device should expect a Zero Length Termination (ZLT) packet.
 /// Calling this function if there's no remaining data to transfer will result in an error.
+/// All chunks but the last one are copied to an internal queue and transferred asynchronously, so this function may return before the data has reached the host device.
+/// Transfer errors may therefore be reported by a later call. The last chunk is only sent once all queued chunks have been transferred.
 bool usbSendFileData(const void *data, u64 data_size);
 
 /// Used to gracefully cancel an ongoing file transfer. The current USB session is kept alive.
@@ -88,6 +118,44 @@ bool usbStartExtractedFsDump(u64 extracted_fs_size, const char *extracted_fs_roo
 /// This is only issued after all extracted file entries have been successfully transferred to the host device.
 void usbEndExtractedFsDump(void);
 
+/// Sets the bounds used to split file data chunks from usbSendFileData() into USB transfers. Both values must be aligned to 4 KiB and must not exceed USB_TRANSFER_BUFFER_SIZE.
+/// By default, bounds are picked at session start based on the USB speed, and the transfer size is adjusted within them on the fly based on how long each transfer takes to complete.
+/// Setting both values to the same size disables this behaviour. Setting both values to zero restores the default bounds.
+bool usbSetTransferChunkSizeBounds(u32 min_size, u32 max_size);
+
+/// Returns the transfer size currently used to split file data chunks, or zero if no USB session has been established.
+u32 usbGetTransferChunkSize(void);
+
+/// Returns the UsbSessionFeature bitmask negotiated with the host device, or UsbSessionFeature_None if no USB session has been established.
+u8 usbGetSessionFeatures(void);
+
+/// Returns true if the host device supports usbSendFileBatchProperties() calls.
+bool usbIsFileBatchSupported(void);
+
+/// Sends the properties from multiple files to the host device at once. Can only be used during an extracted filesystem dump started via usbStartExtractedFsDump().
+/// The data from all files in the batch must then be sent in order through usbSendFileData(), as if it were a single file. Chunks may span multiple files.
+/// The host device splits the data stream into separate files and only replies with a single status response at the end of it, which avoids a round trip per file.
+/// Not all entries may fit into a single batch. Returns the number of entries that were sent, or zero if an error occurred.
+/// Calling this function before finishing an ongoing file data transfer will result in an error.
+u32 usbSendFileBatchProperties(const UsbFileBatchEntry *entries, u32 entry_count);
+
+/// Returns true if the host device supports streams. If so, multiple files may be transferred concurrently using usbOpenStream(), usbSendStreamData() and usbCloseStream().
+/// Streams can't be used while a regular file transfer is in progress (or under NSP transfer mode), and vice versa.
+bool usbIsStreamSupported(void);
+
+/// Opens a new stream for an output file with the provided size. 'filename' follows the same conventions as the 'filename' argument from usbSendFileProperties().
+/// The stream ID is saved to 'out_stream_id'. Up to 4 streams may be open at the same time.
+bool usbOpenStream(u64 file_size, const char *filename, u32 *out_stream_id);
+
+/// Sends data for a previously opened stream. Safe to call from multiple threads at once, each one with its own stream.
+/// Data is split into 4 MiB slices, each one acknowledged by the host device. Threads sending data for other streams take turns with this one after each slice.
+/// If an error occurs, only this stream is affected. It must then be closed with usbCloseStream().
+bool usbSendStreamData(u32 stream_id, const void *data, u64 data_size);
+
+/// Closes a previously opened stream. If 'cancel' is true, or if not all of the stream data has been sent, the host device discards the output file.
+/// Returns false if the stream was incomplete and 'cancel' wasn't set.
+bool usbCloseStream(u32 stream_id, bool cancel);
+
 #ifdef __cplusplus
 }
 #endif
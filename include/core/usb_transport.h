@@ -0,0 +1,81 @@
+/*
+ * usb_transport.h
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __USB_TRANSPORT_H__
+#define __USB_TRANSPORT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Low-level transport used by the USB protocol implementation from usb.c.
+/// The backend is picked at link time: usb_transport.c provides the usb:ds based one, while the loopback harness from host/usb_bench provides its own.
+/// None of these functions are thread-safe. usb.c serializes all calls through its interface mutex.
+
+#define USB_FS_EP_MAX_PACKET_SIZE   0x40                        /* 64 bytes. */
+#define USB_HS_EP_MAX_PACKET_SIZE   0x200                       /* 512 bytes. */
+#define USB_SS_EP_MAX_PACKET_SIZE   0x400                       /* 1024 bytes. */
+
+typedef enum {
+    UsbTransportEndpoint_In    = 0, ///< Input (write) endpoint. Data flows from the console to the host device.
+    UsbTransportEndpoint_Out   = 1, ///< Output (read) endpoint. Data flows from the host device to the console.
+    UsbTransportEndpoint_Count = 2  ///< Total values supported by this enum.
+} UsbTransportEndpoint;
+
+/// Initializes the USB interface and both endpoints.
+bool usbTransportInitialize(void);
+
+/// Closes the USB interface and both endpoints.
+void usbTransportExit(void);
+
+/// Returns a pointer to an event that's signaled each time the USB connection state changes.
+/// usbTransportIsHostAvailable() must be used to retrieve the new state.
+Event *usbTransportGetStateChangeEvent(void);
+
+/// Returns true if the console is connected to a host device that has configured our USB interface.
+bool usbTransportIsHostAvailable(void);
+
+/// Enables or disables Zero Length Termination (ZLT) packets for transfers posted to the input (write) endpoint.
+void usbTransportSetZlt(bool enable);
+
+/// Posts an asynchronous transfer (URB) to the provided endpoint. 'buf' must be page-aligned.
+/// The URB ID is saved to 'out_urb_id'. Multiple URBs may be in flight on the same endpoint, and they're completed in order.
+Result usbTransportPostBuffer(u8 endpoint, void *buf, u32 size, u32 *out_urb_id);
+
+/// Returns a pointer to the completion event from the provided endpoint. It's signaled each time an URB is completed, but it's never cleared by the transport.
+/// A single signal may cover multiple URBs.
+Event *usbTransportGetCompletionEvent(u8 endpoint);
+
+/// Retrieves the status of a previously posted URB. 'out_completed' is set to false if the URB is still in flight.
+/// If the URB has been completed, the transferred size is saved to 'out_transferred_size'.
+/// Returns an error if the URB couldn't be found, or if it was completed with an error (e.g. cancelled).
+Result usbTransportGetUrbStatus(u8 endpoint, u32 urb_id, bool *out_completed, u32 *out_transferred_size);
+
+/// Cancels all in-flight URBs from the provided endpoint. The completion event is signaled once they've all been cancelled.
+void usbTransportCancel(u8 endpoint);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_TRANSPORT_H__ */
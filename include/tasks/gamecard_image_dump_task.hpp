@@ -26,20 +26,139 @@
 
 #include <optional>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <vector>
 
 #include "data_transfer_task.hpp"
+#include "../core/gamecard.h"
+#include "../core/multi_digest.h"
+#include "../utils/file_writer.hpp"
 
 namespace nxdt::tasks
 {
     typedef std::optional<std::string> GameCardDumpTaskError;
 
+    /* Used to hold the verification result for a single Hash FS entry from the inserted gamecard. */
+    typedef struct {
+        std::string partition_name;             ///< Hash FS partition name.
+        std::string entry_name;                 ///< Hash FS entry name.
+        u64 hash_target_offset;                 ///< Hash target offset, relative to the start of the gamecard image.
+        u32 hash_target_size;                   ///< Hash target size.
+        u32 processed_size;                     ///< Hash target data size processed thus far.
+        u8 expected_hash[SHA256_HASH_SIZE];     ///< SHA-256 checksum stored in the Hash FS entry.
+        u8 calculated_hash[SHA256_HASH_SIZE];   ///< SHA-256 checksum calculated over the dumped hash target data.
+        bool matched;                           ///< Set to true if the hash target was fully processed and both checksums match.
+    } GameCardHashFileSystemEntryVerificationResult;
+
+    /* Verifies the SHA-256 checksums from all Hash FS entries in the inserted gamecard using image data that's already being streamed by a dump task. */
+    /* Hash target data is copied from each processed block and hashed on a dedicated worker thread, so no additional gamecard reads are needed. */
+    class GameCardHashFileSystemVerifier
+    {
+        private:
+            typedef struct {
+                size_t entry_idx;
+                std::vector<u8> data;
+            } HashJob;
+
+            std::vector<GameCardHashFileSystemEntryVerificationResult> entries{};
+            std::vector<Sha256Context> sha256_ctxs{};
+            size_t cur_entry_idx = 0;
+
+            std::thread worker{};
+            std::mutex job_mtx{};
+            std::condition_variable job_cv{};
+            std::deque<HashJob> jobs{};
+            bool stop_worker = false;
+
+            bool AddHashFileSystemEntries(u8 hfs_partition_type);
+
+            void WorkerThreadFunc(void);
+
+            void StopWorker(void);
+
+        protected:
+            /* Set class as non-copyable and non-moveable. */
+            NON_COPYABLE(GameCardHashFileSystemVerifier);
+            NON_MOVEABLE(GameCardHashFileSystemVerifier);
+
+        public:
+            GameCardHashFileSystemVerifier() = default;
+            ~GameCardHashFileSystemVerifier();
+
+            /* Retrieves hash target information for all Hash FS entries and starts the worker thread. */
+            bool Initialize(void);
+
+            /* Submits the hash target data from a gamecard image block to the worker thread. */
+            /* Blocks must be provided sequentially. The offset must be relative to the start of the gamecard image. */
+            void ProcessBlock(const void *buf, size_t blksize, u64 offset);
+
+            /* Waits for the worker thread to process all pending data, then compares all checksums. */
+            /* Returns the number of Hash FS entries that failed verification. */
+            size_t Finalize(void);
+
+            /* Returns the verification results for all Hash FS entries. Only meaningful after calling Finalize(). */
+            ALWAYS_INLINE const std::vector<GameCardHashFileSystemEntryVerificationResult>& GetResults(void)
+            {
+                return this->entries;
+            }
+    };
+
     /* Generates an image dump out of the inserted gamecard. */
-    class GameCardImageDumpTask: public DataTransferTask<GameCardDumpTaskError, std::string, bool, bool, bool, bool, bool>
+    /* Gamecard reads, checksum calculation and output writes are pipelined through a ring of page-aligned buffers, each stage running on its own thread. */
+    /* If checksum calculation is enabled, multiple digests are calculated in a single pass and saved to a plain text file next to the output file. */
+    /* Dumps to SD card / UMS devices are periodically checkpointed, which lets interrupted dumps be resumed using the same gamecard and dump options. */
+    /* Dumps to USB hosts are resumed using the data already held by the host, if it supports it. */
+    /* Verification-only dumps don't generate an output file: image data is fed to a TeeWriter digest sink (or a null sink, if checksum calculation is disabled) instead. */
+    /* If a USB host mirror path is provided, image data is fed to a TeeWriter with two file sinks instead: the output file and a best-effort copy sent to the USB host. Mirrored dumps aren't checkpointed. */
+    class GameCardImageDumpTask: public DataTransferTask<GameCardDumpTaskError, std::string, bool, bool, bool, bool, bool, bool, std::string>
     {
         private:
+            /* Number of USB_TRANSFER_BUFFER_SIZE buffers shared by the dump pipeline. */
+            static constexpr size_t BufferCount = 4;
+
+            /* Gamecard image data size between checkpoints. Must be a multiple of USB_TRANSFER_BUFFER_SIZE. */
+            static constexpr size_t CheckpointInterval = 0x10000000;    /* 256 MiB. */
+
+            /* Dump state saved alongside each checkpoint. */
+            typedef struct {
+                u8 header_hash[SHA256_HASH_SIZE];   ///< SHA-256 checksum calculated over the gamecard header. Used to identify the source gamecard.
+                bool prepend_key_area;
+                bool keep_certificate;
+                bool trim_dump;
+                bool calculate_checksum;
+                u32 gc_img_crc;                     ///< Only valid if the key area is prepended. The multi-digest CRC32 covers the gamecard image alone otherwise.
+                u32 overlap_crc;                    ///< CRC32 calculated over the last gamecard image block before the checkpoint offset.
+                u32 overlap_size;                   ///< Size for the last gamecard image block before the checkpoint offset.
+                u8 reserved[0x4];
+                MultiDigestState digest_state;      ///< Only valid if checksum calculation is enabled.
+            } CheckpointState;
+
+            /* Dump pipeline stages. */
+            typedef enum : size_t {
+                Read  = 0,  ///< Reader thread.
+                Hash  = 1,  ///< Hasher thread.
+                Write = 2,  ///< Task thread.
+                Count = 3   ///< Total values supported by this enum.
+            } PipelineStage;
+
             std::mutex task_mtx;
             bool calculate_checksum = false, lookup_checksum = false;
             u32 gc_img_crc = 0, full_gc_img_crc = 0;
+            MultiDigestResult gc_img_digests{};
+            std::optional<std::string> checksum_lookup_result{};
+            std::vector<GameCardHashFileSystemEntryVerificationResult> hfs_verification_results{};
+
+            /* Saves the calculated checksums to a plain text file next to the output file. */
+            void WriteDigestReport(const std::string& output_path, size_t output_size);
+
+            /* Reads the last gamecard image block before a checkpoint offset back from the partial output file and compares its checksum against the one stored in the checkpoint. */
+            bool VerifyCheckpointOverlap(const CheckpointState *state, nxdt::utils::FileWriter *file, size_t offset);
+
+            /* Compares the checksum reported by a USB host for the output data right before a resume offset against the data from the gamecard. */
+            /* 'key_area' must point to the key area prepended to the output file, if any. */
+            bool VerifyUsbResumeWindow(u32 window_crc, size_t offset, const GameCardKeyArea *key_area, bool keep_certificate);
 
         protected:
             /* Set class as non-copyable and non-moveable. */
@@ -48,7 +167,7 @@ namespace nxdt::tasks
 
             /* Runs in the background thread. */
             GameCardDumpTaskError DoInBackground(const std::string& output_path, const bool& prepend_key_area, const bool& keep_certificate, const bool& trim_dump,
-                                                 const bool& calculate_checksum, const bool& lookup_checksum) override final;
+                                                 const bool& calculate_checksum, const bool& lookup_checksum, const bool& verify_only, const std::string& mirror_path) override final;
 
         public:
             GameCardImageDumpTask() = default;
@@ -68,6 +187,32 @@ namespace nxdt::tasks
                 std::scoped_lock lock(this->task_mtx);
                 return ((this->calculate_checksum && this->IsFinished() && !this->IsCancelled()) ? this->full_gc_img_crc : 0);
             }
+
+            /* Returns the CRC32, MD5, SHA-1 and SHA-256 checksums calculated over the output file (including key area data, if it was prepended). */
+            /* Returns an empty optional if checksum calculation wasn't enabled, if the task hasn't finished yet or if the task was cancelled. */
+            ALWAYS_INLINE std::optional<MultiDigestResult> GetImageDigests(void)
+            {
+                std::scoped_lock lock(this->task_mtx);
+                if (!this->calculate_checksum || !this->IsFinished() || this->IsCancelled()) return {};
+                return this->gc_img_digests;
+            }
+
+            /* Returns the title record name from the offline checksum database that matches the gamecard image checksum. */
+            /* Returns an empty optional if checksum lookup wasn't enabled, if no match was found, if the task hasn't finished yet or if the task was cancelled. */
+            ALWAYS_INLINE std::optional<std::string> GetChecksumLookupResult(void)
+            {
+                std::scoped_lock lock(this->task_mtx);
+                if (!this->IsFinished() || this->IsCancelled()) return {};
+                return this->checksum_lookup_result;
+            }
+
+            /* Returns the Hash FS entry verification results. */
+            /* Returns an empty vector if the task hasn't finished yet, if the task was cancelled or if verification couldn't be performed. */
+            ALWAYS_INLINE std::vector<GameCardHashFileSystemEntryVerificationResult> GetHashFileSystemVerificationResults(void)
+            {
+                std::scoped_lock lock(this->task_mtx);
+                return ((this->IsFinished() && !this->IsCancelled()) ? this->hfs_verification_results : std::vector<GameCardHashFileSystemEntryVerificationResult>{});
+            }
     };
 }
 
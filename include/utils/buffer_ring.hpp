@@ -0,0 +1,101 @@
+/*
+ * buffer_ring.hpp
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __BUFFER_RING_HPP__
+#define __BUFFER_RING_HPP__
+
+#include <borealis.hpp>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "../core/nxdt_utils.h"
+
+namespace nxdt::utils
+{
+    /* Fixed-size ring of page-aligned memory buffers shared by a multi-stage data processing pipeline (e.g. read -> hash -> write). */
+    /* Each stage must be driven by a single thread. Blocks flow through every stage in the same order they were acquired by the first stage, */
+    /* and they become available to the first stage again after the last stage releases them. This provides backpressure between stages. */
+    class BufferRing
+    {
+        public:
+            /* Holds information about a single buffer in the ring. */
+            typedef struct {
+                void *data;     ///< Page-aligned buffer.
+                size_t size;    ///< Number of valid bytes in the buffer. Set by the first stage.
+                u64 offset;     ///< Data offset. Set by the first stage.
+            } Block;
+
+        private:
+            std::mutex ring_mtx{};
+            std::condition_variable ring_cv{};
+
+            std::vector<Block> blocks{};
+            std::vector<size_t> stage_pos{};
+
+            size_t block_size = 0, end_pos = 0;
+            bool end_of_stream = false, aborted = false;
+
+            bool IsBlockAvailable(size_t stage);
+
+        protected:
+            /* Set class as non-copyable and non-moveable. */
+            NON_COPYABLE(BufferRing);
+            NON_MOVEABLE(BufferRing);
+
+        public:
+            /* Throws an exception if memory can't be allocated for the buffers. */
+            BufferRing(size_t block_count, size_t block_size, size_t stage_count);
+            ~BufferRing();
+
+            /* Waits until the next block is available for the provided stage and returns a pointer to it. */
+            /* Returns nullptr if the pipeline was aborted, or if all blocks have been processed by the previous stage after SetEndOfStream() was called. */
+            Block *Acquire(size_t stage);
+
+            /* Hands the block previously acquired by the provided stage over to the next stage. */
+            void Release(size_t stage);
+
+            /* Waits until the last stage has released every block handed over by the first stage so far. */
+            /* Must only be called by the thread driving the first stage, while it doesn't hold any block. Returns false if the pipeline was aborted. */
+            bool Drain(void);
+
+            /* Called by the first stage to indicate that no more blocks will be produced. */
+            void SetEndOfStream(void);
+
+            /* Wakes up all stages and makes every pending and future Acquire() call return nullptr. */
+            void Abort(void);
+
+            ALWAYS_INLINE bool IsAborted(void)
+            {
+                std::scoped_lock lock(this->ring_mtx);
+                return this->aborted;
+            }
+
+            ALWAYS_INLINE size_t GetBlockSize(void)
+            {
+                return this->block_size;
+            }
+    };
+}
+
+#endif  /* __BUFFER_RING_HPP__ */
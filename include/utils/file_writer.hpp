@@ -26,14 +26,22 @@
 
 #include <borealis.hpp>
 #include <optional>
+#include <thread>
+#include <memory>
 
 #include "../core/nxdt_utils.h"
 #include "../core/usb.h"
+#include "buffer_ring.hpp"
 
 namespace nxdt::utils
 {
     /* Writes output files to different storage locations based on the provided input path. */
-    /* It also handles file splitting in FAT-based UMS volumes. */
+    /* It also handles file splitting in FAT-based UMS volumes. Each output file (or part file) is preallocated to its final size as soon as it's created. */
+    /* Resumable output files keep a checkpoint file next to them, which allows interrupted transfers to SD card / UMS devices to be resumed later. */
+    /* Interrupted transfers to a USB host are resumed using the data already held by the host, if it supports it. */
+    /* Other transfers to a USB host use a stream if the host supports them, so they can run alongside transfers carried out by other FileWriter objects. */
+    /* Output writes for big files are carried out by a background thread, fed through a bounded queue of page-aligned buffers. This lets callers produce the next block in the meantime. */
+    /* Data sent to SD card / UMS devices is coalesced into cluster-aligned blocks before being written, so small and odd-sized writes don't end up as partial cluster writes. */
     class FileWriter
     {
         public:
@@ -46,8 +54,39 @@ namespace nxdt::utils
             } StorageType;
 
         private:
-            std::string output_path{};
-            size_t total_size = 0, cur_size = 0;
+            /* Checkpoint file header. The opaque state blob provided by the caller is stored right after it. */
+            typedef struct {
+                u32 magic;                  ///< "NXCK".
+                u32 version;                ///< FileWriter::CheckpointVersion.
+                u64 total_size;             ///< Must match the total size from the FileWriter object.
+                u64 committed_size;         ///< Output data size that was fully written when the checkpoint was generated.
+                u32 nsp_header_size;        ///< Must match the NSP header size from the FileWriter object.
+                u32 split_file_part_idx;    ///< Part file index that holds the data at the committed offset (split UMS files only).
+                u32 state_size;
+                u32 state_crc;              ///< CRC32 calculated over the state blob.
+            } CheckpointHeader;
+
+            static constexpr u32 CheckpointMagic = 0x4E58434B;  /* "NXCK". */
+            static constexpr u32 CheckpointVersion = 1;
+
+            /* Write-behind queue stages. */
+            typedef enum : size_t {
+                Queue  = 0, ///< Write() calls. Data is copied to a queue buffer.
+                Output = 1, ///< Writer thread. Data is written to the output storage.
+                Count  = 2
+            } WriteBehindStage;
+
+            /* Write-behind queue settings. Files that aren't bigger than a single queue buffer are written synchronously. */
+            static constexpr size_t WriteBehindBlockCount = 4;
+            static constexpr size_t WriteBehindBlockSize = 0x400000;   /* 4 MiB. */
+
+            /* Staging buffer settings. The block size is a multiple of the filesystem cluster size. */
+            static constexpr size_t StagingDefaultAlignment = 0x10000;     /* 64 KiB. Used if the filesystem doesn't report its cluster size. */
+            static constexpr size_t StagingMinBlockSize = 0x100000;        /* 1 MiB. */
+            static constexpr size_t StagingMaxBlockSize = 0x400000;        /* 4 MiB. */
+
+            std::string output_path{}, checkpoint_path{};
+            size_t total_size = 0, cur_size = 0, out_size = 0;
 
             u32 nsp_header_size = 0;
             bool nsp_header_written = false;
@@ -56,29 +95,78 @@ namespace nxdt::utils
 
             bool split_file = false, file_created = false, file_closed = false;
 
+            bool resumable = false, resumed = false, checkpoint_written = false;
+            std::vector<u8> checkpoint_state{};
+            u32 resume_window_crc = 0;
+
+            u32 usb_stream_id = 0;
+
             FILE *fp = nullptr;
             u8 split_file_part_cnt = 0, split_file_part_idx = 0;
             size_t split_file_part_size = 0;
 
+            std::unique_ptr<BufferRing> write_behind_ring{};
+            std::thread write_behind_thread{};
+            bool write_behind_failed = false;
+
+            u8 *staging_buf = nullptr;
+            size_t staging_block_size = 0, staging_align = 0, staging_size = 0;
+
             std::optional<std::string> CheckFreeSpace(void);
 
             void CloseCurrentFile(void);
 
+            void PreallocateCurrentFile(void);
+
             bool OpenNextFile(void);
 
             bool CreateInitialFile(void);
 
+            bool LoadCheckpoint(void);
+
+            bool LoadCheckpointFile(const std::string& path);
+
+            bool ReopenFile(void);
+
+            void RemoveCheckpoint(void);
+
+            bool WriteData(const void *data, const size_t& data_size);
+
+            void SetupStagingBuffer(void);
+
+            size_t GetStagingCapacity(void);
+
+            bool StageData(const void *data, const size_t& data_size);
+
+            bool FlushStagingBuffer(void);
+
+            void FreeStagingBuffer(void);
+
+            void StartWriteBehind(void);
+
+            bool QueueData(const void *data, const size_t& data_size);
+
+            bool FlushWriteBehind(void);
+
+            bool StopWriteBehind(bool abort);
+
+            void WriteBehindThreadFunc(void);
+
         protected:
             /* Set class as non-copyable and non-moveable. */
             NON_COPYABLE(FileWriter);
             NON_MOVEABLE(FileWriter);
 
         public:
-            FileWriter(const std::string& output_path, const size_t& total_size, const u32& nsp_header_size = 0);
+            /* If 'resumable' is true and a valid checkpoint is available for the provided output path, the output file is reopened and writes resume at the checkpoint offset. */
+            /* Resumable output files are supported on SD card and UMS devices, as well as USB hosts that support resuming transfers. NSPs can't be resumed on a USB host. */
+            FileWriter(const std::string& output_path, const size_t& total_size, const u32& nsp_header_size = 0, const bool& resumable = false);
             ~FileWriter();
 
             /* Writes data to the output file. */
             /* Takes care of seamlessly switching to a new part file if needed. */
+            /* If the write-behind queue is in use, data is copied to it and this function may return before it has been written. Output errors are then reported by a later call. */
+            /* The call that completes the file always waits for all queued and staged data to be written. */
             bool Write(const void *data, const size_t& data_size);
 
             /* Writes NSP header data to offset 0. */
@@ -86,10 +174,47 @@ namespace nxdt::utils
             bool WriteNspHeader(const void *nsp_header, const u32& nsp_header_size);
 
             /* Closes the file and deletes it if it's incomplete (or if forcefully requested). */
+            /* Incomplete resumable files are kept, along with their checkpoint file, if at least one checkpoint was successfully written. */
             void Close(bool force_delete = false);
 
+            /* Saves a checkpoint for the data written so far, along with an opaque state blob provided by the caller. */
+            /* Only valid if dealing with a resumable file. */
+            bool WriteCheckpoint(const void *state, const size_t& state_size);
+
+            /* Reads back output data that has already been written, starting at the provided offset. Data must be located before the current offset. */
+            /* Only valid if dealing with the SD card or a UMS device. Used to verify partial output files before resuming them. */
+            bool ReadBack(void *data, const size_t& data_size, const size_t& offset);
+
+            /* Returns true if this file was resumed from a checkpoint. */
+            ALWAYS_INLINE bool IsResumed(void)
+            {
+                return this->resumed;
+            }
+
+            /* Returns the state blob loaded from the checkpoint file. Empty if this file wasn't resumed. */
+            ALWAYS_INLINE const std::vector<u8>& GetCheckpointState(void)
+            {
+                return this->checkpoint_state;
+            }
+
+            /* Returns the CRC32 checksum reported by the USB host for the last MIN(offset, USB_RESUME_WINDOW_SIZE) bytes before the current offset. */
+            /* Only valid if this file was resumed on a USB host. Callers must check it against their source data, and start over if it doesn't match. */
+            ALWAYS_INLINE u32 GetResumeWindowChecksum(void)
+            {
+                return this->resume_window_crc;
+            }
+
+            /* Returns the current output offset. Includes data that may still be waiting in the write-behind queue. */
+            ALWAYS_INLINE size_t GetCurrentOffset(void)
+            {
+                return this->cur_size;
+            }
+
             /* Returns the storage type for this file. */
             StorageType GetStorageType(void);
+
+            /* Returns the storage type that would be used for the provided output path. */
+            static StorageType GetStorageTypeByPath(const std::string& output_path);
     };
 }
 
@@ -0,0 +1,149 @@
+/*
+ * tee_writer.hpp
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifndef __TEE_WRITER_HPP__
+#define __TEE_WRITER_HPP__
+
+#include <borealis.hpp>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+
+#include "../core/nxdt_utils.h"
+#include "../core/multi_digest.h"
+#include "file_writer.hpp"
+
+namespace nxdt::utils
+{
+    /* Fans out output data to multiple sinks at once: output files (on any storage type supported by FileWriter), multi-digest contexts or nothing at all. */
+    /* This makes it possible to keep copies of a dump on different storage devices (e.g. SD card + USB host) or to just verify it, using a single read of the source data. */
+    /* Each sink is driven by its own thread, so all sinks are written to in parallel. Write() returns once every sink is done with the provided block, */
+    /* which means the overall throughput is limited by the slowest sink. Per-sink statistics are kept to find out which one it is. */
+    class TeeWriter
+    {
+        public:
+            /* Sink types. */
+            typedef enum : u8 {
+                File   = 0,     ///< Output file, handled by a FileWriter object.
+                Digest = 1,     ///< Multi-digest context owned by the caller.
+                Null   = 2      ///< Discards all data.
+            } SinkType;
+
+            /* Determines how write errors from a sink are handled. */
+            typedef enum : u8 {
+                Required   = 0, ///< Write() fails, as well as all further calls.
+                BestEffort = 1  ///< The sink is dropped (its output file is deleted) and the rest of the sinks keep going.
+            } ErrorPolicy;
+
+            /* Per-sink statistics. */
+            typedef struct {
+                std::string name;       ///< Output path for file sinks.
+                SinkType type;
+                ErrorPolicy policy;
+                bool failed;
+                size_t written_size;    ///< Data size successfully written to this sink.
+                u64 busy_time;          ///< Time spent by this sink writing data, in nanoseconds.
+            } SinkStats;
+
+        private:
+            typedef struct {
+                SinkStats stats;
+                std::unique_ptr<FileWriter> file;
+                MultiDigestContext *digest_ctx;
+                std::thread thread;
+                bool dropped;
+            } Sink;
+
+            std::vector<std::unique_ptr<Sink>> sinks{};
+
+            std::mutex sink_mtx{};
+            std::condition_variable work_cv{}, done_cv{};
+
+            const void *data = nullptr;
+            size_t data_size = 0, pending_count = 0;
+            u64 generation = 0;
+            bool exit = false;
+
+            size_t total_size = 0, cur_size = 0;
+            bool started = false, failed = false, closed = false;
+
+            void CheckStarted(void);
+
+            void StartSinkThreads(void);
+
+            void StopSinkThreads(void);
+
+            void SinkThreadFunc(Sink *sink);
+
+            bool WriteSink(Sink *sink, const void *data, const size_t& data_size);
+
+            static u64 GetThroughput(const SinkStats& stats);
+
+        protected:
+            /* Set class as non-copyable and non-moveable. */
+            NON_COPYABLE(TeeWriter);
+            NON_MOVEABLE(TeeWriter);
+
+        public:
+            /* 'total_size' is used for all output file sinks. */
+            TeeWriter(const size_t& total_size);
+            ~TeeWriter();
+
+            /* Adds an output file sink. Throws an exception if the output file can't be created. */
+            /* Only a single output file may be sent to a USB host at a time, so adding a second sink with a USB host output path throws an exception as well. */
+            /* Sinks must be added before writing any data. */
+            void AddFileSink(const std::string& output_path, ErrorPolicy policy = ErrorPolicy::Required);
+
+            /* Adds a multi-digest context sink. The context must have already been initialized by the caller, and it must remain valid until this object is closed. */
+            /* The caller is also responsible for finalizing and freeing the context. */
+            void AddDigestSink(MultiDigestContext *digest_ctx, ErrorPolicy policy = ErrorPolicy::Required);
+
+            /* Adds a sink that discards all data. Useful to measure source throughput. */
+            void AddNullSink(void);
+
+            /* Writes the provided data to all sinks in parallel. The caller may reuse its buffer as soon as this function returns. */
+            /* Returns false if a sink with a Required error policy fails, or if no sinks are left. */
+            bool Write(const void *data, const size_t& data_size);
+
+            /* Closes all output file sinks. They're deleted if they're incomplete (or if forcefully requested). */
+            /* Per-sink statistics are logged, along with the slowest sink. */
+            void Close(bool force_delete = false);
+
+            /* Returns statistics for all sinks, in the order they were added. */
+            std::vector<SinkStats> GetSinkStats(void);
+
+            /* Returns the index of the sink with the lowest throughput, or -1 if no data has been written yet. Dropped sinks are ignored. */
+            /* Its throughput, in bytes per second, is saved to 'out_throughput' (if provided). */
+            ssize_t GetSlowestSink(u64 *out_throughput = nullptr);
+
+            /* Returns the current output offset. */
+            ALWAYS_INLINE size_t GetCurrentOffset(void)
+            {
+                return this->cur_size;
+            }
+    };
+}
+
+#endif  /* __TEE_WRITER_HPP__ */
@@ -55,6 +55,8 @@ namespace nxdt::views
 
             void UpdateStoragePrefix(u32 selected);
 
+            bool GenerateOutputFilePath(const std::string& prefix, bool append_base_path, const std::string& extension, std::string& output);
+
         protected:
             DumpOptionsFrame(RootView *root_view, const std::string& title, const std::string& base_output_path, const std::string& raw_filename);
             DumpOptionsFrame(RootView *root_view, const std::string& title, brls::Image *icon, const std::string& base_output_path, const std::string& raw_filename);
@@ -66,6 +68,14 @@ namespace nxdt::views
 
             bool GetOutputFilePath(const std::string& extension, std::string& output);
 
+            /* Generates an output file path for the USB host, regardless of the selected output storage. */
+            bool GetUsbHostOutputFilePath(const std::string& extension, std::string& output);
+
+            ALWAYS_INLINE bool IsUsbHostOutputStorageSelected(void)
+            {
+                return (this->output_storage->getSelectedValue() == ConfigOutputStorage_UsbHost);
+            }
+
             ALWAYS_INLINE brls::GenericEvent::Subscription RegisterButtonListener(brls::GenericEvent::Callback cb)
             {
                 return this->button_click_event->subscribe([this, cb](brls::View *view){
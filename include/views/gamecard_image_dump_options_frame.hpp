@@ -39,6 +39,8 @@ namespace nxdt::views
             brls::ToggleListItem *trim_dump = nullptr;
             brls::ToggleListItem *calculate_checksum = nullptr;
             brls::ToggleListItem *lookup_checksum = nullptr;
+            brls::ToggleListItem *verify_only = nullptr;
+            brls::ToggleListItem *mirror_to_usb_host = nullptr;
 
         public:
             GameCardImageDumpOptionsFrame(RootView *root_view, std::string raw_filename);
@@ -0,0 +1,634 @@
+/*
+ * checksum_db.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <core/nxdt_utils.h>
+#include <core/checksum_db.h>
+
+#define CHECKSUM_DB_NAME_LENGTH     0x200
+
+/* Type definitions. */
+
+typedef struct {
+    u32 count;
+    u64 size;
+    u64 mtime;
+} ChecksumDbDatInfo;
+
+typedef struct {
+    ChecksumDbIndexEntry *entries;
+    u32 entry_count;
+    u32 entry_capacity;
+    char *string_table;
+    u32 string_table_size;
+    u32 string_table_capacity;
+} ChecksumDbIndexBuilder;
+
+typedef struct {
+    const char *name;
+    char value;
+} ChecksumDbXmlEntity;
+
+/* Global variables. */
+
+static Mutex g_checksumDbMutex = 0;
+static bool g_checksumDbInterfaceInit = false;
+
+/* Used to avoid retrying a failed initialization on every lookup. It's only retried once the contents from the DAT directory change. */
+static bool g_checksumDbInitFailed = false;
+static ChecksumDbDatInfo g_checksumDbFailedDatInfo = {0};
+
+static ChecksumDbIndexEntry *g_checksumDbEntries = NULL;
+static u32 g_checksumDbEntryCount = 0;
+static u64 g_checksumDbStringTableOffset = 0;
+static u32 g_checksumDbStringTableSize = 0;
+
+static const ChecksumDbXmlEntity g_checksumDbXmlEntities[] = {
+    { "&amp;",  '&'  },
+    { "&lt;",   '<'  },
+    { "&gt;",   '>'  },
+    { "&quot;", '"'  },
+    { "&apos;", '\'' }
+};
+
+static const u32 g_checksumDbXmlEntityCount = MAX_ELEMENTS(g_checksumDbXmlEntities);
+
+static const u8 g_checksumDbEmptySha1[SHA1_HASH_SIZE] = {0};
+
+/* Function prototypes. */
+
+static bool checksumDbGetDatInfo(ChecksumDbDatInfo *out);
+static bool checksumDbIsDatFile(const char *name);
+static bool checksumDbCompareDatInfo(const ChecksumDbDatInfo *a, const ChecksumDbDatInfo *b);
+
+static bool checksumDbLoadIndex(const ChecksumDbDatInfo *dat_info);
+static void checksumDbFreeIndex(void);
+
+static bool checksumDbBuildIndex(const ChecksumDbDatInfo *dat_info);
+static bool checksumDbParseDatFile(ChecksumDbIndexBuilder *builder, const char *path);
+static bool checksumDbAddIndexEntry(ChecksumDbIndexBuilder *builder, const char *name, u32 *name_offset, const char *rom_tag, const char *rom_tag_end);
+static void checksumDbFreeIndexBuilder(ChecksumDbIndexBuilder *builder);
+
+static bool checksumDbGetXmlAttribute(const char *tag, const char *tag_end, const char *attr, char *out, size_t out_size);
+
+static int checksumDbIndexEntrySortFunction(const void *a, const void *b);
+static const ChecksumDbIndexEntry *checksumDbFindFirstEntryByCrc32(u32 crc32);
+static bool checksumDbReadEntryName(const ChecksumDbIndexEntry *entry, char *out_name, size_t out_name_size);
+
+bool checksumDbInitialize(void)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&g_checksumDbMutex)
+    {
+        ret = g_checksumDbInterfaceInit;
+        if (ret) break;
+
+        ChecksumDbDatInfo dat_info = {0};
+        bool dat_available = checksumDbGetDatInfo(&dat_info);
+
+        /* Bail out right away if the last initialization attempt failed and the DAT directory hasn't been modified since. */
+        /* This avoids rebuilding a broken index (or scanning an empty directory and logging about it) each time a lookup is requested. */
+        if (g_checksumDbInitFailed && checksumDbCompareDatInfo(&dat_info, &g_checksumDbFailedDatInfo)) break;
+
+        /* Assume initialization is going to fail. This is cleared below if everything goes well. */
+        g_checksumDbInitFailed = true;
+        memcpy(&g_checksumDbFailedDatInfo, &dat_info, sizeof(ChecksumDbDatInfo));
+
+        /* Check if there are any DAT files available. */
+        if (!dat_available || !dat_info.count)
+        {
+            LOG_MSG_INFO("No DAT files available at \"" CHECKSUM_DB_DAT_PATH "\".");
+            break;
+        }
+
+        /* Load index file. Rebuild it if it doesn't exist or if it's outdated. */
+        if (!checksumDbLoadIndex(&dat_info) && (!checksumDbBuildIndex(&dat_info) || !checksumDbLoadIndex(&dat_info)))
+        {
+            LOG_MSG_ERROR("Failed to load checksum database index!");
+            break;
+        }
+
+        LOG_MSG_INFO("Loaded %u checksum database entries from %u DAT file(s).", g_checksumDbEntryCount, dat_info.count);
+
+        /* Update flags. */
+        ret = g_checksumDbInterfaceInit = true;
+        g_checksumDbInitFailed = false;
+    }
+
+    return ret;
+}
+
+void checksumDbExit(void)
+{
+    SCOPED_LOCK(&g_checksumDbMutex)
+    {
+        checksumDbFreeIndex();
+        g_checksumDbInterfaceInit = g_checksumDbInitFailed = false;
+    }
+}
+
+bool checksumDbLookup(u32 crc32, u64 size, const u8 *sha1, char *out_name, size_t out_name_size)
+{
+    if (!out_name || !out_name_size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool ret = false;
+
+    if (!checksumDbInitialize()) return false;
+
+    SCOPED_LOCK(&g_checksumDbMutex)
+    {
+        if (!g_checksumDbInterfaceInit) break;
+
+        const ChecksumDbIndexEntry *entry = checksumDbFindFirstEntryByCrc32(crc32), *last_entry = (g_checksumDbEntries + g_checksumDbEntryCount);
+        if (!entry) break;
+
+        /* Entries sharing the same CRC32 checksum are stored next to each other. */
+        for(; entry < last_entry && entry->crc32 == crc32; entry++)
+        {
+            if (size && entry->size != size) continue;
+            if (sha1 && memcmp(entry->sha1, g_checksumDbEmptySha1, SHA1_HASH_SIZE) != 0 && memcmp(entry->sha1, sha1, SHA1_HASH_SIZE) != 0) continue;
+
+            ret = checksumDbReadEntryName(entry, out_name, out_name_size);
+            break;
+        }
+    }
+
+    return ret;
+}
+
+static bool checksumDbGetDatInfo(ChecksumDbDatInfo *out)
+{
+    DIR *dir = NULL;
+    struct dirent *dt = NULL;
+    struct stat st = {0};
+    char path[FS_MAX_PATH] = {0};
+
+    memset(out, 0, sizeof(ChecksumDbDatInfo));
+
+    dir = opendir(CHECKSUM_DB_DAT_PATH);
+    if (!dir) return false;
+
+    while((dt = readdir(dir)))
+    {
+        if (dt->d_type != DT_REG || !checksumDbIsDatFile(dt->d_name)) continue;
+
+        snprintf(path, sizeof(path), CHECKSUM_DB_DAT_PATH "%s", dt->d_name);
+        if (stat(path, &st) != 0 || !st.st_size) continue;
+
+        out->count++;
+        out->size += (u64)st.st_size;
+        if ((u64)st.st_mtime > out->mtime) out->mtime = (u64)st.st_mtime;
+    }
+
+    closedir(dir);
+
+    return true;
+}
+
+static bool checksumDbIsDatFile(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    return (ext && (!strcasecmp(ext, ".dat") || !strcasecmp(ext, ".xml")));
+}
+
+static bool checksumDbCompareDatInfo(const ChecksumDbDatInfo *a, const ChecksumDbDatInfo *b)
+{
+    return (a->count == b->count && a->size == b->size && a->mtime == b->mtime);
+}
+
+static bool checksumDbLoadIndex(const ChecksumDbDatInfo *dat_info)
+{
+    FILE *fd = NULL;
+    struct stat st = {0};
+    ChecksumDbIndexHeader header = {0};
+    size_t entries_size = 0;
+    bool success = false;
+
+    fd = fopen(CHECKSUM_DB_INDEX_PATH, "rb");
+    if (!fd) return false;
+
+    /* Read and validate index header. */
+    if (fstat(fileno(fd), &st) != 0 || fread(&header, 1, sizeof(ChecksumDbIndexHeader), fd) != sizeof(ChecksumDbIndexHeader))
+    {
+        LOG_MSG_ERROR("Failed to read checksum database index header!");
+        goto end;
+    }
+
+    entries_size = ((size_t)header.entry_count * sizeof(ChecksumDbIndexEntry));
+
+    if (header.magic != CHECKSUM_DB_INDEX_MAGIC || header.version != CHECKSUM_DB_INDEX_VERSION || !header.entry_count || !header.string_table_size || \
+        (u64)st.st_size != (sizeof(ChecksumDbIndexHeader) + entries_size + header.string_table_size))
+    {
+        LOG_MSG_INFO("Invalid checksum database index. It will be rebuilt.");
+        goto end;
+    }
+
+    if (header.dat_count != dat_info->count || header.dat_size != dat_info->size || header.dat_mtime != dat_info->mtime)
+    {
+        LOG_MSG_INFO("Outdated checksum database index. It will be rebuilt.");
+        goto end;
+    }
+
+    /* Read entry table. Title record names are only read when needed, which keeps our memory footprint small. */
+    g_checksumDbEntries = malloc(entries_size);
+    if (!g_checksumDbEntries)
+    {
+        LOG_MSG_ERROR("Failed to allocate memory for checksum database entries!");
+        goto end;
+    }
+
+    if (fread(g_checksumDbEntries, 1, entries_size, fd) != entries_size)
+    {
+        LOG_MSG_ERROR("Failed to read checksum database entries!");
+        goto end;
+    }
+
+    g_checksumDbEntryCount = header.entry_count;
+    g_checksumDbStringTableOffset = (sizeof(ChecksumDbIndexHeader) + entries_size);
+    g_checksumDbStringTableSize = header.string_table_size;
+
+    success = true;
+
+end:
+    if (fd) fclose(fd);
+
+    if (!success) checksumDbFreeIndex();
+
+    return success;
+}
+
+static void checksumDbFreeIndex(void)
+{
+    if (g_checksumDbEntries)
+    {
+        free(g_checksumDbEntries);
+        g_checksumDbEntries = NULL;
+    }
+
+    g_checksumDbEntryCount = 0;
+    g_checksumDbStringTableOffset = 0;
+    g_checksumDbStringTableSize = 0;
+}
+
+static bool checksumDbBuildIndex(const ChecksumDbDatInfo *dat_info)
+{
+    DIR *dir = NULL;
+    struct dirent *dt = NULL;
+    char path[FS_MAX_PATH] = {0};
+
+    ChecksumDbIndexBuilder builder = {0};
+    ChecksumDbIndexHeader header = {0};
+
+    FILE *fd = NULL;
+    bool success = false;
+
+    LOG_MSG_INFO("Building checksum database index...");
+
+    dir = opendir(CHECKSUM_DB_DAT_PATH);
+    if (!dir)
+    {
+        LOG_MSG_ERROR("Failed to open DAT directory!");
+        goto end;
+    }
+
+    /* Parse all available DAT files. */
+    while((dt = readdir(dir)))
+    {
+        if (dt->d_type != DT_REG || !checksumDbIsDatFile(dt->d_name)) continue;
+
+        snprintf(path, sizeof(path), CHECKSUM_DB_DAT_PATH "%s", dt->d_name);
+        if (!checksumDbParseDatFile(&builder, path)) goto end;
+    }
+
+    if (!builder.entry_count)
+    {
+        LOG_MSG_ERROR("No valid entries found in DAT files!");
+        goto end;
+    }
+
+    /* Sort entries by CRC32 and size. */
+    if (builder.entry_count > 1) qsort(builder.entries, builder.entry_count, sizeof(ChecksumDbIndexEntry), &checksumDbIndexEntrySortFunction);
+
+    /* Fill index header. */
+    header.magic = CHECKSUM_DB_INDEX_MAGIC;
+    header.version = CHECKSUM_DB_INDEX_VERSION;
+    header.entry_count = builder.entry_count;
+    header.string_table_size = builder.string_table_size;
+    header.dat_count = dat_info->count;
+    header.dat_size = dat_info->size;
+    header.dat_mtime = dat_info->mtime;
+
+    /* Write index file. */
+    fd = fopen(CHECKSUM_DB_INDEX_PATH, "wb");
+    if (!fd)
+    {
+        LOG_MSG_ERROR("Failed to open checksum database index for writing!");
+        goto end;
+    }
+
+    if (fwrite(&header, 1, sizeof(ChecksumDbIndexHeader), fd) != sizeof(ChecksumDbIndexHeader) || \
+        fwrite(builder.entries, sizeof(ChecksumDbIndexEntry), builder.entry_count, fd) != builder.entry_count || \
+        fwrite(builder.string_table, 1, builder.string_table_size, fd) != builder.string_table_size)
+    {
+        LOG_MSG_ERROR("Failed to write checksum database index!");
+        goto end;
+    }
+
+    LOG_MSG_INFO("Successfully built checksum database index (%u entries, 0x%X-byte long string table).", builder.entry_count, builder.string_table_size);
+
+    success = true;
+
+end:
+    if (fd)
+    {
+        fclose(fd);
+        if (!success) remove(CHECKSUM_DB_INDEX_PATH);
+        utilsCommitSdCardFileSystemChanges();
+    }
+
+    if (dir) closedir(dir);
+
+    checksumDbFreeIndexBuilder(&builder);
+
+    return success;
+}
+
+static bool checksumDbParseDatFile(ChecksumDbIndexBuilder *builder, const char *path)
+{
+    FILE *fd = NULL;
+    struct stat st = {0};
+    char *dat_buf = NULL, *ptr = NULL, name[CHECKSUM_DB_NAME_LENGTH] = {0};
+    bool success = false;
+
+    /* Read the whole DAT file. It's only kept in memory while the index is being built. */
+    if (stat(path, &st) != 0 || !st.st_size || !(fd = fopen(path, "rb")))
+    {
+        LOG_MSG_ERROR("Failed to open DAT file \"%s\"!", path);
+        goto end;
+    }
+
+    if (!(dat_buf = malloc((size_t)st.st_size + 1)))
+    {
+        LOG_MSG_ERROR("Failed to allocate memory for DAT file \"%s\"!", path);
+        goto end;
+    }
+
+    if (fread(dat_buf, 1, (size_t)st.st_size, fd) != (size_t)st.st_size)
+    {
+        LOG_MSG_ERROR("Failed to read DAT file \"%s\"!", path);
+        goto end;
+    }
+
+    dat_buf[st.st_size] = '\0';
+
+    /* Parse game elements. Each one of them represents a single title record, and may hold multiple rom elements. */
+    ptr = dat_buf;
+
+    while((ptr = strstr(ptr, "<game")) != NULL)
+    {
+        char *game_tag_end = NULL, *game_end = NULL, *rom = NULL, *rom_tag_end = NULL;
+        u32 name_offset = UINT32_MAX;
+
+        if (!isspace((unsigned char)ptr[5]) || !(game_tag_end = strchr(ptr, '>')) || !(game_end = strstr(game_tag_end, "</game>")))
+        {
+            ptr += 5;
+            continue;
+        }
+
+        if (checksumDbGetXmlAttribute(ptr, game_tag_end, "name", name, sizeof(name)) && *name)
+        {
+            for(rom = game_tag_end; (rom = strstr(rom, "<rom")) != NULL && rom < game_end; rom = rom_tag_end)
+            {
+                if (!(rom_tag_end = strchr(rom, '>')) || rom_tag_end > game_end) break;
+                if (!checksumDbAddIndexEntry(builder, name, &name_offset, rom, rom_tag_end)) goto end;
+            }
+        }
+
+        ptr = (game_end + 7);
+    }
+
+    success = true;
+
+end:
+    if (dat_buf) free(dat_buf);
+
+    if (fd) fclose(fd);
+
+    return success;
+}
+
+static bool checksumDbAddIndexEntry(ChecksumDbIndexBuilder *builder, const char *name, u32 *name_offset, const char *rom_tag, const char *rom_tag_end)
+{
+    char attr[(SHA1_HASH_SIZE * 2) + 1] = {0}, *end_ptr = NULL;
+    ChecksumDbIndexEntry entry = {0};
+
+    /* CRC32 and size attributes are mandatory. Entries without them are skipped. */
+    if (!checksumDbGetXmlAttribute(rom_tag, rom_tag_end, "crc", attr, sizeof(attr)) || strlen(attr) != 8) return true;
+
+    entry.crc32 = (u32)strtoul(attr, &end_ptr, 16);
+    if (!end_ptr || *end_ptr) return true;
+
+    if (!checksumDbGetXmlAttribute(rom_tag, rom_tag_end, "size", attr, sizeof(attr))) return true;
+
+    entry.size = strtoull(attr, &end_ptr, 10);
+    if (!end_ptr || *end_ptr || !entry.size) return true;
+
+    /* SHA-1 attribute is optional. */
+    if (checksumDbGetXmlAttribute(rom_tag, rom_tag_end, "sha1", attr, sizeof(attr)) && strlen(attr) == (SHA1_HASH_SIZE * 2) && \
+        !utilsParseHexString(entry.sha1, sizeof(entry.sha1), attr, 0)) memset(entry.sha1, 0, sizeof(entry.sha1));
+
+    /* Add title record name to the string table, if needed. All rom elements from the same game element share it. */
+    if (*name_offset == UINT32_MAX)
+    {
+        size_t name_size = (strlen(name) + 1);
+
+        if ((builder->string_table_size + name_size) > builder->string_table_capacity)
+        {
+            u32 new_capacity = (builder->string_table_capacity ? (builder->string_table_capacity * 2) : 0x10000);
+            while(new_capacity < (builder->string_table_size + name_size)) new_capacity *= 2;
+
+            char *tmp_string_table = realloc(builder->string_table, new_capacity);
+            if (!tmp_string_table)
+            {
+                LOG_MSG_ERROR("Failed to reallocate checksum database string table!");
+                return false;
+            }
+
+            builder->string_table = tmp_string_table;
+            builder->string_table_capacity = new_capacity;
+        }
+
+        memcpy(builder->string_table + builder->string_table_size, name, name_size);
+
+        *name_offset = builder->string_table_size;
+        builder->string_table_size += (u32)name_size;
+    }
+
+    entry.name_offset = *name_offset;
+
+    /* Add index entry. */
+    if (builder->entry_count >= builder->entry_capacity)
+    {
+        u32 new_capacity = (builder->entry_capacity ? (builder->entry_capacity * 2) : 0x400);
+
+        ChecksumDbIndexEntry *tmp_entries = realloc(builder->entries, new_capacity * sizeof(ChecksumDbIndexEntry));
+        if (!tmp_entries)
+        {
+            LOG_MSG_ERROR("Failed to reallocate checksum database entries!");
+            return false;
+        }
+
+        builder->entries = tmp_entries;
+        builder->entry_capacity = new_capacity;
+    }
+
+    memcpy(&(builder->entries[builder->entry_count++]), &entry, sizeof(ChecksumDbIndexEntry));
+
+    return true;
+}
+
+static void checksumDbFreeIndexBuilder(ChecksumDbIndexBuilder *builder)
+{
+    if (builder->entries) free(builder->entries);
+    if (builder->string_table) free(builder->string_table);
+    memset(builder, 0, sizeof(ChecksumDbIndexBuilder));
+}
+
+static bool checksumDbGetXmlAttribute(const char *tag, const char *tag_end, const char *attr, char *out, size_t out_size)
+{
+    size_t attr_len = strlen(attr), out_len = 0;
+
+    for(const char *ptr = tag; (ptr + attr_len + 2) < tag_end; ptr++)
+    {
+        if (!isspace((unsigned char)*ptr) || strncmp(ptr + 1, attr, attr_len) != 0 || ptr[attr_len + 1] != '=' || ptr[attr_len + 2] != '"') continue;
+
+        const char *value = (ptr + attr_len + 3), *value_end = memchr(value, '"', (size_t)(tag_end - value));
+        if (!value_end) return false;
+
+        /* Copy attribute value while decoding predefined XML entities. Values that don't fit are truncated. */
+        while(value < value_end && (out_len + 1) < out_size)
+        {
+            char c = *value++;
+
+            if (c == '&')
+            {
+                for(u32 i = 0; i < g_checksumDbXmlEntityCount; i++)
+                {
+                    size_t entity_len = strlen(g_checksumDbXmlEntities[i].name);
+                    if ((size_t)(value_end - value + 1) < entity_len || strncmp(value - 1, g_checksumDbXmlEntities[i].name, entity_len) != 0) continue;
+
+                    c = g_checksumDbXmlEntities[i].value;
+                    value += (entity_len - 1);
+                    break;
+                }
+            }
+
+            out[out_len++] = c;
+        }
+
+        out[out_len] = '\0';
+
+        return true;
+    }
+
+    return false;
+}
+
+static int checksumDbIndexEntrySortFunction(const void *a, const void *b)
+{
+    const ChecksumDbIndexEntry *entry_1 = (const ChecksumDbIndexEntry*)a;
+    const ChecksumDbIndexEntry *entry_2 = (const ChecksumDbIndexEntry*)b;
+
+    if (entry_1->crc32 != entry_2->crc32) return (entry_1->crc32 < entry_2->crc32 ? -1 : 1);
+    if (entry_1->size != entry_2->size) return (entry_1->size < entry_2->size ? -1 : 1);
+
+    return 0;
+}
+
+static const ChecksumDbIndexEntry *checksumDbFindFirstEntryByCrc32(u32 crc32)
+{
+    if (!g_checksumDbEntries || !g_checksumDbEntryCount) return NULL;
+
+    const ChecksumDbIndexEntry *entries = g_checksumDbEntries;
+    u32 low = 0, high = (g_checksumDbEntryCount - 1), pos = 0;
+
+    /* CRC32 checksums are evenly distributed, so an interpolation search lets us find matches in O(log log n) on average. */
+    while(low <= high && crc32 >= entries[low].crc32 && crc32 <= entries[high].crc32)
+    {
+        if (entries[high].crc32 == entries[low].crc32)
+        {
+            pos = low;
+        } else {
+            pos = (low + (u32)(((u64)(crc32 - entries[low].crc32) * (u64)(high - low)) / (u64)(entries[high].crc32 - entries[low].crc32)));
+        }
+
+        if (entries[pos].crc32 < crc32)
+        {
+            low = (pos + 1);
+        } else
+        if (entries[pos].crc32 > crc32)
+        {
+            if (!pos) break;
+            high = (pos - 1);
+        } else {
+            /* Rewind to the first entry with this checksum. */
+            while(pos > 0 && entries[pos - 1].crc32 == crc32) pos--;
+            return &(entries[pos]);
+        }
+    }
+
+    return NULL;
+}
+
+static bool checksumDbReadEntryName(const ChecksumDbIndexEntry *entry, char *out_name, size_t out_name_size)
+{
+    FILE *fd = NULL;
+    size_t read_size = 0;
+    bool success = false;
+
+    if (entry->name_offset >= g_checksumDbStringTableSize)
+    {
+        LOG_MSG_ERROR("Invalid name offset in checksum database entry! (0x%X).", entry->name_offset);
+        goto end;
+    }
+
+    read_size = MIN(out_name_size - 1, (size_t)(g_checksumDbStringTableSize - entry->name_offset));
+
+    if (!(fd = fopen(CHECKSUM_DB_INDEX_PATH, "rb")) || fseek(fd, (long)(g_checksumDbStringTableOffset + entry->name_offset), SEEK_SET) != 0 || \
+        fread(out_name, 1, read_size, fd) != read_size)
+    {
+        LOG_MSG_ERROR("Failed to read checksum database entry name!");
+        goto end;
+    }
+
+    out_name[read_size] = '\0';
+
+    success = true;
+
+end:
+    if (fd) fclose(fd);
+
+    return success;
+}
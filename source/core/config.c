@@ -228,7 +228,7 @@ end:
 static bool configValidateJsonGameCardObject(const struct json_object *obj)
 {
     bool ret = false, prepend_key_area_found = false, keep_certificate_found = false, trim_dump_found = false, calculate_checksum_found = false;
-    bool lookup_checksum_found = false, write_raw_hfs_partition_found = false;
+    bool lookup_checksum_found = false, verify_only_found = false, mirror_to_usb_host_found = false, write_raw_hfs_partition_found = false;
 
     if (!jsonValidateObject(obj)) goto end;
 
@@ -239,11 +239,14 @@ static bool configValidateJsonGameCardObject(const struct json_object *obj)
         CONFIG_VALIDATE_FIELD(Boolean, trim_dump);
         CONFIG_VALIDATE_FIELD(Boolean, calculate_checksum);
         CONFIG_VALIDATE_FIELD(Boolean, lookup_checksum);
+        CONFIG_VALIDATE_FIELD(Boolean, verify_only);
+        CONFIG_VALIDATE_FIELD(Boolean, mirror_to_usb_host);
         CONFIG_VALIDATE_FIELD(Boolean, write_raw_hfs_partition);
         goto end;
     }
 
-    ret = (prepend_key_area_found && keep_certificate_found && trim_dump_found && calculate_checksum_found && lookup_checksum_found && write_raw_hfs_partition_found);
+    ret = (prepend_key_area_found && keep_certificate_found && trim_dump_found && calculate_checksum_found && lookup_checksum_found && verify_only_found && \
+           mirror_to_usb_host_found && write_raw_hfs_partition_found);
 
 end:
     return ret;
@@ -253,7 +256,7 @@ static bool configValidateJsonNspObject(const struct json_object *obj)
 {
     bool ret = false, set_download_distribution_found = false, remove_console_data_found = false, remove_titlekey_crypto_found = false;
     bool disable_linked_account_requirement_found = false, enable_screenshots_found = false, enable_video_capture_found = false, disable_hdcp_found = false;
-    bool generate_authoringtool_data_found = false, lookup_checksum_found = false;
+    bool generate_authoringtool_data_found = false, lookup_checksum_found = false, generate_digest_report_found = false, sequential_output_found = false;
 
     if (!jsonValidateObject(obj)) goto end;
 
@@ -268,11 +271,14 @@ static bool configValidateJsonNspObject(const struct json_object *obj)
         CONFIG_VALIDATE_FIELD(Boolean, disable_hdcp);
         CONFIG_VALIDATE_FIELD(Boolean, lookup_checksum);
         CONFIG_VALIDATE_FIELD(Boolean, generate_authoringtool_data);
+        CONFIG_VALIDATE_FIELD(Boolean, generate_digest_report);
+        CONFIG_VALIDATE_FIELD(Boolean, sequential_output);
         goto end;
     }
 
     ret = (set_download_distribution_found && remove_console_data_found && remove_titlekey_crypto_found && disable_linked_account_requirement_found && \
-           enable_screenshots_found && enable_video_capture_found && disable_hdcp_found && generate_authoringtool_data_found && lookup_checksum_found);
+           enable_screenshots_found && enable_video_capture_found && disable_hdcp_found && generate_authoringtool_data_found && lookup_checksum_found && \
+           generate_digest_report_found && sequential_output_found);
 
 end:
     return ret;
@@ -160,8 +160,8 @@ static ssize_t hfsdev_read(struct _reent *r, void *fd, char *ptr, size_t len)
 
     //LOG_MSG_DEBUG("Reading 0x%lX byte(s) at offset 0x%lX from \"%s:/%s\".", len, file->offset, dev_ctx->name, file->name);
 
-    /* Read file data. */
-    if (!hfsReadEntryData(fs_ctx, file->hfs_entry, ptr, len, file->offset)) DEVOPTAB_SET_ERROR_AND_EXIT(EIO);
+    /* Read file data. Devoptab reads are UI-driven (e.g. filesystem browsing), so they're serviced ahead of background gamecard dumps. */
+    if (!hfsReadEntryDataWithPriority(fs_ctx, file->hfs_entry, ptr, len, file->offset, GameCardIoPriority_High)) DEVOPTAB_SET_ERROR_AND_EXIT(EIO);
 
     /* Adjust offset. */
     file->offset += len;
@@ -26,6 +26,7 @@
 #include <core/rsa.h>
 
 #define GAMECARD_READ_BUFFER_SIZE               0x800000                /* 8 MiB. */
+#define GAMECARD_SMALL_READ_THRESHOLD           0x10000                 /* 64 KiB. Unaligned reads up to this size are entirely bounced through the read buffer. */
 
 #define GAMECARD_ACCESS_DELAY                   3                       /* Seconds. */
 
@@ -36,6 +37,10 @@
 
 #define LAFW_MAGIC                              0x4C414657              /* "LAFW". */
 
+#define GAMECARD_IO_MERGE_THRESHOLD             0x100000                /* 1 MiB. Only requests up to this size are merged with adjacent requests. */
+#define GAMECARD_IO_MAX_MERGE_COUNT             32
+#define GAMECARD_IO_MAX_SKIP_COUNT              8                       /* Requests passed over this many times are serviced before anything else, to avoid starvation. */
+
 /* Type definitions. */
 
 typedef enum {
@@ -44,6 +49,18 @@ typedef enum {
     GameCardStorageArea_Secure = 2
 } GameCardStorageArea;
 
+/// Pending read request from a gamecard I/O scheduler client. Lives in the stack of the client thread until it has been serviced.
+typedef struct _GameCardIoRequest {
+    void *out;
+    u64 read_size;
+    u64 offset;
+    u8 priority;                        ///< GameCardIoPriority.
+    u32 skip_count;                     ///< Number of times this request has been passed over by the scheduler.
+    bool done;
+    bool success;
+    struct _GameCardIoRequest *next;
+} GameCardIoRequest;
+
 typedef enum {
     GameCardCapacity_1GiB  = BITL(30),
     GameCardCapacity_2GiB  = BITL(31),
@@ -89,6 +106,20 @@ static u64 g_gameCardCapacity = 0;
 static u32 g_gameCardHfsCount = 0;
 static HashFileSystemContext **g_gameCardHfsCtx = NULL;
 
+/* Gamecard image file backend. Used in place of the FS gamecard storage whenever an image file is mounted. */
+static FILE *g_gameCardImageFile = NULL;
+static u64 g_gameCardImageFileSize = 0, g_gameCardImageBaseOffset = 0;
+
+/* Gamecard I/O scheduler. g_gameCardMutex must never be locked while holding g_gameCardIoMutex. */
+static Mutex g_gameCardIoMutex = 0;
+static CondVar g_gameCardIoCondVar = 0;
+static GameCardIoRequest *g_gameCardIoQueue = NULL;
+static bool g_gameCardIoServicing = false;
+static GameCardIoRequest *g_gameCardIoLeader = NULL;
+static u64 g_gameCardIoLastOffset = 0;
+static GameCardIoStats g_gameCardIoStats = {0};
+static __thread u8 g_gameCardThreadIoPriority = GameCardIoPriority_Normal;
+
 static MemoryLocation g_fsProgramMemory = {
     .program_id = FS_SYSMODULE_TID,
     .mask = 0,
@@ -140,8 +171,25 @@ static bool gamecardGetHandleAndStorage(u32 partition);
 
 static bool gamecardOpenStorageArea(u8 area);
 static bool gamecardReadStorageArea(void *out, u64 read_size, u64 offset);
+static bool gamecardReadStorageAreaSegment(u8 *out, u64 read_size, u64 base_offset);
 static void gamecardCloseStorageArea(void);
 
+NX_INLINE bool gamecardIsStorageAreaOpen(void);
+static Result gamecardStorageRead(u64 offset, void *out, u64 read_size);
+static Result gamecardStorageGetSize(u64 *out);
+
+static bool gamecardOpenImageFile(const char *path);
+static void gamecardCloseImageFile(void);
+
+static void gamecardServiceIoQueue(GameCardIoRequest *request);
+static GameCardIoRequest *gamecardGetNextIoRequest(void);
+static u32 gamecardDequeueIoRequests(GameCardIoRequest *request, GameCardIoRequest **out_requests);
+static int gamecardCompareIoRequests(const GameCardIoRequest *a, const GameCardIoRequest *b);
+static void gamecardRemoveIoRequest(GameCardIoRequest *request);
+static bool gamecardExecuteIoRequests(GameCardIoRequest **requests, u32 request_count);
+NX_INLINE u8 gamecardGetStorageAreaFromOffset(u64 offset);
+NX_INLINE bool gamecardIsIoRequestMergeable(const GameCardIoRequest *request);
+
 static bool gamecardGetStorageAreasSizes(void);
 NX_INLINE u64 gamecardGetCapacityFromRomSizeValue(u8 rom_size);
 
@@ -254,6 +302,9 @@ void gamecardExit(void)
             g_openDeviceOperator = false;
         }
 
+        /* Close gamecard image file. */
+        gamecardCloseImageFile();
+
         /* Free gamecard read buffer. */
         if (g_gameCardReadBuf)
         {
@@ -288,6 +339,73 @@ u8 gamecardGetStatus(void)
     return atomic_load(&g_gameCardStatus);
 }
 
+bool gamecardMountImageFile(const char *path)
+{
+    bool ret = false;
+
+    SCOPED_LOCK(&g_gameCardMutex)
+    {
+        if (!g_gameCardInterfaceInit || !path || !*path)
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        /* Free gamecard info and close any previously mounted image file. */
+        gamecardFreeInfo(true);
+        gamecardCloseImageFile();
+
+        /* Open gamecard image file and load its info. */
+        if (gamecardOpenImageFile(path))
+        {
+            atomic_store(&g_gameCardStatus, GameCardStatus_Processing);
+            gamecardLoadInfo();
+
+            ret = (atomic_load(&g_gameCardStatus) == GameCardStatus_InsertedAndInfoLoaded);
+            if (!ret)
+            {
+                LOG_MSG_ERROR("Failed to load gamecard info from \"%s\"!", path);
+                gamecardFreeInfo(true);
+                gamecardCloseImageFile();
+            }
+        }
+
+        /* Signal user mode gamecard status change event. */
+        ueventSignal(&g_gameCardStatusChangeEvent);
+    }
+
+    return ret;
+}
+
+void gamecardUnmountImageFile(void)
+{
+    SCOPED_LOCK(&g_gameCardMutex)
+    {
+        if (!g_gameCardInterfaceInit || !g_gameCardImageFile) break;
+
+        /* Free gamecard info and close image file. */
+        gamecardFreeInfo(true);
+        gamecardCloseImageFile();
+
+        /* Fall back to the physical gamecard, if there's one inserted. */
+        if (gamecardIsInserted())
+        {
+            atomic_store(&g_gameCardStatus, GameCardStatus_Processing);
+            gamecardLoadInfo();
+        }
+
+        /* Signal user mode gamecard status change event. */
+        ueventSignal(&g_gameCardStatusChangeEvent);
+    }
+}
+
+bool gamecardIsImageFileMounted(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_gameCardMutex) ret = (g_gameCardImageFile != NULL);
+    return ret;
+}
+
 /* Read full FS program memory to retrieve the GameCardSecurityInformation block. */
 /* In FS program memory, this is returned by Lotus command "ChangeToSecureMode" (0xF). */
 /* This means it is only available *after* the gamecard secure area has been mounted, which is taken care of in gamecardReadSecurityInformation(). */
@@ -306,6 +424,12 @@ bool gamecardGetCardIdSet(FsGameCardIdSet *out)
     {
         if (!g_gameCardInterfaceInit || atomic_load(&g_gameCardStatus) != GameCardStatus_InsertedAndInfoLoaded || !out) break;
 
+        if (g_gameCardImageFile)
+        {
+            LOG_MSG_ERROR("Gamecard ID set isn't available for gamecard image files!");
+            break;
+        }
+
         Result rc = fsDeviceOperatorGetGameCardIdSet(&g_deviceOperator, out, sizeof(FsGameCardIdSet), (s64)sizeof(FsGameCardIdSet));
         if (R_FAILED(rc)) LOG_MSG_ERROR("fsDeviceOperatorGetGameCardIdSet failed! (0x%X)", rc);
 
@@ -335,11 +459,85 @@ bool gamecardGetLotusAsicFirmwareBlob(LotusAsicFirmwareBlob *out_lafw_blob, u64
     return ret;
 }
 
-bool gamecardReadStorage(void *out, u64 read_size, u64 offset)
+bool gamecardReadStorageWithPriority(void *out, u64 read_size, u64 offset, u8 priority)
 {
-    bool ret = false;
-    SCOPED_LOCK(&g_gameCardMutex) ret = gamecardReadStorageArea(out, read_size, offset);
-    return ret;
+    if (!out || !read_size || priority >= GameCardIoPriority_Count)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    GameCardIoRequest request = { .out = out, .read_size = read_size, .offset = offset, .priority = priority };
+    GameCardIoRequest **tail = NULL;
+
+    mutexLock(&g_gameCardIoMutex);
+
+    /* Append request to the queue. */
+    for(tail = &g_gameCardIoQueue; *tail; tail = &((*tail)->next));
+    *tail = &request;
+
+    g_gameCardIoStats.request_count++;
+    if (++g_gameCardIoStats.queue_depth > g_gameCardIoStats.max_queue_depth) g_gameCardIoStats.max_queue_depth = g_gameCardIoStats.queue_depth;
+
+    /* Take the lead if no other thread is servicing the queue, or if it was handed over to us. Otherwise, wait until our request has been serviced. */
+    /* The leading thread only services its own request, along with any requests merged into it, and then passes the lead on to the owner of the next request. */
+    while(!request.done)
+    {
+        if (g_gameCardIoServicing && g_gameCardIoLeader != &request)
+        {
+            condvarWait(&g_gameCardIoCondVar, &g_gameCardIoMutex);
+            continue;
+        }
+
+        g_gameCardIoServicing = true;
+        g_gameCardIoLeader = &request;
+
+        mutexUnlock(&g_gameCardIoMutex);
+        gamecardServiceIoQueue(&request);
+        mutexLock(&g_gameCardIoMutex);
+    }
+
+    mutexUnlock(&g_gameCardIoMutex);
+
+    return request.success;
+}
+
+u8 gamecardSetThreadIoPriority(u8 priority)
+{
+    u8 prev_priority = g_gameCardThreadIoPriority;
+
+    if (priority >= GameCardIoPriority_Count)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return prev_priority;
+    }
+
+    g_gameCardThreadIoPriority = priority;
+
+    return prev_priority;
+}
+
+u8 gamecardGetThreadIoPriority(void)
+{
+    return g_gameCardThreadIoPriority;
+}
+
+bool gamecardGetIoStats(GameCardIoStats *out)
+{
+    if (!out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    SCOPED_LOCK(&g_gameCardIoMutex) memcpy(out, &g_gameCardIoStats, sizeof(GameCardIoStats));
+
+    return true;
+}
+
+void gamecardResetIoMaxQueueDepth(void)
+{
+    SCOPED_LOCK(&g_gameCardIoMutex) g_gameCardIoStats.max_queue_depth = g_gameCardIoStats.queue_depth;
 }
 
 bool gamecardGetHeader(GameCardHeader *out)
@@ -374,7 +572,16 @@ bool gamecardGetCertificate(FsGameCardCertificate *out)
 
     SCOPED_LOCK(&g_gameCardMutex)
     {
-        if (!g_gameCardInterfaceInit || atomic_load(&g_gameCardStatus) != GameCardStatus_InsertedAndInfoLoaded || !g_gameCardHandle.value || !out) break;
+        if (!g_gameCardInterfaceInit || atomic_load(&g_gameCardStatus) != GameCardStatus_InsertedAndInfoLoaded || !out) break;
+
+        /* Gamecard image files hold the certificate within the normal storage area. */
+        if (g_gameCardImageFile)
+        {
+            ret = gamecardReadStorageArea(out, sizeof(FsGameCardCertificate), GAMECARD_CERT_OFFSET);
+            break;
+        }
+
+        if (!g_gameCardHandle.value) break;
 
         /* Read the gamecard certificate using the official IPC call. */
         Result rc = fsDeviceOperatorGetGameCardDeviceCertificate(&g_deviceOperator, &g_gameCardHandle, out, sizeof(FsGameCardCertificate), (s64)sizeof(FsGameCardCertificate));
@@ -431,7 +638,7 @@ bool gamecardGetBundledFirmwareUpdateVersion(Version *out)
 
     SCOPED_LOCK(&g_gameCardMutex)
     {
-        if (!g_gameCardInterfaceInit || atomic_load(&g_gameCardStatus) != GameCardStatus_InsertedAndInfoLoaded || !g_gameCardHandle.value || !out) break;
+        if (!g_gameCardInterfaceInit || atomic_load(&g_gameCardStatus) != GameCardStatus_InsertedAndInfoLoaded || g_gameCardImageFile || !g_gameCardHandle.value || !out) break;
 
         u64 update_id = 0;
         u32 update_version = 0;
@@ -690,6 +897,9 @@ static void gamecardDetectionThreadFunc(void *arg)
 
         SCOPED_LOCK(&g_gameCardMutex)
         {
+            /* Ignore physical gamecard status changes while a gamecard image file is mounted. */
+            if (g_gameCardImageFile) break;
+
             /* Free gamecard info before proceeding. */
             gamecardFreeInfo(true);
 
@@ -758,7 +968,8 @@ static void gamecardLoadInfo(void)
     if (!_gamecardGetPlaintextCardInfoArea()) goto end;
 
     /* Check if we meet the Lotus ASIC firmware (LAFW) version requirement. */
-    if (g_lafwVersion < g_gameCardInfoArea.fw_version)
+    /* This doesn't apply to gamecard image files. */
+    if (!g_gameCardImageFile && g_lafwVersion < g_gameCardInfoArea.fw_version)
     {
         LOG_MSG_ERROR("LAFW version doesn't meet gamecard requirement! (%lu < %lu).", g_lafwVersion, g_gameCardInfoArea.fw_version);
         atomic_store(&g_gameCardStatus, GameCardStatus_LotusAsicFirmwareUpdateRequired);
@@ -781,7 +992,7 @@ static void gamecardLoadInfo(void)
         goto end;
     }
 
-    if (utilsGetCustomFirmwareType() == UtilsCustomFirmwareType_SXOS)
+    if (!g_gameCardImageFile && utilsGetCustomFirmwareType() == UtilsCustomFirmwareType_SXOS)
     {
         /* The total size for the secure storage area is maxed out under SX OS. */
         /* Let's try to calculate it manually. */
@@ -895,10 +1106,10 @@ static bool gamecardReadHeader(void)
 
     /* Read gamecard header. */
     /* We don't use gamecardReadStorageArea() here because of its dependence on storage area sizes (which we haven't yet retrieved). */
-    rc = fsStorageRead(&g_gameCardStorage, 0, &g_gameCardHeader, sizeof(GameCardHeader));
+    rc = gamecardStorageRead(0, &g_gameCardHeader, sizeof(GameCardHeader));
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("fsStorageRead failed to read gamecard header! (0x%X).", rc);
+        LOG_MSG_ERROR("gamecardStorageRead failed to read gamecard header! (0x%X).", rc);
         return false;
     }
 
@@ -915,20 +1126,20 @@ static bool gamecardReadHeader(void)
     if (g_gameCardHeader.flags & GameCardFlags_HasCa10Certificate)
     {
         /* Read the Header2 area. */
-        rc = fsStorageRead(&g_gameCardStorage, GAMECARD_HEADER2_OFFSET, &g_gameCardHeader2, sizeof(GameCardHeader2));
+        rc = gamecardStorageRead(GAMECARD_HEADER2_OFFSET, &g_gameCardHeader2, sizeof(GameCardHeader2));
         if (R_FAILED(rc))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read gamecard Header2 area! (0x%X).", rc);
+            LOG_MSG_ERROR("gamecardStorageRead failed to read gamecard Header2 area! (0x%X).", rc);
             return false;
         }
 
         LOG_DATA_DEBUG(&g_gameCardHeader2, sizeof(GameCardHeader2), "Gamecard Header2 dump:");
 
         /* Read the Header2Certificate area. */
-        rc = fsStorageRead(&g_gameCardStorage, GAMECARD_HEADER2_CERT_OFFSET, &g_gameCardHeader2Cert, sizeof(GameCardHeader2Certificate));
+        rc = gamecardStorageRead(GAMECARD_HEADER2_CERT_OFFSET, &g_gameCardHeader2Cert, sizeof(GameCardHeader2Certificate));
         if (R_FAILED(rc))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read gamecard Header2Certificate area! (0x%X).", rc);
+            LOG_MSG_ERROR("gamecardStorageRead failed to read gamecard Header2Certificate area! (0x%X).", rc);
             return false;
         }
 
@@ -990,6 +1201,12 @@ static bool gamecardReadSecurityInformation(GameCardSecurityInformation *out)
     /* Clear output. */
     memset(out, 0, sizeof(GameCardSecurityInformation));
 
+    if (g_gameCardImageFile)
+    {
+        LOG_MSG_ERROR("Gamecard security information isn't available for gamecard image files!");
+        return false;
+    }
+
     /* Open secure storage area. */
     if (!gamecardOpenStorageArea(GameCardStorageArea_Secure))
     {
@@ -1043,6 +1260,9 @@ static bool gamecardGetHandleAndStorage(u32 partition)
         return false;
     }
 
+    /* Gamecard image files don't need any handles. Storage areas are addressed using offsets relative to the start of the file. */
+    if (g_gameCardImageFile) return true;
+
     Result rc = 0;
 
     /* 10 tries. */
@@ -1093,7 +1313,13 @@ static bool gamecardOpenStorageArea(u8 area)
     }
 
     /* Return right away if a valid handle has already been retrieved and the desired gamecard storage area is currently open. */
-    if (g_gameCardHandle.value && serviceIsActive(&(g_gameCardStorage.s)) && g_gameCardCurrentStorageArea == area) return true;
+    if (gamecardIsStorageAreaOpen() && g_gameCardCurrentStorageArea == area) return true;
+
+    /* Update storage area switch count. */
+    if (g_gameCardCurrentStorageArea != GameCardStorageArea_None)
+    {
+        SCOPED_LOCK(&g_gameCardIoMutex) g_gameCardIoStats.storage_switch_count++;
+    }
 
     /* Close both the gamecard handle and the open storage area. */
     gamecardCloseStorageArea();
@@ -1122,73 +1348,112 @@ static bool gamecardReadStorageArea(void *out, u64 read_size, u64 offset)
         return false;
     }
 
-    Result rc = 0;
     u8 *out_u8 = (u8*)out;
-    u8 area = (offset < g_gameCardNormalAreaSize ? GameCardStorageArea_Normal : GameCardStorageArea_Secure);
-    bool success = false;
 
-    /* Handle reads that span both the normal and secure gamecard storage areas. */
-    if (area == GameCardStorageArea_Normal && (offset + read_size) > g_gameCardNormalAreaSize)
+    /* Reads that span both the normal and secure gamecard storage areas are split into one segment per storage area. */
+    while(read_size)
     {
-        /* Calculate normal storage area size difference. */
-        u64 diff_size = (g_gameCardNormalAreaSize - offset);
+        u8 area = (offset < g_gameCardNormalAreaSize ? GameCardStorageArea_Normal : GameCardStorageArea_Secure);
+        u64 area_read_size = (area == GameCardStorageArea_Normal ? MIN(read_size, g_gameCardNormalAreaSize - offset) : read_size);
 
-        /* Read normal storage area data. */
-        if (!gamecardReadStorageArea(out_u8, diff_size, offset)) goto end;
+        /* Calculate proper storage area offset. */
+        u64 base_offset = (area == GameCardStorageArea_Normal ? offset : (offset - g_gameCardNormalAreaSize));
 
-        /* Adjust variables to read right from the start of the secure storage area. */
-        read_size -= diff_size;
-        offset = g_gameCardNormalAreaSize;
-        out_u8 += diff_size;
-        area = GameCardStorageArea_Secure;
-    }
+        /* Open a storage area if needed. */
+        /* If the right storage area has already been opened, this will return true. */
+        if (!gamecardOpenStorageArea(area))
+        {
+            LOG_MSG_ERROR("Failed to open %s storage area!", GAMECARD_STORAGE_AREA_NAME(area));
+            return false;
+        }
 
-    /* Open a storage area if needed. */
-    /* If the right storage area has already been opened, this will return true. */
-    if (!gamecardOpenStorageArea(area))
-    {
-        LOG_MSG_ERROR("Failed to open %s storage area!", GAMECARD_STORAGE_AREA_NAME(area));
-        goto end;
+        if (!gamecardReadStorageAreaSegment(out_u8, area_read_size, base_offset)) return false;
+
+        out_u8 += area_read_size;
+        read_size -= area_read_size;
+        offset += area_read_size;
     }
 
-    /* Calculate proper storage area offset. */
-    u64 base_offset = (area == GameCardStorageArea_Normal ? offset : (offset - g_gameCardNormalAreaSize));
+    return true;
+}
 
-    if (!(base_offset % GAMECARD_PAGE_SIZE) && !(read_size % GAMECARD_PAGE_SIZE))
+/* Reads data from the currently open storage area. 'base_offset' is relative to the start of the storage area. */
+/* Only the unaligned head and tail pages are read into our read buffer. The aligned middle is read straight into the output buffer. */
+static bool gamecardReadStorageAreaSegment(u8 *out, u64 read_size, u64 base_offset)
+{
+    Result rc = 0;
+    const char *area_name = GAMECARD_STORAGE_AREA_NAME(g_gameCardCurrentStorageArea);
+
+    u64 block_start_offset = ALIGN_DOWN(base_offset, GAMECARD_PAGE_SIZE);
+    u64 block_end_offset = ALIGN_UP(base_offset + read_size, GAMECARD_PAGE_SIZE);
+    u64 block_size = (block_end_offset - block_start_offset);
+    u64 tail_size = 0;
+
+    /* Small unaligned reads are serviced using a single storage read into our read buffer, which is cheaper than issuing up to three separate storage reads. */
+    if (((base_offset % GAMECARD_PAGE_SIZE) || (read_size % GAMECARD_PAGE_SIZE)) && block_size <= GAMECARD_SMALL_READ_THRESHOLD)
     {
-        /* Optimization for reads that are already aligned to a GAMECARD_PAGE_SIZE boundary. */
-        rc = fsStorageRead(&g_gameCardStorage, base_offset, out_u8, read_size);
+        rc = gamecardStorageRead(block_start_offset, g_gameCardReadBuf, block_size);
         if (R_FAILED(rc))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (aligned).", read_size, base_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
-            goto end;
+            LOG_MSG_ERROR("gamecardStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (unaligned).", block_size, block_start_offset, area_name, rc);
+            return false;
         }
 
-        success = true;
-    } else {
-        /* Fix offset and/or size to avoid unaligned reads. */
-        u64 block_start_offset = ALIGN_DOWN(base_offset, GAMECARD_PAGE_SIZE);
-        u64 block_end_offset = ALIGN_UP(base_offset + read_size, GAMECARD_PAGE_SIZE);
-        u64 block_size = (block_end_offset - block_start_offset);
+        memcpy(out, g_gameCardReadBuf + (base_offset - block_start_offset), read_size);
 
+        return true;
+    }
+
+    /* Unaligned head page. */
+    if (base_offset % GAMECARD_PAGE_SIZE)
+    {
         u64 data_start_offset = (base_offset - block_start_offset);
-        u64 chunk_size = (block_size > GAMECARD_READ_BUFFER_SIZE ? GAMECARD_READ_BUFFER_SIZE : block_size);
-        u64 out_chunk_size = (block_size > GAMECARD_READ_BUFFER_SIZE ? (GAMECARD_READ_BUFFER_SIZE - data_start_offset) : read_size);
+        u64 head_size = MIN(GAMECARD_PAGE_SIZE - data_start_offset, read_size);
 
-        rc = fsStorageRead(&g_gameCardStorage, block_start_offset, g_gameCardReadBuf, chunk_size);
+        rc = gamecardStorageRead(block_start_offset, g_gameCardReadBuf, GAMECARD_PAGE_SIZE);
         if (R_FAILED(rc))
         {
-            LOG_MSG_ERROR("fsStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (unaligned).", chunk_size, block_start_offset, GAMECARD_STORAGE_AREA_NAME(area), rc);
-            goto end;
+            LOG_MSG_ERROR("gamecardStorageRead failed to read head page at offset 0x%lX from %s storage area! (0x%X).", block_start_offset, area_name, rc);
+            return false;
         }
 
-        memcpy(out_u8, g_gameCardReadBuf + data_start_offset, out_chunk_size);
+        memcpy(out, g_gameCardReadBuf + data_start_offset, head_size);
 
-        success = (block_size > GAMECARD_READ_BUFFER_SIZE ? gamecardReadStorageArea(out_u8 + out_chunk_size, read_size - out_chunk_size, offset + out_chunk_size) : true);
+        out += head_size;
+        read_size -= head_size;
+        base_offset += head_size;
     }
 
-end:
-    return success;
+    tail_size = (read_size % GAMECARD_PAGE_SIZE);
+
+    /* Aligned middle. */
+    if (read_size > tail_size)
+    {
+        rc = gamecardStorageRead(base_offset, out, read_size - tail_size);
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("gamecardStorageRead failed to read 0x%lX bytes at offset 0x%lX from %s storage area! (0x%X) (aligned).", read_size - tail_size, base_offset, area_name, rc);
+            return false;
+        }
+
+        out += (read_size - tail_size);
+        base_offset += (read_size - tail_size);
+    }
+
+    /* Unaligned tail page. */
+    if (tail_size)
+    {
+        rc = gamecardStorageRead(base_offset, g_gameCardReadBuf, GAMECARD_PAGE_SIZE);
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("gamecardStorageRead failed to read tail page at offset 0x%lX from %s storage area! (0x%X).", base_offset, area_name, rc);
+            return false;
+        }
+
+        memcpy(out, g_gameCardReadBuf, tail_size);
+    }
+
+    return true;
 }
 
 static void gamecardCloseStorageArea(void)
@@ -1206,6 +1471,285 @@ static void gamecardCloseStorageArea(void)
     g_gameCardCurrentStorageArea = GameCardStorageArea_None;
 }
 
+NX_INLINE bool gamecardIsStorageAreaOpen(void)
+{
+    return (g_gameCardImageFile ? true : (g_gameCardHandle.value && serviceIsActive(&(g_gameCardStorage.s))));
+}
+
+/* Reads data from the currently open storage area. 'offset' is relative to the start of the storage area. */
+static Result gamecardStorageRead(u64 offset, void *out, u64 read_size)
+{
+    if (!g_gameCardImageFile) return fsStorageRead(&g_gameCardStorage, (s64)offset, out, read_size);
+
+    /* The secure storage area starts right where the normal storage area ends. */
+    /* If the normal storage area size hasn't been retrieved yet, we're still reading the gamecard header. */
+    if (g_gameCardCurrentStorageArea == GameCardStorageArea_Secure) offset += GAMECARD_PAGE_OFFSET(g_gameCardHeader.rom_area_start_page);
+    offset += g_gameCardImageBaseOffset;
+
+    if (g_gameCardCurrentStorageArea == GameCardStorageArea_None || (offset + read_size) > g_gameCardImageFileSize) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    if (fseeko(g_gameCardImageFile, (off_t)offset, SEEK_SET) != 0 || fread(out, 1, read_size, g_gameCardImageFile) != read_size) return MAKERESULT(Module_Libnx, LibnxError_IoError);
+
+    return 0;
+}
+
+/* Retrieves the size for the currently open storage area. */
+static Result gamecardStorageGetSize(u64 *out)
+{
+    if (!g_gameCardImageFile) return fsStorageGetSize(&g_gameCardStorage, (s64*)out);
+
+    /* Both storage area sizes are derived from the secure area start page in the gamecard header, just like the Lotus does. */
+    /* Trimmed gamecard image files are supported: the secure storage area size is capped by the file size. */
+    u64 data_size = (g_gameCardImageFileSize - g_gameCardImageBaseOffset);
+    u64 normal_area_size = GAMECARD_PAGE_OFFSET(g_gameCardHeader.rom_area_start_page);
+
+    if (normal_area_size < sizeof(GameCardHeader) || normal_area_size >= data_size) return MAKERESULT(Module_Libnx, LibnxError_BadInput);
+
+    *out = (g_gameCardCurrentStorageArea == GameCardStorageArea_Normal ? normal_area_size : (data_size - normal_area_size));
+
+    return 0;
+}
+
+static bool gamecardOpenImageFile(const char *path)
+{
+    struct stat st = {0};
+    u32 magic = 0;
+    bool success = false;
+
+    /* Open gamecard image file. */
+    g_gameCardImageFile = fopen(path, "rb");
+    if (!g_gameCardImageFile)
+    {
+        LOG_MSG_ERROR("Failed to open gamecard image file \"%s\"! (%d).", path, errno);
+        goto end;
+    }
+
+    if (fstat(fileno(g_gameCardImageFile), &st) != 0 || (u64)st.st_size < (sizeof(GameCardKeyArea) + sizeof(GameCardHeader)))
+    {
+        LOG_MSG_ERROR("Invalid gamecard image file size! (\"%s\").", path);
+        goto end;
+    }
+
+    g_gameCardImageFileSize = (u64)st.st_size;
+
+    /* Check if the gamecard image file starts with a key area. */
+    for(u8 i = 0; i < 2; i++)
+    {
+        u64 base_offset = (i == 0 ? 0 : sizeof(GameCardKeyArea));
+
+        if (fseeko(g_gameCardImageFile, (off_t)(base_offset + offsetof(GameCardHeader, magic)), SEEK_SET) != 0 || \
+            fread(&magic, 1, sizeof(u32), g_gameCardImageFile) != sizeof(u32)) break;
+
+        if (__builtin_bswap32(magic) == GAMECARD_HEAD_MAGIC)
+        {
+            g_gameCardImageBaseOffset = base_offset;
+            success = true;
+            break;
+        }
+    }
+
+    if (!success) LOG_MSG_ERROR("Unable to locate gamecard header in \"%s\"!", path);
+
+end:
+    if (!success) gamecardCloseImageFile();
+
+    return success;
+}
+
+static void gamecardCloseImageFile(void)
+{
+    if (g_gameCardImageFile)
+    {
+        fclose(g_gameCardImageFile);
+        g_gameCardImageFile = NULL;
+    }
+
+    g_gameCardImageFileSize = g_gameCardImageBaseOffset = 0;
+}
+
+static void gamecardServiceIoQueue(GameCardIoRequest *request)
+{
+    GameCardIoRequest *requests[GAMECARD_IO_MAX_MERGE_COUNT] = {0};
+    u32 request_count = 0;
+    bool success = false;
+
+    SCOPED_LOCK(&g_gameCardMutex)
+    {
+        /* Only service our own request if it's the one that should go next. Otherwise, hand the lead over to the owner of the request that should. */
+        SCOPED_LOCK(&g_gameCardIoMutex)
+        {
+            GameCardIoRequest *next = gamecardGetNextIoRequest();
+
+            if (next == request)
+            {
+                request_count = gamecardDequeueIoRequests(request, requests);
+            } else {
+                g_gameCardIoLeader = next;
+                condvarWakeAll(&g_gameCardIoCondVar);
+            }
+        }
+
+        if (!request_count) break;
+
+        /* Read data. */
+        success = gamecardExecuteIoRequests(requests, request_count);
+
+        /* Signal completion to all affected clients, then pass the lead on to the owner of the next request, if there's one. */
+        SCOPED_LOCK(&g_gameCardIoMutex)
+        {
+            for(u32 i = 0; i < request_count; i++)
+            {
+                requests[i]->success = success;
+                requests[i]->done = true;
+            }
+
+            g_gameCardIoLeader = gamecardGetNextIoRequest();
+            if (!g_gameCardIoLeader) g_gameCardIoServicing = false;
+
+            condvarWakeAll(&g_gameCardIoCondVar);
+        }
+    }
+}
+
+/* Must be called with both g_gameCardMutex and g_gameCardIoMutex locked. */
+static GameCardIoRequest *gamecardGetNextIoRequest(void)
+{
+    GameCardIoRequest *best = NULL;
+
+    /* Pick the highest priority request, preferring the currently open storage area and offsets ahead of the last read. */
+    for(GameCardIoRequest *cur = g_gameCardIoQueue; cur; cur = cur->next)
+    {
+        if (!best || gamecardCompareIoRequests(cur, best) < 0) best = cur;
+    }
+
+    return best;
+}
+
+/* Must be called with both g_gameCardMutex and g_gameCardIoMutex locked. */
+static u32 gamecardDequeueIoRequests(GameCardIoRequest *request, GameCardIoRequest **out_requests)
+{
+    GameCardIoRequest *cur = NULL;
+    u32 request_count = 0;
+
+    /* Age all requests that are being passed over. */
+    for(cur = g_gameCardIoQueue; cur; cur = cur->next)
+    {
+        if (cur != request) cur->skip_count++;
+    }
+
+    gamecardRemoveIoRequest(request);
+    out_requests[request_count++] = request;
+
+    /* Merge small requests that are adjacent to the current one. They're serviced using a single page-aligned storage read. */
+    if (gamecardIsIoRequestMergeable(request))
+    {
+        u8 area = gamecardGetStorageAreaFromOffset(request->offset);
+        u64 span_start = ALIGN_DOWN(request->offset, GAMECARD_PAGE_SIZE);
+        u64 span_end = ALIGN_UP(request->offset + request->read_size, GAMECARD_PAGE_SIZE);
+
+        while(request_count < GAMECARD_IO_MAX_MERGE_COUNT)
+        {
+            GameCardIoRequest *next = NULL;
+
+            for(cur = g_gameCardIoQueue; cur; cur = cur->next)
+            {
+                if (!gamecardIsIoRequestMergeable(cur) || gamecardGetStorageAreaFromOffset(cur->offset) != area || cur->offset < span_start || cur->offset > span_end) continue;
+                if (MAX(span_end, ALIGN_UP(cur->offset + cur->read_size, GAMECARD_PAGE_SIZE)) - span_start > GAMECARD_READ_BUFFER_SIZE) continue;
+                if (!next || cur->offset < next->offset) next = cur;
+            }
+
+            if (!next) break;
+
+            span_end = MAX(span_end, ALIGN_UP(next->offset + next->read_size, GAMECARD_PAGE_SIZE));
+
+            gamecardRemoveIoRequest(next);
+            out_requests[request_count++] = next;
+        }
+
+        if (request_count > 1) g_gameCardIoStats.merged_request_count += request_count;
+    }
+
+    g_gameCardIoStats.queue_depth -= request_count;
+    g_gameCardIoStats.storage_read_count++;
+
+    return request_count;
+}
+
+static int gamecardCompareIoRequests(const GameCardIoRequest *a, const GameCardIoRequest *b)
+{
+    /* Starving requests are treated as if they had the highest priority. */
+    u8 a_priority = (a->skip_count >= GAMECARD_IO_MAX_SKIP_COUNT ? GameCardIoPriority_Count : a->priority);
+    u8 b_priority = (b->skip_count >= GAMECARD_IO_MAX_SKIP_COUNT ? GameCardIoPriority_Count : b->priority);
+    if (a_priority != b_priority) return (a_priority > b_priority ? -1 : 1);
+
+    /* Avoid storage area switches. */
+    bool a_same_area = (gamecardGetStorageAreaFromOffset(a->offset) == g_gameCardCurrentStorageArea);
+    bool b_same_area = (gamecardGetStorageAreaFromOffset(b->offset) == g_gameCardCurrentStorageArea);
+    if (a_same_area != b_same_area) return (a_same_area ? -1 : 1);
+
+    /* Sweep forward from the last serviced offset, then wrap around. */
+    bool a_ahead = (a->offset >= g_gameCardIoLastOffset), b_ahead = (b->offset >= g_gameCardIoLastOffset);
+    if (a_ahead != b_ahead) return (a_ahead ? -1 : 1);
+
+    if (a->offset != b->offset) return (a->offset < b->offset ? -1 : 1);
+
+    return 0;
+}
+
+static void gamecardRemoveIoRequest(GameCardIoRequest *request)
+{
+    for(GameCardIoRequest **cur = &g_gameCardIoQueue; *cur; cur = &((*cur)->next))
+    {
+        if (*cur != request) continue;
+        *cur = request->next;
+        request->next = NULL;
+        break;
+    }
+}
+
+/* Must be called with g_gameCardMutex locked. */
+static bool gamecardExecuteIoRequests(GameCardIoRequest **requests, u32 request_count)
+{
+    GameCardIoRequest *last_request = requests[request_count - 1];
+    u64 span_start = 0, span_end = 0;
+    bool success = false;
+
+    if (request_count == 1)
+    {
+        success = gamecardReadStorageArea(requests[0]->out, requests[0]->read_size, requests[0]->offset);
+        g_gameCardIoLastOffset = (requests[0]->offset + requests[0]->read_size);
+        return success;
+    }
+
+    /* Merged requests are sorted by offset, but they may overlap. Read the whole page-aligned span into our read buffer. */
+    span_start = ALIGN_DOWN(requests[0]->offset, GAMECARD_PAGE_SIZE);
+
+    for(u32 i = 0; i < request_count; i++) span_end = MAX(span_end, ALIGN_UP(requests[i]->offset + requests[i]->read_size, GAMECARD_PAGE_SIZE));
+
+    success = gamecardReadStorageArea(g_gameCardReadBuf, span_end - span_start, span_start);
+    if (success)
+    {
+        for(u32 i = 0; i < request_count; i++) memcpy(requests[i]->out, g_gameCardReadBuf + (requests[i]->offset - span_start), requests[i]->read_size);
+    }
+
+    g_gameCardIoLastOffset = (last_request->offset + last_request->read_size);
+
+    return success;
+}
+
+NX_INLINE u8 gamecardGetStorageAreaFromOffset(u64 offset)
+{
+    return (offset < g_gameCardNormalAreaSize ? GameCardStorageArea_Normal : GameCardStorageArea_Secure);
+}
+
+NX_INLINE bool gamecardIsIoRequestMergeable(const GameCardIoRequest *request)
+{
+    /* Requests that span both storage areas or that reach the end of the gamecard image (which may not be page-aligned) aren't merged. */
+    u64 end_offset = (request->offset + request->read_size);
+    return (request->read_size <= GAMECARD_IO_MERGE_THRESHOLD && (request->offset >= g_gameCardNormalAreaSize || end_offset <= g_gameCardNormalAreaSize) && \
+            ALIGN_UP(end_offset, GAMECARD_PAGE_SIZE) <= g_gameCardTotalSize);
+}
+
 static bool gamecardGetStorageAreasSizes(void)
 {
     for(u8 i = 0; i < 2; i++)
@@ -1220,13 +1764,13 @@ static bool gamecardGetStorageAreasSizes(void)
             return false;
         }
 
-        rc = fsStorageGetSize(&g_gameCardStorage, (s64*)&area_size);
+        rc = gamecardStorageGetSize(&area_size);
 
         gamecardCloseStorageArea();
 
         if (R_FAILED(rc) || !area_size)
         {
-            LOG_MSG_ERROR("fsStorageGetSize failed to retrieve %s storage area size! (0x%X).", GAMECARD_STORAGE_AREA_NAME(area), rc);
+            LOG_MSG_ERROR("gamecardStorageGetSize failed to retrieve %s storage area size! (0x%X).", GAMECARD_STORAGE_AREA_NAME(area), rc);
             return false;
         }
 
@@ -22,7 +22,10 @@
 #include <core/nxdt_utils.h>
 #include <core/gamecard.h>
 
-#define HFS_PARTITION_NAME_INDEX(x) ((x) - 1)
+#define HFS_PARTITION_NAME_INDEX(x)     ((x) - 1)
+
+#define HFS_NAME_HASH_FNV_OFFSET_BASIS  0x811C9DC5
+#define HFS_NAME_HASH_FNV_PRIME         0x01000193
 
 static const char *g_hfsPartitionNames[] = {
     [HFS_PARTITION_NAME_INDEX(HashFileSystemPartitionType_Root)]   = "root",
@@ -32,16 +35,25 @@ static const char *g_hfsPartitionNames[] = {
     [HFS_PARTITION_NAME_INDEX(HashFileSystemPartitionType_Secure)] = "secure"
 };
 
-bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset)
+/* Function prototypes. */
+
+static bool hfsGenerateNameIndex(HashFileSystemContext *ctx);
+static HashFileSystemNameIndexEntry *hfsFindFirstNameIndexEntryByHash(HashFileSystemNameIndexEntry *name_index, u32 entry_count, u32 name_hash);
+
+NX_INLINE u32 hfsCalculateNameHash(const char *name);
+
+static int hfsNameIndexEntrySortFunction(const void *a, const void *b);
+
+bool hfsReadPartitionDataWithPriority(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset, u8 priority)
 {
-    if (!hfsIsValidContext(ctx) || !out || !read_size || (offset + read_size) > ctx->size)
+    if (!hfsIsValidContext(ctx) || !out || !read_size || (offset + read_size) > ctx->size || priority >= GameCardIoPriority_Count)
     {
         LOG_MSG_ERROR("Invalid parameters!");
         return false;
     }
 
     /* Read partition data. */
-    if (!gamecardReadStorage(out, read_size, ctx->offset + offset))
+    if (!gamecardReadStorageWithPriority(out, read_size, ctx->offset + offset, priority))
     {
         LOG_MSG_ERROR("Failed to read Hash FS partition data!");
         return false;
@@ -50,7 +62,7 @@ bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size,
     return true;
 }
 
-bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset)
+bool hfsReadEntryDataWithPriority(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset, u8 priority)
 {
     if (!ctx || !fs_entry || !fs_entry->size || (fs_entry->offset + fs_entry->size) > ctx->size || !out || !read_size || (offset + read_size) > fs_entry->size)
     {
@@ -59,7 +71,7 @@ bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry,
     }
 
     /* Read entry data. */
-    if (!hfsReadPartitionData(ctx, out, read_size, ctx->header_size + fs_entry->offset + offset))
+    if (!hfsReadPartitionDataWithPriority(ctx, out, read_size, ctx->header_size + fs_entry->offset + offset, priority))
     {
         LOG_MSG_ERROR("Failed to read Partition FS entry data!");
         return false;
@@ -68,6 +80,16 @@ bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry,
     return true;
 }
 
+bool hfsReadPartitionData(HashFileSystemContext *ctx, void *out, u64 read_size, u64 offset)
+{
+    return hfsReadPartitionDataWithPriority(ctx, out, read_size, offset, gamecardGetThreadIoPriority());
+}
+
+bool hfsReadEntryData(HashFileSystemContext *ctx, HashFileSystemEntry *fs_entry, void *out, u64 read_size, u64 offset)
+{
+    return hfsReadEntryDataWithPriority(ctx, fs_entry, out, read_size, offset, gamecardGetThreadIoPriority());
+}
+
 bool hfsGetTotalDataSize(HashFileSystemContext *ctx, u64 *out_size)
 {
     if (!hfsIsValidContext(ctx) || !out_size)
@@ -98,9 +120,9 @@ bool hfsGetTotalDataSize(HashFileSystemContext *ctx, u64 *out_size)
 
 bool hfsGetEntryIndexByName(HashFileSystemContext *ctx, const char *name, u32 *out_idx)
 {
-    HashFileSystemEntry *fs_entry = NULL;
-    u32 entry_count = 0, name_table_size = 0;
+    u32 entry_count = 0, name_hash = 0;
     char *name_table = NULL;
+    HashFileSystemNameIndexEntry *index_entry = NULL;
     bool ret = false;
 
     if (hfsIsValidContext(ctx) && name && *name && out_idx)
@@ -117,36 +139,129 @@ bool hfsGetEntryIndexByName(HashFileSystemContext *ctx, const char *name, u32 *o
     }
 
     ret = false;
-    name_table_size = ((HashFileSystemHeader*)ctx->header)->name_table_size;
 
+    /* Generate name index, if needed. */
+    if (!ctx->name_index && !hfsGenerateNameIndex(ctx)) goto end;
+
+    /* Look for the first index entry with a matching name hash. */
+    name_hash = hfsCalculateNameHash(name);
+    index_entry = hfsFindFirstNameIndexEntryByHash(ctx->name_index, entry_count, name_hash);
+
+    /* Compare entry names until a match is found, or until the name hash no longer matches. */
+    for(; index_entry && index_entry < (ctx->name_index + entry_count) && index_entry->name_hash == name_hash; index_entry++)
+    {
+        if (!strcmp(name_table + hfsGetEntryByIndex(ctx, index_entry->index)->name_offset, name))
+        {
+            *out_idx = index_entry->index;
+            ret = true;
+            break;
+        }
+    }
+
+end:
+    return ret;
+}
+
+const char *hfsGetPartitionNameString(u8 hfs_partition_type)
+{
+    return ((hfs_partition_type > HashFileSystemPartitionType_None && hfs_partition_type < HashFileSystemPartitionType_Count) ? \
+            g_hfsPartitionNames[HFS_PARTITION_NAME_INDEX(hfs_partition_type)] : NULL);
+}
+
+static bool hfsGenerateNameIndex(HashFileSystemContext *ctx)
+{
+    HashFileSystemEntry *fs_entry = NULL;
+    u32 entry_count = hfsGetEntryCount(ctx), name_table_size = ((HashFileSystemHeader*)ctx->header)->name_table_size;
+    char *name_table = hfsGetNameTable(ctx);
+    HashFileSystemNameIndexEntry *name_index = NULL;
+
+    /* Allocate memory for the name index. */
+    name_index = calloc(entry_count, sizeof(HashFileSystemNameIndexEntry));
+    if (!name_index)
+    {
+        LOG_MSG_ERROR("Unable to allocate memory for the Hash FS name index! (%u entries).", entry_count);
+        return false;
+    }
+
+    /* Calculate name hashes for all entries. */
     for(u32 i = 0; i < entry_count; i++)
     {
         if (!(fs_entry = hfsGetEntryByIndex(ctx, i)))
         {
             LOG_MSG_ERROR("Failed to retrieve Hash FS entry #%u!", i);
-            break;
+            goto end;
         }
 
         if (fs_entry->name_offset >= name_table_size)
         {
             LOG_MSG_ERROR("Name offset from Hash FS entry #%u exceeds name table size!", i);
-            break;
+            goto end;
         }
 
-        if (!strcmp(name_table + fs_entry->name_offset, name))
+        name_index[i].name_hash = hfsCalculateNameHash(name_table + fs_entry->name_offset);
+        name_index[i].index = i;
+    }
+
+    /* Sort index entries by name hash. */
+    if (entry_count > 1) qsort(name_index, entry_count, sizeof(HashFileSystemNameIndexEntry), &hfsNameIndexEntrySortFunction);
+
+    /* Update context. */
+    ctx->name_index = name_index;
+    name_index = NULL;
+
+end:
+    if (name_index) free(name_index);
+
+    return (ctx->name_index != NULL);
+}
+
+static HashFileSystemNameIndexEntry *hfsFindFirstNameIndexEntryByHash(HashFileSystemNameIndexEntry *name_index, u32 entry_count, u32 name_hash)
+{
+    u32 low = 0, high = entry_count;
+
+    /* Perform a lower bound binary search. Entries sharing the same name hash are stored next to each other. */
+    while(low < high)
+    {
+        u32 mid = (low + ((high - low) / 2));
+
+        if (name_index[mid].name_hash < name_hash)
         {
-            *out_idx = i;
-            ret = true;
-            break;
+            low = (mid + 1);
+        } else {
+            high = mid;
         }
     }
 
-end:
-    return ret;
+    return ((low < entry_count && name_index[low].name_hash == name_hash) ? &(name_index[low]) : NULL);
 }
 
-const char *hfsGetPartitionNameString(u8 hfs_partition_type)
+NX_INLINE u32 hfsCalculateNameHash(const char *name)
 {
-    return ((hfs_partition_type > HashFileSystemPartitionType_None && hfs_partition_type < HashFileSystemPartitionType_Count) ? \
-            g_hfsPartitionNames[HFS_PARTITION_NAME_INDEX(hfs_partition_type)] : NULL);
+    u32 hash = HFS_NAME_HASH_FNV_OFFSET_BASIS;
+
+    while(*name)
+    {
+        hash ^= (u8)*name++;
+        hash *= HFS_NAME_HASH_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int hfsNameIndexEntrySortFunction(const void *a, const void *b)
+{
+    const HashFileSystemNameIndexEntry *index_entry_1 = (const HashFileSystemNameIndexEntry*)a;
+    const HashFileSystemNameIndexEntry *index_entry_2 = (const HashFileSystemNameIndexEntry*)b;
+
+    if (index_entry_1->name_hash < index_entry_2->name_hash)
+    {
+        return -1;
+    } else
+    if (index_entry_1->name_hash > index_entry_2->name_hash)
+    {
+        return 1;
+    }
+
+    /* Preserve the original entry order for colliding hashes. */
+    return (index_entry_1->index < index_entry_2->index ? -1 : (index_entry_1->index > index_entry_2->index ? 1 : 0));
 }
@@ -0,0 +1,492 @@
+/*
+ * multi_digest.c
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <core/nxdt_utils.h>
+#include <core/multi_digest.h>
+
+#include <mbedtls/version.h>
+
+/* mbedtls 3.x dropped the "_ret" suffix from its MD5 functions. */
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+#define MULTI_DIGEST_MD5_STARTS mbedtls_md5_starts
+#define MULTI_DIGEST_MD5_UPDATE mbedtls_md5_update
+#define MULTI_DIGEST_MD5_FINISH mbedtls_md5_finish
+#else
+#define MULTI_DIGEST_MD5_STARTS mbedtls_md5_starts_ret
+#define MULTI_DIGEST_MD5_UPDATE mbedtls_md5_update_ret
+#define MULTI_DIGEST_MD5_FINISH mbedtls_md5_finish_ret
+#endif
+
+/* Global variables. */
+
+static const u32 g_multiDigestTypes[MULTI_DIGEST_TYPE_COUNT] = {
+    MultiDigestType_Crc32,
+    MultiDigestType_Md5,
+    MultiDigestType_Sha1,
+    MultiDigestType_Sha256
+};
+
+static const char *g_multiDigestTypeNames[MULTI_DIGEST_TYPE_COUNT] = {
+    "CRC32",
+    "MD5",
+    "SHA-1",
+    "SHA-256"
+};
+
+/* Function prototypes. */
+
+static void multiDigestWorkerThreadFunc(void *arg);
+
+static void multiDigestInitializeWorkerState(MultiDigestWorker *worker);
+static void multiDigestUpdateWorkerState(MultiDigestWorker *worker, const void *data, size_t data_size);
+static void multiDigestFinalizeWorkerState(MultiDigestWorker *worker, MultiDigestResult *out);
+
+static void multiDigestStopWorkers(MultiDigestContext *ctx);
+
+static MultiDigestWorker *multiDigestGetWorkerByType(MultiDigestContext *ctx, u32 type);
+
+bool multiDigestInitializeContext(MultiDigestContext *ctx, u32 type_mask)
+{
+    if (!ctx || !(type_mask &= MultiDigestType_All))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    bool success = false;
+
+    /* Clear context. */
+    memset(ctx, 0, sizeof(MultiDigestContext));
+
+    ctx->type_mask = type_mask;
+
+    mutexInit(&(ctx->mutex));
+    condvarInit(&(ctx->work_cond));
+    condvarInit(&(ctx->done_cond));
+
+    /* Initialize workers. */
+    for(u32 i = 0; i < MULTI_DIGEST_TYPE_COUNT; i++)
+    {
+        if (!(type_mask & g_multiDigestTypes[i])) continue;
+
+        MultiDigestWorker *worker = &(ctx->workers[ctx->worker_count]);
+
+        worker->parent = ctx;
+        worker->type = g_multiDigestTypes[i];
+
+        multiDigestInitializeWorkerState(worker);
+
+        /* Spread workers across all available CPU cores. */
+        if (!utilsCreateThread(&(worker->thread), multiDigestWorkerThreadFunc, worker, (int)(ctx->worker_count % 3)))
+        {
+            LOG_MSG_ERROR("Failed to create %s worker thread!", g_multiDigestTypeNames[i]);
+            goto end;
+        }
+
+        worker->thread_created = true;
+        ctx->worker_count++;
+    }
+
+    success = true;
+
+end:
+    if (!success) multiDigestStopWorkers(ctx);
+
+    return success;
+}
+
+bool multiDigestUpdateAsync(MultiDigestContext *ctx, const void *data, size_t data_size)
+{
+    if (!ctx || !ctx->worker_count || ctx->finalized || !data || !data_size)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    /* Make sure the previous block has been fully processed. */
+    multiDigestWait(ctx);
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        /* Submit new block to all workers. */
+        ctx->data = data;
+        ctx->data_size = data_size;
+        ctx->pending_count = ctx->worker_count;
+        ctx->generation++;
+
+        ctx->total_size += data_size;
+
+        condvarWakeAll(&(ctx->work_cond));
+    }
+
+    return true;
+}
+
+void multiDigestWait(MultiDigestContext *ctx)
+{
+    if (!ctx) return;
+
+    u64 start_tick = armGetSystemTick();
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        while(ctx->pending_count) condvarWait(&(ctx->done_cond), &(ctx->mutex));
+
+        /* Don't keep a reference to a block we no longer own. */
+        ctx->data = NULL;
+        ctx->data_size = 0;
+    }
+
+    ctx->wait_time += armTicksToNs(armGetSystemTick() - start_tick);
+}
+
+bool multiDigestFinalize(MultiDigestContext *ctx, MultiDigestResult *out)
+{
+    if (!ctx || !ctx->worker_count || ctx->finalized || !out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    /* Wait for the last block and stop all workers. */
+    multiDigestWait(ctx);
+    multiDigestStopWorkers(ctx);
+
+    memset(out, 0, sizeof(MultiDigestResult));
+
+    for(u32 i = 0; i < ctx->worker_count; i++) multiDigestFinalizeWorkerState(&(ctx->workers[i]), out);
+
+    ctx->finalized = true;
+
+    return true;
+}
+
+bool multiDigestExportState(MultiDigestContext *ctx, MultiDigestState *out)
+{
+    if (!ctx || !ctx->worker_count || ctx->finalized || !out)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    /* Make sure all workers are idle. */
+    multiDigestWait(ctx);
+
+    memset(out, 0, sizeof(MultiDigestState));
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        out->type_mask = ctx->type_mask;
+        out->total_size = ctx->total_size;
+
+        for(u32 i = 0; i < ctx->worker_count; i++)
+        {
+            MultiDigestWorker *worker = &(ctx->workers[i]);
+
+            switch(worker->type)
+            {
+                case MultiDigestType_Crc32:
+                    out->crc32 = worker->state.crc32;
+                    break;
+                case MultiDigestType_Md5:
+                    memcpy(&(out->md5), &(worker->state.md5), sizeof(mbedtls_md5_context));
+                    break;
+                case MultiDigestType_Sha1:
+                    memcpy(&(out->sha1), &(worker->state.sha1), sizeof(Sha1Context));
+                    break;
+                case MultiDigestType_Sha256:
+                    memcpy(&(out->sha256), &(worker->state.sha256), sizeof(Sha256Context));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool multiDigestImportState(MultiDigestContext *ctx, const MultiDigestState *state)
+{
+    if (!ctx || !ctx->worker_count || ctx->finalized || ctx->total_size || !state || state->type_mask != ctx->type_mask)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        ctx->total_size = state->total_size;
+
+        for(u32 i = 0; i < ctx->worker_count; i++)
+        {
+            MultiDigestWorker *worker = &(ctx->workers[i]);
+
+            switch(worker->type)
+            {
+                case MultiDigestType_Crc32:
+                    worker->state.crc32 = state->crc32;
+                    break;
+                case MultiDigestType_Md5:
+                    memcpy(&(worker->state.md5), &(state->md5), sizeof(mbedtls_md5_context));
+                    break;
+                case MultiDigestType_Sha1:
+                    memcpy(&(worker->state.sha1), &(state->sha1), sizeof(Sha1Context));
+                    break;
+                case MultiDigestType_Sha256:
+                    memcpy(&(worker->state.sha256), &(state->sha256), sizeof(Sha256Context));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool multiDigestGetStats(MultiDigestContext *ctx, u32 type, MultiDigestStats *out)
+{
+    MultiDigestWorker *worker = NULL;
+
+    if (!ctx || !out || !(worker = multiDigestGetWorkerByType(ctx, type)))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    SCOPED_LOCK(&(ctx->mutex)) memcpy(out, &(worker->stats), sizeof(MultiDigestStats));
+
+    return true;
+}
+
+void multiDigestFreeContext(MultiDigestContext *ctx)
+{
+    if (!ctx) return;
+
+    multiDigestStopWorkers(ctx);
+
+    /* Free MD5 context, if needed. */
+    MultiDigestWorker *md5_worker = multiDigestGetWorkerByType(ctx, MultiDigestType_Md5);
+    if (md5_worker) mbedtls_md5_free(&(md5_worker->state.md5));
+
+    memset(ctx, 0, sizeof(MultiDigestContext));
+}
+
+const char *multiDigestGetTypeName(u32 type)
+{
+    for(u32 i = 0; i < MULTI_DIGEST_TYPE_COUNT; i++)
+    {
+        if (g_multiDigestTypes[i] == type) return g_multiDigestTypeNames[i];
+    }
+
+    return NULL;
+}
+
+char *multiDigestGenerateReport(const MultiDigestResult *result, u32 type_mask, const char *file_name, u64 file_size)
+{
+    if (!result || !(type_mask &= MultiDigestType_All) || !file_name || !*file_name)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return NULL;
+    }
+
+    char *report = NULL, hash_str[(SHA256_HASH_SIZE * 2) + 1] = {0};
+    size_t report_size = 0;
+    bool success = false;
+
+    if (!utilsAppendFormattedStringToBuffer(&report, &report_size, "File: %s\r\nSize: %lu\r\n", file_name, file_size)) goto end;
+
+    if (type_mask & MultiDigestType_Crc32)
+    {
+        if (!utilsAppendFormattedStringToBuffer(&report, &report_size, "CRC32: %08X\r\n", result->crc32)) goto end;
+    }
+
+    if (type_mask & MultiDigestType_Md5)
+    {
+        utilsGenerateHexString(hash_str, sizeof(hash_str), result->md5, sizeof(result->md5), false);
+        if (!utilsAppendFormattedStringToBuffer(&report, &report_size, "MD5: %s\r\n", hash_str)) goto end;
+    }
+
+    if (type_mask & MultiDigestType_Sha1)
+    {
+        utilsGenerateHexString(hash_str, sizeof(hash_str), result->sha1, sizeof(result->sha1), false);
+        if (!utilsAppendFormattedStringToBuffer(&report, &report_size, "SHA-1: %s\r\n", hash_str)) goto end;
+    }
+
+    if (type_mask & MultiDigestType_Sha256)
+    {
+        utilsGenerateHexString(hash_str, sizeof(hash_str), result->sha256, sizeof(result->sha256), false);
+        if (!utilsAppendFormattedStringToBuffer(&report, &report_size, "SHA-256: %s\r\n", hash_str)) goto end;
+    }
+
+    success = true;
+
+end:
+    if (!success)
+    {
+        LOG_MSG_ERROR("Failed to generate digest report for \"%s\"!", file_name);
+
+        if (report)
+        {
+            free(report);
+            report = NULL;
+        }
+    }
+
+    return report;
+}
+
+static void multiDigestWorkerThreadFunc(void *arg)
+{
+    MultiDigestWorker *worker = (MultiDigestWorker*)arg;
+    MultiDigestContext *ctx = worker->parent;
+
+    const void *data = NULL;
+    size_t data_size = 0;
+    u64 start_tick = 0, busy_time = 0;
+
+    while(true)
+    {
+        mutexLock(&(ctx->mutex));
+
+        /* Update stats from the previous block, signal the producer if we're the last worker to finish it and wait for a new block. */
+        if (data)
+        {
+            worker->stats.processed_size += data_size;
+            worker->stats.busy_time += busy_time;
+            if (--ctx->pending_count == 0) condvarWakeAll(&(ctx->done_cond));
+        }
+
+        while(!ctx->exit && worker->generation == ctx->generation) condvarWait(&(ctx->work_cond), &(ctx->mutex));
+
+        if (ctx->exit)
+        {
+            mutexUnlock(&(ctx->mutex));
+            break;
+        }
+
+        worker->generation = ctx->generation;
+        data = ctx->data;
+        data_size = ctx->data_size;
+
+        mutexUnlock(&(ctx->mutex));
+
+        /* Update digest state outside of the lock. */
+        start_tick = armGetSystemTick();
+        multiDigestUpdateWorkerState(worker, data, data_size);
+        busy_time = armTicksToNs(armGetSystemTick() - start_tick);
+    }
+
+    threadExit();
+}
+
+static void multiDigestInitializeWorkerState(MultiDigestWorker *worker)
+{
+    switch(worker->type)
+    {
+        case MultiDigestType_Crc32:
+            worker->state.crc32 = 0;
+            break;
+        case MultiDigestType_Md5:
+            mbedtls_md5_init(&(worker->state.md5));
+            MULTI_DIGEST_MD5_STARTS(&(worker->state.md5));
+            break;
+        case MultiDigestType_Sha1:
+            sha1ContextCreate(&(worker->state.sha1));
+            break;
+        case MultiDigestType_Sha256:
+            sha256ContextCreate(&(worker->state.sha256));
+            break;
+        default:
+            break;
+    }
+}
+
+static void multiDigestUpdateWorkerState(MultiDigestWorker *worker, const void *data, size_t data_size)
+{
+    switch(worker->type)
+    {
+        case MultiDigestType_Crc32:
+            worker->state.crc32 = crc32CalculateWithSeed(worker->state.crc32, data, data_size);
+            break;
+        case MultiDigestType_Md5:
+            MULTI_DIGEST_MD5_UPDATE(&(worker->state.md5), (const u8*)data, data_size);
+            break;
+        case MultiDigestType_Sha1:
+            sha1ContextUpdate(&(worker->state.sha1), data, data_size);
+            break;
+        case MultiDigestType_Sha256:
+            sha256ContextUpdate(&(worker->state.sha256), data, data_size);
+            break;
+        default:
+            break;
+    }
+}
+
+static void multiDigestFinalizeWorkerState(MultiDigestWorker *worker, MultiDigestResult *out)
+{
+    switch(worker->type)
+    {
+        case MultiDigestType_Crc32:
+            out->crc32 = worker->state.crc32;
+            break;
+        case MultiDigestType_Md5:
+            MULTI_DIGEST_MD5_FINISH(&(worker->state.md5), out->md5);
+            break;
+        case MultiDigestType_Sha1:
+            sha1ContextGetHash(&(worker->state.sha1), out->sha1);
+            break;
+        case MultiDigestType_Sha256:
+            sha256ContextGetHash(&(worker->state.sha256), out->sha256);
+            break;
+        default:
+            break;
+    }
+}
+
+static void multiDigestStopWorkers(MultiDigestContext *ctx)
+{
+    SCOPED_LOCK(&(ctx->mutex))
+    {
+        ctx->exit = true;
+        condvarWakeAll(&(ctx->work_cond));
+    }
+
+    for(u32 i = 0; i < MULTI_DIGEST_TYPE_COUNT; i++)
+    {
+        MultiDigestWorker *worker = &(ctx->workers[i]);
+        if (!worker->thread_created) continue;
+
+        utilsJoinThread(&(worker->thread));
+        worker->thread_created = false;
+    }
+}
+
+static MultiDigestWorker *multiDigestGetWorkerByType(MultiDigestContext *ctx, u32 type)
+{
+    for(u32 i = 0; i < ctx->worker_count; i++)
+    {
+        if (ctx->workers[i].type == type) return &(ctx->workers[i]);
+    }
+
+    return NULL;
+}
@@ -29,6 +29,7 @@
 #include <core/usb.h>
 #include <core/title.h>
 #include <core/bfttf.h>
+#include <core/checksum_db.h>
 #include <core/nxdt_bfsar.h>
 #include <core/devoptab/nxdt_devoptab.h>
 #include <core/fatfs/ff.h>
@@ -118,6 +119,8 @@ static void utilsOverclockSystemAppletHook(AppletHookType hook, void *param);
 
 static void utilsChangeHomeButtonBlockStatus(bool block);
 
+static bool utilsGetFileSystemInfoByPath(const char *path, struct statvfs *out_info);
+
 static size_t utilsGetUtf8StringLimit(const char *str, size_t str_size, size_t byte_limit);
 
 static char utilsConvertHexDigitToBinary(char c);
@@ -364,6 +367,9 @@ void utilsCloseResources(void)
         /* Deinitialize BFTTF interface. */
         bfttfExit();
 
+        /* Deinitialize offline checksum database interface. */
+        checksumDbExit();
+
         /* Deinitialize title interface. */
         titleExit();
 
@@ -855,27 +861,42 @@ void utilsGenerateFormattedSizeString(double size, char *dst, size_t dst_size)
 
 bool utilsGetFileSystemStatsByPath(const char *path, u64 *out_total, u64 *out_free)
 {
-    char *name_end = NULL, stat_path[32] = {0};
     struct statvfs info = {0};
-    int ret = -1;
 
-    if (!path || !*path || !(name_end = strchr(path, ':')) || *(name_end + 1) != '/' || (!out_total && !out_free))
+    if (!out_total && !out_free)
     {
         LOG_MSG_ERROR("Invalid parameters!");
         return false;
     }
 
-    name_end += 2;
-    snprintf(stat_path, MAX_ELEMENTS(stat_path), "%.*s", (int)(name_end - path), path);
+    if (!utilsGetFileSystemInfoByPath(path, &info)) return false;
+
+    if (out_total) *out_total = ((u64)info.f_blocks * (u64)info.f_frsize);
+    if (out_free) *out_free = ((u64)info.f_bfree * (u64)info.f_frsize);
+
+    return true;
+}
+
+bool utilsGetFileSystemClusterSizeByPath(const char *path, u32 *out_cluster_size)
+{
+    struct statvfs info = {0};
 
-    if ((ret = statvfs(stat_path, &info)) != 0)
+    if (!out_cluster_size)
     {
-        LOG_MSG_ERROR("statvfs failed for \"%s\"! (%d) (errno: %d).", stat_path, ret, errno);
+        LOG_MSG_ERROR("Invalid parameters!");
         return false;
     }
 
-    if (out_total) *out_total = ((u64)info.f_blocks * (u64)info.f_frsize);
-    if (out_free) *out_free = ((u64)info.f_bfree * (u64)info.f_frsize);
+    if (!utilsGetFileSystemInfoByPath(path, &info)) return false;
+
+    /* Some devoptab devices (e.g. the SD card) report a 1-byte block size, which is useless for our purposes. */
+    if (info.f_bsize < 0x200 || info.f_bsize > UINT32_MAX || !IS_POWER_OF_TWO(info.f_bsize))
+    {
+        LOG_MSG_DEBUG("Unusable block size reported for \"%s\" (0x%lX).", path, (u64)info.f_bsize);
+        return false;
+    }
+
+    *out_cluster_size = (u32)info.f_bsize;
 
     return true;
 }
@@ -1545,6 +1566,29 @@ static void utilsChangeHomeButtonBlockStatus(bool block)
     }
 }
 
+static bool utilsGetFileSystemInfoByPath(const char *path, struct statvfs *out_info)
+{
+    char *name_end = NULL, stat_path[32] = {0};
+    int ret = -1;
+
+    if (!path || !*path || !(name_end = strchr(path, ':')) || *(name_end + 1) != '/' || !out_info)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    name_end += 2;
+    snprintf(stat_path, MAX_ELEMENTS(stat_path), "%.*s", (int)(name_end - path), path);
+
+    if ((ret = statvfs(stat_path, out_info)) != 0)
+    {
+        LOG_MSG_ERROR("statvfs failed for \"%s\"! (%d) (errno: %d).", stat_path, ret, errno);
+        return false;
+    }
+
+    return true;
+}
+
 static size_t utilsGetUtf8StringLimit(const char *str, size_t str_size, size_t byte_limit)
 {
     if (!str || !*str || !str_size || !byte_limit) return 0;
@@ -25,6 +25,18 @@
 
 #define PFS_HEADER_PADDING_ALIGNMENT    0x20
 
+#define PFS_NAME_HASH_FNV_OFFSET_BASIS  0x811C9DC5
+#define PFS_NAME_HASH_FNV_PRIME         0x01000193
+
+/* Function prototypes. */
+
+static bool pfsGenerateNameIndex(PartitionFileSystemContext *ctx);
+static PartitionFileSystemNameIndexEntry *pfsFindFirstNameIndexEntryByHash(PartitionFileSystemNameIndexEntry *name_index, u32 entry_count, u32 name_hash);
+
+NX_INLINE u32 pfsCalculateNameHash(const char *name);
+
+static int pfsNameIndexEntrySortFunction(const void *a, const void *b);
+
 bool pfsInitializeContext(PartitionFileSystemContext *out, NcaFsSectionContext *nca_fs_ctx)
 {
     u32 magic = 0;
@@ -158,9 +170,9 @@ bool pfsReadEntryData(PartitionFileSystemContext *ctx, PartitionFileSystemEntry
 
 bool pfsGetEntryIndexByName(PartitionFileSystemContext *ctx, const char *name, u32 *out_idx)
 {
-    PartitionFileSystemEntry *fs_entry = NULL;
-    u32 entry_count = pfsGetEntryCount(ctx), name_table_size = 0;
+    u32 entry_count = pfsGetEntryCount(ctx), name_hash = 0;
     char *name_table = pfsGetNameTable(ctx);
+    PartitionFileSystemNameIndexEntry *index_entry = NULL;
 
     if (!entry_count || !name_table || !name || !*name || !out_idx)
     {
@@ -168,25 +180,19 @@ bool pfsGetEntryIndexByName(PartitionFileSystemContext *ctx, const char *name, u
         return false;
     }
 
-    name_table_size = ((PartitionFileSystemHeader*)ctx->header)->name_table_size;
+    /* Generate name index, if needed. */
+    if (!ctx->name_index && !pfsGenerateNameIndex(ctx)) return false;
 
-    for(u32 i = 0; i < entry_count; i++)
-    {
-        if (!(fs_entry = pfsGetEntryByIndex(ctx, i)))
-        {
-            LOG_MSG_ERROR("Failed to retrieve Partition FS entry #%u!", i);
-            return false;
-        }
-
-        if (fs_entry->name_offset >= name_table_size)
-        {
-            LOG_MSG_ERROR("Name offset from Partition FS entry #%u exceeds name table size!", i);
-            return false;
-        }
+    /* Look for the first index entry with a matching name hash. */
+    name_hash = pfsCalculateNameHash(name);
+    index_entry = pfsFindFirstNameIndexEntryByHash(ctx->name_index, entry_count, name_hash);
 
-        if (!strcmp(name_table + fs_entry->name_offset, name))
+    /* Compare entry names until a match is found, or until the name hash no longer matches. */
+    for(; index_entry && index_entry < (ctx->name_index + entry_count) && index_entry->name_hash == name_hash; index_entry++)
+    {
+        if (!strcmp(name_table + pfsGetEntryByIndex(ctx, index_entry->index)->name_offset, name))
         {
-            *out_idx = i;
+            *out_idx = index_entry->index;
             return true;
         }
     }
@@ -389,3 +395,101 @@ bool pfsWriteImageContextHeaderToMemoryBuffer(PartitionFileSystemImageContext *c
 
     return true;
 }
+
+static bool pfsGenerateNameIndex(PartitionFileSystemContext *ctx)
+{
+    PartitionFileSystemEntry *fs_entry = NULL;
+    u32 entry_count = pfsGetEntryCount(ctx), name_table_size = ((PartitionFileSystemHeader*)ctx->header)->name_table_size;
+    char *name_table = pfsGetNameTable(ctx);
+    PartitionFileSystemNameIndexEntry *name_index = NULL;
+
+    /* Allocate memory for the name index. */
+    name_index = calloc(entry_count, sizeof(PartitionFileSystemNameIndexEntry));
+    if (!name_index)
+    {
+        LOG_MSG_ERROR("Unable to allocate memory for the Partition FS name index! (%u entries).", entry_count);
+        return false;
+    }
+
+    /* Calculate name hashes for all entries. */
+    for(u32 i = 0; i < entry_count; i++)
+    {
+        if (!(fs_entry = pfsGetEntryByIndex(ctx, i)))
+        {
+            LOG_MSG_ERROR("Failed to retrieve Partition FS entry #%u!", i);
+            goto end;
+        }
+
+        if (fs_entry->name_offset >= name_table_size)
+        {
+            LOG_MSG_ERROR("Name offset from Partition FS entry #%u exceeds name table size!", i);
+            goto end;
+        }
+
+        name_index[i].name_hash = pfsCalculateNameHash(name_table + fs_entry->name_offset);
+        name_index[i].index = i;
+    }
+
+    /* Sort index entries by name hash. */
+    if (entry_count > 1) qsort(name_index, entry_count, sizeof(PartitionFileSystemNameIndexEntry), &pfsNameIndexEntrySortFunction);
+
+    /* Update context. */
+    ctx->name_index = name_index;
+    name_index = NULL;
+
+end:
+    if (name_index) free(name_index);
+
+    return (ctx->name_index != NULL);
+}
+
+static PartitionFileSystemNameIndexEntry *pfsFindFirstNameIndexEntryByHash(PartitionFileSystemNameIndexEntry *name_index, u32 entry_count, u32 name_hash)
+{
+    u32 low = 0, high = entry_count;
+
+    /* Perform a lower bound binary search. Entries sharing the same name hash are stored next to each other. */
+    while(low < high)
+    {
+        u32 mid = (low + ((high - low) / 2));
+
+        if (name_index[mid].name_hash < name_hash)
+        {
+            low = (mid + 1);
+        } else {
+            high = mid;
+        }
+    }
+
+    return ((low < entry_count && name_index[low].name_hash == name_hash) ? &(name_index[low]) : NULL);
+}
+
+NX_INLINE u32 pfsCalculateNameHash(const char *name)
+{
+    u32 hash = PFS_NAME_HASH_FNV_OFFSET_BASIS;
+
+    while(*name)
+    {
+        hash ^= (u8)*name++;
+        hash *= PFS_NAME_HASH_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int pfsNameIndexEntrySortFunction(const void *a, const void *b)
+{
+    const PartitionFileSystemNameIndexEntry *index_entry_1 = (const PartitionFileSystemNameIndexEntry*)a;
+    const PartitionFileSystemNameIndexEntry *index_entry_2 = (const PartitionFileSystemNameIndexEntry*)b;
+
+    if (index_entry_1->name_hash < index_entry_2->name_hash)
+    {
+        return -1;
+    } else
+    if (index_entry_1->name_hash > index_entry_2->name_hash)
+    {
+        return 1;
+    }
+
+    /* Preserve the original entry order for colliding hashes. */
+    return (index_entry_1->index < index_entry_2->index ? -1 : (index_entry_1->index > index_entry_2->index ? 1 : 0));
+}
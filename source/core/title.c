@@ -3395,6 +3395,9 @@ static void titleGameCardInfoThreadFunc(void *arg)
     Waiter gamecard_status_event_waiter = waiterForUEvent(g_titleGameCardStatusChangeUserEvent);
     Waiter exit_event_waiter = waiterForUEvent(&g_titleGameCardInfoThreadExitEvent);
 
+    /* Gamecard title info is displayed by the UI as soon as it's available, so our gamecard reads are serviced ahead of background dumps. */
+    gamecardSetThreadIoPriority(GameCardIoPriority_High);
+
     while(true)
     {
         /* Wait until an event is triggered. */
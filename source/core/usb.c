@@ -24,6 +24,7 @@
 
 #include <core/nxdt_utils.h>
 #include <core/usb.h>
+#include <core/usb_transport.h>
 
 #define USB_ABI_VERSION_MAJOR       1
 #define USB_ABI_VERSION_MINOR       2
@@ -34,25 +35,30 @@
 #define USB_TRANSFER_ALIGNMENT      0x1000                      /* 4 KiB. */
 #define USB_TRANSFER_TIMEOUT        10                          /* 10 seconds. */
 
-#define USB_DEV_VID                 0x057E                      /* VID officially used by Nintendo in usb:ds. */
-#define USB_DEV_PID                 0x3000                      /* PID officially used by Nintendo in usb:ds. */
-#define USB_DEV_BCD_REL             0x0100                      /* Device release number. Always 1.0. */
+#define USB_URB_QUEUE_DEPTH         3                           /* Maximum number of file data URBs in flight on the input (write) endpoint. */
+#define USB_URB_TUNING_SAMPLES      4                           /* Measured URB completions needed before adjusting the URB size. */
+#define USB_URB_MIN_LATENCY         20000000                    /* 20 ms. The URB size is doubled if URBs take less time than this to complete on average. */
+#define USB_URB_MAX_LATENCY         200000000                   /* 200 ms. The URB size is halved if URBs take more time than this to complete on average. */
 
-#define USB_FS_BCD_REVISION         0x0110                      /* USB 1.1. */
-#define USB_FS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
-#define USB_FS_EP_MAX_PACKET_SIZE   0x40                        /* 64 bytes. */
+#define USB_URB_BUFFER_SIZE         (USB_TRANSFER_BUFFER_SIZE + USB_TRANSFER_ALIGNMENT)   /* Leaves room for a UsbFileDataChunkTrailer after a full transfer buffer. */
 
-#define USB_HS_BCD_REVISION         0x0200                      /* USB 2.0. */
-#define USB_HS_EP0_MAX_PACKET_SIZE  0x40                        /* 64 bytes. */
-#define USB_HS_EP_MAX_PACKET_SIZE   0x200                       /* 512 bytes. */
+#define USB_CHUNK_MAGIC             0x4E58434B                  /* "NXCK". */
+#define USB_CHUNK_MAX_RETRIES       3                           /* Maximum number of times a single file data chunk may be sent again after being rejected by the host. */
+#define USB_CHUNK_CHECKSUM_BLOCK    0x10000                     /* 64 KiB. File data is checksummed in blocks this big right after copying them, while they're still cached. */
 
-#define USB_SS_BCD_REVISION         0x0300                      /* USB 3.0. */
-#define USB_SS_EP0_MAX_PACKET_SIZE  9                           /* 512 bytes (1 << 9). */
-#define USB_SS_EP_MAX_PACKET_SIZE   0x400                       /* 1024 bytes. */
+#define USB_LZ4_FRAME_MAGIC         0x4E584C5A                  /* "NXLZ". */
+#define USB_LZ4_WORKER_COUNT        3                           /* One compression worker per available CPU core. */
+#define USB_LZ4_MIN_SLICE_SIZE      0x10000                     /* 64 KiB. File data chunks are never split into slices smaller than this. */
+#define USB_LZ4_MAX_SLICE_SIZE      0x300000                    /* 3 MiB. Large enough to split a full USB transfer buffer among all workers. */
+#define USB_LZ4_FRAME_BUFFER_SIZE   (USB_LZ4_MAX_SLICE_SIZE + USB_TRANSFER_ALIGNMENT)
+#define USB_LZ4_MIN_SAVINGS_SHIFT   4                           /* Compressed payloads must be at least 1/16 smaller than their raw counterparts. */
+#define USB_LZ4_MAX_POOR_FRAMES     8                           /* Consecutive poorly compressed frames needed to fall back to raw frames for the rest of a file. */
 
-#define USB_BOS_SIZE                0x16                        /* usb_bos_descriptor + usb_2_0_extension_descriptor + usb_ss_usb_device_capability_descriptor. */
+#define USB_FILE_BATCH_MAX_BLOCK_SIZE   0x100000                /* 1 MiB. Maximum SendFileBatch command block size. */
+#define USB_FILE_BATCH_ENTRY_ALIGNMENT  8                       /* SendFileBatch manifest entries are aligned to this value. */
 
-#define USB_LANGID_ENUS             0x0409
+#define USB_STREAM_MAX_COUNT        4                           /* Maximum number of concurrently open streams. */
+#define USB_STREAM_SLICE_SIZE       0x400000                    /* 4 MiB. Maximum data size per SendStreamData command. Streams take turns after each slice. */
 
 /* Type definitions. */
 
@@ -64,7 +70,12 @@ typedef enum {
     UsbCommandType_EndSession           = 4,
     UsbCommandType_StartExtractedFsDump = 5,
     UsbCommandType_EndExtractedFsDump   = 6,
-    UsbCommandType_Count                = 7     ///< Total values supported by this enum.
+    UsbCommandType_SendFileBatch        = 7,    ///< Requires UsbSessionFeature_FileBatch.
+    UsbCommandType_OpenStream           = 8,    ///< Requires UsbSessionFeature_Streams.
+    UsbCommandType_SendStreamData       = 9,    ///< Requires UsbSessionFeature_Streams.
+    UsbCommandType_CloseStream          = 10,   ///< Requires UsbSessionFeature_Streams.
+    UsbCommandType_SendResumableFileProperties = 11,    ///< Requires UsbSessionFeature_Resume. Uses the same command block as SendFileProperties.
+    UsbCommandType_Count                = 12    ///< Total values supported by this enum.
 } UsbCommandType;
 
 typedef struct {
@@ -82,7 +93,8 @@ typedef struct {
     u8 app_ver_micro;
     u8 abi_version;
     char git_commit[8];
-    u8 reserved[0x4];
+    u8 features;            ///< UsbSessionFeature bitmask requested by nxdumptool.
+    u8 reserved[0x3];
 } UsbCommandStartSession;
 
 NXDT_ASSERT(UsbCommandStartSession, 0x10);
@@ -105,6 +117,51 @@ typedef struct {
 
 NXDT_ASSERT(UsbCommandStartExtractedFsDump, 0x310);
 
+/// SendFileBatch command block header. Followed by 'file_count' UsbFileBatchManifestEntry elements.
+typedef struct {
+    u64 total_size;         ///< Sum of all file sizes from the manifest. Sent as a single data stream right after the status response.
+    u32 file_count;
+    u8 reserved[0x4];
+} UsbCommandSendFileBatch;
+
+NXDT_ASSERT(UsbCommandSendFileBatch, 0x10);
+
+/// SendFileBatch manifest entry. Followed by a UTF-8 encoded path that's not NULL-terminated, padded to USB_FILE_BATCH_ENTRY_ALIGNMENT.
+typedef struct {
+    u64 file_size;
+    u32 path_length;
+    u8 reserved[0x4];
+} UsbFileBatchManifestEntry;
+
+NXDT_ASSERT(UsbFileBatchManifestEntry, 0x10);
+
+typedef struct {
+    u32 stream_id;
+    u8 reserved_1[0x4];
+    u64 file_size;
+    char filename[FS_MAX_PATH];
+    u8 reserved_2[0x7];
+} UsbCommandOpenStream;
+
+NXDT_ASSERT(UsbCommandOpenStream, 0x318);
+
+/// SendStreamData command block header. Followed by 'data_size' bytes of stream data.
+typedef struct {
+    u32 stream_id;
+    u32 data_size;
+    u64 offset;             ///< Stream offset for this data slice.
+} UsbCommandSendStreamData;
+
+NXDT_ASSERT(UsbCommandSendStreamData, 0x10);
+
+typedef struct {
+    u32 stream_id;
+    u8 cancel;              ///< Set to true if the host should discard the stream output.
+    u8 reserved[0xB];
+} UsbCommandCloseStream;
+
+NXDT_ASSERT(UsbCommandCloseStream, 0x10);
+
 typedef enum {
     ///< Expected response code.
     UsbStatusType_Success               = 0,
@@ -128,77 +185,96 @@ typedef struct {
     u32 magic;
     u32 status;             ///< UsbStatusType.
     u16 max_packet_size;    ///< USB host endpoint max packet size.
-    u8 reserved[0x6];
+    u8 features;            ///< UsbSessionFeature bitmask accepted by the host. Only evaluated in StartSession responses.
+    u8 reserved[0x5];
 } UsbStatus;
 
 NXDT_ASSERT(UsbStatus, 0x10);
 
-/// Imported from libusb, with some adjustments.
-enum usb_bos_type {
-    USB_BT_WIRELESS_USB_DEVICE_CAPABILITY = 1,
-    USB_BT_USB_2_0_EXTENSION              = 2,
-    USB_BT_SS_USB_DEVICE_CAPABILITY       = 3,
-    USB_BT_CONTAINER_ID                   = 4
-};
+/// Sent by the host device right after the status response for a SendResumableFileProperties command, if it succeeded.
+typedef struct {
+    u32 magic;
+    u32 window_crc;         ///< CRC32 calculated over the last MIN(offset, USB_RESUME_WINDOW_SIZE) bytes before the resume offset.
+    u64 offset;             ///< Amount of file data already held by the host device. Aligned to USB_RESUME_WINDOW_SIZE, unless it matches the file size.
+} UsbResumeInfo;
 
-/// Imported from libusb, with some adjustments.
-enum usb_2_0_extension_attributes {
-    USB_BM_LPM_SUPPORT = 2
-};
+NXDT_ASSERT(UsbResumeInfo, 0x10);
 
-/// Imported from libusb, with some adjustments.
-enum usb_ss_usb_device_capability_attributes {
-    USB_BM_LTM_SUPPORT = 2
-};
+/// Prepended to each file data frame if UsbSessionFeature_Lz4Compression has been negotiated.
+/// Each frame is sent as a standalone transfer and can be decoded on its own.
+typedef struct {
+    u32 magic;              ///< "NXLZ".
+    u32 raw_size;           ///< Decoded payload size.
+    u32 stored_size;        ///< Payload size. Matches raw_size if the payload is stored uncompressed.
+    u8 compressed;          ///< Set to true if the payload is a raw LZ4 block.
+    u8 reserved[0x3];
+} UsbFileDataFrameHeader;
 
-/// Imported from libusb, with some adjustments.
-enum usb_supported_speed {
-    USB_LOW_SPEED_OPERATION   = BIT(0),
-    USB_FULL_SPEED_OPERATION  = BIT(1),
-    USB_HIGH_SPEED_OPERATION  = BIT(2),
-    USB_SUPER_SPEED_OPERATION = BIT(3)
-};
+NXDT_ASSERT(UsbFileDataFrameHeader, 0x10);
 
-/// Imported from libusb, with some adjustments.
-struct NX_PACKED usb_bos_descriptor {
-    u8 bLength;
-    u8 bDescriptorType; ///< Must match USB_DT_BOS.
-    u16 wTotalLength;   ///< Length of this descriptor and all of its sub descriptors.
-    u8 bNumDeviceCaps;  ///< The number of separate device capability descriptors in the BOS.
-};
+/// Appended to each file data chunk if UsbSessionFeature_ChunkChecksum has been negotiated. Both are sent as a single, standalone transfer.
+/// If UsbSessionFeature_Lz4Compression has also been negotiated, each frame is treated as a chunk.
+typedef struct {
+    u32 magic;              ///< "NXCK".
+    u32 crc;                ///< CRC32C calculated over the chunk data, as transferred.
+    u64 offset;             ///< Chunk data offset, relative to the start of the data transfer stage. Frames use the offset for their decoded payload.
+} UsbFileDataChunkTrailer;
 
-NXDT_ASSERT(struct usb_bos_descriptor, 0x5);
+NXDT_ASSERT(UsbFileDataChunkTrailer, 0x10);
 
-/// Imported from libusb, with some adjustments.
-struct NX_PACKED usb_2_0_extension_descriptor {
-    u8 bLength;
-    u8 bDescriptorType;     ///< Must match USB_DT_DEVICE_CAPABILITY.
-    u8 bDevCapabilityType;  ///< Must match USB_BT_USB_2_0_EXTENSION.
-    u32 bmAttributes;       ///< usb_2_0_extension_attributes.
-};
+/// Sent by the host device right after receiving each file data chunk if UsbSessionFeature_ChunkChecksum has been negotiated.
+typedef struct {
+    u32 magic;              ///< "NXCK".
+    u32 resend;             ///< Set to a non-zero value if the chunk must be sent again, either because it was corrupted or because a previous chunk was.
+    u64 offset;             ///< Copied from the UsbFileDataChunkTrailer for the acknowledged chunk.
+} UsbFileDataChunkAck;
 
-NXDT_ASSERT(struct usb_2_0_extension_descriptor, 0x7);
-
-/// Imported from libusb, with some adjustments.
-struct NX_PACKED usb_ss_usb_device_capability_descriptor {
-    u8 bLength;
-    u8 bDescriptorType;         ///< Must match USB_DT_DEVICE_CAPABILITY.
-    u8 bDevCapabilityType;      ///< Must match USB_BT_SS_USB_DEVICE_CAPABILITY.
-    u8 bmAttributes;            ///< usb_ss_usb_device_capability_attributes.
-    u16 wSpeedsSupported;       ///< usb_supported_speed.
-    u8 bFunctionalitySupport;   ///< The lowest speed at which all the functionality that the device supports is available to the user.
-    u8 bU1DevExitLat;           ///< U1 Device Exit Latency.
-    u16 bU2DevExitLat;          ///< U2 Device Exit Latency.
-};
+NXDT_ASSERT(UsbFileDataChunkAck, 0x10);
+
+/// File data URB posted to the input (write) endpoint.
+typedef struct {
+    u8 *buf;        ///< Page-aligned queue buffer owned by this entry. Always USB_URB_BUFFER_SIZE bytes long.
+    u64 size;       ///< Includes the UsbFileDataChunkTrailer, if there's one.
+    u64 offset;     ///< Data transfer stage offset.
+    u64 post_tick;  ///< System tick at the time this URB was posted.
+    u32 urb_id;
+    u32 retries;    ///< Number of times this URB has been posted again after being rejected by the host device.
+} UsbUrbQueueEntry;
+
+/// URB size bounds for file data transfers. Selected at session start, based on the USB speed negotiated by the host device.
+/// All sizes must be multiples of USB_TRANSFER_ALIGNMENT, which keeps every URB but the last one aligned to the endpoint max packet size.
+typedef struct {
+    u32 min_size;
+    u32 initial_size;
+    u32 max_size;
+} UsbUrbSizeProfile;
 
-NXDT_ASSERT(struct usb_ss_usb_device_capability_descriptor, 0xA);
+/// Logical file transfer multiplexed with other streams over the same USB session.
+typedef struct {
+    bool open;
+    bool failed;            ///< Set if a data slice couldn't be delivered. Only usbCloseStream() may be used afterwards.
+    u32 id;
+    u64 size;
+    u64 offset;
+} UsbStream;
+
+/// LZ4 compression worker. Each worker turns a single slice from a file data chunk into a file data frame.
+typedef struct {
+    Thread thread;
+    bool thread_created;
+    u64 generation;         ///< Last slice generation processed by this worker.
+    void *lz4_state;        ///< LZ4 compression state. LZ4_sizeofState() bytes long.
+    u8 *buf;                ///< Page-aligned frame buffer. USB_LZ4_FRAME_BUFFER_SIZE bytes long.
+    const u8 *data;         ///< Input slice. Set to NULL if this worker has no slice to process in the current generation.
+    u32 data_size;
+    u32 frame_size;         ///< Output frame size (header + payload).
+    bool compressed;
+} UsbLz4Worker;
 
 /* Global variables. */
 
 static Mutex g_usbInterfaceMutex = 0;
-static UsbDsInterface *g_usbInterface = NULL;
-static UsbDsEndpoint *g_usbEndpointIn = NULL, *g_usbEndpointOut = NULL;
-static bool g_usbInterfaceInit = false, g_usbHos5xEnabled = false;
+static bool g_usbInterfaceInit = false;
 
 static Event *g_usbStateChangeEvent = NULL;
 static Thread g_usbDetectionThread = {0};
@@ -208,8 +284,42 @@ static atomic_bool g_usbDetectionThreadCreated = false;
 
 static u8 *g_usbTransferBuffer = NULL;
 static u64 g_usbTransferRemainingSize = 0, g_usbTransferWrittenSize = 0;
+
+static UsbUrbQueueEntry g_usbUrbQueue[USB_URB_QUEUE_DEPTH] = {0};
+static u32 g_usbUrbQueueHead = 0, g_usbUrbQueueCount = 0;
+
+static bool g_usbChunkResendPending = false;
+static u64 g_usbChunkResendOffset = 0;
 static atomic_ushort g_usbEndpointMaxPacketSize = 0;
 
+static const UsbUrbSizeProfile g_usbUrbSizeProfiles[UsbHostSpeed_Count] = {
+    [UsbHostSpeed_FullSpeed]  = { 0x10000,  0x40000,                  0x100000 },                   /* 64 KiB - 1 MiB. */
+    [UsbHostSpeed_HighSpeed]  = { 0x40000,  0x200000,                 USB_TRANSFER_BUFFER_SIZE },   /* 256 KiB - 8 MiB. */
+    [UsbHostSpeed_SuperSpeed] = { 0x100000, USB_TRANSFER_BUFFER_SIZE, USB_TRANSFER_BUFFER_SIZE }    /* 1 MiB - 8 MiB. */
+};
+
+static u32 g_usbUrbSize = USB_TRANSFER_BUFFER_SIZE, g_usbUrbMinSize = USB_TRANSFER_BUFFER_SIZE, g_usbUrbMaxSize = USB_TRANSFER_BUFFER_SIZE;
+static u32 g_usbUrbUserMinSize = 0, g_usbUrbUserMaxSize = 0;
+static u64 g_usbUrbLastCompletionTick = 0, g_usbUrbLatencySum = 0;
+static u32 g_usbUrbLatencyCount = 0;
+
+static u8 g_usbSessionFeatures = UsbSessionFeature_None;
+static bool g_usbExtractedFsDumpStarted = false;
+
+static UsbStream g_usbStreams[USB_STREAM_MAX_COUNT] = {0};
+static u32 g_usbStreamIdCounter = 0;
+
+static Mutex g_usbStreamTurnMutex = 0;
+static CondVar g_usbStreamTurnCondVar = 0;
+static u64 g_usbStreamTicketNext = 0, g_usbStreamTicketServing = 0;
+
+static UsbLz4Worker g_usbLz4Workers[USB_LZ4_WORKER_COUNT] = {0};
+static Mutex g_usbLz4Mutex = 0;
+static CondVar g_usbLz4WorkCondVar = 0, g_usbLz4DoneCondVar = 0;
+static u64 g_usbLz4Generation = 0;
+static u32 g_usbLz4PendingCount = 0, g_usbLz4PoorFrameCount = 0;
+static bool g_usbLz4WorkersStarted = false, g_usbLz4WorkersExit = false, g_usbLz4Bypass = false;
+
 /* Function prototypes. */
 
 static bool usbCreateDetectionThread(void);
@@ -228,20 +338,33 @@ static void usbLogStatusDetail(u32 status);
 NX_INLINE bool usbAllocateTransferBuffer(void);
 NX_INLINE void usbFreeTransferBuffer(void);
 
-static bool usbInitializeComms(void);
-static bool usbInitializeComms5x(void);
-static bool usbInitializeComms1x(void);
-static void usbCloseComms(void);
-
-static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode);
-
-NX_INLINE bool usbIsHostAvailable(void);
-
-NX_INLINE void usbSetZltPacket(bool enable);
+static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode, u64 *out_resume_offset, u32 *out_window_crc);
 
 NX_INLINE bool usbRead(void *buf, size_t size);
 NX_INLINE bool usbWrite(void *buf, size_t size);
-static bool usbTransferData(void *buf, size_t size, UsbDsEndpoint *endpoint);
+static bool usbTransferData(void *buf, size_t size, u8 endpoint);
+
+static void usbResetUrbSize(void);
+static void usbUpdateUrbSize(u64 latency);
+
+static bool usbPostFileData(const void *data, u64 data_size);
+static bool usbPostUrb(const void *data, u64 size, u64 offset);
+static bool usbSubmitUrb(UsbUrbQueueEntry *entry);
+static bool usbReadChunkAck(UsbUrbQueueEntry *entry, bool *out_resend);
+static bool usbReapUrb(void);
+static bool usbFlushUrbQueue(void);
+static void usbCancelUrbQueue(void);
+
+static bool usbStartLz4Workers(void);
+static void usbStopLz4Workers(void);
+static void usbLz4WorkerThreadFunc(void *arg);
+static void usbLz4BuildFrame(UsbLz4Worker *worker, bool bypass);
+static bool usbSendCompressedFileData(const void *data, u64 data_size);
+
+static void usbAcquireStreamTurn(void);
+static void usbReleaseStreamTurn(void);
+NX_INLINE bool usbHasOpenStreams(void);
+NX_INLINE UsbStream *usbGetOpenStream(u32 stream_id);
 
 bool usbInitialize(void)
 {
@@ -260,14 +383,14 @@ bool usbInitialize(void)
         }
 
         /* Initialize USB comms. */
-        if (!usbInitializeComms())
+        if (!usbTransportInitialize())
         {
             LOG_MSG_ERROR("Failed to initialize USB comms!");
             break;
         }
 
         /* Retrieve USB state change kernel event. */
-        g_usbStateChangeEvent = usbDsGetStateChangeEvent();
+        g_usbStateChangeEvent = usbTransportGetStateChangeEvent();
         if (!g_usbStateChangeEvent)
         {
             LOG_MSG_ERROR("Failed to retrieve USB state change kernel event!");
@@ -307,7 +430,10 @@ void usbExit(void)
         g_usbStateChangeEvent = NULL;
 
         /* Close USB device interface. */
-        usbCloseComms();
+        usbTransportExit();
+
+        /* Stop LZ4 compression workers. */
+        usbStopLz4Workers();
 
         /* Free USB transfer buffer. */
         usbFreeTransferBuffer();
@@ -349,14 +475,48 @@ u8 usbIsReady(void)
 bool usbSendFileProperties(u64 file_size, const char *filename)
 {
     bool ret = false;
-    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(file_size, filename, 0, false);
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(file_size, filename, 0, false, NULL, NULL);
+    return ret;
+}
+
+bool usbIsResumeSupported(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = (g_usbInterfaceInit && g_usbHostAvailable && g_usbSessionStarted && (g_usbSessionFeatures & UsbSessionFeature_Resume));
+    return ret;
+}
+
+bool usbSendResumableFileProperties(u64 file_size, const char *filename, u64 *out_offset, u32 *out_window_crc)
+{
+    bool ret = false;
+
+    if (!out_offset || !out_window_crc)
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    *out_offset = 0;
+    *out_window_crc = 0;
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        /* Fall back to a regular file transfer if the host device doesn't support resuming transfers. */
+        if (!(g_usbSessionFeatures & UsbSessionFeature_Resume))
+        {
+            ret = _usbSendFileProperties(file_size, filename, 0, false, NULL, NULL);
+        } else {
+            ret = _usbSendFileProperties(file_size, filename, 0, false, out_offset, out_window_crc);
+        }
+    }
+
     return ret;
 }
 
 bool usbSendNspProperties(u64 nsp_size, const char *filename, u32 nsp_header_size)
 {
     bool ret = false;
-    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(nsp_size, filename, nsp_header_size, true);
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = _usbSendFileProperties(nsp_size, filename, nsp_header_size, true, NULL, NULL);
     return ret;
 }
 
@@ -367,7 +527,7 @@ bool usbSendFileData(const void *data, u64 data_size)
     SCOPED_LOCK(&g_usbInterfaceMutex)
     {
         void *buf = NULL;
-        bool zlt_required = false;
+        bool zlt_required = false, last_chunk = false;
 
         if (!g_usbTransferBuffer || !g_usbInterfaceInit || !g_usbHostAvailable || !g_usbSessionStarted || !g_usbTransferRemainingSize || !data || !data_size || \
             data_size > USB_TRANSFER_BUFFER_SIZE || data_size > g_usbTransferRemainingSize)
@@ -376,38 +536,73 @@ bool usbSendFileData(const void *data, u64 data_size)
             goto end;
         }
 
-        /* Optimization for buffers that already are page aligned. */
-        if (IS_ALIGNED((u64)data, USB_TRANSFER_ALIGNMENT))
+        /* Check if this is the last data chunk for this file. */
+        last_chunk = ((g_usbTransferRemainingSize - data_size) == 0);
+
+        if (g_usbSessionFeatures & (UsbSessionFeature_Lz4Compression | UsbSessionFeature_ChunkChecksum))
         {
-            buf = (void*)data;
-        } else {
-            buf = g_usbTransferBuffer;
-            memcpy(buf, data, data_size);
-        }
+            /* Each frame (or checksummed chunk) is sent as a standalone transfer, and the host reads it using a buffer bigger than the transfer itself. */
+            /* ZLT must stay enabled throughout the whole file, or the host won't be able to tell where packet-aligned transfers end. */
+            if (!g_usbTransferWrittenSize)
+            {
+                usbTransportSetZlt(true);
+                g_usbLz4PoorFrameCount = 0;
+                g_usbLz4Bypass = false;
+            }
+
+            /* Compress data chunk and queue all of its frames, or queue it as-is. */
+            if (g_usbSessionFeatures & UsbSessionFeature_Lz4Compression)
+            {
+                ret = usbSendCompressedFileData(data, data_size);
+            } else {
+                ret = usbPostFileData(data, data_size);
+            }
+
+            /* Wait for all in-flight URBs to complete if this is the last chunk. We need to read a status block from the host right after it. */
+            if (ret && last_chunk) ret = usbFlushUrbQueue();
 
-        /* Determine if we'll need to set a Zero Length Termination (ZLT) packet. */
-        /* This is automatically handled by usbDsEndpoint_PostBufferAsync(), depending on the ZLT setting from the input (write) endpoint. */
-        /* First, check if this is the last data chunk for this file. */
-        if ((g_usbTransferRemainingSize - data_size) == 0)
+            /* Disable ZLT once we're done with this file. */
+            zlt_required = (!ret || last_chunk);
+        } else if (last_chunk)
         {
+            /* Determine if we'll need to set a Zero Length Termination (ZLT) packet. */
+            /* This is automatically handled by usbTransportPostBuffer(), depending on the ZLT setting from the input (write) endpoint. */
+            /* Wait for all in-flight URBs to complete. The ZLT setting applies to the whole endpoint, and we need to read a status block from the host right after this chunk. */
+            if (!(ret = usbFlushUrbQueue())) goto end;
+
+            /* Optimization for buffers that already are page aligned. */
+            if (IS_ALIGNED((u64)data, USB_TRANSFER_ALIGNMENT))
+            {
+                buf = (void*)data;
+            } else {
+                buf = g_usbTransferBuffer;
+                memcpy(buf, data, data_size);
+            }
+
             /* Enable ZLT if the last chunk size is aligned to the USB endpoint max packet size. */
             if (IS_ALIGNED(data_size, atomic_load(&g_usbEndpointMaxPacketSize)))
             {
                 zlt_required = true;
-                usbSetZltPacket(true);
+                usbTransportSetZlt(true);
                 LOG_MSG_DEBUG("ZLT enabled. Last chunk size: 0x%lX bytes.", data_size);
             }
+
+            /* Send last data chunk. */
+            ret = usbWrite(buf, data_size);
         } else {
             /* Disable ZLT if this is the first of multiple data chunks. */
             if (!g_usbTransferWrittenSize)
             {
-                usbSetZltPacket(false);
+                usbTransportSetZlt(false);
                 LOG_MSG_DEBUG("ZLT disabled (first chunk).");
             }
+
+            /* Queue data chunk. This returns as soon as the last URB has been posted, unless the URB queue is full, in which case we wait for the oldest URB to complete. */
+            /* Keeping multiple URBs in flight makes sure the USB link doesn't sit idle while the caller prepares the next chunk. */
+            ret = usbPostFileData(data, data_size);
         }
 
-        /* Send data chunk. */
-        if (!(ret = usbWrite(buf, data_size)))
+        if (!ret)
         {
             LOG_MSG_ERROR("Failed to write 0x%lX bytes long file data chunk from offset 0x%lX! (total size: 0x%lX).", data_size, g_usbTransferWrittenSize, \
                                                                                                                       g_usbTransferRemainingSize + g_usbTransferWrittenSize);
@@ -443,11 +638,12 @@ bool usbSendFileData(const void *data, u64 data_size)
 
 end:
         /* Disable ZLT if it was previously enabled. */
-        if (zlt_required) usbSetZltPacket(false);
+        if (zlt_required) usbTransportSetZlt(false);
 
         /* Reset variables in case of errors. */
         if (!ret)
         {
+            usbCancelUrbQueue();
             g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
             g_nspTransferMode = false;
         }
@@ -462,9 +658,16 @@ void usbCancelFileTransfer(void)
     {
         if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || (!g_usbTransferRemainingSize && !g_nspTransferMode)) break;
 
-        /* Reset variables right away. */
+        /* Reset variables right away. Cancelling a file transfer also cancels any ongoing extracted FS dump. */
         g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
-        g_nspTransferMode = false;
+        g_nspTransferMode = g_usbExtractedFsDumpStarted = false;
+
+        /* Wait for all in-flight URBs to complete before sending any commands. */
+        /* If this fails, the USB session is reset by the background thread, so there's no point in sending the command. */
+        if (!usbFlushUrbQueue()) break;
+
+        /* ZLT is kept enabled throughout compressed and checksummed file transfers. */
+        if (g_usbSessionFeatures & (UsbSessionFeature_Lz4Compression | UsbSessionFeature_ChunkChecksum)) usbTransportSetZlt(false);
 
         /* Prepare command data. */
         usbPrepareCommandHeader(UsbCommandType_CancelFileTransfer, 0);
@@ -507,8 +710,8 @@ bool usbStartExtractedFsDump(u64 extracted_fs_size, const char *extracted_fs_roo
 
     SCOPED_LOCK(&g_usbInterfaceMutex)
     {
-        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || g_usbTransferRemainingSize || g_nspTransferMode || !extracted_fs_size || \
-            !extracted_fs_root_path || !*extracted_fs_root_path) break;
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || g_usbTransferRemainingSize || g_nspTransferMode || usbHasOpenStreams() || \
+            !extracted_fs_size || !extracted_fs_root_path || !*extracted_fs_root_path) break;
 
         /* Prepare command data. */
         usbPrepareCommandHeader(UsbCommandType_StartExtractedFsDump, (u32)sizeof(UsbCommandStartExtractedFsDump));
@@ -520,7 +723,7 @@ bool usbStartExtractedFsDump(u64 extracted_fs_size, const char *extracted_fs_roo
         snprintf(cmd_block->extracted_fs_root_path, sizeof(cmd_block->extracted_fs_root_path), "%s", extracted_fs_root_path);
 
         /* Send command. */
-        ret = usbSendCommand();
+        ret = g_usbExtractedFsDumpStarted = usbSendCommand();
     }
 
     return ret;
@@ -532,6 +735,8 @@ void usbEndExtractedFsDump(void)
     {
         if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || g_usbTransferRemainingSize || g_nspTransferMode) break;
 
+        g_usbExtractedFsDumpStarted = false;
+
         /* Prepare command data. */
         usbPrepareCommandHeader(UsbCommandType_EndExtractedFsDump, 0);
 
@@ -540,6 +745,281 @@ void usbEndExtractedFsDump(void)
     }
 }
 
+bool usbSetTransferChunkSizeBounds(u32 min_size, u32 max_size)
+{
+    if ((min_size || max_size) && (!min_size || min_size > max_size || max_size > USB_TRANSFER_BUFFER_SIZE || !IS_ALIGNED(min_size, USB_TRANSFER_ALIGNMENT) || \
+        !IS_ALIGNED(max_size, USB_TRANSFER_ALIGNMENT)))
+    {
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
+    }
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        g_usbUrbUserMinSize = min_size;
+        g_usbUrbUserMaxSize = max_size;
+
+        /* Apply the new bounds right away if a session has already been established. */
+        if (g_usbSessionStarted) usbResetUrbSize();
+    }
+
+    return true;
+}
+
+u32 usbGetTransferChunkSize(void)
+{
+    u32 ret = 0;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = (g_usbSessionStarted ? g_usbUrbSize : 0);
+    return ret;
+}
+
+u8 usbGetSessionFeatures(void)
+{
+    u8 ret = UsbSessionFeature_None;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = ((g_usbInterfaceInit && g_usbHostAvailable && g_usbSessionStarted) ? g_usbSessionFeatures : UsbSessionFeature_None);
+    return ret;
+}
+
+bool usbIsFileBatchSupported(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = (g_usbInterfaceInit && g_usbHostAvailable && g_usbSessionStarted && (g_usbSessionFeatures & UsbSessionFeature_FileBatch));
+    return ret;
+}
+
+u32 usbSendFileBatchProperties(const UsbFileBatchEntry *entries, u32 entry_count)
+{
+    u32 ret = 0;
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || !(g_usbSessionFeatures & UsbSessionFeature_FileBatch) || \
+            !g_usbExtractedFsDumpStarted || g_usbTransferRemainingSize || g_nspTransferMode || !entries || !entry_count)
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        UsbCommandSendFileBatch *cmd_block = (UsbCommandSendFileBatch*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+        u8 *manifest = ((u8*)cmd_block + sizeof(UsbCommandSendFileBatch));
+        u32 cmd_block_size = (u32)sizeof(UsbCommandSendFileBatch), file_count = 0;
+        u64 total_size = 0;
+
+        memset(cmd_block, 0, sizeof(UsbCommandSendFileBatch));
+
+        /* Fill the manifest with as many entries as we can fit into a single command block. */
+        for(file_count = 0; file_count < entry_count; file_count++)
+        {
+            const UsbFileBatchEntry *entry = &(entries[file_count]);
+            size_t path_length = (entry->path ? strlen(entry->path) : 0);
+
+            if (!path_length || path_length >= FS_MAX_PATH)
+            {
+                LOG_MSG_ERROR("Invalid path for file batch entry #%u!", file_count);
+                file_count = 0;
+                break;
+            }
+
+            u32 manifest_entry_size = (u32)ALIGN_UP(sizeof(UsbFileBatchManifestEntry) + path_length, USB_FILE_BATCH_ENTRY_ALIGNMENT);
+            if ((cmd_block_size + manifest_entry_size) > USB_FILE_BATCH_MAX_BLOCK_SIZE) break;
+
+            UsbFileBatchManifestEntry *manifest_entry = (UsbFileBatchManifestEntry*)(manifest + (cmd_block_size - sizeof(UsbCommandSendFileBatch)));
+            memset(manifest_entry, 0, manifest_entry_size);
+
+            manifest_entry->file_size = entry->size;
+            manifest_entry->path_length = (u32)path_length;
+            memcpy((u8*)manifest_entry + sizeof(UsbFileBatchManifestEntry), entry->path, path_length);
+
+            cmd_block_size += manifest_entry_size;
+            total_size += entry->size;
+        }
+
+        if (!file_count) break;
+
+        cmd_block->total_size = total_size;
+        cmd_block->file_count = file_count;
+
+        /* Prepare command header. This must be done after filling the command block, since the header is placed right before it. */
+        usbPrepareCommandHeader(UsbCommandType_SendFileBatch, cmd_block_size);
+
+        /* Send command. */
+        /* All file data from this batch is then sent as a single data stream through usbSendFileData(), followed by a single status response. */
+        if (usbSendCommand())
+        {
+            g_usbTransferRemainingSize = total_size;
+            g_usbTransferWrittenSize = 0;
+            ret = file_count;
+        } else {
+            g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+        }
+    }
+
+    return ret;
+}
+
+bool usbIsStreamSupported(void)
+{
+    bool ret = false;
+    SCOPED_LOCK(&g_usbInterfaceMutex) ret = (g_usbInterfaceInit && g_usbHostAvailable && g_usbSessionStarted && (g_usbSessionFeatures & UsbSessionFeature_Streams));
+    return ret;
+}
+
+bool usbOpenStream(u64 file_size, const char *filename, u32 *out_stream_id)
+{
+    size_t filename_length = 0;
+    bool ret = false;
+
+    usbAcquireStreamTurn();
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || !(g_usbSessionFeatures & UsbSessionFeature_Streams) || \
+            g_usbTransferRemainingSize || g_nspTransferMode || !filename || !(filename_length = strlen(filename)) || filename_length >= FS_MAX_PATH || !out_stream_id)
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        /* Look for a free stream slot. */
+        UsbStream *stream = NULL;
+
+        for(u32 i = 0; i < USB_STREAM_MAX_COUNT; i++)
+        {
+            if (g_usbStreams[i].open) continue;
+            stream = &(g_usbStreams[i]);
+            break;
+        }
+
+        if (!stream)
+        {
+            LOG_MSG_ERROR("No free stream slots available!");
+            break;
+        }
+
+        /* Generate a new stream ID. Zero is never used. */
+        do {
+            if (!++g_usbStreamIdCounter) g_usbStreamIdCounter++;
+        } while(usbGetOpenStream(g_usbStreamIdCounter));
+
+        /* Prepare command data. */
+        usbPrepareCommandHeader(UsbCommandType_OpenStream, (u32)sizeof(UsbCommandOpenStream));
+
+        UsbCommandOpenStream *cmd_block = (UsbCommandOpenStream*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+        memset(cmd_block, 0, sizeof(UsbCommandOpenStream));
+
+        cmd_block->stream_id = g_usbStreamIdCounter;
+        cmd_block->file_size = file_size;
+        snprintf(cmd_block->filename, sizeof(cmd_block->filename), "%s", filename);
+
+        /* Send command. */
+        if (!(ret = usbSendCommand())) break;
+
+        memset(stream, 0, sizeof(UsbStream));
+        stream->open = true;
+        stream->id = *out_stream_id = g_usbStreamIdCounter;
+        stream->size = file_size;
+    }
+
+    usbReleaseStreamTurn();
+
+    return ret;
+}
+
+bool usbSendStreamData(u32 stream_id, const void *data, u64 data_size)
+{
+    const u8 *data_u8 = (const u8*)data;
+    bool ret = (data && data_size);
+
+    if (!ret) LOG_MSG_ERROR("Invalid parameters!");
+
+    /* Send data in slices. Other streams get a chance to send their own data in-between slices, in the order they asked for it. */
+    /* Each slice is acknowledged by the host before the stream sends the next one, which also acts as per-stream flow control. */
+    for(u64 offset = 0, slice_size = 0; ret && offset < data_size; offset += slice_size)
+    {
+        slice_size = MIN(data_size - offset, USB_STREAM_SLICE_SIZE);
+        ret = false;
+
+        usbAcquireStreamTurn();
+
+        SCOPED_LOCK(&g_usbInterfaceMutex)
+        {
+            UsbStream *stream = NULL;
+
+            if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || !(stream = usbGetOpenStream(stream_id)) || stream->failed || \
+                slice_size > (stream->size - stream->offset))
+            {
+                LOG_MSG_ERROR("Invalid parameters for stream %u!", stream_id);
+                break;
+            }
+
+            /* Prepare command data. */
+            usbPrepareCommandHeader(UsbCommandType_SendStreamData, (u32)(sizeof(UsbCommandSendStreamData) + slice_size));
+
+            UsbCommandSendStreamData *cmd_block = (UsbCommandSendStreamData*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+            cmd_block->stream_id = stream_id;
+            cmd_block->data_size = (u32)slice_size;
+            cmd_block->offset = stream->offset;
+
+            memcpy((u8*)cmd_block + sizeof(UsbCommandSendStreamData), data_u8 + offset, slice_size);
+
+            /* Send command. A failure only affects this stream. */
+            ret = usbSendCommand();
+            if (ret)
+            {
+                stream->offset += slice_size;
+            } else {
+                LOG_MSG_ERROR("Failed to send 0x%lX bytes long data slice for stream %u at offset 0x%lX!", slice_size, stream_id, stream->offset);
+                stream->failed = true;
+            }
+        }
+
+        usbReleaseStreamTurn();
+    }
+
+    return ret;
+}
+
+bool usbCloseStream(u32 stream_id, bool cancel)
+{
+    bool ret = false;
+
+    usbAcquireStreamTurn();
+
+    SCOPED_LOCK(&g_usbInterfaceMutex)
+    {
+        UsbStream *stream = NULL;
+
+        if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || !(stream = usbGetOpenStream(stream_id)))
+        {
+            LOG_MSG_ERROR("Invalid parameters!");
+            break;
+        }
+
+        /* Incomplete streams are always discarded. */
+        bool incomplete = (stream->failed || stream->offset != stream->size);
+        if (incomplete && !cancel) LOG_MSG_ERROR("Stream %u is incomplete! (0x%lX / 0x%lX). Cancelling it.", stream_id, stream->offset, stream->size);
+
+        /* Free stream slot right away. */
+        memset(stream, 0, sizeof(UsbStream));
+
+        /* Prepare command data. */
+        usbPrepareCommandHeader(UsbCommandType_CloseStream, (u32)sizeof(UsbCommandCloseStream));
+
+        UsbCommandCloseStream *cmd_block = (UsbCommandCloseStream*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+        memset(cmd_block, 0, sizeof(UsbCommandCloseStream));
+
+        cmd_block->stream_id = stream_id;
+        cmd_block->cancel = (cancel || incomplete);
+
+        /* Send command. */
+        ret = (usbSendCommand() && (cancel || !incomplete));
+    }
+
+    usbReleaseStreamTurn();
+
+    return ret;
+}
+
 static bool usbCreateDetectionThread(void)
 {
     if (!utilsCreateThread(&g_usbDetectionThread, usbDetectionThreadFunc, NULL, 1))
@@ -586,9 +1066,14 @@ static void usbDetectionThreadFunc(void *arg)
         {
             /* Retrieve current USB connection status. */
             /* Only proceed if we're dealing with a status change. */
-            g_usbHostAvailable = usbIsHostAvailable();
+            g_usbHostAvailable = usbTransportIsHostAvailable();
             g_usbSessionStarted = false;
             g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+            g_usbUrbQueueHead = g_usbUrbQueueCount = 0;
+            g_usbChunkResendPending = false;
+            g_usbSessionFeatures = UsbSessionFeature_None;
+            g_usbExtractedFsDumpStarted = false;
+            memset(g_usbStreams, 0, sizeof(g_usbStreams));
             atomic_store(&g_usbEndpointMaxPacketSize, 0);
 
             /* Start a USB session if we're connected to a host device. */
@@ -629,6 +1114,7 @@ static void usbDetectionThreadFunc(void *arg)
 static bool usbStartSession(void)
 {
     UsbCommandStartSession *cmd_block = NULL;
+    u8 requested_features = UsbSessionFeature_None;
     bool ret = false;
 
     if (!g_usbInterfaceInit || !g_usbTransferBuffer)
@@ -648,6 +1134,11 @@ static bool usbStartSession(void)
     cmd_block->abi_version = USB_ABI_VERSION;
     snprintf(cmd_block->git_commit, sizeof(cmd_block->git_commit), "%s", GIT_COMMIT);
 
+    /* Only request LZ4 compression if our workers are up and running. Sessions work just fine without it. */
+    cmd_block->features = (UsbSessionFeature_FileBatch | UsbSessionFeature_Streams | UsbSessionFeature_Resume | UsbSessionFeature_ChunkChecksum);
+    if (usbStartLz4Workers()) cmd_block->features |= UsbSessionFeature_Lz4Compression;
+    requested_features = cmd_block->features;
+
     ret = usbSendCommand();
     if (ret)
     {
@@ -663,6 +1154,14 @@ static bool usbStartSession(void)
             ret = false;
         } else {
             atomic_store(&g_usbEndpointMaxPacketSize, max_packet_size);
+
+            /* Pick the initial URB size for file data transfers. It's adjusted on the fly afterwards. */
+            usbResetUrbSize();
+
+            /* Keep track of the optional features accepted by the USB host. Hosts may only accept features we actually requested. */
+            g_usbSessionFeatures = (((UsbStatus*)g_usbTransferBuffer)->features & requested_features);
+            if (g_usbSessionFeatures & UsbSessionFeature_Lz4Compression) LOG_MSG_INFO("LZ4 compression enabled for file data transfers.");
+            if (g_usbSessionFeatures & UsbSessionFeature_ChunkChecksum) LOG_MSG_INFO("CRC32C checksums enabled for file data transfers.");
         }
     }
 
@@ -737,7 +1236,7 @@ static bool usbSendCommand(void)
 
         /* Determine if we'll need to set a Zero Length Termination (ZLT) packet after sending the command block. */
         zlt_required = IS_ALIGNED(cmd_block_size, atomic_load(&g_usbEndpointMaxPacketSize));
-        if (zlt_required) usbSetZltPacket(true);
+        if (zlt_required) usbTransportSetZlt(true);
 
         /* Write command block. */
         cmd_block_written = usbWrite(g_usbTransferBuffer, cmd_block_size);
@@ -748,7 +1247,7 @@ static bool usbSendCommand(void)
         }
 
         /* Disable ZLT if it was previously enabled. */
-        if (zlt_required) usbSetZltPacket(false);
+        if (zlt_required) usbTransportSetZlt(false);
 
         /* Bail out if we failed to write the command block. */
         if (!cmd_block_written) goto end;
@@ -825,589 +1324,721 @@ static void usbLogStatusDetail(u32 status)
 NX_INLINE bool usbAllocateTransferBuffer(void)
 {
     if (g_usbTransferBuffer) return true;
+
     g_usbTransferBuffer = memalign(USB_TRANSFER_ALIGNMENT, USB_TRANSFER_BUFFER_SIZE);
-    return (g_usbTransferBuffer != NULL);
-}
+    if (!g_usbTransferBuffer) return false;
 
-NX_INLINE void usbFreeTransferBuffer(void)
-{
-    if (!g_usbTransferBuffer) return;
-    free(g_usbTransferBuffer);
-    g_usbTransferBuffer = NULL;
+    /* Allocate URB queue buffers. */
+    for(u32 i = 0; i < USB_URB_QUEUE_DEPTH; i++)
+    {
+        g_usbUrbQueue[i].buf = memalign(USB_TRANSFER_ALIGNMENT, USB_URB_BUFFER_SIZE);
+        if (g_usbUrbQueue[i].buf) continue;
+
+        usbFreeTransferBuffer();
+        return false;
+    }
+
+    return true;
 }
 
-static bool usbInitializeComms(void)
+NX_INLINE void usbFreeTransferBuffer(void)
 {
-    Result rc = 0;
-    bool ret = false, is_5x = hosversionAtLeast(5, 0, 0);
+    for(u32 i = 0; i < USB_URB_QUEUE_DEPTH; i++)
+    {
+        if (g_usbUrbQueue[i].buf) free(g_usbUrbQueue[i].buf);
+        memset(&(g_usbUrbQueue[i]), 0, sizeof(UsbUrbQueueEntry));
+    }
 
-    /* Carry out USB comms initialization steps for this HOS version. */
-    ret = (is_5x ? usbInitializeComms5x() : usbInitializeComms1x());
-    if (!ret) goto end;
+    g_usbUrbQueueHead = g_usbUrbQueueCount = 0;
+    g_usbChunkResendPending = false;
 
-    /* Enable USB interface. */
-    /* This is always needed regardless of the HOS version. */
-    rc = usbDsInterface_EnableInterface(g_usbInterface);
-    if (R_FAILED(rc))
+    if (!g_usbTransferBuffer) return;
+    free(g_usbTransferBuffer);
+    g_usbTransferBuffer = NULL;
+}
+
+static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode, u64 *out_resume_offset, u32 *out_window_crc)
+{
+    bool ret = false;
+    size_t filename_length = 0;
+    u64 resume_offset = 0;
+
+    /* Disallow sending new files if we're not in NSP transfer mode and the remaining transfer size isn't zero. */
+    /* Allow empty files if we're not in NSP transfer mode. */
+    /* Disallow sending new NSPs if we're already in NSP transfer mode. */
+    if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || (!g_nspTransferMode && g_usbTransferRemainingSize) || usbHasOpenStreams() || \
+        !filename || !(filename_length = strlen(filename)) || filename_length >= FS_MAX_PATH || (!enforce_nsp_mode && nsp_header_size) || \
+        (enforce_nsp_mode && (g_nspTransferMode || !file_size || !nsp_header_size || nsp_header_size >= file_size)) || \
+        (out_resume_offset && (g_nspTransferMode || enforce_nsp_mode || !out_window_crc)))
     {
-        LOG_MSG_ERROR("usbDsInterface_EnableInterface failed! (0x%X).", rc);
-        goto end;
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
     }
 
-    /* Additional step needed under HOS 5.0.0+. */
-    if (is_5x)
+    /* Prepare command data. */
+    usbPrepareCommandHeader(out_resume_offset ? UsbCommandType_SendResumableFileProperties : UsbCommandType_SendFileProperties, (u32)sizeof(UsbCommandSendFileProperties));
+
+    UsbCommandSendFileProperties *cmd_block = (UsbCommandSendFileProperties*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
+    memset(cmd_block, 0, sizeof(UsbCommandSendFileProperties));
+
+    cmd_block->file_size = file_size;
+    cmd_block->filename_length = (u32)filename_length;
+    cmd_block->nsp_header_size = nsp_header_size;
+    snprintf(cmd_block->filename, sizeof(cmd_block->filename), "%s", filename);
+
+    /* Send command. */
+    ret = usbSendCommand();
+
+    /* Retrieve the amount of data already held by the host device, if needed. */
+    if (ret && out_resume_offset)
     {
-        rc = usbDsEnable();
-        if (R_FAILED(rc))
+        UsbResumeInfo *resume_info = (UsbResumeInfo*)g_usbTransferBuffer;
+
+        if (!(ret = usbRead(resume_info, sizeof(UsbResumeInfo))))
         {
-            LOG_MSG_ERROR("usbDsEnable failed! (0x%X).", rc);
-            goto end;
+            LOG_MSG_ERROR("Failed to read 0x%lX bytes long resume info block!", sizeof(UsbResumeInfo));
+        } else
+        if (!(ret = (resume_info->magic == __builtin_bswap32(USB_CMD_HEADER_MAGIC) && resume_info->offset <= file_size && \
+                          (IS_ALIGNED(resume_info->offset, USB_RESUME_WINDOW_SIZE) || resume_info->offset == file_size))))
+        {
+            LOG_MSG_ERROR("Invalid resume info block! (magic 0x%08X, offset 0x%lX).", __builtin_bswap32(resume_info->magic), resume_info->offset);
+        } else {
+            resume_offset = *out_resume_offset = resume_info->offset;
+            *out_window_crc = resume_info->window_crc;
+            if (resume_offset) LOG_MSG_INFO("Host device already holds 0x%lX / 0x%lX bytes from \"%s\".", resume_offset, file_size, filename);
         }
 
-        g_usbHos5xEnabled = true;
-    }
+        /* The host device sends a status response right away if it already holds the whole file. */
+        if (ret && resume_offset == file_size)
+        {
+            UsbStatus *cmd_status = (UsbStatus*)g_usbTransferBuffer;
 
-    ret = true;
+            if (!(ret = usbRead(cmd_status, sizeof(UsbStatus))))
+            {
+                LOG_MSG_ERROR("Failed to read 0x%lX bytes long status block!", sizeof(UsbStatus));
+            } else
+            if (!(ret = (cmd_status->magic == __builtin_bswap32(USB_CMD_HEADER_MAGIC))))
+            {
+                LOG_MSG_ERROR("Invalid status block magic word! (0x%08X).", __builtin_bswap32(cmd_status->magic));
+            } else {
+                ret = (cmd_status->status == UsbStatusType_Success);
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+                if (!ret) usbLogStatusDetail(cmd_status->status);
+#endif
+            }
+        }
+    }
 
-end:
-    if (!ret) usbCloseComms();
+    if (ret)
+    {
+        g_usbTransferRemainingSize = (file_size - resume_offset);
+        g_usbTransferWrittenSize = 0;
+        if (!g_nspTransferMode && enforce_nsp_mode) g_nspTransferMode = true;
+    } else {
+        g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
+        g_nspTransferMode = false;
+    }
 
     return ret;
 }
 
-static bool usbInitializeComms5x(void)
+NX_INLINE bool usbRead(void *buf, u64 size)
 {
-    Result rc = 0;
-    bool ret = false;
+    return usbTransferData(buf, size, UsbTransportEndpoint_Out);
+}
 
-    struct usb_device_descriptor device_descriptor = {
-        .bLength = USB_DT_DEVICE_SIZE,
-        .bDescriptorType = USB_DT_DEVICE,
-        .bcdUSB = USB_FS_BCD_REVISION,                  /* USB 1.1. Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bDeviceClass = 0,                              /* Defined at interface level. */
-        .bDeviceSubClass = 0,                           /* Defined at interface level. */
-        .bDeviceProtocol = 0,                           /* Defined at interface level. */
-        .bMaxPacketSize0 = USB_FS_EP0_MAX_PACKET_SIZE,  /* Updated before setting the USB 3.0 device descriptor. */
-        .idVendor = USB_DEV_VID,
-        .idProduct = USB_DEV_PID,
-        .bcdDevice = USB_DEV_BCD_REL,
-        .iManufacturer = 0,                             /* Filled at a later time. */
-        .iProduct = 0,                                  /* Filled at a later time. */
-        .iSerialNumber = 0,                             /* Filled at a later time. */
-        .bNumConfigurations = 1
-    };
-
-    static const u16 supported_langs[] = { USB_LANGID_ENUS };
-    static const u16 num_supported_langs = (u16)MAX_ELEMENTS(supported_langs);
-
-    u8 bos[USB_BOS_SIZE] = {0};
-
-    struct usb_bos_descriptor *bos_desc = (struct usb_bos_descriptor*)bos;
-    struct usb_2_0_extension_descriptor *usb2_ext_desc = (struct usb_2_0_extension_descriptor*)(bos + sizeof(struct usb_bos_descriptor));
-    struct usb_ss_usb_device_capability_descriptor *usb3_devcap_desc = (struct usb_ss_usb_device_capability_descriptor*)((u8*)usb2_ext_desc + sizeof(struct usb_2_0_extension_descriptor));
-
-    bos_desc->bLength = sizeof(struct usb_bos_descriptor);
-    bos_desc->bDescriptorType = USB_DT_BOS;
-    bos_desc->wTotalLength = sizeof(bos);
-    bos_desc->bNumDeviceCaps = 2;   /* USB 2.0 + USB 3.0. No extra capabilities for USB 1.x. */
-
-    usb2_ext_desc->bLength = sizeof(struct usb_2_0_extension_descriptor);
-    usb2_ext_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
-    usb2_ext_desc->bDevCapabilityType = USB_BT_USB_2_0_EXTENSION;
-    usb2_ext_desc->bmAttributes = USB_BM_LPM_SUPPORT;
-
-    usb3_devcap_desc->bLength = sizeof(struct usb_ss_usb_device_capability_descriptor);
-    usb3_devcap_desc->bDescriptorType = USB_DT_DEVICE_CAPABILITY;
-    usb3_devcap_desc->bDevCapabilityType = USB_BT_SS_USB_DEVICE_CAPABILITY;
-    usb3_devcap_desc->bmAttributes = 0;
-    usb3_devcap_desc->wSpeedsSupported = (USB_SUPER_SPEED_OPERATION | USB_HIGH_SPEED_OPERATION | USB_FULL_SPEED_OPERATION);
-    usb3_devcap_desc->bFunctionalitySupport = 1;    /* We can fully work under USB 1.x. */
-    usb3_devcap_desc->bU1DevExitLat = 0;
-    usb3_devcap_desc->bU2DevExitLat = 0;
-
-    struct usb_interface_descriptor interface_descriptor = {
-        .bLength = USB_DT_INTERFACE_SIZE,
-        .bDescriptorType = USB_DT_INTERFACE,
-        .bInterfaceNumber = USBDS_DEFAULT_InterfaceNumber,
-        .bAlternateSetting = 0,
-        .bNumEndpoints = 2,
-        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
-        .iInterface = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_in = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_IN,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bInterval = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_out = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_OUT,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_FS_EP_MAX_PACKET_SIZE,    /* Updated before setting new device descriptors for USB 2.0 and 3.0. */
-        .bInterval = 0
-    };
-
-    struct usb_ss_endpoint_companion_descriptor endpoint_companion = {
-        .bLength = sizeof(struct usb_ss_endpoint_companion_descriptor),
-        .bDescriptorType = USB_DT_SS_ENDPOINT_COMPANION,
-        .bMaxBurst = 0x0F,
-        .bmAttributes = 0,
-        .wBytesPerInterval = 0
-    };
-
-    /* Set language string descriptor. */
-    rc = usbDsAddUsbLanguageStringDescriptor(NULL, supported_langs, num_supported_langs);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsAddUsbLanguageStringDescriptor failed! (0x%X).", rc);
-        goto end;
-    }
+NX_INLINE bool usbWrite(void *buf, u64 size)
+{
+    return usbTransferData(buf, size, UsbTransportEndpoint_In);
+}
 
-    /* Set manufacturer string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iManufacturer), APP_AUTHOR);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (manufacturer).", rc);
-        goto end;
-    }
+static bool usbTransferData(void *buf, u64 size, u8 endpoint)
+{
+    Event *completion_event = usbTransportGetCompletionEvent(endpoint);
 
-    /* Set product string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iProduct), APP_TITLE);
-    if (R_FAILED(rc))
+    if (!buf || !IS_ALIGNED((u64)buf, USB_TRANSFER_ALIGNMENT) || !size || !completion_event)
     {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (product).", rc);
-        goto end;
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
     }
 
-    /* Set serial number string descriptor. */
-    rc = usbDsAddUsbStringDescriptor(&(device_descriptor.iSerialNumber), APP_VERSION);
-    if (R_FAILED(rc))
+    if (!usbTransportIsHostAvailable())
     {
-        LOG_MSG_ERROR("usbDsAddUsbStringDescriptor failed! (0x%X) (serial number).", rc);
-        goto end;
+        LOG_MSG_ERROR("USB host unavailable!");
+        return false;
     }
 
-    /* Set device descriptors. */
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Full, &device_descriptor);  /* Full Speed is USB 1.1. */
-    if (R_FAILED(rc))
+    Result rc = 0;
+    u32 urb_id = 0, transferred_size = 0;
+    bool thread_exit = false, completed = false;
+
+    /* Start a USB transfer using the provided endpoint. */
+    rc = usbTransportPostBuffer(endpoint, buf, size, &urb_id);
+    if (R_FAILED(rc)) return false;
+
+    /* Wait for the transfer to finish. */
+    /* The completion event may still hold a late signal from a previously reaped URB, so we poll the status of our own URB until it's completed, just like usbReapUrb() does. */
+    while(true)
     {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 1.1).", rc);
-        goto end;
+        rc = usbTransportGetUrbStatus(endpoint, urb_id, &completed, &transferred_size);
+        if (R_FAILED(rc) || completed) break;
+
+        if (g_usbSessionStarted)
+        {
+            /* If the USB session has already been established, then use a regular timeout value. */
+            rc = eventWait(completion_event, USB_TRANSFER_TIMEOUT * (u64)1000000000);
+        } else {
+            /* If we're starting a USB session, wait indefinitely inside a loop to let the user start the host script. */
+            int idx = 0;
+            Waiter completion_event_waiter = waiterForEvent(completion_event);
+            Waiter exit_event_waiter = waiterForUEvent(&g_usbDetectionThreadExitEvent);
+
+            rc = waitMulti(&idx, -1, completion_event_waiter, exit_event_waiter);
+            if (R_SUCCEEDED(rc) && idx == 1)
+            {
+                /* Exit event triggered. */
+                rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
+                g_usbDetectionThreadExitFlag = thread_exit = true;
+            }
+        }
+
+        if (R_FAILED(rc)) break;
+
+        /* Clear the endpoint completion event. */
+        eventClear(completion_event);
     }
 
-    device_descriptor.bcdUSB = USB_HS_BCD_REVISION;
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_High, &device_descriptor);  /* High Speed is USB 2.0. */
-    if (R_FAILED(rc))
+    if (R_SUCCEEDED(rc) && transferred_size != size)
     {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 2.0).", rc);
-        goto end;
+        LOG_MSG_ERROR("USB transfer failed! Expected 0x%lX bytes, got 0x%X bytes (URB ID %u).", size, transferred_size, urb_id);
+        rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
     }
 
-    device_descriptor.bcdUSB = USB_SS_BCD_REVISION;
-    device_descriptor.bMaxPacketSize0 = USB_SS_EP0_MAX_PACKET_SIZE;
-    rc = usbDsSetUsbDeviceDescriptor(UsbDeviceSpeed_Super, &device_descriptor); /* Super Speed is USB 3.0. */
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsSetUsbDeviceDescriptor failed! (0x%X) (USB 3.0).", rc);
-        goto end;
+        /* Cancel transfer. */
+        usbTransportCancel(endpoint);
+
+        /* Safety measure: wait until the completion event is triggered again before proceeding. */
+        eventWait(completion_event, UINT64_MAX);
+        eventClear(completion_event);
+
+        /* Signal user-mode USB timeout event if needed. */
+        /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
+        if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
+
+        if (!thread_exit) LOG_MSG_ERROR("USB transfer failed! (0x%X) (URB ID %u).", rc, urb_id);
+
+        return false;
     }
 
-    /* Set Binary Object Store. */
-    rc = usbDsSetBinaryObjectStore(bos, sizeof(bos));
-    if (R_FAILED(rc))
+    return true;
+}
+
+static void usbResetUrbSize(void)
+{
+    const UsbUrbSizeProfile *profile = &(g_usbUrbSizeProfiles[usbIsReady()]);
+
+    /* Bounds set through usbSetTransferChunkSizeBounds() take precedence over the ones from the speed profile. */
+    if (g_usbUrbUserMinSize)
     {
-        LOG_MSG_ERROR("usbDsSetBinaryObjectStore failed! (0x%X).", rc);
-        goto end;
+        g_usbUrbMinSize = g_usbUrbUserMinSize;
+        g_usbUrbMaxSize = g_usbUrbUserMaxSize;
+    } else {
+        g_usbUrbMinSize = profile->min_size;
+        g_usbUrbMaxSize = profile->max_size;
     }
 
-    /* Setup interface. */
-    rc = usbDsRegisterInterface(&g_usbInterface);
-    if (R_FAILED(rc))
+    g_usbUrbSize = MIN(MAX(profile->initial_size, g_usbUrbMinSize), g_usbUrbMaxSize);
+
+    g_usbUrbLastCompletionTick = g_usbUrbLatencySum = 0;
+    g_usbUrbLatencyCount = 0;
+
+    LOG_MSG_INFO("File data URB size: 0x%X bytes (min: 0x%X, max: 0x%X). Transfer buffer size: 0x%X bytes (%u URBs).", g_usbUrbSize, g_usbUrbMinSize, g_usbUrbMaxSize, \
+                 USB_TRANSFER_BUFFER_SIZE, USB_URB_QUEUE_DEPTH);
+}
+
+static void usbUpdateUrbSize(u64 latency)
+{
+    u32 urb_size = g_usbUrbSize;
+    u64 avg_latency = 0;
+
+    g_usbUrbLatencySum += latency;
+    if (++g_usbUrbLatencyCount < USB_URB_TUNING_SAMPLES) return;
+
+    avg_latency = (g_usbUrbLatencySum / g_usbUrbLatencyCount);
+    g_usbUrbLatencySum = 0;
+    g_usbUrbLatencyCount = 0;
+
+    /* Short completion times mean the fixed per-URB overhead is eating into our throughput. */
+    /* Long completion times mean fewer URBs in flight for the same amount of data, as well as coarser progress updates and a higher chance to hit a timeout. */
+    if (avg_latency < USB_URB_MIN_LATENCY && urb_size < g_usbUrbMaxSize)
     {
-        LOG_MSG_ERROR("usbDsRegisterInterface failed! (0x%X).", rc);
-        goto end;
+        urb_size = MIN(urb_size * 2, g_usbUrbMaxSize);
+    } else
+    if (avg_latency > USB_URB_MAX_LATENCY && urb_size > g_usbUrbMinSize)
+    {
+        urb_size = MAX(ALIGN_DOWN(urb_size / 2, USB_TRANSFER_ALIGNMENT), g_usbUrbMinSize);
     }
 
-    interface_descriptor.bInterfaceNumber = g_usbInterface->interface_index;
-    endpoint_descriptor_in.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
-    endpoint_descriptor_out.bEndpointAddress += (interface_descriptor.bInterfaceNumber + 1);
+    if (urb_size == g_usbUrbSize) return;
 
-    /* Full Speed config (USB 1.1). */
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
+    LOG_MSG_INFO("File data URB size changed from 0x%X to 0x%X bytes (average completion latency: %lu ms).", g_usbUrbSize, urb_size, avg_latency / 1000000);
+
+    g_usbUrbSize = urb_size;
+}
+
+static bool usbPostFileData(const void *data, u64 data_size)
+{
+    /* Split data chunk into URBs. The URB size may change in the middle of this loop, but it's always a multiple of the endpoint max packet size, so the host device won't notice. */
+    /* If checksums are enabled, each URB gets its own trailer and it's sent as a standalone transfer. */
+    for(u64 offset = 0, urb_size = 0; offset < data_size; offset += urb_size)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (interface).", rc);
-        goto end;
+        urb_size = MIN((u64)g_usbUrbSize, data_size - offset);
+        if (!usbPostUrb((const u8*)data + offset, urb_size, g_usbTransferWrittenSize + offset)) return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    return true;
+}
+
+static bool usbPostUrb(const void *data, u64 size, u64 offset)
+{
+    if (!data || !size || size > USB_TRANSFER_BUFFER_SIZE)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (in endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("Invalid parameters!");
+        return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Full, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    /* Wait for the oldest URB to complete if the queue is full. A rejected chunk is queued again right away, so this may take more than one try. */
+    while(g_usbUrbQueueCount >= USB_URB_QUEUE_DEPTH)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 1.1) (out endpoint).", rc);
-        goto end;
+        if (!usbReapUrb()) return false;
     }
 
-    /* High Speed config (USB 2.0). */
-    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE;
+    UsbUrbQueueEntry *entry = &(g_usbUrbQueue[(g_usbUrbQueueHead + g_usbUrbQueueCount) % USB_URB_QUEUE_DEPTH]);
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
+    /* The caller is free to reuse its buffer as soon as we return, so the data must be copied to a buffer we own. */
+    if (g_usbSessionFeatures & UsbSessionFeature_ChunkChecksum)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (interface).", rc);
-        goto end;
+        UsbFileDataChunkTrailer trailer = { .magic = __builtin_bswap32(USB_CHUNK_MAGIC), .crc = 0, .offset = offset };
+
+        /* Checksum each block right after copying it, while it's still cached. This avoids a second pass over the whole chunk. */
+        /* We're also doing this while previously posted URBs are still in flight, so the USB link doesn't have to wait for us. */
+        for(u64 blk_offset = 0, blk_size = 0; blk_offset < size; blk_offset += blk_size)
+        {
+            blk_size = MIN((u64)USB_CHUNK_CHECKSUM_BLOCK, size - blk_offset);
+            memcpy(entry->buf + blk_offset, (const u8*)data + blk_offset, blk_size);
+            trailer.crc = crc32cCalculateWithSeed(trailer.crc, entry->buf + blk_offset, blk_size);
+        }
+
+        memcpy(entry->buf + size, &trailer, sizeof(UsbFileDataChunkTrailer));
+        size += sizeof(UsbFileDataChunkTrailer);
+    } else {
+        memcpy(entry->buf, data, size);
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    entry->size = size;
+    entry->offset = offset;
+    entry->retries = 0;
+
+    /* Post URB to the input (write) endpoint. */
+    if (!usbSubmitUrb(entry)) return false;
+
+    g_usbUrbQueueCount++;
+
+    return true;
+}
+
+static bool usbSubmitUrb(UsbUrbQueueEntry *entry)
+{
+    entry->post_tick = armGetSystemTick();
+    return R_SUCCEEDED(usbTransportPostBuffer(UsbTransportEndpoint_In, entry->buf, entry->size, &(entry->urb_id)));
+}
+
+static bool usbReadChunkAck(UsbUrbQueueEntry *entry, bool *out_resend)
+{
+    UsbFileDataChunkAck *ack = (UsbFileDataChunkAck*)g_usbTransferBuffer;
+
+    /* The host device sends an acknowledgement right after receiving each chunk. We read them in the same order we post our URBs. */
+    if (!usbRead(g_usbTransferBuffer, sizeof(UsbFileDataChunkAck)))
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (in endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("Failed to read chunk acknowledgement! (offset 0x%lX).", entry->offset);
+        return false;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_High, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    if (ack->magic != __builtin_bswap32(USB_CHUNK_MAGIC) || ack->offset != entry->offset)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 2.0) (out endpoint).", rc);
-        goto end;
+        LOG_MSG_ERROR("Invalid chunk acknowledgement! (magic 0x%08X, offset 0x%lX, expected 0x%lX).", __builtin_bswap32(ack->magic), ack->offset, entry->offset);
+        return false;
     }
 
-    /* Super Speed config (USB 3.0). */
-    endpoint_descriptor_in.wMaxPacketSize = endpoint_descriptor_out.wMaxPacketSize = USB_SS_EP_MAX_PACKET_SIZE;
+    *out_resend = (ack->resend != 0);
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &interface_descriptor, USB_DT_INTERFACE_SIZE);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (interface).", rc);
-        goto end;
-    }
+    return true;
+}
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_in, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+static bool usbReapUrb(void)
+{
+    if (!g_usbUrbQueueCount) return true;
+
+    UsbUrbQueueEntry *entry = &(g_usbUrbQueue[g_usbUrbQueueHead]);
+    Event *completion_event = usbTransportGetCompletionEvent(UsbTransportEndpoint_In);
+    u32 transferred_size = 0;
+    u64 cur_tick = 0;
+    bool waited = false, resend = false;
+    Result rc = 0;
+
+    while(true)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint).", rc);
-        goto end;
+        /* Check if the oldest URB has already been completed. A single completion event may cover multiple URBs. */
+        bool completed = false;
+
+        rc = usbTransportGetUrbStatus(UsbTransportEndpoint_In, entry->urb_id, &completed, &transferred_size);
+        if (R_FAILED(rc)) goto end;
+
+        if (completed) break;
+
+        /* Wait for the next URB completion. */
+        rc = eventWait(completion_event, USB_TRANSFER_TIMEOUT * (u64)1000000000);
+        if (R_FAILED(rc))
+        {
+            LOG_MSG_ERROR("eventWait failed! (0x%X) (URB ID %u).", rc, entry->urb_id);
+            goto end;
+        }
+
+        eventClear(completion_event);
+        waited = true;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
-    if (R_FAILED(rc))
+    if (transferred_size != entry->size)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (in endpoint companion).", rc);
+        LOG_MSG_ERROR("USB transfer failed! Expected 0x%lX bytes, got 0x%X bytes (URB ID %u, offset 0x%lX).", entry->size, transferred_size, entry->urb_id, entry->offset);
+        rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
         goto end;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_descriptor_out, USB_DT_ENDPOINT_SIZE);
-    if (R_FAILED(rc))
+    /* Find out if the host device received this chunk intact (if needed). */
+    if ((g_usbSessionFeatures & UsbSessionFeature_ChunkChecksum) && !usbReadChunkAck(entry, &resend))
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint).", rc);
+        rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
         goto end;
     }
 
-    rc = usbDsInterface_AppendConfigurationData(g_usbInterface, UsbDeviceSpeed_Super, &endpoint_companion, USB_DT_SS_ENDPOINT_COMPANION_SIZE);
-    if (R_FAILED(rc))
+    /* Measure how long this URB took to complete, starting from whichever happened last: its submission or the completion of the previous URB. */
+    /* Only URBs we had to wait for are taken into account, since we can't tell when the rest of them were actually completed. */
+    /* Compressed frames are left out as well -- they're never split, so the URB size doesn't apply to them. */
+    cur_tick = armGetSystemTick();
+    if (waited && !(g_usbSessionFeatures & UsbSessionFeature_Lz4Compression)) usbUpdateUrbSize(armTicksToNs(cur_tick - MAX(entry->post_tick, g_usbUrbLastCompletionTick)));
+    g_usbUrbLastCompletionTick = cur_tick;
+
+    /* The host device is back in sync as soon as it accepts a chunk. */
+    if (!resend) g_usbChunkResendPending = false;
+
+    /* Pop URB from the queue. */
+    g_usbUrbQueueHead = ((g_usbUrbQueueHead + 1) % USB_URB_QUEUE_DEPTH);
+    g_usbUrbQueueCount--;
+
+    /* Post the rejected chunk again, right after the ones that are still in flight. */
+    /* The host device discards (and rejects) every chunk it receives until it gets this one, so they'll all be sent again in order as we reap them. */
+    /* Only chunks the host device actually found to be corrupted count as retries. The ones it discarded because they arrived out of order never reached its checksum check. */
+    if (resend)
     {
-        LOG_MSG_ERROR("usbDsInterface_AppendConfigurationData failed! (0x%X) (USB 3.0) (out endpoint companion).", rc);
-        goto end;
+        UsbUrbQueueEntry *tail = &(g_usbUrbQueue[(g_usbUrbQueueHead + g_usbUrbQueueCount) % USB_URB_QUEUE_DEPTH]);
+        u8 *buf = tail->buf;
+        bool corrupted = (!g_usbChunkResendPending || entry->offset == g_usbChunkResendOffset);
+
+        if (corrupted)
+        {
+            if (entry->retries >= USB_CHUNK_MAX_RETRIES)
+            {
+                LOG_MSG_ERROR("Chunk rejected too many times by the host device! (offset 0x%lX).", entry->offset);
+                rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+                goto end;
+            }
+
+            LOG_MSG_WARNING("Chunk rejected by the host device. Sending it again (offset 0x%lX, retry #%u).", entry->offset, entry->retries + 1);
+
+            /* The host device won't accept any other chunk until it gets this one. */
+            g_usbChunkResendPending = true;
+            g_usbChunkResendOffset = entry->offset;
+        } else {
+            LOG_MSG_DEBUG("Chunk discarded by the host device. Sending it again (offset 0x%lX).", entry->offset);
+        }
+
+        /* The tail entry may not be the one we just popped, so we swap buffers instead of copying data around. */
+        tail->buf = entry->buf;
+        entry->buf = buf;
+
+        tail->size = entry->size;
+        tail->offset = entry->offset;
+        tail->retries = (entry->retries + (corrupted ? 1 : 0));
+
+        if (!usbSubmitUrb(tail))
+        {
+            rc = MAKERESULT(Module_Libnx, LibnxError_IoError);
+            goto end;
+        }
+
+        g_usbUrbQueueCount++;
     }
 
-    /* Setup endpoints. */
-    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointIn, endpoint_descriptor_in.bEndpointAddress);
+end:
     if (R_FAILED(rc))
     {
-        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (in endpoint).", rc);
-        goto end;
+        /* Cancel all in-flight URBs. */
+        usbCancelUrbQueue();
+
+        /* Signal user-mode USB timeout event. */
+        /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
+        if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
     }
 
-    rc = usbDsInterface_RegisterEndpoint(g_usbInterface, &g_usbEndpointOut, endpoint_descriptor_out.bEndpointAddress);
-    if (R_FAILED(rc))
+    return R_SUCCEEDED(rc);
+}
+
+static bool usbFlushUrbQueue(void)
+{
+    if (!g_usbUrbQueueCount) return true;
+
+    while(g_usbUrbQueueCount)
     {
-        LOG_MSG_ERROR("usbDsInterface_RegisterEndpoint failed! (0x%X) (out endpoint).", rc);
-        goto end;
+        if (!usbReapUrb()) return false;
     }
 
-    ret = true;
+    /* URBs may have been reaped without waiting on the completion event, so it could still be signaled. */
+    /* Clear it to spare usbTransferData() a spurious wakeup. It still checks its own URB status, since a late signal may arrive after this point. */
+    eventClear(usbTransportGetCompletionEvent(UsbTransportEndpoint_In));
 
-end:
-    return ret;
+    return true;
 }
 
-static bool usbInitializeComms1x(void)
+static void usbCancelUrbQueue(void)
 {
-    Result rc = 0;
-    bool ret = false;
+    if (!g_usbUrbQueueCount) return;
 
-    static const UsbDsDeviceInfo device_info = {
-        .idVendor = USB_DEV_VID,
-        .idProduct = USB_DEV_PID,
-        .bcdDevice = USB_DEV_BCD_REL,
-        .Manufacturer = APP_AUTHOR,
-        .Product = APP_TITLE,
-        .SerialNumber = APP_VERSION
-    };
-
-    struct usb_interface_descriptor interface_descriptor = {
-        .bLength = USB_DT_INTERFACE_SIZE,
-        .bDescriptorType = USB_DT_INTERFACE,
-        .bInterfaceNumber = 0,
-        .bAlternateSetting = 0,
-        .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceSubClass = USB_CLASS_VENDOR_SPEC,
-        .bInterfaceProtocol = USB_CLASS_VENDOR_SPEC,
-        .iInterface = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_in = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_IN,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
-        .bInterval = 0
-    };
-
-    struct usb_endpoint_descriptor endpoint_descriptor_out = {
-        .bLength = USB_DT_ENDPOINT_SIZE,
-        .bDescriptorType = USB_DT_ENDPOINT,
-        .bEndpointAddress = USB_ENDPOINT_OUT,
-        .bmAttributes = USB_TRANSFER_TYPE_BULK,
-        .wMaxPacketSize = USB_HS_EP_MAX_PACKET_SIZE,
-        .bInterval = 0
-    };
-
-    /* Set VID, PID and BCD. */
-    rc = usbDsSetVidPidBcd(&device_info);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsSetVidPidBcd failed! (0x%X).", rc);
-        goto end;
-    }
+    Event *completion_event = usbTransportGetCompletionEvent(UsbTransportEndpoint_In);
 
-    /* Setup interface. */
-    rc = usbDsGetDsInterface(&g_usbInterface, &interface_descriptor, "usb");
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsGetDsInterface failed! (0x%X).", rc);
-        goto end;
-    }
+    /* Cancel all in-flight URBs. */
+    usbTransportCancel(UsbTransportEndpoint_In);
 
-    /* Setup endpoints. */
-    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointIn, &endpoint_descriptor_in);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (in endpoint).", rc);
-        goto end;
-    }
+    /* Safety measure: wait until the completion event is triggered again before proceeding. */
+    eventWait(completion_event, UINT64_MAX);
+    eventClear(completion_event);
 
-    rc = usbDsInterface_GetDsEndpoint(g_usbInterface, &g_usbEndpointOut, &endpoint_descriptor_out);
-    if (R_FAILED(rc))
+    g_usbUrbQueueHead = g_usbUrbQueueCount = 0;
+    g_usbChunkResendPending = false;
+}
+
+static bool usbStartLz4Workers(void)
+{
+    if (g_usbLz4WorkersStarted) return true;
+
+    int lz4_state_size = LZ4_sizeofState();
+    bool success = false;
+
+    g_usbLz4Generation = 0;
+    g_usbLz4PendingCount = 0;
+    g_usbLz4WorkersExit = false;
+
+    for(u32 i = 0; i < USB_LZ4_WORKER_COUNT; i++)
     {
-        LOG_MSG_ERROR("usbDsInterface_GetDsEndpoint failed! (0x%X) (out endpoint).", rc);
-        goto end;
+        UsbLz4Worker *worker = &(g_usbLz4Workers[i]);
+
+        worker->lz4_state = malloc((size_t)lz4_state_size);
+        worker->buf = memalign(USB_TRANSFER_ALIGNMENT, USB_LZ4_FRAME_BUFFER_SIZE);
+        if (!worker->lz4_state || !worker->buf)
+        {
+            LOG_MSG_ERROR("Failed to allocate memory for LZ4 worker #%u!", i);
+            goto end;
+        }
+
+        /* Spread workers across all available CPU cores. */
+        if (!utilsCreateThread(&(worker->thread), usbLz4WorkerThreadFunc, worker, (int)i))
+        {
+            LOG_MSG_ERROR("Failed to create LZ4 worker thread #%u!", i);
+            goto end;
+        }
+
+        worker->thread_created = true;
     }
 
-    ret = true;
+    success = g_usbLz4WorkersStarted = true;
 
 end:
-    return ret;
+    if (!success) usbStopLz4Workers();
+
+    return success;
 }
 
-static void usbCloseComms(void)
+static void usbStopLz4Workers(void)
 {
-    bool is_5x = hosversionAtLeast(5, 0, 0);
-
-    if (is_5x && g_usbHos5xEnabled)
+    SCOPED_LOCK(&g_usbLz4Mutex)
     {
-        usbDsDisable();
-        g_usbHos5xEnabled = false;
+        g_usbLz4WorkersExit = true;
+        condvarWakeAll(&g_usbLz4WorkCondVar);
     }
 
-    if (g_usbEndpointOut)
+    for(u32 i = 0; i < USB_LZ4_WORKER_COUNT; i++)
     {
-        usbDsEndpoint_Close(g_usbEndpointOut);
-        g_usbEndpointOut = NULL;
-    }
+        UsbLz4Worker *worker = &(g_usbLz4Workers[i]);
 
-    if (g_usbEndpointIn)
-    {
-        usbDsEndpoint_Close(g_usbEndpointIn);
-        g_usbEndpointIn = NULL;
-    }
+        if (worker->thread_created) utilsJoinThread(&(worker->thread));
+        if (worker->lz4_state) free(worker->lz4_state);
+        if (worker->buf) free(worker->buf);
 
-    if (g_usbInterface)
-    {
-        /* usbDsInterface_DisableInterface() is internally called here. */
-        usbDsInterface_Close(g_usbInterface);
-        g_usbInterface = NULL;
+        memset(worker, 0, sizeof(UsbLz4Worker));
     }
 
-    if (is_5x) usbDsClearDeviceData();
+    g_usbLz4WorkersStarted = false;
 }
 
-static bool _usbSendFileProperties(u64 file_size, const char *filename, u32 nsp_header_size, bool enforce_nsp_mode)
+static void usbLz4WorkerThreadFunc(void *arg)
 {
-    bool ret = false;
-    size_t filename_length = 0;
+    UsbLz4Worker *worker = (UsbLz4Worker*)arg;
+    bool busy = false, bypass = false;
 
-    /* Disallow sending new files if we're not in NSP transfer mode and the remaining transfer size isn't zero. */
-    /* Allow empty files if we're not in NSP transfer mode. */
-    /* Disallow sending new NSPs if we're already in NSP transfer mode. */
-    if (!g_usbInterfaceInit || !g_usbTransferBuffer || !g_usbHostAvailable || !g_usbSessionStarted || (!g_nspTransferMode && g_usbTransferRemainingSize) || \
-        !filename || !(filename_length = strlen(filename)) || filename_length >= FS_MAX_PATH || (!enforce_nsp_mode && nsp_header_size) || \
-        (enforce_nsp_mode && (g_nspTransferMode || !file_size || !nsp_header_size || nsp_header_size >= file_size)))
+    while(true)
     {
-        LOG_MSG_ERROR("Invalid parameters!");
-        return false;
-    }
+        mutexLock(&g_usbLz4Mutex);
 
-    /* Prepare command data. */
-    usbPrepareCommandHeader(UsbCommandType_SendFileProperties, (u32)sizeof(UsbCommandSendFileProperties));
+        /* Signal the producer if we're the last worker to finish the current generation, then wait for a new one. */
+        if (busy && --g_usbLz4PendingCount == 0) condvarWakeAll(&g_usbLz4DoneCondVar);
 
-    UsbCommandSendFileProperties *cmd_block = (UsbCommandSendFileProperties*)(g_usbTransferBuffer + sizeof(UsbCommandHeader));
-    memset(cmd_block, 0, sizeof(UsbCommandSendFileProperties));
+        while(!g_usbLz4WorkersExit && worker->generation == g_usbLz4Generation) condvarWait(&g_usbLz4WorkCondVar, &g_usbLz4Mutex);
 
-    cmd_block->file_size = file_size;
-    cmd_block->filename_length = (u32)filename_length;
-    cmd_block->nsp_header_size = nsp_header_size;
-    snprintf(cmd_block->filename, sizeof(cmd_block->filename), "%s", filename);
+        if (g_usbLz4WorkersExit)
+        {
+            mutexUnlock(&g_usbLz4Mutex);
+            break;
+        }
 
-    /* Send command. */
-    ret = usbSendCommand();
-    if (ret)
-    {
-        g_usbTransferRemainingSize = file_size;
-        g_usbTransferWrittenSize = 0;
-        if (!g_nspTransferMode && enforce_nsp_mode) g_nspTransferMode = true;
-    } else {
-        g_usbTransferRemainingSize = g_usbTransferWrittenSize = 0;
-        g_nspTransferMode = false;
+        worker->generation = g_usbLz4Generation;
+        busy = (worker->data != NULL);
+        bypass = g_usbLz4Bypass;
+
+        mutexUnlock(&g_usbLz4Mutex);
+
+        /* Build frame. */
+        if (busy) usbLz4BuildFrame(worker, bypass);
     }
 
-    return ret;
+    threadExit();
 }
 
-NX_INLINE bool usbIsHostAvailable(void)
+static void usbLz4BuildFrame(UsbLz4Worker *worker, bool bypass)
 {
-    UsbState state = UsbState_Detached;
-    Result rc = usbDsGetState(&state);
-    return (R_SUCCEEDED(rc) && state == UsbState_Configured);
-}
+    UsbFileDataFrameHeader *frame_header = (UsbFileDataFrameHeader*)worker->buf;
+    u8 *payload = (worker->buf + sizeof(UsbFileDataFrameHeader));
+    int compressed_size = 0;
 
-NX_INLINE void usbSetZltPacket(bool enable)
-{
-    usbDsEndpoint_SetZlt(g_usbEndpointIn, enable);
-}
+    /* Limit the compressed output to the size we're willing to send. LZ4 bails out early if the payload doesn't fit, which saves us from compressing poorly compressible data in full. */
+    if (!bypass)
+    {
+        int max_compressed_size = (int)(worker->data_size - (worker->data_size >> USB_LZ4_MIN_SAVINGS_SHIFT));
+        compressed_size = LZ4_compress_fast_extState(worker->lz4_state, (const char*)worker->data, (char*)payload, (int)worker->data_size, max_compressed_size, 1);
+    }
 
-NX_INLINE bool usbRead(void *buf, u64 size)
-{
-    return usbTransferData(buf, size, g_usbEndpointOut);
-}
+    /* Store the payload uncompressed if it didn't compress well enough. */
+    worker->compressed = (compressed_size > 0);
+    if (!worker->compressed) memcpy(payload, worker->data, worker->data_size);
 
-NX_INLINE bool usbWrite(void *buf, u64 size)
-{
-    return usbTransferData(buf, size, g_usbEndpointIn);
+    frame_header->magic = __builtin_bswap32(USB_LZ4_FRAME_MAGIC);
+    frame_header->raw_size = worker->data_size;
+    frame_header->stored_size = (worker->compressed ? (u32)compressed_size : worker->data_size);
+    frame_header->compressed = worker->compressed;
+    memset(frame_header->reserved, 0, sizeof(frame_header->reserved));
+
+    worker->frame_size = (u32)(sizeof(UsbFileDataFrameHeader) + frame_header->stored_size);
 }
 
-static bool usbTransferData(void *buf, u64 size, UsbDsEndpoint *endpoint)
+static bool usbSendCompressedFileData(const void *data, u64 data_size)
 {
-    if (!buf || !IS_ALIGNED((u64)buf, USB_TRANSFER_ALIGNMENT) || !size || !endpoint)
+    if (!g_usbLz4WorkersStarted || !data || !data_size || data_size > USB_TRANSFER_BUFFER_SIZE)
     {
         LOG_MSG_ERROR("Invalid parameters!");
         return false;
     }
 
-    if (!usbIsHostAvailable())
+    const u8 *data_u8 = (const u8*)data;
+    u64 slice_size = MAX(ALIGN_UP((data_size + USB_LZ4_WORKER_COUNT - 1) / USB_LZ4_WORKER_COUNT, USB_TRANSFER_ALIGNMENT), USB_LZ4_MIN_SLICE_SIZE);
+    u32 slice_count = (u32)((data_size + slice_size - 1) / slice_size);
+
+    /* Split the data chunk into slices and hand them over to our workers. */
+    /* Frames from the previous chunk are still in flight at this point, so compression overlaps with the USB transfer. */
+    SCOPED_LOCK(&g_usbLz4Mutex)
     {
-        LOG_MSG_ERROR("USB host unavailable!");
-        return false;
-    }
+        for(u32 i = 0; i < USB_LZ4_WORKER_COUNT; i++)
+        {
+            UsbLz4Worker *worker = &(g_usbLz4Workers[i]);
+            u64 offset = (i * slice_size);
 
-    Result rc = 0;
-    UsbDsReportData report_data = {0};
-    u32 urb_id = 0, transferred_size = 0;
-    bool thread_exit = false;
+            worker->data = (i < slice_count ? (data_u8 + offset) : NULL);
+            worker->data_size = (i < slice_count ? (u32)MIN(slice_size, data_size - offset) : 0);
+        }
 
-    /* Start a USB transfer using the provided endpoint. */
-    rc = usbDsEndpoint_PostBufferAsync(endpoint, buf, size, &urb_id);
-    if (R_FAILED(rc))
-    {
-        LOG_MSG_ERROR("usbDsEndpoint_PostBufferAsync failed! (0x%X) (URB ID %u).", rc, urb_id);
-        return false;
+        g_usbLz4PendingCount = slice_count;
+        g_usbLz4Generation++;
+        condvarWakeAll(&g_usbLz4WorkCondVar);
+
+        while(g_usbLz4PendingCount) condvarWait(&g_usbLz4DoneCondVar, &g_usbLz4Mutex);
     }
 
-    /* Wait for the transfer to finish. */
-    if (g_usbSessionStarted)
+    /* Queue all frames in order. */
+    for(u32 i = 0; i < slice_count; i++)
     {
-        /* If the USB session has already been established, then use a regular timeout value. */
-        rc = eventWait(&(endpoint->CompletionEvent), USB_TRANSFER_TIMEOUT * (u64)1000000000);
-    } else {
-        /* If we're starting a USB session, wait indefinitely inside a loop to let the user start the host script. */
-        int idx = 0;
-        Waiter completion_event_waiter = waiterForEvent(&(endpoint->CompletionEvent));
-        Waiter exit_event_waiter = waiterForUEvent(&g_usbDetectionThreadExitEvent);
+        UsbLz4Worker *worker = &(g_usbLz4Workers[i]);
+
+        if (!usbPostUrb(worker->buf, worker->frame_size, g_usbTransferWrittenSize + (i * slice_size))) return false;
 
-        rc = waitMulti(&idx, -1, completion_event_waiter, exit_event_waiter);
-        if (R_SUCCEEDED(rc) && idx == 1)
+        /* Stop wasting CPU time on data that doesn't compress well. Raw frames are still used for the rest of the current file. */
+        g_usbLz4PoorFrameCount = (worker->compressed ? 0 : (g_usbLz4PoorFrameCount + 1));
+        if (!g_usbLz4Bypass && g_usbLz4PoorFrameCount >= USB_LZ4_MAX_POOR_FRAMES)
         {
-            /* Exit event triggered. */
-            rc = MAKERESULT(Module_Kernel, KernelError_TimedOut);
-            g_usbDetectionThreadExitFlag = thread_exit = true;
+            LOG_MSG_DEBUG("Poor LZ4 compression ratio detected at offset 0x%lX. Falling back to raw frames.", g_usbTransferWrittenSize);
+            g_usbLz4Bypass = true;
         }
     }
 
-    /* Clear the endpoint completion event. */
-    if (!thread_exit) eventClear(&(endpoint->CompletionEvent));
+    return true;
+}
 
-    if (R_FAILED(rc))
+static void usbAcquireStreamTurn(void)
+{
+    SCOPED_LOCK(&g_usbStreamTurnMutex)
     {
-        /* Cancel transfer. */
-        usbDsEndpoint_Cancel(endpoint);
-
-        /* Safety measure: wait until the completion event is triggered again before proceeding. */
-        eventWait(&(endpoint->CompletionEvent), UINT64_MAX);
-        eventClear(&(endpoint->CompletionEvent));
-
-        /* Signal user-mode USB timeout event if needed. */
-        /* This will "reset" the USB connection by making the background thread wait until a new session is established. */
-        if (g_usbSessionStarted) ueventSignal(&g_usbTimeoutEvent);
-
-        if (!thread_exit) LOG_MSG_ERROR("eventWait failed! (0x%X) (URB ID %u).", rc, urb_id);
-
-        return false;
+        /* Take a ticket and wait until it's being served. This hands out the USB link to all streams in FIFO order, which g_usbInterfaceMutex alone can't guarantee. */
+        u64 ticket = g_usbStreamTicketNext++;
+        while(ticket != g_usbStreamTicketServing) condvarWait(&g_usbStreamTurnCondVar, &g_usbStreamTurnMutex);
     }
+}
 
-    rc = usbDsEndpoint_GetReportData(endpoint, &report_data);
-    if (R_FAILED(rc))
+static void usbReleaseStreamTurn(void)
+{
+    SCOPED_LOCK(&g_usbStreamTurnMutex)
     {
-        LOG_MSG_ERROR("usbDsEndpoint_GetReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
-        return false;
+        g_usbStreamTicketServing++;
+        condvarWakeAll(&g_usbStreamTurnCondVar);
     }
+}
 
-    rc = usbDsParseReportData(&report_data, urb_id, NULL, &transferred_size);
-    if (R_FAILED(rc))
+NX_INLINE bool usbHasOpenStreams(void)
+{
+    for(u32 i = 0; i < USB_STREAM_MAX_COUNT; i++)
     {
-        LOG_MSG_ERROR("usbDsParseReportData failed! (0x%X) (URB ID %u).", rc, urb_id);
-        return false;
+        if (g_usbStreams[i].open) return true;
     }
 
-    if (transferred_size != size)
+    return false;
+}
+
+NX_INLINE UsbStream *usbGetOpenStream(u32 stream_id)
+{
+    if (!stream_id) return NULL;
+
+    for(u32 i = 0; i < USB_STREAM_MAX_COUNT; i++)
     {
-        LOG_MSG_ERROR("USB transfer failed! Expected 0x%lX bytes, got 0x%X bytes (URB ID %u).", size, transferred_size, urb_id);
-        return false;
+        if (g_usbStreams[i].open && g_usbStreams[i].id == stream_id) return &(g_usbStreams[i]);
     }
 
-    return true;
+    return NULL;
 }
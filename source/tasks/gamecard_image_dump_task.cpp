@@ -22,26 +22,217 @@
 #include <tasks/gamecard_image_dump_task.hpp>
 #include <utils/scope_guard.hpp>
 #include <utils/file_writer.hpp>
+#include <utils/tee_writer.hpp>
+#include <utils/buffer_ring.hpp>
 #include <core/gamecard.h>
+#include <core/checksum_db.h>
+
+#include <algorithm>
+#include <memory>
 
 namespace i18n = brls::i18n;    /* For getStr(). */
 using namespace i18n::literals; /* For _i18n. */
 
 namespace nxdt::tasks
 {
+    GameCardHashFileSystemVerifier::~GameCardHashFileSystemVerifier()
+    {
+        this->StopWorker();
+    }
+
+    bool GameCardHashFileSystemVerifier::Initialize(void)
+    {
+        HashFileSystemContext root_hfs_ctx{};
+
+        /* Retrieve root Hash FS partition context. Its entries hold the checksums for the child partition headers. */
+        if (!gamecardGetHashFileSystemContext(HashFileSystemPartitionType_Root, &root_hfs_ctx)) return false;
+
+        ON_SCOPE_EXIT { hfsFreeContext(&root_hfs_ctx); };
+
+        if (!this->AddHashFileSystemEntries(HashFileSystemPartitionType_Root)) return false;
+
+        /* Add entries from all child partitions available in the inserted gamecard. */
+        for(u8 i = HashFileSystemPartitionType_Update; i < HashFileSystemPartitionType_Count; i++)
+        {
+            if (!hfsGetEntryByName(&root_hfs_ctx, hfsGetPartitionNameString(i))) continue;
+            if (!this->AddHashFileSystemEntries(i)) return false;
+        }
+
+        /* Sort entries by hash target offset. This lets us process image blocks sequentially. */
+        std::sort(this->entries.begin(), this->entries.end(), [](const GameCardHashFileSystemEntryVerificationResult& a, const GameCardHashFileSystemEntryVerificationResult& b) {
+            return (a.hash_target_offset < b.hash_target_offset);
+        });
+
+        /* Initialize SHA-256 contexts. */
+        this->sha256_ctxs.resize(this->entries.size());
+        for(Sha256Context& sha256_ctx : this->sha256_ctxs) sha256ContextCreate(&sha256_ctx);
+
+        LOG_MSG_DEBUG("Verifying %lu Hash FS entries.", this->entries.size());
+
+        /* Start worker thread. */
+        this->worker = std::thread(&GameCardHashFileSystemVerifier::WorkerThreadFunc, this);
+
+        return true;
+    }
+
+    bool GameCardHashFileSystemVerifier::AddHashFileSystemEntries(u8 hfs_partition_type)
+    {
+        HashFileSystemContext hfs_ctx{};
+
+        if (!gamecardGetHashFileSystemContext(hfs_partition_type, &hfs_ctx)) return false;
+
+        ON_SCOPE_EXIT { hfsFreeContext(&hfs_ctx); };
+
+        u32 entry_count = hfsGetEntryCount(&hfs_ctx);
+
+        for(u32 i = 0; i < entry_count; i++)
+        {
+            HashFileSystemEntry *hfs_entry = hfsGetEntryByIndex(&hfs_ctx, i);
+            const char *hfs_entry_name = hfsGetEntryName(&hfs_ctx, hfs_entry);
+            if (!hfs_entry || !hfs_entry_name) return false;
+
+            /* Skip entries without a valid hash target. */
+            if (!hfs_entry->hash_target_size || (hfs_entry->hash_target_offset + hfs_entry->hash_target_size) > hfs_entry->size)
+            {
+                LOG_MSG_WARNING("Invalid hash target for Hash FS entry \"%s\" (\"%s\" partition). Skipping.", hfs_entry_name, hfs_ctx.name);
+                continue;
+            }
+
+            GameCardHashFileSystemEntryVerificationResult entry{};
+
+            entry.partition_name = hfs_ctx.name;
+            entry.entry_name = hfs_entry_name;
+            entry.hash_target_offset = (hfs_ctx.offset + hfs_ctx.header_size + hfs_entry->offset + hfs_entry->hash_target_offset);
+            entry.hash_target_size = hfs_entry->hash_target_size;
+            memcpy(entry.expected_hash, hfs_entry->hash, sizeof(entry.expected_hash));
+
+            this->entries.push_back(std::move(entry));
+        }
+
+        return true;
+    }
+
+    void GameCardHashFileSystemVerifier::ProcessBlock(const void *buf, size_t blksize, u64 offset)
+    {
+        const u8 *buf_u8 = static_cast<const u8*>(buf);
+        u64 block_end_offset = (offset + blksize);
+        size_t entry_count = this->entries.size();
+
+        if (!this->worker.joinable() || !buf || !blksize) return;
+
+        for(size_t i = this->cur_entry_idx; i < entry_count && this->entries[i].hash_target_offset < block_end_offset; i++)
+        {
+            GameCardHashFileSystemEntryVerificationResult& entry = this->entries[i];
+
+            /* Calculate the portion of the hash target that's covered by this block. */
+            u64 data_start_offset = (entry.hash_target_offset + entry.processed_size);
+            u64 data_end_offset = std::min(entry.hash_target_offset + entry.hash_target_size, block_end_offset);
+            if (data_start_offset < offset || data_start_offset >= data_end_offset) continue;
+
+            HashJob job{};
+            job.entry_idx = i;
+            job.data.assign(buf_u8 + (data_start_offset - offset), buf_u8 + (data_end_offset - offset));
+
+            entry.processed_size += static_cast<u32>(data_end_offset - data_start_offset);
+
+            /* Hand the hash target data over to the worker thread. */
+            {
+                std::scoped_lock lock(this->job_mtx);
+                this->jobs.push_back(std::move(job));
+            }
+
+            this->job_cv.notify_one();
+        }
+
+        /* Skip entries that have already been fully submitted. */
+        while(this->cur_entry_idx < entry_count && this->entries[this->cur_entry_idx].processed_size >= this->entries[this->cur_entry_idx].hash_target_size) this->cur_entry_idx++;
+    }
+
+    size_t GameCardHashFileSystemVerifier::Finalize(void)
+    {
+        size_t mismatch_count = 0;
+
+        /* Wait until the worker thread has processed all pending jobs. */
+        this->StopWorker();
+
+        for(size_t i = 0; i < this->entries.size(); i++)
+        {
+            GameCardHashFileSystemEntryVerificationResult& entry = this->entries[i];
+
+            if (entry.processed_size == entry.hash_target_size)
+            {
+                sha256ContextGetHash(&(this->sha256_ctxs[i]), entry.calculated_hash);
+                entry.matched = !memcmp(entry.calculated_hash, entry.expected_hash, sizeof(entry.calculated_hash));
+            }
+
+            if (entry.matched) continue;
+
+            LOG_MSG_ERROR("Hash FS entry \"%s\" (\"%s\" partition) failed SHA-256 verification! (offset 0x%lX, size 0x%X, processed 0x%X).", entry.entry_name.c_str(), \
+                          entry.partition_name.c_str(), entry.hash_target_offset, entry.hash_target_size, entry.processed_size);
+
+            mismatch_count++;
+        }
+
+        return mismatch_count;
+    }
+
+    void GameCardHashFileSystemVerifier::WorkerThreadFunc(void)
+    {
+        while(true)
+        {
+            HashJob job{};
+
+            {
+                std::unique_lock lock(this->job_mtx);
+                this->job_cv.wait(lock, [this] { return (!this->jobs.empty() || this->stop_worker); });
+
+                /* Only exit once all pending jobs have been processed. */
+                if (this->jobs.empty()) break;
+
+                job = std::move(this->jobs.front());
+                this->jobs.pop_front();
+            }
+
+            sha256ContextUpdate(&(this->sha256_ctxs[job.entry_idx]), job.data.data(), job.data.size());
+        }
+    }
+
+    void GameCardHashFileSystemVerifier::StopWorker(void)
+    {
+        if (!this->worker.joinable()) return;
+
+        {
+            std::scoped_lock lock(this->job_mtx);
+            this->stop_worker = true;
+        }
+
+        this->job_cv.notify_one();
+
+        this->worker.join();
+    }
+
     GameCardDumpTaskError GameCardImageDumpTask::DoInBackground(const std::string& output_path, const bool& prepend_key_area, const bool& keep_certificate, const bool& trim_dump,
-                                                                const bool& calculate_checksum, const bool& lookup_checksum)
+                                                                const bool& calculate_checksum, const bool& lookup_checksum, const bool& verify_only, const std::string& mirror_path)
     {
         std::scoped_lock lock(this->task_mtx);
 
         GameCardKeyArea gc_key_area{};
         GameCardSecurityInformation gc_security_information{};
+        GameCardHeader gc_header{};
 
-        u32 gc_key_area_crc = 0;
-        size_t gc_img_size = 0;
+        size_t gc_img_size = 0, resume_offset = 0, read_offset = 0;
 
         nxdt::utils::FileWriter *file = nullptr;
-        void *buf = nullptr;
+
+        GameCardHashFileSystemVerifier hfs_verifier{};
+        bool verify_hfs_entries = false;
+
+        MultiDigestContext digest_ctx{};
+
+        CheckpointState ckpt_state{};
+        std::mutex ckpt_mtx{};
+        std::deque<std::pair<size_t, CheckpointState>> ckpt_queue{};
+        bool checkpoint = false, rehash_prefix = false;
 
         DataTransferProgress progress{};
 
@@ -49,12 +240,36 @@ namespace nxdt::tasks
         this->calculate_checksum = calculate_checksum;
         this->lookup_checksum = lookup_checksum;
 
-        LOG_MSG_DEBUG("Starting dump with parameters:\n- Output path: \"%s\".\n- Prepend key area: %u.\n- Keep certificate: %u.\n- Trim dump: %u.\n- Calculate checksum: %u.\n- Lookup checksum: %d.", \
-                      output_path.c_str(), prepend_key_area, keep_certificate, trim_dump, calculate_checksum, lookup_checksum);
+        LOG_MSG_DEBUG("Starting dump with parameters:\n- Output path: \"%s\".\n- Prepend key area: %u.\n- Keep certificate: %u.\n- Trim dump: %u.\n- Calculate checksum: %u.\n- Lookup checksum: %d.\n- Verify only: %u.\n- Mirror path: \"%s\".", \
+                      output_path.c_str(), prepend_key_area, keep_certificate, trim_dump, calculate_checksum, lookup_checksum, verify_only, mirror_path.c_str());
 
         /* Retrieve gamecard image size. */
         if ((!trim_dump && !gamecardGetTotalSize(&gc_img_size)) || (trim_dump && !gamecardGetTrimmedSize(&gc_img_size)) || !gc_img_size) return "tasks/gamecard/image/get_size_failed"_i18n;
 
+        /* Retrieve gamecard header checksum. Used to identify the gamecard in checkpoints. */
+        if (!gamecardGetHeader(&gc_header)) return "tasks/gamecard/image/get_header_failed"_i18n;
+        sha256CalculateHash(ckpt_state.header_hash, &gc_header, sizeof(GameCardHeader));
+
+        /* Log gamecard I/O scheduler statistics for this dump once we're done. The max queue depth is reset here, since it can't be calculated as a difference. */
+        GameCardIoStats start_io_stats{};
+        gamecardResetIoMaxQueueDepth();
+        bool log_io_stats = gamecardGetIoStats(&start_io_stats);
+
+        ON_SCOPE_EXIT {
+            GameCardIoStats end_io_stats{};
+            if (!log_io_stats || !gamecardGetIoStats(&end_io_stats)) return;
+
+            LOG_MSG_INFO("Gamecard I/O stats: %lu request(s), %lu merged, %lu storage read(s), %lu storage switch(es), max queue depth %u.", \
+                         end_io_stats.request_count - start_io_stats.request_count, end_io_stats.merged_request_count - start_io_stats.merged_request_count, \
+                         end_io_stats.storage_read_count - start_io_stats.storage_read_count, end_io_stats.storage_switch_count - start_io_stats.storage_switch_count, \
+                         end_io_stats.max_queue_depth);
+        };
+
+        ckpt_state.prepend_key_area = prepend_key_area;
+        ckpt_state.keep_certificate = keep_certificate;
+        ckpt_state.trim_dump = trim_dump;
+        ckpt_state.calculate_checksum = calculate_checksum;
+
         /* Check if we're supposed to prepend the key area to the gamecard image. */
         if (prepend_key_area)
         {
@@ -66,79 +281,415 @@ namespace nxdt::tasks
 
             /* Copy the GameCardInitialData area from the GameCardSecurityInformation area to our GameCardKeyArea object. */
             memcpy(&(gc_key_area.initial_data), &(gc_security_information.initial_data), sizeof(GameCardInitialData));
+        }
 
-            if (calculate_checksum)
+        if (calculate_checksum)
+        {
+            /* Start digest workers. These calculate all checksums for the output file in a single pass. */
+            /* The context is freed on scope exit, which also takes care of stopping the workers. */
+            if (!multiDigestInitializeContext(&digest_ctx, MultiDigestType_All))
             {
-                /* Update gamecard image checksum if we're prepending the key area to it. */
-                gc_key_area_crc = crc32Calculate(&gc_key_area, sizeof(GameCardKeyArea));
-                this->full_gc_img_crc = gc_key_area_crc;
+                multiDigestFreeContext(&digest_ctx);
+                return "tasks/gamecard/image/digest_init_failed"_i18n;
+            }
+        }
+
+        ON_SCOPE_EXIT { multiDigestFreeContext(&digest_ctx); };
+
+        /* Used instead of an output file for verification-only and mirrored dumps. Must be destroyed before the multi-digest context is freed. */
+        std::unique_ptr<nxdt::utils::TeeWriter> tee{};
+        bool digest_sink = false;
+
+        if (verify_only)
+        {
+            /* Feed image data to the multi-digest context through a digest sink. The hasher thread doesn't touch the context in this case. */
+            /* Only Hash FS entries are verified if checksum calculation is disabled, so all data is discarded. */
+            try {
+                tee = std::make_unique<nxdt::utils::TeeWriter>(gc_img_size);
+
+                if (calculate_checksum)
+                {
+                    tee->AddDigestSink(&digest_ctx);
+                    digest_sink = true;
+                } else {
+                    tee->AddNullSink();
+                }
+            } catch(const std::string& msg) {
+                LOG_MSG_ERROR("%s", msg.c_str());
+                return msg;
+            }
+        } else
+        if (!mirror_path.empty())
+        {
+            /* Write the output file and send a copy of it to the USB host at the same time. Losing the copy doesn't make the dump fail. */
+            try {
+                tee = std::make_unique<nxdt::utils::TeeWriter>(gc_img_size);
+                tee->AddFileSink(output_path);
+                tee->AddFileSink(mirror_path, nxdt::utils::TeeWriter::ErrorPolicy::BestEffort);
+            } catch(const std::string& msg) {
+                LOG_MSG_ERROR("%s", msg.c_str());
+                return msg;
+            }
+        } else {
+            /* Open output file. A previous dump is resumed if a valid checkpoint is available for it. */
+            try {
+                file = new nxdt::utils::FileWriter(output_path, gc_img_size, 0, true);
+            } catch(const std::string& msg) {
+                LOG_MSG_ERROR("%s", msg.c_str());
+                return msg;
             }
         }
 
+        ON_SCOPE_EXIT { delete file; };
+
+        /* Writes output data to either the output file or the TeeWriter. */
+        auto write_output = [&](const void *data, size_t data_size) -> bool {
+            return (tee ? tee->Write(data, data_size) : file->Write(data, data_size));
+        };
+
+        checkpoint = (file && file->GetStorageType() != nxdt::utils::FileWriter::StorageType::UsbHost);
+
+        if (file && file->IsResumed())
+        {
+            size_t key_area_size = (prepend_key_area ? sizeof(GameCardKeyArea) : 0);
+            size_t img_offset = (file->GetCurrentOffset() > key_area_size ? (file->GetCurrentOffset() - key_area_size) : 0);
+            bool valid = false;
+
+            if (checkpoint)
+            {
+                const std::vector<u8>& ckpt_blob = file->GetCheckpointState();
+                const CheckpointState *prev_ckpt_state = (ckpt_blob.size() == sizeof(CheckpointState) ? reinterpret_cast<const CheckpointState*>(ckpt_blob.data()) : nullptr);
+
+                /* Make sure the checkpoint was generated using the same gamecard and dump options, then verify the overlap window. */
+                valid = (prev_ckpt_state && img_offset && !memcmp(prev_ckpt_state->header_hash, ckpt_state.header_hash, sizeof(ckpt_state.header_hash)) && \
+                         prev_ckpt_state->prepend_key_area == prepend_key_area && prev_ckpt_state->keep_certificate == keep_certificate && \
+                         prev_ckpt_state->trim_dump == trim_dump && prev_ckpt_state->calculate_checksum == calculate_checksum && \
+                         this->VerifyCheckpointOverlap(prev_ckpt_state, file, file->GetCurrentOffset()));
+
+                /* Restore checksum states. */
+                if (valid && calculate_checksum) valid = multiDigestImportState(&digest_ctx, &(prev_ckpt_state->digest_state));
+
+                if (valid) this->gc_img_crc = prev_ckpt_state->gc_img_crc;
+            } else {
+                /* USB hosts only report a checksum for the data right before the resume offset. Compare it against our own data. */
+                valid = (img_offset && this->VerifyUsbResumeWindow(file->GetResumeWindowChecksum(), file->GetCurrentOffset(), prepend_key_area ? &gc_key_area : nullptr, keep_certificate));
+
+                /* Checksum states can't be restored in this case, so data before the resume offset is read and hashed again, but not written. */
+                /* This is still much faster than sending it to the USB host. */
+                rehash_prefix = (valid && calculate_checksum);
+            }
+
+            if (valid)
+            {
+                LOG_MSG_INFO("Resuming gamecard image dump at offset 0x%lX.", img_offset);
+                resume_offset = img_offset;
+            } else {
+                LOG_MSG_WARNING("Partial dump doesn't match the inserted gamecard or the current dump options. Starting over.");
+
+                /* Get rid of the partial dump and start over. */
+                /* Transfers to a USB host aren't resumable this time around, or the host would just report the same data again. */
+                file->Close(true);
+                delete file;
+                file = nullptr;
+
+                try {
+                    file = new nxdt::utils::FileWriter(output_path, gc_img_size, 0, checkpoint);
+                } catch(const std::string& msg) {
+                    LOG_MSG_ERROR("%s", msg.c_str());
+                    return msg;
+                }
+            }
+        }
+
+        /* Retrieve Hash FS entry hash targets. These will be verified using the data we read from the gamecard. */
+        /* Verification is skipped for resumed dumps, since most hash targets have already been dumped, unless we're reading all the data again. */
+        if (!resume_offset || rehash_prefix)
+        {
+            verify_hfs_entries = hfs_verifier.Initialize();
+            if (!verify_hfs_entries) LOG_MSG_ERROR("Failed to initialize Hash FS entry verifier! Verification will be skipped.");
+        } else {
+            LOG_MSG_WARNING("Hash FS entry verification isn't available for resumed dumps.");
+        }
+
         /* Push progress onto the class. */
         progress.total_size = gc_img_size;
+        progress.xfer_size = (file ? file->GetCurrentOffset() : 0);
+        progress.percentage = static_cast<int>((progress.xfer_size * 100) / progress.total_size);
         this->PublishProgress(progress);
 
-        /* Open output file. */
+        if (prepend_key_area && (!resume_offset || rehash_prefix))
+        {
+            /* Update output file checksums. The TeeWriter digest sink takes care of this on its own. */
+            if (calculate_checksum && !digest_sink) multiDigestUpdate(&digest_ctx, &gc_key_area, sizeof(GameCardKeyArea));
+
+            if (!resume_offset)
+            {
+                /* Write GameCardKeyArea object. */
+                if (!write_output(&gc_key_area, sizeof(GameCardKeyArea))) return "tasks/gamecard/image/write_key_area_failed"_i18n;
+
+                /* Push progress onto the class. */
+                progress.xfer_size += sizeof(GameCardKeyArea);
+                this->PublishProgress(progress);
+            }
+        }
+
+        /* Determine where the reader thread should start. */
+        read_offset = (rehash_prefix ? 0 : resume_offset);
+
+        /* Update gamecard image size. */
+        if (prepend_key_area) gc_img_size -= sizeof(GameCardKeyArea);
+
+        /* Allocate buffer ring for the dump pipeline. */
+        /* Gamecard reads, checksum calculation and output writes take place on different threads, and each one of them works on a different buffer. */
+        std::unique_ptr<nxdt::utils::BufferRing> ring{};
+
         try {
-            file = new nxdt::utils::FileWriter(output_path, gc_img_size);
+            ring = std::make_unique<nxdt::utils::BufferRing>(GameCardImageDumpTask::BufferCount, USB_TRANSFER_BUFFER_SIZE, PipelineStage::Count);
         } catch(const std::string& msg) {
             LOG_MSG_ERROR("%s", msg.c_str());
             return msg;
         }
 
-        ON_SCOPE_EXIT { delete file; };
+        GameCardDumpTaskError read_error{};
 
-        if (prepend_key_area)
-        {
-            /* Write GameCardKeyArea object. */
-            if (!file->Write(&gc_key_area, sizeof(GameCardKeyArea))) return "tasks/gamecard/image/write_key_area_failed"_i18n;
+        /* Start reader thread. */
+        std::thread reader([&]() {
+            for(size_t offset = read_offset, blksize = ring->GetBlockSize(); offset < gc_img_size; offset += blksize)
+            {
+                /* Wait until a free buffer is available. */
+                nxdt::utils::BufferRing::Block *block = ring->Acquire(PipelineStage::Read);
+                if (!block) return;
 
-            /* Push progress onto the class. */
-            progress.xfer_size += sizeof(GameCardKeyArea);
-            this->PublishProgress(progress);
+                /* Adjust current block size, if needed. */
+                if (blksize > (gc_img_size - offset)) blksize = (gc_img_size - offset);
 
-            /* Update gamecard image size. */
-            gc_img_size -= sizeof(GameCardKeyArea);
-        }
+                /* Read current block. */
+                if (!gamecardReadStorageWithPriority(block->data, blksize, offset, GameCardIoPriority_Low))
+                {
+                    read_error = i18n::getStr("tasks/gamecard/image/io_failed", "generic/read"_i18n, blksize, offset);
+                    ring->Abort();
+                    return;
+                }
+
+                /* Remove certificate, if needed. */
+                if (!keep_certificate && offset == 0) memset(static_cast<u8*>(block->data) + GAMECARD_CERT_OFFSET, 0xFF, sizeof(FsGameCardCertificate));
+
+                /* Hand the current block over to the hasher thread. */
+                block->size = blksize;
+                block->offset = offset;
+                ring->Release(PipelineStage::Read);
+            }
+
+            ring->SetEndOfStream();
+        });
+
+        /* Start hasher thread. */
+        std::thread hasher([&]() {
+            nxdt::utils::BufferRing::Block *block = nullptr;
 
-        /* Allocate memory buffer for the dump process. */
-        buf = usbAllocatePageAlignedBuffer(USB_TRANSFER_BUFFER_SIZE);
-        if (!buf) return "generic/mem_alloc_failed"_i18n;
+            while((block = ring->Acquire(PipelineStage::Hash)) != nullptr)
+            {
+                /* Submit current block to the digest workers. They hash it in parallel while we take care of the rest. */
+                /* The TeeWriter digest sink takes care of this on the writer stage for verification-only dumps. */
+                if (calculate_checksum && !digest_sink) multiDigestUpdateAsync(&digest_ctx, block->data, block->size);
+
+                /* Update image checksum. This one excludes key area data, so it only needs to be calculated separately if the key area is being prepended. */
+                /* Otherwise, the CRC32 checksum from the multi-digest context already covers the exact same data. */
+                if (calculate_checksum && prepend_key_area) this->gc_img_crc = crc32CalculateWithSeed(this->gc_img_crc, block->data, block->size);
+
+                /* Submit Hash FS entry hash target data. */
+                if (verify_hfs_entries) hfs_verifier.ProcessBlock(block->data, block->size, block->offset);
+
+                /* Wait for the digest workers to finish processing the current block. */
+                if (calculate_checksum && !digest_sink) multiDigestWait(&digest_ctx);
 
-        ON_SCOPE_EXIT { free(buf); };
+                /* Take a snapshot of our checksum states if a checkpoint is due right after the current block. It'll be saved by the writer. */
+                size_t block_end_offset = (block->offset + block->size);
+                if (checkpoint && !(block_end_offset % GameCardImageDumpTask::CheckpointInterval) && block_end_offset < gc_img_size)
+                {
+                    CheckpointState cur_ckpt_state = ckpt_state;
 
-        /* Dump gamecard image. */
-        for(size_t offset = 0, blksize = USB_TRANSFER_BUFFER_SIZE; offset < gc_img_size; offset += blksize)
+                    cur_ckpt_state.gc_img_crc = this->gc_img_crc;
+                    cur_ckpt_state.overlap_crc = crc32Calculate(block->data, block->size);
+                    cur_ckpt_state.overlap_size = static_cast<u32>(block->size);
+                    if (calculate_checksum) multiDigestExportState(&digest_ctx, &(cur_ckpt_state.digest_state));
+
+                    std::scoped_lock ckpt_lock(ckpt_mtx);
+                    ckpt_queue.emplace_back(block_end_offset, cur_ckpt_state);
+                }
+
+                /* Hand the current block over to the writer. */
+                ring->Release(PipelineStage::Hash);
+            }
+        });
+
+        /* Make sure both threads exit before the buffer ring is freed. */
+        ON_SCOPE_EXIT {
+            ring->Abort();
+            if (reader.joinable()) reader.join();
+            if (hasher.joinable()) hasher.join();
+        };
+
+        /* Write gamecard image blocks on the task thread. */
+        while(true)
         {
             /* Don't proceed if the task has been cancelled. */
             if (this->IsCancelled()) return {};
 
-            /* Adjust current block size, if needed. */
-            if (blksize > (gc_img_size - offset)) blksize = (gc_img_size - offset);
+            /* Wait until the next block has been read and hashed. */
+            nxdt::utils::BufferRing::Block *block = ring->Acquire(PipelineStage::Write);
+            if (!block) break;
 
-            /* Read current block. */
-            if (!gamecardReadStorage(buf, blksize, offset)) return i18n::getStr("tasks/gamecard/image/io_failed", "generic/read"_i18n, blksize, offset);
+            /* Write current block. Data before the resume offset is only hashed. */
+            size_t skip_size = (block->offset < resume_offset ? MIN(resume_offset - block->offset, block->size) : 0);
+            size_t write_size = (block->size - skip_size);
 
-            /* Remove certificate, if needed. */
-            if (!keep_certificate && offset == 0) memset(static_cast<u8*>(buf) + GAMECARD_CERT_OFFSET, 0xFF, sizeof(FsGameCardCertificate));
+            if (write_size && !write_output(static_cast<u8*>(block->data) + skip_size, write_size)) return i18n::getStr("tasks/gamecard/image/io_failed", "generic/write"_i18n, write_size, block->offset + skip_size);
+
+            /* Push progress onto the class. */
+            progress.xfer_size += write_size;
+            progress.percentage = static_cast<int>((progress.xfer_size * 100) / progress.total_size);
+            this->PublishProgress(progress);
 
-            /* Update image checksum. */
-            if (calculate_checksum)
+            /* Save a checkpoint if one is due right after the current block. Failing to do so isn't considered a fatal error. */
+            if (checkpoint)
             {
-                this->gc_img_crc = crc32CalculateWithSeed(this->gc_img_crc, buf, blksize);
-                if (prepend_key_area) this->full_gc_img_crc = crc32CalculateWithSeed(this->full_gc_img_crc, buf, blksize);
+                std::scoped_lock ckpt_lock(ckpt_mtx);
+
+                if (!ckpt_queue.empty() && ckpt_queue.front().first == (block->offset + block->size))
+                {
+                    if (!file->WriteCheckpoint(&(ckpt_queue.front().second), sizeof(CheckpointState))) LOG_MSG_WARNING("Failed to save checkpoint at offset 0x%lX.", ckpt_queue.front().first);
+                    ckpt_queue.pop_front();
+                }
             }
 
-            /* Write current block. */
-            if (!file->Write(buf, blksize)) return i18n::getStr("tasks/gamecard/image/io_failed", "generic/write"_i18n, blksize, offset);
+            /* Release current block. */
+            ring->Release(PipelineStage::Write);
+        }
 
-            /* Push progress onto the class. */
-            progress.xfer_size += blksize;
-            progress.percentage = static_cast<int>((progress.xfer_size * 100) / progress.total_size);
-            this->PublishProgress(progress);
+        /* Wait for both threads to exit. */
+        reader.join();
+        hasher.join();
+
+        /* Check if the reader thread failed. */
+        if (read_error) return read_error;
+
+        /* Stop TeeWriter sink threads. All data has already been processed at this point, and sink statistics are logged. */
+        if (tee) tee->Close();
+
+        /* Retrieve Hash FS entry verification results. Mismatches are reported after saving the checksums, since the full image has already been written at this point. */
+        size_t hfs_mismatch_count = 0;
+
+        if (verify_hfs_entries)
+        {
+            hfs_mismatch_count = hfs_verifier.Finalize();
+            this->hfs_verification_results = hfs_verifier.GetResults();
         }
 
+        if (calculate_checksum)
+        {
+            /* Retrieve output file checksums. */
+            multiDigestFinalize(&digest_ctx, &(this->gc_img_digests));
+            if (prepend_key_area)
+            {
+                this->full_gc_img_crc = this->gc_img_digests.crc32;
+            } else {
+                this->gc_img_crc = this->gc_img_digests.crc32;
+            }
+
+            /* Close output file before saving the checksums. Only a single file can be transferred at a time to a USB host. */
+            if (file) file->Close();
+            this->WriteDigestReport(output_path, progress.total_size);
+
+            /* Look up the gamecard image checksum in the offline checksum database. DAT entries never include key area data. */
+            /* The SHA-1 checksum can only be compared if it was calculated over the gamecard image alone. */
+            if (lookup_checksum)
+            {
+                char dat_name[0x200] = {0};
+
+                if (checksumDbLookup(this->gc_img_crc, gc_img_size, prepend_key_area ? nullptr : this->gc_img_digests.sha1, dat_name, sizeof(dat_name)))
+                {
+                    LOG_MSG_INFO("Gamecard image checksum matches DAT entry \"%s\".", dat_name);
+                    this->checksum_lookup_result = dat_name;
+                } else {
+                    LOG_MSG_INFO("Gamecard image checksum not found in offline checksum database.");
+                }
+            }
+        }
+
+        /* Check Hash FS entry verification results. */
+        if (hfs_mismatch_count) return i18n::getStr("tasks/gamecard/image/hfs_verification_failed", hfs_mismatch_count, this->hfs_verification_results.size());
+
         return {};
     }
+
+    bool GameCardImageDumpTask::VerifyCheckpointOverlap(const CheckpointState *state, nxdt::utils::FileWriter *file, size_t offset)
+    {
+        if (!state->overlap_size || state->overlap_size > USB_TRANSFER_BUFFER_SIZE || state->overlap_size > offset) return false;
+
+        size_t overlap_offset = (offset - state->overlap_size);
+
+        /* Read the overlap window back from the partial output file. This is the data that's actually being resumed, so there's no need to read the gamecard again. */
+        /* The checkpoint CRC32 was calculated over the exact data that was written, so certificate removal is already reflected in it. */
+        std::unique_ptr<u8[]> buf(new (std::nothrow) u8[state->overlap_size]);
+        if (!buf || !file->ReadBack(buf.get(), state->overlap_size, overlap_offset)) return false;
+
+        bool match = (crc32Calculate(buf.get(), state->overlap_size) == state->overlap_crc);
+        if (!match) LOG_MSG_ERROR("Checkpoint overlap window mismatch! (offset 0x%lX, size 0x%X).", overlap_offset, state->overlap_size);
+
+        return match;
+    }
+
+    bool GameCardImageDumpTask::VerifyUsbResumeWindow(u32 window_crc, size_t offset, const GameCardKeyArea *key_area, bool keep_certificate)
+    {
+        size_t key_area_size = (key_area ? sizeof(GameCardKeyArea) : 0);
+        size_t window_size = MIN(offset, static_cast<size_t>(USB_RESUME_WINDOW_SIZE)), window_offset = (offset - window_size), pos = 0;
+        if (!window_size) return false;
+
+        std::unique_ptr<u8[]> buf(new (std::nothrow) u8[window_size]);
+        if (!buf) return false;
+
+        /* Copy key area data, if needed. The window offset is relative to the start of the output file. */
+        if (window_offset < key_area_size)
+        {
+            pos = MIN(key_area_size - window_offset, window_size);
+            memcpy(buf.get(), reinterpret_cast<const u8*>(key_area) + window_offset, pos);
+        }
+
+        if (pos < window_size)
+        {
+            size_t img_offset = (window_offset + pos - key_area_size), img_size = (window_size - pos);
+            if (!gamecardReadStorage(buf.get() + pos, img_size, img_offset)) return false;
+
+            /* Remove certificate, if needed. */
+            size_t cert_start = MAX(img_offset, static_cast<size_t>(GAMECARD_CERT_OFFSET)), cert_end = MIN(img_offset + img_size, GAMECARD_CERT_OFFSET + sizeof(FsGameCardCertificate));
+            if (!keep_certificate && cert_start < cert_end) memset(buf.get() + pos + (cert_start - img_offset), 0xFF, cert_end - cert_start);
+        }
+
+        bool match = (crc32Calculate(buf.get(), window_size) == window_crc);
+        if (!match) LOG_MSG_ERROR("USB host resume window mismatch! (offset 0x%lX, size 0x%lX).", window_offset, window_size);
+
+        return match;
+    }
+
+    void GameCardImageDumpTask::WriteDigestReport(const std::string& output_path, size_t output_size)
+    {
+        /* Use the output file name in the report. */
+        size_t pos = output_path.find_last_of('/');
+        std::string file_name = (pos == std::string::npos ? output_path : output_path.substr(pos + 1));
+
+        char *report = multiDigestGenerateReport(&(this->gc_img_digests), MultiDigestType_All, file_name.c_str(), output_size);
+        if (!report) return;
+
+        ON_SCOPE_EXIT { free(report); };
+
+        /* Failing to save the report isn't considered a fatal error, since the dump itself is complete at this point. */
+        try {
+            size_t report_size = strlen(report);
+            nxdt::utils::FileWriter report_file(output_path + MULTI_DIGEST_REPORT_EXTENSION, report_size);
+            if (!report_file.Write(report, report_size)) LOG_MSG_ERROR("Failed to write digest report for \"%s\"!", output_path.c_str());
+        } catch(const std::string& msg) {
+            LOG_MSG_ERROR("%s", msg.c_str());
+        }
+    }
 }
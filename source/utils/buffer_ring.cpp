@@ -0,0 +1,124 @@
+/*
+ * buffer_ring.cpp
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <utils/buffer_ring.hpp>
+#include <core/usb.h>
+
+namespace i18n = brls::i18n;    /* For getStr(). */
+using namespace i18n::literals; /* For _i18n. */
+
+namespace nxdt::utils
+{
+    BufferRing::BufferRing(size_t block_count, size_t block_size, size_t stage_count) : block_size(block_size)
+    {
+        if (!block_count || !block_size || !stage_count) throw "generic/mem_alloc_failed"_i18n;
+
+        this->stage_pos.resize(stage_count, 0);
+        this->blocks.reserve(block_count);
+
+        for(size_t i = 0; i < block_count; i++)
+        {
+            void *data = usbAllocatePageAlignedBuffer(block_size);
+            if (!data)
+            {
+                for(Block& block : this->blocks) free(block.data);
+                throw "generic/mem_alloc_failed"_i18n;
+            }
+
+            this->blocks.push_back({ data, 0, 0 });
+        }
+    }
+
+    BufferRing::~BufferRing()
+    {
+        for(Block& block : this->blocks) free(block.data);
+    }
+
+    bool BufferRing::IsBlockAvailable(size_t stage)
+    {
+        size_t pos = this->stage_pos[stage];
+
+        /* The first stage may only reuse a block once the last stage is done with it. */
+        if (stage == 0) return (!this->end_of_stream && (pos - this->stage_pos.back()) < this->blocks.size());
+
+        /* Any other stage waits for the previous stage. */
+        return (pos < this->stage_pos[stage - 1]);
+    }
+
+    BufferRing::Block *BufferRing::Acquire(size_t stage)
+    {
+        if (stage >= this->stage_pos.size()) return nullptr;
+
+        std::unique_lock lock(this->ring_mtx);
+
+        this->ring_cv.wait(lock, [this, stage] {
+            return (this->aborted || this->IsBlockAvailable(stage) || (this->end_of_stream && (stage == 0 || this->stage_pos[stage] >= this->end_pos)));
+        });
+
+        if (this->aborted || !this->IsBlockAvailable(stage)) return nullptr;
+
+        return &(this->blocks[this->stage_pos[stage] % this->blocks.size()]);
+    }
+
+    void BufferRing::Release(size_t stage)
+    {
+        if (stage >= this->stage_pos.size()) return;
+
+        {
+            std::scoped_lock lock(this->ring_mtx);
+            this->stage_pos[stage]++;
+        }
+
+        this->ring_cv.notify_all();
+    }
+
+    bool BufferRing::Drain(void)
+    {
+        std::unique_lock lock(this->ring_mtx);
+
+        this->ring_cv.wait(lock, [this] {
+            return (this->aborted || this->stage_pos.back() >= this->stage_pos.front());
+        });
+
+        return !this->aborted;
+    }
+
+    void BufferRing::SetEndOfStream(void)
+    {
+        {
+            std::scoped_lock lock(this->ring_mtx);
+            this->end_of_stream = true;
+            this->end_pos = this->stage_pos.front();
+        }
+
+        this->ring_cv.notify_all();
+    }
+
+    void BufferRing::Abort(void)
+    {
+        {
+            std::scoped_lock lock(this->ring_mtx);
+            this->aborted = true;
+        }
+
+        this->ring_cv.notify_all();
+    }
+}
@@ -20,25 +20,27 @@
  */
 
 #include <utils/file_writer.hpp>
+#include <utils/scope_guard.hpp>
 
 namespace i18n = brls::i18n;    /* For getStr(). */
 using namespace i18n::literals; /* For _i18n. */
 
 namespace nxdt::utils
 {
-    FileWriter::FileWriter(const std::string& output_path, const size_t& total_size, const u32& nsp_header_size) : output_path(output_path), total_size(total_size), nsp_header_size(nsp_header_size)
+    FileWriter::FileWriter(const std::string& output_path, const size_t& total_size, const u32& nsp_header_size, const bool& resumable) : output_path(output_path), total_size(total_size),
+                                                                                                                                        nsp_header_size(nsp_header_size), resumable(resumable)
     {
         const char *output_path_str = this->output_path.c_str();
 
         LOG_MSG_DEBUG("Creating FileWriter object with arguments:\r\n" \
                       "- output_path: \"%s\".\r\n" \
                       "- total_size: 0x%lX.\r\n" \
-                      "- nsp_header_size: 0x%X.", \
-                      output_path_str, total_size, nsp_header_size);
+                      "- nsp_header_size: 0x%X.\r\n" \
+                      "- resumable: %u.", \
+                      output_path_str, total_size, nsp_header_size, resumable);
 
         /* Determine the storage device based on the input path. */
-        this->storage_type = (this->output_path.starts_with(DEVOPTAB_SDMC_DEVICE) ? StorageType::SdCard  :
-                             (this->output_path.starts_with('/')                  ? StorageType::UsbHost : StorageType::UmsDevice));
+        this->storage_type = FileWriter::GetStorageTypeByPath(this->output_path);
 
         if (this->storage_type != StorageType::UsbHost)
         {
@@ -61,6 +63,38 @@ namespace nxdt::utils
 
         LOG_MSG_DEBUG("storage_type: %d | split_file: %u | split_file_part_cnt: %u", this->storage_type, this->split_file, this->split_file_part_cnt);
 
+        /* Resumable files are supported on SD card and UMS devices, as well as USB hosts that support resuming transfers. */
+        if (this->resumable && (!this->total_size || (this->storage_type == StorageType::UsbHost && (this->nsp_header_size || !usbIsResumeSupported())))) this->resumable = false;
+
+        /* USB hosts keep track of the data they hold on their own. The resume offset is retrieved while creating the initial file. */
+        if (this->resumable && this->storage_type != StorageType::UsbHost)
+        {
+            this->checkpoint_path = (this->output_path + ".ckpt");
+
+            /* Resume a previous transfer if a valid checkpoint is available. */
+            if (this->LoadCheckpoint())
+            {
+                if (this->ReopenFile())
+                {
+                    LOG_MSG_INFO("Resuming \"%s\" at offset 0x%lX.", output_path_str, this->cur_size);
+                    this->resumed = this->checkpoint_written = true;
+                    this->SetupStagingBuffer();
+                    this->StartWriteBehind();
+                    return;
+                }
+
+                LOG_MSG_WARNING("Failed to reopen \"%s\" at offset 0x%lX! Starting over.", output_path_str, this->cur_size);
+
+                this->cur_size = this->out_size = this->split_file_part_size = 0;
+                this->split_file_part_idx = 0;
+                this->file_created = false;
+                this->checkpoint_state.clear();
+            }
+
+            /* Get rid of stale checkpoint files. */
+            this->RemoveCheckpoint();
+        }
+
         /* Check free space. */
         if (auto chk = this->CheckFreeSpace()) throw chk.value();
 
@@ -71,6 +105,9 @@ namespace nxdt::utils
             throw (this->storage_type == StorageType::UsbHost ? "utils/file_writer/initial_file/usb_host_error"_i18n : "utils/file_writer/initial_file/generic_error"_i18n);
         }
 
+        /* Set up staging buffer. This must be done before writing the NSP header placeholder. */
+        this->SetupStagingBuffer();
+
         /* Handle NSP header placeholder if a NSP header size was provided. */
         if (this->nsp_header_size)
         {
@@ -84,11 +121,14 @@ namespace nxdt::utils
                     this->Close(true);
                     throw "utils/file_writer/nsp_header_placeholder_error"_i18n;
                 }
+            } else {
+                /* Manually adjust current file offset. USB hosts write the placeholder on their own. */
+                this->cur_size = this->out_size = this->nsp_header_size;
             }
-
-            /* Manually adjust current file offset. */
-            this->cur_size += this->nsp_header_size;
         }
+
+        /* Start write-behind queue, if needed. */
+        this->StartWriteBehind();
     }
 
     FileWriter::~FileWriter()
@@ -187,9 +227,35 @@ namespace nxdt::utils
         /* Disable file stream buffering. */
         setvbuf(this->fp, nullptr, _IONBF, 0);
 
+        /* Set the final size for this file. */
+        this->PreallocateCurrentFile();
+
         return true;
     }
 
+    void FileWriter::PreallocateCurrentFile(void)
+    {
+        size_t size = this->total_size;
+
+        /* Each part file holds up to CONCATENATION_FILE_PART_SIZE bytes. The part file index has already been updated at this point. */
+        if (this->storage_type == StorageType::UmsDevice && this->split_file)
+        {
+            size_t part_offset = (static_cast<size_t>(this->split_file_part_idx - 1) * CONCATENATION_FILE_PART_SIZE);
+            size = MIN(this->total_size - part_offset, static_cast<size_t>(CONCATENATION_FILE_PART_SIZE));
+        }
+
+        /* Setting the final file size up front lets the FAT / exFAT driver allocate the whole cluster chain at once (contiguously, if possible), */
+        /* instead of updating it for every single write. Existing data in resumed files is left untouched. */
+        /* Not a fatal error -- the file will just grow as we write to it. */
+        if (ftruncate(fileno(this->fp), static_cast<off_t>(size)) != 0)
+        {
+            LOG_MSG_WARNING("Failed to preallocate 0x%lX bytes for output file! (%d).", size, errno);
+            return;
+        }
+
+        LOG_MSG_DEBUG("Preallocated 0x%lX bytes for output file.", size);
+    }
+
     bool FileWriter::CreateInitialFile(void)
     {
         /* Don't proceed if the file has already been created. */
@@ -201,6 +267,26 @@ namespace nxdt::utils
         {
             /* Send file properties to USB host. */
             LOG_MSG_DEBUG("Sending file properties to USB host...");
+
+            if (this->resumable)
+            {
+                /* Skip the data already held by the USB host. */
+                u64 resume_offset = 0;
+                if (!usbSendResumableFileProperties(this->total_size, output_path_str, &resume_offset, &(this->resume_window_crc))) return false;
+
+                if (resume_offset)
+                {
+                    LOG_MSG_INFO("Resuming \"%s\" at offset 0x%lX.", output_path_str, resume_offset);
+                    this->cur_size = this->out_size = resume_offset;
+                    this->resumed = true;
+                }
+            } else
+            if (!this->nsp_header_size && usbIsStreamSupported())
+            {
+                /* Open a stream for this file. NSPs can't be sent through streams, since they need to be transferred under NSP transfer mode. */
+                if (!usbOpenStream(this->total_size, output_path_str, &(this->usb_stream_id))) return false;
+                LOG_MSG_DEBUG("Opened USB stream %u for \"%s\".", this->usb_stream_id, output_path_str);
+            } else
             if ((!this->nsp_header_size && !usbSendFileProperties(this->total_size, output_path_str)) ||
                 (this->nsp_header_size && !usbSendNspProperties(this->total_size, output_path_str, this->nsp_header_size))) return false;
         } else {
@@ -226,28 +312,144 @@ namespace nxdt::utils
         return true;
     }
 
+    bool FileWriter::LoadCheckpoint(void)
+    {
+        /* Fall back to the backup checkpoint file if we were interrupted while WriteCheckpoint() was replacing the current one. */
+        return (this->LoadCheckpointFile(this->checkpoint_path) || this->LoadCheckpointFile(this->checkpoint_path + ".bak"));
+    }
+
+    bool FileWriter::LoadCheckpointFile(const std::string& path)
+    {
+        CheckpointHeader header{};
+
+        FILE *checkpoint_fp = fopen(path.c_str(), "rb");
+        if (!checkpoint_fp) return false;
+
+        ON_SCOPE_EXIT { fclose(checkpoint_fp); };
+
+        LOG_MSG_DEBUG("Loading checkpoint file: \"%s\".", path.c_str());
+
+        /* Validate checkpoint header. */
+        if (fread(&header, 1, sizeof(CheckpointHeader), checkpoint_fp) != sizeof(CheckpointHeader) || header.magic != FileWriter::CheckpointMagic ||
+            header.version != FileWriter::CheckpointVersion || header.total_size != this->total_size || header.nsp_header_size != this->nsp_header_size ||
+            !header.committed_size || header.committed_size >= this->total_size)
+        {
+            LOG_MSG_WARNING("Invalid checkpoint file header!");
+            return false;
+        }
+
+        /* Read state blob. */
+        if (header.state_size)
+        {
+            this->checkpoint_state.resize(header.state_size);
+
+            if (fread(this->checkpoint_state.data(), 1, header.state_size, checkpoint_fp) != header.state_size ||
+                crc32Calculate(this->checkpoint_state.data(), header.state_size) != header.state_crc)
+            {
+                LOG_MSG_WARNING("Invalid checkpoint state blob!");
+                this->checkpoint_state.clear();
+                return false;
+            }
+        }
+
+        this->cur_size = this->out_size = header.committed_size;
+        this->split_file_part_idx = static_cast<u8>(header.split_file_part_idx);
+
+        return true;
+    }
+
+    bool FileWriter::ReopenFile(void)
+    {
+        std::string path = this->output_path;
+        size_t offset = this->cur_size;
+        bool split_ums_file = (this->storage_type == StorageType::UmsDevice && this->split_file);
+
+        if (split_ums_file)
+        {
+            /* Validate part file index. */
+            if (this->split_file_part_idx != (this->cur_size / CONCATENATION_FILE_PART_SIZE) || this->split_file_part_idx >= this->split_file_part_cnt) return false;
+
+            path = fmt::format("{}/{:02d}", this->output_path, this->split_file_part_idx);
+            offset = (this->cur_size % CONCATENATION_FILE_PART_SIZE);
+        }
+
+        /* Reopen output file without truncating it. Concatenation files on the SD card are handled transparently. */
+        /* Part files that haven't been created yet are opened in creation mode. */
+        LOG_MSG_DEBUG("Reopening output file: \"%s\" (offset 0x%lX).", path.c_str(), offset);
+        this->fp = fopen(path.c_str(), offset ? "rb+" : "wb");
+        if (!this->fp || fseeko(this->fp, static_cast<off_t>(offset), SEEK_SET) != 0)
+        {
+            LOG_MSG_ERROR("Failed to reopen output file! (%d).", errno);
+            this->CloseCurrentFile();
+            return false;
+        }
+
+        /* Disable file stream buffering. */
+        setvbuf(this->fp, nullptr, _IONBF, 0);
+
+        if (split_ums_file)
+        {
+            /* Update part file index and size. */
+            this->split_file_part_idx++;
+            this->split_file_part_size = offset;
+        }
+
+        /* Set the final size for this file. Part files that were created by a previous run have already been preallocated, but this is harmless. */
+        this->PreallocateCurrentFile();
+
+        /* Update flag. */
+        this->file_created = true;
+
+        return true;
+    }
+
+    void FileWriter::RemoveCheckpoint(void)
+    {
+        if (this->checkpoint_path.empty()) return;
+
+        remove(this->checkpoint_path.c_str());
+        remove((this->checkpoint_path + ".bak").c_str());
+        remove((this->checkpoint_path + ".tmp").c_str());
+        this->checkpoint_written = false;
+    }
+
     bool FileWriter::Write(const void *data, const size_t& data_size)
     {
         /* Sanity check. */
-        if (!data || !data_size || !this->file_created || this->cur_size >= this->total_size || (this->storage_type != StorageType::UsbHost && !this->fp)) return false;
+        if (!data || !data_size || !this->file_created || this->file_closed || this->cur_size >= this->total_size) return false;
 
         /* Make sure we don't write past the established file size. */
         size_t write_size = ((this->cur_size + data_size) > this->total_size ? (this->total_size - this->cur_size) : data_size);
 
+        /* Hand data over to the writer thread, or write it right away if we're not using the write-behind queue. */
+        if (!(this->write_behind_ring ? this->QueueData(data, write_size) : this->StageData(data, write_size))) return false;
+
+        /* Update the current offset. */
+        this->cur_size += write_size;
+
+        /* Wait for all queued data to be written if this is the last block. Any pending output error is reported right here. */
+        return (this->cur_size < this->total_size || this->StopWriteBehind(false));
+    }
+
+    bool FileWriter::WriteData(const void *data, const size_t& data_size)
+    {
+        /* Sanity check. */
+        if ((this->out_size + data_size) > this->total_size || (this->storage_type != StorageType::UsbHost && !this->fp)) return false;
+
         if (this->storage_type == StorageType::UmsDevice && this->split_file)
         {
             /* Switch to the next part file if we need to. */
             if (this->split_file_part_size >= CONCATENATION_FILE_PART_SIZE && !this->OpenNextFile()) return false;
 
             /* Make sure we don't write past the part file size limit. */
-            size_t part_file_write_size = ((this->split_file_part_size + write_size) > CONCATENATION_FILE_PART_SIZE ? (CONCATENATION_FILE_PART_SIZE - this->split_file_part_size) : write_size);
+            size_t part_file_write_size = ((this->split_file_part_size + data_size) > CONCATENATION_FILE_PART_SIZE ? (CONCATENATION_FILE_PART_SIZE - this->split_file_part_size) : data_size);
 
             /* Write data to current part file. */
             size_t n = fwrite(data, 1, part_file_write_size, this->fp);
             if (n != part_file_write_size)
             {
                 LOG_MSG_ERROR("fwrite() failed to write 0x%lX-byte long block at offset 0x%lX to part file #%u (absolute offset 0x%lX).",
-                              part_file_write_size, this->split_file_part_size, this->split_file_part_idx - 1, this->cur_size);
+                              part_file_write_size, this->split_file_part_size, this->split_file_part_idx - 1, this->out_size);
                 return false;
             }
 
@@ -255,40 +457,224 @@ namespace nxdt::utils
             this->split_file_part_size += part_file_write_size;
 
             /* Update the written data size. */
-            this->cur_size += part_file_write_size;
+            this->out_size += part_file_write_size;
 
             /* Write the rest of the data to the next part file if we need to. */
-            if (part_file_write_size < write_size && !this->Write(static_cast<const u8*>(data) + part_file_write_size, write_size - part_file_write_size)) return false;
+            if (part_file_write_size < data_size && !this->WriteData(static_cast<const u8*>(data) + part_file_write_size, data_size - part_file_write_size)) return false;
         } else {
             if (this->storage_type == StorageType::UsbHost)
             {
                 /* Send data to USB host. */
-                if (!usbSendFileData(data, write_size))
+                if (!(this->usb_stream_id ? usbSendStreamData(this->usb_stream_id, data, data_size) : usbSendFileData(data, data_size)))
                 {
-                    LOG_MSG_ERROR("Failed to send 0x%lX-byte long block at offset 0x%lX to USB host.", write_size, this->cur_size);
+                    LOG_MSG_ERROR("Failed to send 0x%lX-byte long block at offset 0x%lX to USB host.", data_size, this->out_size);
                     return false;
                 }
             } else {
                 /* Write data to output file. */
-                size_t n = fwrite(data, 1, write_size, this->fp);
-                if (n != write_size)
+                size_t n = fwrite(data, 1, data_size, this->fp);
+                if (n != data_size)
                 {
-                    LOG_MSG_ERROR("fwrite() failed to write 0x%lX-byte long block at offset 0x%lX to output file.", write_size, this->cur_size);
+                    LOG_MSG_ERROR("fwrite() failed to write 0x%lX-byte long block at offset 0x%lX to output file.", data_size, this->out_size);
                     return false;
                 }
             }
 
             /* Update the written data size. */
-            this->cur_size += write_size;
+            this->out_size += data_size;
+        }
+
+        return true;
+    }
+
+    void FileWriter::SetupStagingBuffer(void)
+    {
+        /* USB hosts don't need this. Empty files don't either. */
+        if (this->staging_buf || this->storage_type == StorageType::UsbHost || !this->total_size) return;
+
+        /* Get the cluster size from the target filesystem. */
+        u32 cluster_size = 0;
+        if (!utilsGetFileSystemClusterSizeByPath(this->output_path.c_str(), &cluster_size)) cluster_size = static_cast<u32>(FileWriter::StagingDefaultAlignment);
+
+        /* Both values are powers of two. */
+        this->staging_block_size = MIN(MAX(static_cast<size_t>(cluster_size), FileWriter::StagingMinBlockSize), FileWriter::StagingMaxBlockSize);
+        this->staging_align = MIN(static_cast<size_t>(cluster_size), this->staging_block_size);
+        this->staging_size = 0;
+
+        this->staging_buf = static_cast<u8*>(usbAllocatePageAlignedBuffer(this->staging_block_size));
+        if (!this->staging_buf)
+        {
+            /* Not a fatal error. Data will just be written as-is. */
+            LOG_MSG_WARNING("Failed to allocate staging buffer for \"%s\"! Writes won't be coalesced.", this->output_path.c_str());
+            return;
+        }
+
+        LOG_MSG_DEBUG("Staging buffer for \"%s\": cluster size 0x%X, block size 0x%lX.", this->output_path.c_str(), cluster_size, this->staging_block_size);
+    }
+
+    size_t FileWriter::GetStagingCapacity(void)
+    {
+        /* Staged data is written once it reaches the next staging block boundary. */
+        size_t end_offset = (ALIGN_DOWN(this->out_size, this->staging_block_size) + this->staging_block_size);
+
+        /* Don't let a staged block cross a part file boundary. */
+        if (this->storage_type == StorageType::UmsDevice && this->split_file)
+        {
+            size_t part_end_offset = (((this->out_size / CONCATENATION_FILE_PART_SIZE) + 1) * CONCATENATION_FILE_PART_SIZE);
+            end_offset = MIN(end_offset, part_end_offset);
+        }
+
+        return (MIN(end_offset, this->total_size) - this->out_size);
+    }
+
+    bool FileWriter::StageData(const void *data, const size_t& data_size)
+    {
+        /* Write data right away if we have no staging buffer. */
+        if (!this->staging_buf) return this->WriteData(data, data_size);
+
+        const u8 *data_u8 = static_cast<const u8*>(data);
+
+        for(size_t offset = 0, blksize = 0; offset < data_size; offset += blksize)
+        {
+            size_t remaining = (data_size - offset);
+
+            /* Skip the staging buffer altogether for data that starts at a cluster boundary, as long as we have at least a full cluster. */
+            /* Part file boundaries are always cluster-aligned, so this data is still written in whole clusters. */
+            if (!this->staging_size && IS_ALIGNED(this->out_size, this->staging_align) && remaining >= this->staging_align)
+            {
+                blksize = ALIGN_DOWN(remaining, this->staging_align);
+                if (!this->WriteData(data_u8 + offset, blksize)) return false;
+                continue;
+            }
+
+            /* Copy data to the staging buffer. */
+            size_t capacity = this->GetStagingCapacity();
+            blksize = MIN(capacity - this->staging_size, remaining);
+
+            memcpy(this->staging_buf + this->staging_size, data_u8 + offset, blksize);
+            this->staging_size += blksize;
+
+            /* Write the staged block as soon as it's full. This also covers the end of the file and part file boundaries. */
+            if (this->staging_size == capacity && !this->FlushStagingBuffer()) return false;
         }
 
         return true;
     }
 
+    bool FileWriter::FlushStagingBuffer(void)
+    {
+        if (!this->staging_buf || !this->staging_size) return true;
+
+        if (!this->WriteData(this->staging_buf, this->staging_size)) return false;
+
+        this->staging_size = 0;
+
+        return true;
+    }
+
+    void FileWriter::FreeStagingBuffer(void)
+    {
+        if (!this->staging_buf) return;
+
+        free(this->staging_buf);
+        this->staging_buf = nullptr;
+        this->staging_size = 0;
+    }
+
+    void FileWriter::StartWriteBehind(void)
+    {
+        /* Don't bother if the remaining data fits in a single queue buffer. */
+        if (this->write_behind_ring || (this->total_size - this->cur_size) <= FileWriter::WriteBehindBlockSize) return;
+
+        try {
+            this->write_behind_ring = std::make_unique<BufferRing>(FileWriter::WriteBehindBlockCount, FileWriter::WriteBehindBlockSize, WriteBehindStage::Count);
+        } catch(const std::string&) {
+            /* Not a fatal error. We'll just write data synchronously. */
+            LOG_MSG_WARNING("Failed to allocate write-behind queue for \"%s\"! Writes will be synchronous.", this->output_path.c_str());
+            return;
+        }
+
+        this->write_behind_failed = false;
+        this->write_behind_thread = std::thread(&FileWriter::WriteBehindThreadFunc, this);
+
+        LOG_MSG_DEBUG("Started write-behind queue for \"%s\".", this->output_path.c_str());
+    }
+
+    bool FileWriter::QueueData(const void *data, const size_t& data_size)
+    {
+        const u8 *data_u8 = static_cast<const u8*>(data);
+
+        for(size_t offset = 0, blksize = 0; offset < data_size; offset += blksize)
+        {
+            /* Wait until a free queue buffer is available. This only fails if the writer thread hit an error. */
+            BufferRing::Block *block = this->write_behind_ring->Acquire(WriteBehindStage::Queue);
+            if (!block)
+            {
+                LOG_MSG_ERROR("Write-behind queue for \"%s\" was aborted due to a previous output error!", this->output_path.c_str());
+                return false;
+            }
+
+            blksize = MIN(this->write_behind_ring->GetBlockSize(), data_size - offset);
+            memcpy(block->data, data_u8 + offset, blksize);
+
+            block->size = blksize;
+            block->offset = (this->cur_size + offset);
+
+            this->write_behind_ring->Release(WriteBehindStage::Queue);
+        }
+
+        return true;
+    }
+
+    bool FileWriter::FlushWriteBehind(void)
+    {
+        /* Wait until the writer thread is done with all queued data. It's left idle afterwards, so it's safe to access the output file from this thread. */
+        return (!this->write_behind_ring || this->write_behind_ring->Drain());
+    }
+
+    bool FileWriter::StopWriteBehind(bool abort)
+    {
+        if (!this->write_behind_ring) return true;
+
+        /* Queued data is discarded if we're aborting. */
+        if (abort)
+        {
+            this->write_behind_ring->Abort();
+        } else {
+            this->write_behind_ring->SetEndOfStream();
+        }
+
+        if (this->write_behind_thread.joinable()) this->write_behind_thread.join();
+
+        this->write_behind_ring.reset();
+
+        LOG_MSG_DEBUG("Stopped write-behind queue for \"%s\" (0x%lX / 0x%lX).", this->output_path.c_str(), this->out_size, this->total_size);
+
+        return (!this->write_behind_failed && this->out_size == this->cur_size);
+    }
+
+    void FileWriter::WriteBehindThreadFunc(void)
+    {
+        BufferRing::Block *block = nullptr;
+
+        while((block = this->write_behind_ring->Acquire(WriteBehindStage::Output)) != nullptr)
+        {
+            if (!this->StageData(block->data, block->size))
+            {
+                /* Make every pending and future Write() call fail. */
+                this->write_behind_failed = true;
+                this->write_behind_ring->Abort();
+                break;
+            }
+
+            this->write_behind_ring->Release(WriteBehindStage::Output);
+        }
+    }
+
     bool FileWriter::WriteNspHeader(const void *nsp_header, const u32& nsp_header_size)
     {
-        /* Sanity check. */
-        if (!nsp_header || !nsp_header_size || nsp_header_size != this->nsp_header_size || !this->file_created || this->cur_size < this->total_size || this->nsp_header_written ||
+        /* Sanity check. The write-behind queue has already been stopped at this point. */
+        if (!nsp_header || !nsp_header_size || nsp_header_size != this->nsp_header_size || !this->file_created || this->out_size < this->total_size || this->nsp_header_written ||
             (this->storage_type != StorageType::UsbHost && !this->fp)) return false;
 
         if (this->storage_type == StorageType::UmsDevice && this->split_file)
@@ -328,16 +714,45 @@ namespace nxdt::utils
         /* Return immediately if the file has already been closed. */
         if (this->file_closed) return;
 
+        /* Stop the writer thread. It only gets here with queued data if the file is incomplete, so that data is discarded. */
+        this->StopWriteBehind(true);
+
+        /* Write out any data still sitting in the staging buffer, unless we're going to get rid of the file anyway. */
+        if (!force_delete && !this->FlushStagingBuffer()) LOG_MSG_WARNING("Failed to write staged data for \"%s\"!", this->output_path.c_str());
+
+        /* Keep incomplete resumable files around if a checkpoint is available for them. */
+        bool keep_incomplete_file = (this->checkpoint_written && !force_delete && this->out_size != this->total_size);
+        if (keep_incomplete_file)
+        {
+            LOG_MSG_INFO("Keeping incomplete output file \"%s\" for a later resume (0x%lX / 0x%lX).", this->output_path.c_str(), this->out_size, this->total_size);
+
+            /* Release the preallocated space we didn't get to use. Resumed files are preallocated again. */
+            if (this->fp && ftruncate(fileno(this->fp), static_cast<off_t>((this->storage_type == StorageType::UmsDevice && this->split_file) ? this->split_file_part_size : this->out_size)) != 0)
+            {
+                LOG_MSG_WARNING("Failed to truncate incomplete output file! (%d).", errno);
+            }
+        }
+
         /* Close current file. */
         this->CloseCurrentFile();
 
+        /* Free staging buffer. */
+        this->FreeStagingBuffer();
+
         /* Delete created file(s), if needed. */
-        if (this->cur_size != this->total_size && (this->file_created || force_delete))
+        if (!keep_incomplete_file && this->out_size != this->total_size && (this->file_created || force_delete))
         {
             if (this->storage_type == StorageType::UsbHost)
             {
                 LOG_MSG_DEBUG("Cancelling USB file transfer...");
-                usbCancelFileTransfer();
+
+                if (this->usb_stream_id)
+                {
+                    usbCloseStream(this->usb_stream_id, true);
+                    this->usb_stream_id = 0;
+                } else {
+                    usbCancelFileTransfer();
+                }
             } else {
                 const char *output_path_str = this->output_path.c_str();
 
@@ -358,6 +773,13 @@ namespace nxdt::utils
             }
         }
 
+        /* Close the USB stream for this file, if it's still open. The host only keeps the output file if all of its data was sent. */
+        if (this->usb_stream_id && !usbCloseStream(this->usb_stream_id, false)) LOG_MSG_ERROR("Failed to close USB stream %u for \"%s\"!", this->usb_stream_id, this->output_path.c_str());
+        this->usb_stream_id = 0;
+
+        /* Remove checkpoint file if it's no longer needed. */
+        if (!keep_incomplete_file) this->RemoveCheckpoint();
+
         /* Commit SD card filesystem changes, if needed. */
         if (this->storage_type == StorageType::SdCard)
         {
@@ -369,8 +791,136 @@ namespace nxdt::utils
         this->file_closed = true;
     }
 
+    bool FileWriter::WriteCheckpoint(const void *state, const size_t& state_size)
+    {
+        /* Sanity check. */
+        if (!this->resumable || !this->file_created || this->file_closed || (!state && state_size) || state_size > UINT32_MAX) return false;
+
+        /* Wait until all queued and staged data has been written. */
+        if (!this->FlushWriteBehind() || !this->FlushStagingBuffer() || !this->fp) return false;
+
+        std::string tmp_checkpoint_path = (this->checkpoint_path + ".tmp");
+        const char *checkpoint_path_str = this->checkpoint_path.c_str(), *tmp_checkpoint_path_str = tmp_checkpoint_path.c_str();
+        bool success = false;
+
+        CheckpointHeader header{};
+        header.magic = FileWriter::CheckpointMagic;
+        header.version = FileWriter::CheckpointVersion;
+        header.total_size = this->total_size;
+        header.committed_size = this->out_size;
+        header.nsp_header_size = this->nsp_header_size;
+        header.split_file_part_idx = static_cast<u32>((this->storage_type == StorageType::UmsDevice && this->split_file) ? (this->out_size / CONCATENATION_FILE_PART_SIZE) : 0);
+        header.state_size = static_cast<u32>(state_size);
+        header.state_crc = (state_size ? crc32Calculate(state, state_size) : 0);
+
+        /* Make sure all written data has reached the storage device before saving the checkpoint. */
+        if (fflush(this->fp) != 0 || fsync(fileno(this->fp)) != 0)
+        {
+            LOG_MSG_ERROR("Failed to flush output file! (%d).", errno);
+            return false;
+        }
+
+        /* Write checkpoint data to a temporary file, then replace the current checkpoint file with it. */
+        FILE *checkpoint_fp = fopen(tmp_checkpoint_path_str, "wb");
+        if (checkpoint_fp)
+        {
+            success = (fwrite(&header, 1, sizeof(CheckpointHeader), checkpoint_fp) == sizeof(CheckpointHeader) &&
+                       (!state_size || fwrite(state, 1, state_size, checkpoint_fp) == state_size));
+            fclose(checkpoint_fp);
+        }
+
+        if (success && rename(tmp_checkpoint_path_str, checkpoint_path_str) != 0)
+        {
+            /* Not every filesystem lets rename() overwrite an existing file (e.g. FAT through the FS sysmodule). */
+            /* In that case, the current checkpoint file is moved out of the way and only removed once the new one is in place. */
+            /* LoadCheckpoint() falls back to the backup file, so a valid checkpoint is still available if we're interrupted in between. */
+            std::string bak_checkpoint_path = (this->checkpoint_path + ".bak");
+            const char *bak_checkpoint_path_str = bak_checkpoint_path.c_str();
+
+            struct stat st{};
+            bool has_checkpoint = (stat(checkpoint_path_str, &st) == 0);
+
+            if (has_checkpoint) remove(bak_checkpoint_path_str);
+
+            success = ((!has_checkpoint || rename(checkpoint_path_str, bak_checkpoint_path_str) == 0) && rename(tmp_checkpoint_path_str, checkpoint_path_str) == 0);
+            if (success && has_checkpoint) remove(bak_checkpoint_path_str);
+        }
+
+        if (success)
+        {
+            this->checkpoint_written = true;
+            LOG_MSG_DEBUG("Saved checkpoint for \"%s\" at offset 0x%lX.", this->output_path.c_str(), this->out_size);
+        } else {
+            LOG_MSG_ERROR("Failed to save checkpoint file \"%s\"! (%d).", checkpoint_path_str, errno);
+            remove(tmp_checkpoint_path_str);
+        }
+
+        return success;
+    }
+
+    bool FileWriter::ReadBack(void *data, const size_t& data_size, const size_t& offset)
+    {
+        /* Sanity check. */
+        if (this->storage_type == StorageType::UsbHost || !this->file_created || this->file_closed || !data || !data_size || (offset + data_size) > this->cur_size) return false;
+
+        /* Wait until all queued and staged data has been written. */
+        if (!this->FlushWriteBehind() || !this->FlushStagingBuffer() || !this->fp) return false;
+
+        bool split_ums_file = (this->storage_type == StorageType::UmsDevice && this->split_file);
+        u8 *data_u8 = static_cast<u8*>(data);
+        size_t data_offset = 0;
+
+        /* Save the current file position, since the current file may be used to read the requested data. */
+        off_t cur_pos = ftello(this->fp);
+        if (cur_pos < 0) return false;
+
+        ON_SCOPE_EXIT { fseeko(this->fp, cur_pos, SEEK_SET); };
+
+        while(data_offset < data_size)
+        {
+            size_t cur_offset = (offset + data_offset), read_offset = cur_offset, read_size = (data_size - data_offset);
+            u8 part_idx = 0;
+
+            if (split_ums_file)
+            {
+                /* Data may span multiple part files. */
+                part_idx = static_cast<u8>(cur_offset / CONCATENATION_FILE_PART_SIZE);
+                read_offset = (cur_offset % CONCATENATION_FILE_PART_SIZE);
+                read_size = MIN(read_size, CONCATENATION_FILE_PART_SIZE - read_offset);
+            }
+
+            /* Use the current file if it holds the requested data. Otherwise, open the part file in read-only mode. The part file index has already been updated at this point. */
+            FILE *read_fp = ((!split_ums_file || (part_idx + 1) == this->split_file_part_idx) ? this->fp : nullptr);
+            if (!read_fp)
+            {
+                std::string part_file_path = fmt::format("{}/{:02d}", this->output_path, part_idx);
+                read_fp = fopen(part_file_path.c_str(), "rb");
+            }
+
+            bool success = (read_fp && fseeko(read_fp, static_cast<off_t>(read_offset), SEEK_SET) == 0 && fread(data_u8 + data_offset, 1, read_size, read_fp) == read_size);
+
+            if (read_fp && read_fp != this->fp) fclose(read_fp);
+
+            if (!success)
+            {
+                LOG_MSG_ERROR("Failed to read back 0x%lX byte(s) from \"%s\" at offset 0x%lX! (%d).", read_size, this->output_path.c_str(), cur_offset, errno);
+                return false;
+            }
+
+            data_offset += read_size;
+        }
+
+        return true;
+    }
+
     FileWriter::StorageType FileWriter::GetStorageType(void)
     {
         return this->storage_type;
     }
+
+    FileWriter::StorageType FileWriter::GetStorageTypeByPath(const std::string& output_path)
+    {
+        return (output_path.starts_with(DEVOPTAB_SDMC_DEVICE) ? StorageType::SdCard  :
+               (output_path.starts_with('/')                  ? StorageType::UsbHost : StorageType::UmsDevice));
+    }
 }
@@ -0,0 +1,301 @@
+/*
+ * tee_writer.cpp
+ *
+ * Copyright (c) 2020-2024, DarkMatterCore <pabloacurielz@gmail.com>.
+ *
+ * This file is part of nxdumptool (https://github.com/DarkMatterCore/nxdumptool).
+ *
+ * nxdumptool is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nxdumptool is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <utils/tee_writer.hpp>
+
+namespace i18n = brls::i18n;    /* For getStr(). */
+using namespace i18n::literals; /* For _i18n. */
+
+namespace nxdt::utils
+{
+    TeeWriter::TeeWriter(const size_t& total_size) : total_size(total_size)
+    {
+        LOG_MSG_DEBUG("Creating TeeWriter object with total_size 0x%lX.", total_size);
+    }
+
+    TeeWriter::~TeeWriter()
+    {
+        this->Close();
+    }
+
+    void TeeWriter::CheckStarted(void)
+    {
+        if (this->started || this->closed) throw "utils/tee_writer/sinks_already_started"_i18n;
+    }
+
+    void TeeWriter::AddFileSink(const std::string& output_path, ErrorPolicy policy)
+    {
+        this->CheckStarted();
+
+        /* Only a single file can be transferred at a time to a USB host. This must be checked before creating the file, or the ongoing transfer would be cancelled. */
+        if (FileWriter::GetStorageTypeByPath(output_path) == FileWriter::StorageType::UsbHost)
+        {
+            for(std::unique_ptr<Sink>& sink : this->sinks)
+            {
+                if (sink->file && sink->file->GetStorageType() == FileWriter::StorageType::UsbHost) throw "utils/tee_writer/multiple_usb_host_sinks"_i18n;
+            }
+        }
+
+        std::unique_ptr<Sink> sink = std::make_unique<Sink>();
+        sink->stats = { output_path, SinkType::File, policy, false, 0, 0 };
+        sink->file = std::make_unique<FileWriter>(output_path, this->total_size);
+
+        LOG_MSG_DEBUG("Added file sink #%lu: \"%s\".", this->sinks.size(), output_path.c_str());
+
+        this->sinks.push_back(std::move(sink));
+    }
+
+    void TeeWriter::AddDigestSink(MultiDigestContext *digest_ctx, ErrorPolicy policy)
+    {
+        this->CheckStarted();
+
+        if (!digest_ctx) throw "utils/tee_writer/invalid_digest_sink"_i18n;
+
+        std::unique_ptr<Sink> sink = std::make_unique<Sink>();
+        sink->stats = { "digest", SinkType::Digest, policy, false, 0, 0 };
+        sink->digest_ctx = digest_ctx;
+
+        LOG_MSG_DEBUG("Added digest sink #%lu.", this->sinks.size());
+
+        this->sinks.push_back(std::move(sink));
+    }
+
+    void TeeWriter::AddNullSink(void)
+    {
+        this->CheckStarted();
+
+        std::unique_ptr<Sink> sink = std::make_unique<Sink>();
+        sink->stats = { "null", SinkType::Null, ErrorPolicy::BestEffort, false, 0, 0 };
+
+        LOG_MSG_DEBUG("Added null sink #%lu.", this->sinks.size());
+
+        this->sinks.push_back(std::move(sink));
+    }
+
+    void TeeWriter::StartSinkThreads(void)
+    {
+        for(std::unique_ptr<Sink>& sink : this->sinks) sink->thread = std::thread(&TeeWriter::SinkThreadFunc, this, sink.get());
+        this->started = true;
+    }
+
+    void TeeWriter::StopSinkThreads(void)
+    {
+        {
+            std::scoped_lock lock(this->sink_mtx);
+            this->exit = true;
+        }
+
+        this->work_cv.notify_all();
+
+        for(std::unique_ptr<Sink>& sink : this->sinks)
+        {
+            if (sink->thread.joinable()) sink->thread.join();
+        }
+    }
+
+    void TeeWriter::SinkThreadFunc(Sink *sink)
+    {
+        u64 last_generation = 0;
+
+        while(true)
+        {
+            const void *block = nullptr;
+            size_t block_size = 0;
+
+            {
+                /* Wait until a new block is available. */
+                std::unique_lock lock(this->sink_mtx);
+                this->work_cv.wait(lock, [this, last_generation] { return (this->exit || this->generation != last_generation); });
+                if (this->exit) break;
+
+                last_generation = this->generation;
+                block = this->data;
+                block_size = this->data_size;
+            }
+
+            /* Failed sinks just skip all further blocks. */
+            if (!sink->stats.failed)
+            {
+                u64 start_tick = armGetSystemTick();
+                bool success = this->WriteSink(sink, block, block_size);
+                sink->stats.busy_time += armTicksToNs(armGetSystemTick() - start_tick);
+
+                if (success)
+                {
+                    sink->stats.written_size += block_size;
+                } else {
+                    LOG_MSG_ERROR("Failed to write 0x%lX-byte long block at offset 0x%lX to sink \"%s\"!", block_size, sink->stats.written_size, sink->stats.name.c_str());
+                    sink->stats.failed = true;
+                }
+            }
+
+            {
+                /* Let the producer know we're done with this block. */
+                std::scoped_lock lock(this->sink_mtx);
+                if (--this->pending_count == 0) this->done_cv.notify_all();
+            }
+        }
+    }
+
+    bool TeeWriter::WriteSink(Sink *sink, const void *data, const size_t& data_size)
+    {
+        switch(sink->stats.type)
+        {
+            case SinkType::File:
+                return sink->file->Write(data, data_size);
+            case SinkType::Digest:
+                return multiDigestUpdate(sink->digest_ctx, data, data_size);
+            default:
+                break;
+        }
+
+        return true;
+    }
+
+    bool TeeWriter::Write(const void *data, const size_t& data_size)
+    {
+        /* Sanity check. */
+        if (!data || !data_size || this->closed || this->failed || this->sinks.empty() || this->cur_size >= this->total_size) return false;
+
+        /* Make sure we don't write past the established file size. */
+        size_t write_size = ((this->cur_size + data_size) > this->total_size ? (this->total_size - this->cur_size) : data_size);
+
+        /* Start sink threads, if needed. */
+        if (!this->started) this->StartSinkThreads();
+
+        {
+            /* Submit block to all sinks. Dropped sinks still take part, but they skip the block right away. */
+            std::scoped_lock lock(this->sink_mtx);
+            this->data = data;
+            this->data_size = write_size;
+            this->pending_count = this->sinks.size();
+            this->generation++;
+        }
+
+        this->work_cv.notify_all();
+
+        {
+            /* Wait until all sinks are done with the block. */
+            std::unique_lock lock(this->sink_mtx);
+            this->done_cv.wait(lock, [this] { return (this->pending_count == 0); });
+            this->data = nullptr;
+        }
+
+        /* Update the current offset. */
+        this->cur_size += write_size;
+
+        /* Handle sink errors. All sink threads are idle at this point, so it's safe to access their output files. */
+        size_t active_count = 0;
+
+        for(std::unique_ptr<Sink>& sink : this->sinks)
+        {
+            if (sink->stats.failed && !sink->dropped)
+            {
+                if (sink->stats.policy == ErrorPolicy::Required)
+                {
+                    this->failed = true;
+                } else {
+                    LOG_MSG_WARNING("Dropping sink \"%s\" after a write error. Writing to the rest of the sinks.", sink->stats.name.c_str());
+                    if (sink->file) sink->file->Close(true);
+                }
+
+                sink->dropped = true;
+            }
+
+            if (!sink->dropped) active_count++;
+        }
+
+        return (!this->failed && active_count > 0);
+    }
+
+    void TeeWriter::Close(bool force_delete)
+    {
+        /* Return immediately if we have already been closed. */
+        if (this->closed) return;
+
+        /* Stop sink threads. */
+        if (this->started) this->StopSinkThreads();
+
+        /* Close output files. Incomplete files are deleted by FileWriter. */
+        /* Files from sinks that didn't fail are also deleted if a required sink failed, since the dump itself failed. */
+        for(std::unique_ptr<Sink>& sink : this->sinks)
+        {
+            if (sink->file) sink->file->Close(force_delete || this->failed || sink->stats.failed);
+        }
+
+        /* Log statistics. */
+        if (this->cur_size)
+        {
+            for(size_t i = 0; i < this->sinks.size(); i++)
+            {
+                const SinkStats& stats = this->sinks[i]->stats;
+                LOG_MSG_INFO("Sink #%lu (\"%s\"): 0x%lX bytes written, %lu ms busy, %lu KiB/s%s.", i, stats.name.c_str(), stats.written_size, stats.busy_time / 1000000,
+                             TeeWriter::GetThroughput(stats) / 1024, stats.failed ? " (failed)" : "");
+            }
+
+            u64 throughput = 0;
+            ssize_t slowest = this->GetSlowestSink(&throughput);
+            if (slowest >= 0) LOG_MSG_INFO("Slowest sink: #%ld (\"%s\"), %lu KiB/s.", slowest, this->sinks[slowest]->stats.name.c_str(), throughput / 1024);
+        }
+
+        /* Update flag. */
+        this->closed = true;
+    }
+
+    std::vector<TeeWriter::SinkStats> TeeWriter::GetSinkStats(void)
+    {
+        std::vector<SinkStats> stats{};
+
+        /* Statistics are only updated by sink threads while Write() is running. */
+        for(std::unique_ptr<Sink>& sink : this->sinks) stats.push_back(sink->stats);
+
+        return stats;
+    }
+
+    ssize_t TeeWriter::GetSlowestSink(u64 *out_throughput)
+    {
+        ssize_t slowest = -1;
+        u64 slowest_throughput = 0;
+
+        for(size_t i = 0; i < this->sinks.size(); i++)
+        {
+            const Sink *sink = this->sinks[i].get();
+            if (sink->dropped || !sink->stats.written_size) continue;
+
+            u64 throughput = TeeWriter::GetThroughput(sink->stats);
+            if (slowest < 0 || throughput < slowest_throughput)
+            {
+                slowest = static_cast<ssize_t>(i);
+                slowest_throughput = throughput;
+            }
+        }
+
+        if (out_throughput) *out_throughput = slowest_throughput;
+
+        return slowest;
+    }
+
+    u64 TeeWriter::GetThroughput(const SinkStats& stats)
+    {
+        /* Sinks that didn't take any measurable time to write their data are considered to be infinitely fast. */
+        return (stats.busy_time ? static_cast<u64>((static_cast<double>(stats.written_size) * 1000000000.0) / static_cast<double>(stats.busy_time)) : UINT64_MAX);
+    }
+}
@@ -221,13 +221,24 @@ namespace nxdt::views
 
     bool DumpOptionsFrame::GetOutputFilePath(const std::string& extension, std::string& output)
     {
-        std::string tmp = this->storage_prefix;
+        /* Append the application's base path if we're dealing with an SD card or a UMS device. */
         u32 selected = this->output_storage->getSelectedValue();
+        return this->GenerateOutputFilePath(this->storage_prefix, selected == ConfigOutputStorage_SdCard || selected >= ConfigOutputStorage_Count, extension, output);
+    }
+
+    bool DumpOptionsFrame::GetUsbHostOutputFilePath(const std::string& extension, std::string& output)
+    {
+        return this->GenerateOutputFilePath("/", false, extension, output);
+    }
+
+    bool DumpOptionsFrame::GenerateOutputFilePath(const std::string& prefix, bool append_base_path, const std::string& extension, std::string& output)
+    {
+        std::string tmp = prefix;
         char *sanitized_path = nullptr;
 
-        if (selected == ConfigOutputStorage_SdCard || selected >= ConfigOutputStorage_Count)
+        if (append_base_path)
         {
-            /* Remove the trailing path separator (if available) and append the application's base path if we're dealing with an SD card or a UMS device. */
+            /* Remove the trailing path separator (if available) and append the application's base path. */
             if (tmp.back() == '/') tmp.pop_back();
             tmp += APP_BASE_PATH;
         }
@@ -70,6 +70,12 @@ namespace nxdt::views
         /* "Lookup checksum" toggle. */
         GAMECARD_TOGGLE_ITEM(lookup_checksum, "dump_options/gamecard/image/calculate_checksum/label"_i18n, "No-Intro");
 
+        /* "Verify only" toggle. */
+        GAMECARD_TOGGLE_ITEM(verify_only, "dump_options/gamecard/image/calculate_checksum/label"_i18n);
+
+        /* "Mirror to USB host" toggle. */
+        GAMECARD_TOGGLE_ITEM(mirror_to_usb_host, "dump_options/gamecard/image/verify_only/label"_i18n);
+
         /* Register dump button callback. */
         this->RegisterButtonListener([this](brls::View *view) {
             /* Retrieve configuration values set by the user. */
@@ -78,6 +84,8 @@ namespace nxdt::views
             bool trim_dump_val = this->trim_dump->getToggleState();
             bool calculate_checksum_val = this->calculate_checksum->getToggleState();
             bool lookup_checksum_val = this->lookup_checksum->getToggleState();
+            bool verify_only_val = this->verify_only->getToggleState();
+            bool mirror_to_usb_host_val = this->mirror_to_usb_host->getToggleState();
 
             /* Generate file extension. */
             std::string extension = fmt::format(" [{}][{}][{}].xci", prepend_key_area_val ? "KA" : "NKA", keep_certificate_val ? "C" : "NC", trim_dump_val ? "T" : "NT");
@@ -86,9 +94,22 @@ namespace nxdt::views
             std::string output_path{};
             if (!this->GetOutputFilePath(extension, output_path)) return;
 
+            /* Get USB host output path, if the dump is also going to be sent to a USB host. */
+            std::string mirror_path{};
+            if (mirror_to_usb_host_val && !verify_only_val && !this->IsUsbHostOutputStorageSelected())
+            {
+                if (this->root_view->GetUsbHostSpeed() == UsbHostSpeed_None)
+                {
+                    brls::Application::notify("dump_options/notifications/usb_host_unavailable"_i18n);
+                    return;
+                }
+
+                if (!this->GetUsbHostOutputFilePath(extension, mirror_path)) return;
+            }
+
             /* Display task frame. */
             brls::Application::pushView(new GameCardImageDumpTaskFrame(output_path, prepend_key_area_val, keep_certificate_val, trim_dump_val, calculate_checksum_val,
-                                        lookup_checksum_val), brls::ViewAnimation::SLIDE_LEFT, false);
+                                        lookup_checksum_val, verify_only_val, mirror_path), brls::ViewAnimation::SLIDE_LEFT, false);
         });
     }
 